@@ -166,14 +166,17 @@ struct halide_device_interface_t {
 };
 
 typedef struct halide_dimension_t {
-    int32_t min, extent, stride;
+    // stride is 64 bit here, a tensor past 2G elements indexes without
+    // overflow as long as each extent fits 32 bits
+    int32_t min, extent;
+    int64_t stride;
 
     // Per-dimension flags. None are defined yet (This is reserved for future use).
     uint32_t flags;
 
 #ifdef __cplusplus
     HALIDE_ALWAYS_INLINE halide_dimension_t() : min(0), extent(0), stride(0), flags(0) {}
-    HALIDE_ALWAYS_INLINE halide_dimension_t(int32_t m, int32_t e, int32_t s, uint32_t f = 0) :
+    HALIDE_ALWAYS_INLINE halide_dimension_t(int32_t m, int32_t e, int64_t s, uint32_t f = 0) :
         min(m), extent(e), stride(s), flags(f) {}
 
     HALIDE_ALWAYS_INLINE bool operator==(const halide_dimension_t &other) const {
@@ -0,0 +1,112 @@
+//===------------------------tactics/core/alloc_tracer.h------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===---------------------------------------------------------------------------===//
+//
+/// This file defines the allocation tracer of buffer allocators
+///
+//===---------------------------------------------------------------------------===//
+#ifndef TACTICS_CORE_ALLOC_TRACER_H
+#define TACTICS_CORE_ALLOC_TRACER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tactics {
+
+class Tensor;
+
+// records alloc / free events of buffer allocators while enabled. chunks are
+// identified by a key unique among the live chunks of all allocators.
+class AllocTracer {
+public:
+  enum EventType { EVENT_ALLOC = 0, EVENT_FREE, EVENT_COMPUTE };
+
+  struct Event {
+    EventType type;
+    // microseconds since the tracer was enabled
+    uint64_t time;
+    const void *allocator;
+    const void *key;
+    // chunk size, or arena size for EVENT_COMPUTE
+    size_t size;
+    // bytes alive in the allocator after this event
+    size_t live;
+    // index of the matching alloc event for EVENT_FREE
+    size_t allocIndex;
+  };
+
+  struct Summary {
+    const char *name = "";
+    size_t live = 0;
+    size_t peak = 0;
+    // max bytes the allocator held from its parent
+    size_t reserved = 0;
+    size_t allocCount = 0;
+    size_t freeCount = 0;
+    // 1 - peak / reserved
+    float fragmentation() const {
+      return reserved > 0 ? 1.0f - (float)peak / reserved : 0.0f;
+    }
+  };
+
+  struct HistogramBin {
+    // sizes in (upper / 2, upper]
+    size_t upper;
+    size_t count;
+    size_t bytes;
+  };
+
+  static AllocTracer *get();
+  // cheap check for the allocator hot path
+  static inline bool enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+  }
+  // enabling drops events recorded before
+  void set_enable(bool enable);
+
+  void on_alloc(const void *allocator, const char *name, const void *key,
+                size_t size, size_t reserved);
+  void on_free(const void *allocator, const void *key, size_t reserved);
+  // a deferred allocator got its arena
+  void on_compute(const void *allocator, size_t arenaSize);
+  void on_attach(const void *key, const Tensor *tensor);
+
+  std::vector<Event> events() const;
+  std::map<const void *, Summary> summaries() const;
+  std::vector<HistogramBin> size_histogram() const;
+
+  // chrome://tracing json, one track per allocator with chunk lifetimes and a
+  // counter of live bytes
+  bool export_chrome_trace(const char *path) const;
+  // `a <id> <size>` / `f <id>` lines of one allocator, for allocator_bench
+  bool export_replay_trace(const char *path, const void *allocator) const;
+
+private:
+  AllocTracer() = default;
+  uint64_t now() const;
+
+  static std::atomic<bool> g_enabled;
+  mutable std::mutex mLock;
+  uint64_t mStart = 0;
+  std::vector<Event> mEvents;
+  std::map<const void *, Summary> mSummaries;
+  // key -> index of the alloc event of live chunks
+  std::unordered_map<const void *, size_t> mLiveChunks;
+  // alloc event index -> `address [shape]` of tensors using the chunk, taken
+  // at attach since the tensors are usually gone by export
+  std::unordered_map<size_t, std::vector<std::string>> mTensors;
+};
+
+} // namespace tactics
+
+#endif // TACTICS_CORE_ALLOC_TRACER_H
@@ -12,6 +12,7 @@
 #define TACTICS_CORE_AUTO_STORAGE_H
 
 #include "tactics/core/memory_utils.h"
+#include <atomic>
 #include <cassert>
 #include <stdint.h>
 #include <string.h>
@@ -124,6 +125,31 @@ private:
   mutable int mNum;
 };
 
+// RefCount for objects whose references are taken and dropped on different
+// threads, such as Backend::MemObj
+class AtomicRefCount {
+public:
+  void addRef() const { mNum.fetch_add(1, std::memory_order_relaxed); }
+  void decRef() const {
+    auto num = mNum.fetch_sub(1, std::memory_order_acq_rel);
+    assert(num >= 1);
+    if (1 >= num) {
+      delete this;
+    }
+  }
+  inline int count() const { return mNum.load(std::memory_order_relaxed); }
+
+protected:
+  AtomicRefCount() : mNum(1) {}
+  // a copy is a new object with its own references
+  AtomicRefCount(const AtomicRefCount &f) : mNum(1) {}
+  void operator=(const AtomicRefCount &f) {}
+  virtual ~AtomicRefCount() {}
+
+private:
+  mutable std::atomic<int> mNum;
+};
+
 #define SAFE_UNREF(x)                                                          \
   if (NULL != (x)) {                                                           \
     (x)->decRef();                                                             \
@@ -142,17 +168,29 @@ private:
     }                                                                          \
     dst = src;                                                                 \
   }
+// intrusive pointer to a RefCount or AtomicRefCount object, moving one
+// hands over the reference without touching the count
 template <typename T> class SharedPtr {
 public:
   SharedPtr() : mT(NULL) {}
   SharedPtr(T *obj) : mT(obj) {}
   SharedPtr(const SharedPtr &o) : mT(o.mT) { SAFE_REF(mT); }
+  SharedPtr(SharedPtr &&o) noexcept : mT(o.mT) { o.mT = NULL; }
   ~SharedPtr() { SAFE_UNREF(mT); }
 
   SharedPtr &operator=(const SharedPtr &rp) {
     SAFE_ASSIGN(mT, rp.mT);
     return *this;
   }
+  SharedPtr &operator=(SharedPtr &&rp) noexcept {
+    if (this != &rp) {
+      T *old = mT;
+      mT = rp.mT;
+      rp.mT = NULL;
+      SAFE_UNREF(old);
+    }
+    return *this;
+  }
   SharedPtr &operator=(T *obj) {
     SAFE_UNREF(mT);
     mT = obj;
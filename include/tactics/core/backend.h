@@ -15,6 +15,9 @@
 #include <atomic>
 #include <future>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace tactics {
 
@@ -94,6 +97,21 @@ struct RuntimeHint {
 
   // path of the kvcache directory
   std::string kvcacheDirPath = "/tmp";
+
+  // backing of the big memory arenas, see BufferAllocator::ArenaMode
+  // 0: malloc
+  // 1: anonymous mmap
+  // 2: anonymous mmap advised to use transparent huge pages
+  // 3: explicit huge pages, needs pages reserved by the system
+  // a mode not available on the host falls back to the one before it.
+  // only the arenas of the Defer dynamic allocator are mapped this way:
+  // STATIC memory, and Eager dynamic memory carved from it, asks the system
+  // for each tensor at its own size and stays on malloc
+  int arenaMode = 0;
+
+  // free memory in MB each allocator may keep cached through garbage
+  // collection, on_gabage_collect(level) keeps (100 - level)% of it
+  int gcFreeWatermark = 64;
 };
 
 struct BackendConfig {
@@ -174,7 +192,7 @@ public:
     // nothing to do
   }
 
-  virtual ~Backend() = default;
+  virtual ~Backend();
 
 public:
   // create execution for op with input and output tensors.
@@ -204,7 +222,8 @@ public:
   // release buffer of tensor for given storage type.
   bool on_release_buffer(const Tensor *tensor, StorageType storageType);
 
-  class MemObj : public RefCount {
+  // may be released on another thread than the one that acquired it
+  class MemObj : public AtomicRefCount {
   public:
     MemObj() {}
     virtual ~MemObj() {}
@@ -251,8 +270,46 @@ public:
     return 0;
   }
 
+  // the host pointer of tensors of this backend is their memory, Tensor::map
+  // of dense planar tensors returns it without a copy
+  virtual bool host_addressable() const { return false; }
+
+public:
+  // Tensor::map without on_map_tensor. a host copy of the tensor is kept per
+  // tensor until its content version changes, read maps of unchanged tensors
+  // skip the copy unless the backend is host_addressable, where kernels
+  // write the memory directly. buffers not mapped are reused by other
+  // tensors and the least recently used freed above the staging limit
+  void *map_staging(Tensor::MapType mtype, const Tensor *tensor);
+  void unmap_staging(Tensor::MapType mtype, const Tensor *tensor,
+                     void *mapPtr);
+  // forget the host copy of `tensor`, its buffer stays for reuse
+  void drop_staging(const Tensor *tensor);
+  // free all buffers not mapped
+  void clear_staging();
+  size_t staging_size() const;
+  void set_staging_limit(size_t bytes);
+
 private:
+  struct Staging {
+    void *ptr = nullptr;
+    size_t size = 0;
+    // nullptr when free
+    const Tensor *tensor = nullptr;
+    // content version of tensor the buffer holds, 0 for none
+    uint64_t version = 0;
+    uint64_t lastUse = 0;
+    int mapped = 0;
+  };
+  Staging *find_staging(const Tensor *tensor, size_t size);
+  void evict_staging();
+
   const ForwardType mType;
+  mutable std::mutex mStagingLock;
+  std::vector<Staging> mStaging;
+  size_t mStagingSize = 0;
+  size_t mStagingLimit = 64 * 1024 * 1024;
+  uint64_t mStagingClock = 0;
 };
 
 // Each backend belong to a runtime
@@ -275,6 +332,17 @@ public:
   void set_rumtime_hint(const RuntimeHint &hint) { mHint = hint; }
   const RuntimeHint &hint() const { return mHint; }
 
+  // allocator for the big memory arenas, chosen by hint().arenaMode
+  std::shared_ptr<BufferAllocator::Allocator> create_arena_allocator() const;
+
+  // allocators of this runtime accounted by on_get_memory_inmb and trimmed
+  // by on_gabage_collect, until they are destroyed. const so that backends
+  // created by on_create can register theirs. a nested allocator draws its
+  // memory from another registered one, it is trimmed before the others and
+  // not accounted
+  void add_allocator(const std::shared_ptr<BufferAllocator> &allocator,
+                     bool nested = false) const;
+
   virtual CompilerType on_get_compiler_type() const { return Compiler_Loop; }
 
   virtual ~Runtime() = default;
@@ -288,11 +356,13 @@ public:
     // Do nothing
   }
 
-  // clear unuseful resource
-  virtual void on_gabage_collect(int level) {}
+  // clear unuseful resource, level in [0, 100]. the free memory of every
+  // allocator is trimmed down to its share of hint().gcFreeWatermark, level
+  // 100 also returns the heap top of malloc to the system
+  virtual void on_gabage_collect(int level);
 
   // Measure the memory it used in MB
-  virtual float on_get_memory_inmb() { return 0.0f; }
+  virtual float on_get_memory_inmb();
 
   // If buffer is not nullptr, try copy cache, else delete cache
   virtual bool on_set_cache(const void *buffer, size_t size) {
@@ -334,8 +404,13 @@ public:
   void wait_async_work();
 
 private:
+  std::vector<std::shared_ptr<BufferAllocator>> allocators(bool nested);
+
   std::future<int> mFuture;
   RuntimeHint mHint;
+  mutable std::mutex mAllocatorLock;
+  mutable std::vector<std::pair<std::weak_ptr<BufferAllocator>, bool>>
+      mAllocators;
 };
 
 // abstract Runtime register
@@ -11,6 +11,8 @@
 #ifndef TACTICS_CORE_BUFFER_ALLOCATOR_H
 #define TACTICS_CORE_BUFFER_ALLOCATOR_H
 
+#include <cstdint>
+#include <list>
 #include <map>
 #include <memory>
 #include <set>
@@ -37,8 +39,25 @@ public:
   MemNode *left = nullptr, *right = nullptr;
   std::vector<MemNode *> children;
   std::vector<Tensor *> tensors;
+  // lifetime in allocator events, only used by interval planning
+  size_t allocTime = 0, freeTime = SIZE_MAX;
+  // interval planning places this chunk on the memory of `alias`
+  MemNode *alias = nullptr;
 };
 
+// a chunk lifetime [start, end) for offline offset planning
+struct MemInterval {
+  size_t size = 0;
+  size_t start = 0;
+  size_t end = SIZE_MAX;
+  size_t offset = 0;
+};
+
+// assign offsets so that intervals alive at the same time never share bytes.
+// places the largest intervals first, each into the best fitting gap left by
+// the already placed ones. return the arena size needed.
+size_t plan_mem_intervals(std::vector<MemInterval> &intervals);
+
 struct ChunkBySize {
 public:
   ChunkBySize(MemNode *ch) : chunk(ch) {}
@@ -81,14 +100,41 @@ private:
 
 class BufferAllocator {
 public:
+  // where the memory handed out by an Allocator comes from
+  enum ArenaMode {
+    // memory_alloc_align
+    ARENA_MALLOC = 0,
+    // anonymous mmap with normal pages
+    ARENA_MMAP = 1,
+    // anonymous mmap advised with MADV_HUGEPAGE
+    ARENA_MMAP_THP = 2,
+    // explicit huge pages with MAP_HUGETLB
+    ARENA_HUGETLB = 3,
+  };
   class Allocator {
   public:
     Allocator() = default;
     virtual ~Allocator() = default;
     virtual MemChunk on_alloc(size_t size, size_t align) = 0;
     virtual void on_release(MemChunk chunk) = 0;
+    // the `size` bytes at chunk are unused for now but stay allocated, the
+    // allocator may give their pages back to the system. contents are lost.
+    virtual void on_discard(MemChunk chunk, size_t size) {}
+    // backing of the memory returned by the last on_alloc
+    virtual ArenaMode arena_mode() const { return ARENA_MALLOC; }
     static std::shared_ptr<Allocator> create_default();
+    // backs every allocation with its own mapping, for big arenas. tries
+    // `mode` first and falls back to the next weaker mode when unavailable.
+    // alignment is honored up to 2MB.
+    static std::shared_ptr<Allocator> create_mmap(ArenaMode mode = ARENA_MMAP_THP);
+    // thread-cached size-class pool, honors `align` of each call. blocks up
+    // to 64KB never reach malloc once the pool is warm. larger ones are
+    // mapped, up to 64MB of freed mappings are kept for the next of a size.
+    static std::shared_ptr<Allocator> create_slab();
     static std::shared_ptr<Allocator> create_recurse(BufferAllocator *parent);
+    // keeps `parent` alive as long as the allocator
+    static std::shared_ptr<Allocator>
+    create_recurse(std::shared_ptr<BufferAllocator> parent);
   };
   BufferAllocator() = default;
   virtual ~BufferAllocator() = default;
@@ -97,6 +143,11 @@ public:
   virtual bool free(MemChunk chunk) = 0;
   virtual void release(bool allRelease = true) = 0;
   virtual size_t total_size() const = 0;
+  // bytes got from parent but not handed out
+  virtual size_t free_size() const { return 0; }
+  // give free memory back until at most `keep` bytes stay cached, returns
+  // the bytes given back
+  virtual size_t trim(size_t keep) { return 0; }
   virtual void barrier_begin() {}
   virtual void barrier_end() {}
   virtual void begin_group() {}
@@ -119,44 +170,144 @@ public:
   void release(bool allRelease = true) override;
 
   size_t total_size() const override { return mTotalSize; }
+  size_t free_size() const override;
+  // arenas of idle plans go back to parent first, then whole free blocks,
+  // then free pieces of blocks still in use get their pages discarded
+  size_t trim(size_t keep) override;
 
   void barrier_begin() override;
   void barrier_end() override;
   void begin_group() override;
   void end_group() override;
 
+  // the alloc / free sequence between begin_plan and end_plan is recorded
+  // for the signature `shapes`. when the same signature comes again the
+  // sequence replays as precomputed offsets into one arena, falling back to
+  // the free lists as soon as it differs from the recorded one. a plan is
+  // only kept if every chunk allocated in it is freed before end_plan.
+  void begin_plan(const std::vector<std::vector<int>> &shapes);
+  void end_plan();
+  // number of plans kept, the least recently used ones are dropped first
+  void set_plan_cache_size(size_t size);
+  size_t plan_count() const { return mPlans.size(); }
+  // true while the current plan replays
+  bool replaying() const { return nullptr != mPlan.get() && mPlanReplay; }
+
 private:
+  struct Plan;
   class Node : public RefCount {
   public:
     ~Node();
     std::pair<void *, size_t> pointer;
+    // the block got from outside this node is split from, nullptr for itself
     SharedPtr<Node> parent = nullptr;
     size_t size;
-    size_t useCount = 0;
     Allocator *outside = nullptr;
+    // bytes whose pages were discarded by trim while the node is free
+    size_t discarded = 0;
   };
 
-  typedef std::multimap<size_t, SharedPtr<Node>> FREELIST;
+  // free nodes indexed by size for best fit and by address for coalescing,
+  // every operation is logarithmic in the number of free nodes
+  class FreeList {
+  public:
+    typedef std::multimap<size_t, SharedPtr<Node>> SizeIndex;
+    typedef std::map<std::pair<void *, size_t>, SizeIndex::iterator>
+        AddressIndex;
+    // insert node, fuse it with free neighbours split from the same block
+    void insert(SharedPtr<Node> node, bool permitMerge);
+    // remove and return the smallest node not less than size, or nullptr
+    SharedPtr<Node> take(size_t size);
+    void remove(const SharedPtr<Node> &node);
+    const SizeIndex &nodes() const { return mSizeIndex; }
+    size_t bytes() const { return mBytes; }
+    // all pages of free `node` are discarded
+    void mark_discarded(const SharedPtr<Node> &node);
+    size_t discarded() const { return mDiscarded; }
+    void clear();
+
+  private:
+    void erase(AddressIndex::iterator iter);
+    SizeIndex mSizeIndex;
+    AddressIndex mAddressIndex;
+    size_t mBytes = 0;
+    size_t mDiscarded = 0;
+  };
 
-  static void returnMemory(FREELIST *list, SharedPtr<Node> node,
+  std::pair<void *, size_t> allocImpl(size_t size, bool separate,
+                                      size_t align);
+  bool freeImpl(const std::pair<void *, size_t> &pointer);
+  std::pair<void *, size_t> replayAlloc(size_t size, size_t align);
+  bool replayFree(const std::pair<void *, size_t> &pointer);
+  void recordAlloc(const std::pair<void *, size_t> &pointer, size_t size,
+                   size_t align);
+  void recordFree(const std::pair<void *, size_t> &pointer);
+  bool prepareArena(Plan *plan);
+  void releaseArena(Plan *plan);
+  static void returnMemory(FreeList *list, SharedPtr<Node> node,
                            bool permitMerge = true);
-  std::pair<void *, size_t> getFromFreeList(FREELIST *list, size_t size,
+  std::pair<void *, size_t> getFromFreeList(FreeList *list, size_t size,
                                             bool permiteSplit, size_t align);
 
   std::map<std::pair<void *, size_t>, SharedPtr<Node>> mUsedList;
-  FREELIST mFreeList;
+  FreeList mFreeList;
   size_t mTotalSize = 0;
 
-  FREELIST *mCurrentFreeList = nullptr;
-  std::vector<std::shared_ptr<FREELIST>> mGroups;
+  FreeList *mCurrentFreeList = nullptr;
+  std::vector<std::shared_ptr<FreeList>> mGroups;
   std::shared_ptr<Allocator> mAllocator;
   size_t mAlign;
+
+  // most recently used first
+  std::list<std::shared_ptr<Plan>> mPlans;
+  size_t mPlanCacheSize = 4;
+  // the plan recording or replaying between begin_plan and end_plan
+  std::shared_ptr<Plan> mPlan;
+  bool mPlanReplay = false;
+  // dropped plans whose arena still has chunks in use
+  std::vector<std::shared_ptr<Plan>> mRetiredPlans;
 };
+// allocator shared by many threads under one memory budget. sizes are
+// rounded to power of two classes, freed blocks stay in a cache of the
+// freeing thread and move between threads in batches through sharded pools,
+// so threads only meet on a lock when they hit the same shard. `parent` must
+// be thread safe.
+class ConcurrentBufferAllocator : public BufferAllocator {
+public:
+  ConcurrentBufferAllocator(std::shared_ptr<Allocator> parent,
+                            size_t limit = SIZE_MAX,
+                            size_t align = MEMORY_ALIGN_DEFAULT);
+  ~ConcurrentBufferAllocator();
+
+  // return an invalid chunk if the budget `limit` would be exceeded
+  MemChunk alloc(size_t size, bool separate = false, size_t align = 0) override;
+  bool free(MemChunk chunk) override;
+  // allRelease drops every block, otherwise only the ones in shared pools
+  // and in the cache of the calling thread
+  void release(bool allRelease = true) override;
+  size_t total_size() const override;
+  // blocks in shared pools, thread caches are not counted
+  size_t free_size() const override;
+  size_t trim(size_t keep) override;
+
+  struct Pool;
+
+private:
+  std::shared_ptr<Pool> mPool;
+};
+
 typedef void (*MemChunkApplyToTensor)(uint8_t *ptr, size_t offset,
                                       Tensor *tensor);
 
 class DeferBufferAllocator : public BufferAllocator {
 public:
+  // how offsets are assigned to chunks
+  enum PlanMode {
+    // first fit over free chunks while allocating, fuse freed neighbours
+    PLAN_FIRST_FIT = 0,
+    // record alloc/free time of every chunk, pack offline in compute()
+    PLAN_INTERVAL = 1,
+  };
   DeferBufferAllocator(std::shared_ptr<Allocator> parent,
                        size_t align = MEMORY_ALIGN_DEFAULT,
                        MemChunkApplyToTensor func = nullptr);
@@ -164,6 +315,11 @@ public:
 
 public:
   MemChunk alloc(size_t size, bool separate = false, size_t align = 0) override;
+  // alloc the output of an op that may overwrite `input` in place. with
+  // PLAN_INTERVAL both share one chunk if input is freed before anything
+  // else is allocated, chains of such ops all share the same chunk. other
+  // modes ignore `input`.
+  MemChunk alloc_inplace(MemChunk input, size_t size, size_t align = 0);
   bool free(MemChunk chunk) override;
   void release(bool allRelease = true) override;
   size_t total_size() const override;
@@ -174,6 +330,12 @@ public:
   void reset() override;
   bool compute() override;
 
+  // only valid before the first alloc or after reset
+  void set_plan_mode(PlanMode mode);
+  PlanMode plan_mode() const { return mPlanMode; }
+  // max bytes alive at once, compare with total_size() after compute
+  size_t peak_live_size() const { return mPeakLiveSize; }
+
 private:
   std::vector<std::unique_ptr<MemNode>> mChunks;
   MemNode *mHead = nullptr, *mTail = nullptr;
@@ -186,7 +348,17 @@ private:
   // barrier
   bool mBarrrier = false;
   std::vector<MemChunk> mBarrrierFreeChunks;
+  // planning
+  PlanMode mPlanMode = PLAN_FIRST_FIT;
+  size_t mClock = 0;
+  size_t mLiveSize = 0;
+  size_t mPeakLiveSize = 0;
+  // alias waiting for its input to be freed
+  MemNode *mPendingAlias = nullptr;
+
+  bool computeInterval();
 
+  MemChunk allocImpl(size_t size, bool separate);
   MemNode *createMemNode(size_t size);
   MemNode *fuse_to_left(MemNode *left, MemNode *right);
   void erase_node(MemNode *chunk);
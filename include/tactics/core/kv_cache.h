@@ -0,0 +1,293 @@
+//===------------------------tactics/core/kv_cache.h------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===-----------------------------------------------------------------------===//
+//
+/// This file defines the key / value cache of attention layers
+///
+//===-----------------------------------------------------------------------===//
+#ifndef TACTICS_CORE_KV_CACHE_H
+#define TACTICS_CORE_KV_CACHE_H
+
+#include <climits>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tactics/core/auto_storage.h"
+#include "tactics/core/backend.h"
+#include "tactics/core/buffer_allocator.h"
+
+namespace tactics {
+
+class KVSpillFile;
+
+// fixed size blocks carved from arenas of `arenaBlocks` blocks, handed out
+// by index. taking and giving back a block is O(1) and never moves the
+// blocks in use. not thread safe.
+class KVBlockPool {
+public:
+  KVBlockPool(size_t blockBytes, int arenaBlocks = 16, int maxBlocks = INT_MAX,
+              std::shared_ptr<BufferAllocator::Allocator> allocator = nullptr);
+  ~KVBlockPool();
+  KVBlockPool(const KVBlockPool &) = delete;
+  KVBlockPool &operator=(const KVBlockPool &) = delete;
+
+  // index of a free block, -1 once `maxBlocks` are taken or out of memory
+  int alloc();
+  void free(int block);
+  uint8_t *data(int block) const {
+    return mArenas[block / mArenaBlocks].ptr() +
+           (size_t)(block % mArenaBlocks) * mStride;
+  }
+  size_t block_bytes() const { return mBlockBytes; }
+  int used_count() const { return mUsed; }
+  int free_count() const { return (int)mFree.size(); }
+  // blocks alloc can still hand out, growing the pool if needed
+  int available() const;
+  // bytes of all arenas
+  size_t total_size() const;
+
+private:
+  size_t mBlockBytes;
+  size_t mStride;
+  int mArenaBlocks;
+  int mMaxBlocks;
+  int mUsed = 0;
+  std::shared_ptr<BufferAllocator::Allocator> mAllocator;
+  std::vector<MemChunk> mArenas;
+  // indexes of the free blocks, the next one to hand out at the back
+  std::vector<int> mFree;
+};
+
+// a block of the pool referenced by the block tables of sequences and by
+// the prefix cache, given back to the pool with the last reference
+class KVBlock : public RefCount {
+public:
+  KVBlock(KVBlockPool *pool, int id) : mPool(pool), mId(id) {}
+  ~KVBlock() { mPool->free(mId); }
+  int id() const { return mId; }
+  uint8_t *data() const { return mPool->data(mId); }
+
+  // token ids written so far, kept while all tokens before had ids
+  std::vector<int> tokens;
+  // hash of the ids of all tokens up to the end of the block, valid once
+  // `hashed` is set as the block is filled
+  uint64_t hash = 0;
+  bool hashed = false;
+
+private:
+  KVBlockPool *mPool;
+  int mId;
+};
+
+// key / value cache of one attention layer, stored in blocks of
+// `blockTokens` tokens. the newest blocks stay in memory, once the resident
+// bytes pass `sizeLimit` the oldest full blocks move to a file under
+// `dirPath` and are read back through a mapping of that file.
+class KVCache {
+public:
+  // same values as RuntimeHint::kvcacheQuantOption
+  enum QuantOption {
+    QUANT_NONE = 0,
+    // int8 asymmetric keys, a scale and zero point per token and head
+    QUANT_KEY = 1,
+    // fp8 e4m3 values, a scale per token and head
+    QUANT_VALUE = 2,
+    QUANT_BOTH = 3,
+  };
+  struct Config {
+    int kvHeads = 1;
+    int headDim = 64;
+    int blockTokens = 64;
+    int quantOption = QUANT_NONE;
+    // resident bytes before spilling, SIZE_MAX for no limit
+    size_t sizeLimit = SIZE_MAX;
+    std::string dirPath = "/tmp";
+  };
+  // kvcacheSizeLimit of the hint is in MB
+  static Config config_from_hint(const RuntimeHint &hint, int kvHeads,
+                                 int headDim);
+
+  // bytes of one block with its scales and zero points
+  static size_t block_bytes(const Config &config);
+
+  KVCache(const Config &config,
+          std::shared_ptr<BufferAllocator::Allocator> allocator = nullptr);
+  // takes its blocks from `pool`, of block_bytes(config)
+  KVCache(const Config &config, std::shared_ptr<KVBlockPool> pool);
+  ~KVCache();
+  KVCache(const KVCache &) = delete;
+  KVCache &operator=(const KVCache &) = delete;
+
+  // key and value are [tokens, kvHeads, headDim], ids the token ids used to
+  // hash full blocks for prefix sharing. false once the pool has no block
+  // left, the tokens before stay appended. a partly filled block shared with
+  // a fork is copied before it is written
+  bool append(const float *key, const float *value, int tokens,
+              const int *ids = nullptr);
+  // drops the references to the blocks
+  void clear();
+
+  // a cache sharing the blocks of this one, copied on write. none of the
+  // blocks may be spilled
+  KVCache *fork() const;
+  // append a full hashed `block` of the same pool, the tokens must fill
+  // whole blocks
+  void attach(const SharedPtr<KVBlock> &block);
+  // nullptr if spilled
+  const SharedPtr<KVBlock> &shared_block(int block) const {
+    return mBlocks[block].shared;
+  }
+
+  const Config &config() const { return mConfig; }
+  int tokens() const { return mTokens; }
+  int block_count() const { return (int)mBlocks.size(); }
+  // tokens filled in `block`
+  int block_tokens(int block) const;
+  // [blockTokens, kvHeads, headDim] of `block`, valid until the next append.
+  // only for the side not quantized
+  const float *key_block(int block) const;
+  const float *value_block(int block) const;
+  // dequantize the filled tokens of `block` to [tokens, kvHeads, headDim],
+  // key or value may be nullptr
+  void read_block(int block, float *key, float *value) const;
+  bool spilled(int block) const;
+  // index of `block` in the pool, -1 if spilled
+  int block_id(int block) const {
+    return mBlocks[block].spilled ? -1 : mBlocks[block].shared->id();
+  }
+  size_t block_bytes() const { return mLayout.blockBytes; }
+
+  // softmax(q * k / sqrt(headDim)) * v of one query token over all tokens,
+  // walking the block table. query and output are [heads, headDim], heads a
+  // multiple of kvHeads with query heads sharing a kv head in groups
+  void attention(const float *query, int heads, float *output) const;
+
+  // ask the system to read the spilled blocks ahead of use
+  void prefetch() const;
+  size_t resident_size() const;
+  size_t spilled_size() const;
+
+private:
+  struct Block {
+    uint8_t *data = nullptr;
+    SharedPtr<KVBlock> shared;
+    bool spilled = false;
+  };
+  // byte offsets inside a block
+  struct Layout {
+    size_t key = 0, value = 0;
+    // float scale and zero point of each token head of the keys
+    size_t keyParam = 0;
+    // float scale of each token head of the values
+    size_t valueParam = 0;
+    size_t blockBytes = 0;
+  };
+  static Layout make_layout(const Config &config);
+  bool quantKey() const { return 0 != (mConfig.quantOption & QUANT_KEY); }
+  bool quantValue() const { return 0 != (mConfig.quantOption & QUANT_VALUE); }
+  void writeToken(uint8_t *data, int index, const float *key,
+                  const float *value);
+  bool spill(int block);
+  // a new block at the end of the table, or a copy of the last one
+  bool pushBlock(bool copyLast);
+
+  Config mConfig;
+  Layout mLayout;
+  std::shared_ptr<KVBlockPool> mPool;
+  // block table, in token order
+  std::vector<Block> mBlocks;
+  int mTokens = 0;
+  // blocks before it are spilled
+  int mFirstResident = 0;
+  // all tokens came with ids, mHash covers them
+  bool mHashed = true;
+  uint64_t mHash;
+  std::unique_ptr<KVSpillFile> mSpillFile;
+};
+
+// kv caches of the sequences of one layer, sharing one block pool. a
+// sequence takes blocks as it grows and gives them back as soon as it ends,
+// so sequences of any length share the memory without padding.
+//
+// full blocks appended with token ids are kept in a prefix cache keyed by
+// the hash of all ids up to their end. a new sequence starts with the
+// cached blocks of its longest cached prefix, and only the tokens after
+// them need prefill. once the blocks in use pass `sizeLimit` of the config,
+// or the pool runs out, cached blocks no sequence uses are given back least
+// recently used first.
+class PagedKVCache {
+public:
+  // at most `maxBlocks` blocks for all sequences
+  PagedKVCache(const KVCache::Config &config, int maxBlocks = INT_MAX,
+               std::shared_ptr<BufferAllocator::Allocator> allocator = nullptr);
+
+  // id of a new sequence with the cached blocks of the longest prefix of
+  // `ids`, sequence(id)->tokens() of them are already there. the last token
+  // is always left to prefill
+  int add_sequence(const int *ids = nullptr, int count = 0);
+  // id of a new sequence sharing all blocks of `id`
+  int fork_sequence(int id);
+  // append to sequence `id`, making room in the pool first. the blocks it
+  // fills are added to the prefix cache
+  bool append(int id, const int *ids, const float *key, const float *value,
+              int tokens);
+  void end_sequence(int id);
+  // nullptr once ended
+  KVCache *sequence(int id);
+  int sequence_count() const { return (int)mSequences.size(); }
+  const KVBlockPool &pool() const { return *mPool; }
+  // blocks in the prefix cache, in use or not
+  int cached_count() const { return (int)mCached.size(); }
+
+private:
+  struct Sequence {
+    std::unique_ptr<KVCache> cache;
+    // blocks before it were offered to the prefix cache
+    int published = 0;
+  };
+  typedef std::list<SharedPtr<KVBlock>> LRUList;
+  void touch(LRUList::iterator iter);
+  // give back unused cached blocks until `blocks` more fit
+  void reserve(int blocks);
+  void publish(Sequence &sequence);
+
+  KVCache::Config mConfig;
+  size_t mSizeLimit;
+  std::shared_ptr<KVBlockPool> mPool;
+  // most recently used first
+  LRUList mLRU;
+  std::unordered_map<uint64_t, LRUList::iterator> mCached;
+  std::map<int, Sequence> mSequences;
+  int mNextId = 0;
+};
+
+// kv caches of all layers of a model. while one layer runs attention the
+// spilled blocks of the next one are prefetched.
+class KVCacheStore {
+public:
+  KVCacheStore(const RuntimeHint &hint, int layers, int kvHeads, int headDim);
+
+  int layers() const { return (int)mLayers.size(); }
+  KVCache *layer(int index) { return mLayers[index].get(); }
+  // call before running attention of layer `index`
+  void begin_layer(int index);
+  void clear();
+  size_t resident_size() const;
+  size_t spilled_size() const;
+
+private:
+  std::vector<std::unique_ptr<KVCache>> mLayers;
+};
+
+} // namespace tactics
+
+#endif // TACTICS_CORE_KV_CACHE_H
@@ -28,8 +28,30 @@ void* memory_calloc_align(size_t size, size_t align);
 // @brief free aligned memory pointer.
 void memory_free_align(void* mem);
 
+// small blocks of 64 byte aligned memory recycled by size class, for objects
+// created and destroyed at a high rate. served by the slab pool of
+// BufferAllocator::Allocator::create_slab, safe to free during thread exit
+// and static destruction. `size` is passed back to free
+void* memory_pool_alloc(size_t size);
+void memory_pool_free(void* mem, size_t size);
+
 #ifdef __cplusplus
 }
+
+namespace tactics {
+
+// std allocator over memory_pool_alloc, for std::allocate_shared
+template <typename T> struct PoolAllocator {
+  typedef T value_type;
+  PoolAllocator() = default;
+  template <typename U> PoolAllocator(const PoolAllocator<U>&) {}
+  T* allocate(size_t n) { return (T*)memory_pool_alloc(n * sizeof(T)); }
+  void deallocate(T* p, size_t n) { memory_pool_free(p, n * sizeof(T)); }
+  template <typename U> bool operator==(const PoolAllocator<U>&) const { return true; }
+  template <typename U> bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+
+} // namespace tactics
 #endif
 
 #endif // TACTICS_CORE_MEMORY_UTILS_H
\ No newline at end of file
@@ -77,6 +77,24 @@ public:
 
   static Tensor *clone(const Tensor *src, bool deepCopy = false);
 
+  // views read and write the host memory of `tensor` with their own extents
+  // and strides, `offset` elements in. the memory stays alive while a view
+  // does. nullptr without host memory or with a packed channel layout
+  static Tensor *create_view(const Tensor *tensor,
+                             const std::vector<int> &shape,
+                             const std::vector<int64_t> &strides,
+                             int64_t offset = 0);
+  // [begin, end) of `axis` by `step`
+  static Tensor *slice(const Tensor *tensor, int axis, int begin, int end,
+                       int step = 1);
+  // dim i of the view is dim order[i] of tensor
+  static Tensor *permute(const Tensor *tensor, const std::vector<int> &order);
+  // dims of extent 1 repeat with stride 0, leading dims may be added
+  static Tensor *expand(const Tensor *tensor, const std::vector<int> &shape);
+  // one extent of `shape` may be -1. nullptr when the dims merged are not
+  // contiguous, a copy is needed then
+  static Tensor *reshape(const Tensor *tensor, const std::vector<int> &shape);
+
   static void destroy(Tensor *tensor);
 
   bool copy_from_host_tensor(const Tensor *tensor);
@@ -111,13 +129,13 @@ public:
   std::vector<int> shape() const;
 
   // calculate number of bytes needed to store data taking reordering flag into
-  // account.
-  int size() const;
+  // account. 64 bit, tensors may pass 2 GB
+  int64_t size() const;
   size_t usize() const;
 
   // calculate number of elements needed to store data taking reordering flag
   // into account.
-  inline int elementSize() const { return size() / m_buffer.type.bytes(); }
+  inline int64_t elementSize() const { return size() / m_buffer.type.bytes(); }
 
 public:
   inline int width() const { return m_buffer.dim[3].extent; }
@@ -126,9 +144,9 @@ public:
   inline int batch() const { return m_buffer.dim[0].extent; }
 
   // visit dimension's extent & stride
-  inline int stride(int index) const { return m_buffer.dim[index].stride; }
+  inline int64_t stride(int index) const { return m_buffer.dim[index].stride; }
   inline int length(int index) const { return m_buffer.dim[index].extent; }
-  inline void setStride(int index, int stride) {
+  inline void setStride(int index, int64_t stride) {
     m_buffer.dim[index].stride = stride;
   }
   inline void setLength(int index, int length) {
@@ -155,6 +173,10 @@ public:
   // set GPU tensor device ptr, and inform memory type
   bool setDevicePtr(const void *devicePtr, int memoryType);
 
+  // tensors are small and short lived, they come from memory_pool_alloc
+  static void *operator new(size_t size);
+  static void operator delete(void *ptr, size_t size);
+
 private:
   Tensor(bool deepCopy, const Tensor *tensor);
   // remove all assignment operator
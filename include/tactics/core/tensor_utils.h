@@ -69,17 +69,24 @@ struct TensorArrayAttr {
   std::vector<std::vector<int>> element_shape;
 };
 
+// q = clamp(round(x / scale + zero), min, max), x = (q - zero) * scale
 struct QuantAttr {
   float scale;
   float zero = 0.0f;
   float min = -127.0f;
-  float max = 1278.0f;
+  float max = 127.0f;
+  // per channel along dimension `axis` when not empty, replacing scale and
+  // zero
+  int axis = 0;
+  std::vector<float> scales;
+  std::vector<float> zeros;
 };
 
 struct Tensor::InsideDescribe {
+  // offsets and strides in elements, 64 bit for tensors past 2G elements
   struct View {
-    int32_t offset = 0;
-    int32_t stride[3] = {1, 1, 1};
+    int64_t offset = 0;
+    int64_t stride[3] = {1, 1, 1};
   };
   struct Region {
     View src;
@@ -122,39 +129,42 @@ struct Tensor::InsideDescribe {
     COMPUTE_SHAPE_STAGE = 1 << 2,
     CONTENT_NOT_CHANGE = 1 << 3,
   };
-  // extra tensor info container
+  // extra tensor info container. fields read on every create and copy come
+  // first and share a cache line, graph and quant attributes go last
   struct NativeInsideDescribe {
   public:
     // dimension format
     DATA_FORMAT dimension_format = DATA_FORMAT_NC4HW4;
+    MemoryType memoryType = MEMORY_BACKEND;
+    // Only valid when quantAttr is not nullptr
+    DataType type = DataType_DT_FLOAT;
+    Usage usage = NORMAL;
     union {
       // Serperate memory offset
       int offset;
       // function used to free handle
       void (*handleFreeFunction)(void *);
     } extra;
-    MemoryType memoryType = MEMORY_BACKEND;
     // std::weak_ptr<Command> rasterCommand;
     // for DEVICE tensor only.
     int useCount = 0;
-    Usage usage = NORMAL;
-    std::vector<Region> regions;
+    int channel_pack_num = 4;
+    int index = -1;
+    int group = 0;
+    // For isMutable = false Tensor , determine whether the content can be
+    // convert to main backend
+    uint32_t stageMask = 0;
+    bool isMutable = true;
+    bool support_pack16 = true;
+    // bumped by TensorUtils::set_content_changed, 0 until first asked
+    uint64_t contentVersion = 0;
     halide_dimension_t dims[MAX_TENSOR_DIM];
+    std::vector<Region> regions;
     // TensorArray Attribute
     std::shared_ptr<TensorArrayAttr> tensorArrayAttr;
     // Tensor Quant Attribute
     std::shared_ptr<QuantAttr> quantAttr;
-    // Only valid when quantAttr is not nullptr
-    DataType type = DataType_DT_FLOAT;
-    bool isMutable = true;
-    int index = -1;
-    int group = 0;
-    int channel_pack_num = 4;
-    bool support_pack16 = true;
     pad mPads;
-    // For isMutable = false Tensor , determine whether the content can be
-    // convert to main backend
-    uint32_t stageMask = 0;
   };
   std::shared_ptr<NativeInsideDescribe> m_content;
   // SharedPtr type for assign
@@ -162,6 +172,10 @@ struct Tensor::InsideDescribe {
   inline Backend *getBackend() const { return backend; }
   inline void setBackend(Backend *bn) { backend = bn; }
 
+  // from memory_pool_alloc
+  static void *operator new(size_t size);
+  static void operator delete(void *ptr, size_t size);
+
 private:
   // for DEVICE tensor only. backend used to manage tensor's device memory
   Backend *backend = nullptr;
@@ -187,6 +201,26 @@ public:
     static bool compare_tensors(const Tensor* compareTensor, const Tensor* toTensor, float tolerance = 0,
                                bool overall = false, bool printsError = true, bool printsTensors = false);
 
+    // error statistics of compare_tensors. elements equal, both nan, or both
+    // below FLT_EPSILON count as exact. indices are of planar elements
+    struct CompareStats {
+        int64_t count = 0;
+        int64_t mismatches = 0;
+        double maxAbsError = 0.0;
+        // |a - b| / |b|, or / max |b| when overall
+        double maxRelError = 0.0;
+        // representable values between a and b, |a - b| for integers
+        uint64_t maxUlp = 0;
+        // the first mismatches in order, at most maxIndices of them
+        std::vector<int64_t> mismatchIndices;
+    };
+    // the same, streamed block by block in the element type without copies
+    // of host planar tensors and split over `threads`. false on a mismatch,
+    // different types or shapes
+    static bool compare_tensors(const Tensor* compareTensor, const Tensor* toTensor, CompareStats& stats,
+                                float tolerance = 0, bool overall = false, int maxIndices = 16,
+                                int threads = 1);
+
     static void setup_tensor_info(const Tensor* tensor, Tensor* wrapTensor, DATA_FORMAT mMidFormat);
     static Tensor::InsideDescribe::Region make_full_slice(Tensor* input);
     static bool region_is_full(Tensor* input);
@@ -206,6 +240,12 @@ public:
     private:
         FuseRegionStatus* mStatus;
     };
+    // fuse each region of `output` back through MEMORY_VIRTUAL origins that are
+    // written by one region, until it reads a tensor with memory or can't fuse.
+    // returns the number of intermediate copies removed
+    static int fuse_virtual_regions(Tensor* output);
+    // the same over tensors in execution order, virtual ones included
+    static int fuse_virtual_regions(const std::vector<Tensor*>& outputs);
     static void adjust_tensor_for_compability(Tensor* t);
     static std::vector<float> get_quant_info(const Tensor* t);
     
@@ -214,6 +254,18 @@ public:
     
     static bool ref_tensor_content(Tensor* dst, const Tensor* src);
 
+    // whoever writes the memory of a device tensor marks it, so host copies
+    // cached by Backend::map_staging are refreshed. versions are unique over
+    // all tensors, a tensor at a reused address never matches an old copy
+    static void set_content_changed(const Tensor* tensor);
+    static uint64_t get_content_version(const Tensor* tensor);
+
+    // strides of the dense layout of its extents, views can be anything
+    static bool is_contiguous(const Tensor* tensor);
+
+    // copy the host memory of `src` to `dst` of the same shape, any strides
+    static bool copy_strided(const Tensor* src, Tensor* dst);
+
     static int get_tensor_channel_pack(const Tensor* tensor);
 
     static void set_tensor_channel_pack(const Tensor* tensor, int pack);
@@ -2,6 +2,7 @@
 #define TACTICS_MATH_COMMON_H
 
 #include <cstddef>
+#include <cstdint>
 #include <stdio.h>
 
 #ifdef __cplusplus
@@ -21,6 +22,20 @@ void matrix_sub_common(float* C, const float* A, const float* B, size_t width, s
 void matrix_prod_common(float* C, const float* A, const float* B, size_t width, size_t c_stride, size_t a_stride,
                         size_t b_stride, size_t height);
 
+// float16 and bfloat16 storage, computed in float. strides in elements
+void matrix_add_common_fp16(uint16_t* C, const uint16_t* A, const uint16_t* B, size_t width, size_t c_stride,
+                            size_t a_stride, size_t b_stride, size_t height);
+void matrix_sub_common_fp16(uint16_t* C, const uint16_t* A, const uint16_t* B, size_t width, size_t c_stride,
+                            size_t a_stride, size_t b_stride, size_t height);
+void matrix_prod_common_fp16(uint16_t* C, const uint16_t* A, const uint16_t* B, size_t width, size_t c_stride,
+                             size_t a_stride, size_t b_stride, size_t height);
+void matrix_add_common_bf16(uint16_t* C, const uint16_t* A, const uint16_t* B, size_t width, size_t c_stride,
+                            size_t a_stride, size_t b_stride, size_t height);
+void matrix_sub_common_bf16(uint16_t* C, const uint16_t* A, const uint16_t* B, size_t width, size_t c_stride,
+                            size_t a_stride, size_t b_stride, size_t height);
+void matrix_prod_common_bf16(uint16_t* C, const uint16_t* A, const uint16_t* B, size_t width, size_t c_stride,
+                             size_t a_stride, size_t b_stride, size_t height);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,93 @@
+//===------------------------tactics/ops/cpu/cpu_backend.h------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===-----------------------------------------------------------------------------===//
+//
+/// This file defines the cpu runtime and backend
+///
+//===-----------------------------------------------------------------------------===//
+#ifndef TACTICS_OPS_CPU_CPU_BACKEND_H
+#define TACTICS_OPS_CPU_CPU_BACKEND_H
+
+#include "tactics/core/backend.h"
+#include "tactics/core/buffer_allocator.h"
+#include <memory>
+
+namespace tactics {
+
+class CPURuntime : public Runtime {
+public:
+  CPURuntime(const Backend::Info &info);
+  virtual ~CPURuntime() = default;
+
+  // config overrides the precision and memory mode of the runtime
+  Backend *on_create(const BackendConfig *config = nullptr) const override;
+  void on_reset(int numberThread, const BackendConfig *config,
+                bool full) override;
+
+  int thread_number() const { return mThreadNumber; }
+  // STATIC memory of all backends of this runtime
+  const std::shared_ptr<EagerBufferAllocator> &static_allocator() const {
+    return mStaticAllocator;
+  }
+
+private:
+  std::shared_ptr<EagerBufferAllocator> mStaticAllocator;
+  int mThreadNumber;
+  BackendConfig::PrecisionMode mPrecision = BackendConfig::Precision_Normal;
+  BackendConfig::MemoryMode mMemory = BackendConfig::Memory_Normal;
+};
+
+class CPUBackend : public Backend {
+public:
+  // the dynamic allocator is chosen by hint().memoryAllocatorType of runtime
+  CPUBackend(const CPURuntime *runtime,
+             BackendConfig::PrecisionMode precision =
+                 BackendConfig::Precision_Normal,
+             BackendConfig::MemoryMode memory = BackendConfig::Memory_Normal);
+  virtual ~CPUBackend();
+
+  // STATIC from the runtime, DYNAMIC and DYNAMIC_SEPERATE from the dynamic
+  // allocator of this backend. with the Defer allocator the host of the
+  // tensor is set by on_resize_end, DYNAMIC tensors are all released before
+  // it and their memory stays valid until the next on_resize_begin
+  MemObj *on_acquire(const Tensor *tensor, StorageType storageType) override;
+  // drops all dynamic memory, tensors acquired before must not be used
+  bool on_clear_buffer() override;
+  void on_copy_buffer(const Tensor *srcTensor,
+                      const Tensor *dstTensor) const override;
+  bool host_addressable() const override { return true; }
+  // plan the dynamic memory of one resize, Defer only
+  void on_resize_begin() override;
+  bool on_resize_end() override;
+
+  const CPURuntime *runtime() const { return mRuntime; }
+  BufferAllocator *dynamic_allocator() const {
+    return mDynamicAllocator.get();
+  }
+  BackendConfig::PrecisionMode precision() const { return mPrecision; }
+  BackendConfig::MemoryMode memory() const { return mMemory; }
+
+  // bytes of the memory of `tensor`
+  static size_t get_bytes(const Tensor *tensor);
+
+private:
+  class CPUMemObj;
+
+  const CPURuntime *mRuntime;
+  Runtime::AllocatorType mAllocatorType;
+  std::shared_ptr<BufferAllocator> mDynamicAllocator;
+  BackendConfig::PrecisionMode mPrecision;
+  BackendConfig::MemoryMode mMemory;
+  // bumped each time the dynamic memory is dropped at once, mem objects of
+  // an older generation have nothing left to free. shared with them, as they
+  // may outlive the backend
+  std::shared_ptr<int> mGeneration = std::make_shared<int>(0);
+};
+
+} // namespace tactics
+
+#endif // TACTICS_OPS_CPU_CPU_BACKEND_H
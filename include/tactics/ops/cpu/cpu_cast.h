@@ -0,0 +1,107 @@
+//===------------------------tactics/ops/cpu/cpu_cast.h------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===--------------------------------------------------------------------------===//
+//
+/// This file defines the float32, float16 and bfloat16 casts of host tensors
+///
+//===--------------------------------------------------------------------------===//
+#ifndef TACTICS_OPS_CPU_CPU_CAST_H
+#define TACTICS_OPS_CPU_CPU_CAST_H
+
+#include "tactics/core/tensor.h"
+#include <cstdint>
+#include <cstring>
+
+namespace tactics {
+
+class CPUCast {
+public:
+  // round to nearest even, nan stays a quiet nan
+  static inline float half_to_float(uint16_t h) {
+    const uint32_t shiftedExp = 0x7c00u << 13;
+    uint32_t o = (uint32_t)(h & 0x7fff) << 13;
+    uint32_t exp = shiftedExp & o;
+    o += (127 - 15) << 23;
+    if (shiftedExp == exp) {
+      // inf or nan
+      o += (128 - 16) << 23;
+      o |= (o & 0x7fffff) ? 0x400000u : 0u;
+    } else if (0 == exp) {
+      // subnormal, renormalized by the fpu
+      const uint32_t magicBits = 113u << 23;
+      float f, magic;
+      o += 1u << 23;
+      ::memcpy(&f, &o, sizeof(f));
+      ::memcpy(&magic, &magicBits, sizeof(magic));
+      f -= magic;
+      ::memcpy(&o, &f, sizeof(o));
+    }
+    o |= (uint32_t)(h & 0x8000) << 16;
+    float result;
+    ::memcpy(&result, &o, sizeof(result));
+    return result;
+  }
+  static inline uint16_t float_to_half(float f) {
+    uint32_t x;
+    ::memcpy(&x, &f, sizeof(x));
+    uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+    uint32_t o;
+    if (x >= (143u << 23)) {
+      // past the largest half, inf or nan
+      o = x > 0x7f800000u ? 0x7e00u | ((x >> 13) & 0x3ff) : 0x7c00u;
+    } else if (x < (113u << 23)) {
+      // subnormal or zero, rounded by the fpu
+      const uint32_t magicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+      float v, magic;
+      ::memcpy(&v, &x, sizeof(v));
+      ::memcpy(&magic, &magicBits, sizeof(magic));
+      v += magic;
+      ::memcpy(&o, &v, sizeof(o));
+      o -= magicBits;
+    } else {
+      uint32_t odd = (x >> 13) & 1;
+      x += ((uint32_t)(15 - 127) << 23) + 0xfff + odd;
+      o = x >> 13;
+    }
+    return (uint16_t)(o | (sign >> 16));
+  }
+  static inline float bf16_to_float(uint16_t h) {
+    uint32_t o = (uint32_t)h << 16;
+    float result;
+    ::memcpy(&result, &o, sizeof(result));
+    return result;
+  }
+  static inline uint16_t float_to_bf16(float f) {
+    uint32_t x;
+    ::memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7fffffffu) > 0x7f800000u) {
+      return (uint16_t)((x >> 16) | 0x40);
+    }
+    return (uint16_t)((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+  }
+
+  // `count` elements. float16 uses F16C when the cpu has it, bfloat16 SSE2
+  static void half_to_float(const uint16_t *src, float *dst, size_t count);
+  static void float_to_half(const float *src, uint16_t *dst, size_t count);
+  static void bf16_to_float(const uint16_t *src, float *dst, size_t count);
+  static void float_to_bf16(const float *src, uint16_t *dst, size_t count);
+
+  // float32, float16 and bfloat16 to each other
+  static bool can_cast(halide_type_t from, halide_type_t to);
+  // `count` elements of `from` at `src` to `to` at `dst`. large casts are
+  // split over `threads` threads
+  static bool cast(const void *src, halide_type_t from, void *dst,
+                   halide_type_t to, size_t count, int threads = 1);
+  // dense host tensors of the same shape and DATA_FORMAT, padding included
+  static bool cast(const Tensor *input, const Tensor *output,
+                   int threads = 1);
+};
+
+} // namespace tactics
+
+#endif // TACTICS_OPS_CPU_CPU_CAST_H
@@ -0,0 +1,57 @@
+//===------------------------tactics/ops/cpu/cpu_parallel.h------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===------------------------------------------------------------------------------===//
+//
+/// This file defines the parallel loop of cpu kernels
+///
+//===------------------------------------------------------------------------------===//
+#ifndef TACTICS_OPS_CPU_CPU_PARALLEL_H
+#define TACTICS_OPS_CPU_CPU_PARALLEL_H
+
+#include "tactics/core/tensor.h"
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace tactics {
+
+// kernels touching fewer bytes stay on the calling thread
+static const size_t CPU_PARALLEL_BYTES = 1 << 20;
+// elements per thread of elementwise kernels are a multiple of this, so only
+// the last thread has a tail
+static const size_t CPU_PARALLEL_ALIGN = 64;
+
+// run `function` for units [0, units) on up to `threads` threads, the
+// calling thread included. unit `u` goes to thread `u % threads`
+inline void cpu_parallel_for(int units, int threads,
+                             const std::function<void(int)> &function) {
+  threads = ALIMIN(threads, units);
+  if (threads <= 1) {
+    for (int u = 0; u < units; ++u) {
+      function(u);
+    }
+    return;
+  }
+  std::vector<std::thread> workers;
+  for (int t = 1; t < threads; ++t) {
+    workers.emplace_back([&, t]() {
+      for (int u = t; u < units; u += threads) {
+        function(u);
+      }
+    });
+  }
+  for (int u = 0; u < units; u += threads) {
+    function(u);
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+} // namespace tactics
+
+#endif // TACTICS_OPS_CPU_CPU_PARALLEL_H
@@ -0,0 +1,95 @@
+//===------------------------tactics/ops/cpu/cpu_quantize.h------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===------------------------------------------------------------------------------===//
+//
+/// This file defines the int8 quantization and calibration of host tensors
+///
+//===------------------------------------------------------------------------------===//
+#ifndef TACTICS_OPS_CPU_CPU_QUANTIZE_H
+#define TACTICS_OPS_CPU_CPU_QUANTIZE_H
+
+#include "tactics/core/tensor_utils.h"
+#include <cstdint>
+#include <vector>
+
+namespace tactics {
+
+class CPUQuantize {
+public:
+  // q = clamp(round(x * (1 / scale) + zero), min, max), rounding to even.
+  // nan goes to min
+  static void quantize(const float *src, int8_t *dst, size_t count,
+                       float scale, float zero, float min, float max);
+  static void quantize(const float *src, uint8_t *dst, size_t count,
+                       float scale, float zero, float min, float max);
+  // x = (q - zero) * scale
+  static void dequantize(const int8_t *src, float *dst, size_t count,
+                         float scale, float zero);
+  static void dequantize(const uint8_t *src, float *dst, size_t count,
+                         float scale, float zero);
+
+  // int8 or uint8 with a QuantAttr
+  static bool is_quantized(const Tensor *tensor);
+  // elements of `tensor` as [outer, channel, inner] around the axis of
+  // `attr`, channel 1 when per tensor. false when per channel and `tensor`
+  // is packed by NC4HW4 or NHWC4, or the scales don't match the axis
+  static bool split(const Tensor *tensor, const QuantAttr &attr,
+                    size_t &outer, size_t &channel, size_t &inner);
+  // `type` is int8 or uint8. per tensor `channel` is 1. large tensors are
+  // split over `threads` threads
+  static bool quantize(const float *src, void *dst, halide_type_t type,
+                       const QuantAttr &attr, size_t outer, size_t channel,
+                       size_t inner, int threads = 1);
+  static bool dequantize(const void *src, halide_type_t type, float *dst,
+                         const QuantAttr &attr, size_t outer, size_t channel,
+                         size_t inner, int threads = 1);
+  // float32 `input` to quantized `output` and back, by the QuantAttr of
+  // the quantized one. host tensors of the same shape and DATA_FORMAT
+  static bool quantize(const Tensor *input, const Tensor *output,
+                       int threads = 1);
+  static bool dequantize(const Tensor *input, const Tensor *output,
+                         int threads = 1);
+};
+
+// derives a QuantAttr from the activations seen over calibration batches
+class QuantCalibrator {
+public:
+  enum Method {
+    // the full range seen
+    MIN_MAX,
+    // |x| clipped at `percentile` of a histogram, per tensor only
+    PERCENTILE,
+  };
+  // per tensor when `axis` < 0
+  explicit QuantCalibrator(Method method = MIN_MAX, int axis = -1,
+                           float percentile = 0.9999f);
+
+  // a float32 host tensor, false when it does not match earlier ones
+  bool observe(const Tensor *tensor);
+  // symmetric puts zero at 0 and only applies to int8, uint8 is always
+  // asymmetric. scale is 1 before anything is observed
+  QuantAttr compute(halide_type_t type, bool symmetric = true) const;
+
+private:
+  // 2^k bins over |x| in [0, mHistogramRange)
+  void add_histogram(const float *src, size_t count);
+  float clip_range() const;
+
+  Method mMethod;
+  int mAxis;
+  float mPercentile;
+  // per channel, or a single entry
+  std::vector<float> mMin;
+  std::vector<float> mMax;
+  std::vector<uint64_t> mHistogram;
+  float mHistogramRange = 0.0f;
+  uint64_t mCount = 0;
+};
+
+} // namespace tactics
+
+#endif // TACTICS_OPS_CPU_CPU_QUANTIZE_H
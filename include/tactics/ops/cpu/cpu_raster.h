@@ -0,0 +1,44 @@
+//===------------------------tactics/ops/cpu/cpu_raster.h------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===----------------------------------------------------------------------------===//
+//
+/// This file defines the raster of tensors described by regions
+///
+//===----------------------------------------------------------------------------===//
+#ifndef TACTICS_OPS_CPU_CPU_RASTER_H
+#define TACTICS_OPS_CPU_CPU_RASTER_H
+
+#include "tactics/core/tensor_utils.h"
+
+namespace tactics {
+
+class CPURaster {
+public:
+  typedef Tensor::InsideDescribe::Region Region;
+
+  // write the content of `output` from the regions of its describe, each
+  // region reading its origin. the output is zeroed first when the regions
+  // don't cover it. all tensors need host memory and the same element size.
+  // large rasters are split over `threads` threads, by regions and by the
+  // outer dims of each region
+  static bool execute(const Tensor *output, int threads = 1);
+
+  // one region of elements of `bytes`, `src` and `dst` are the start of the
+  // origin and the output, the offsets of the region are added here.
+  // copy regions are memcpy, transpose regions blocked transposes, tile
+  // regions broadcast stores, anything else a strided loop
+  static bool execute(const Region &region, const void *src, void *dst,
+                      int bytes);
+
+  // drop dims of size 1 and merge dims contiguous on both sides, the same
+  // elements moved as fewer and longer rows
+  static Region compact(const Region &region);
+};
+
+} // namespace tactics
+
+#endif // TACTICS_OPS_CPU_CPU_RASTER_H
@@ -0,0 +1,53 @@
+//===------------------------tactics/ops/cpu/cpu_tensor_convert.h------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===------------------------------------------------------------------------------------===//
+//
+/// This file defines the layout conversion of host tensors
+///
+//===------------------------------------------------------------------------------------===//
+#ifndef TACTICS_OPS_CPU_CPU_TENSOR_CONVERT_H
+#define TACTICS_OPS_CPU_CPU_TENSOR_CONVERT_H
+
+#include "tactics/core/tensor_utils.h"
+
+namespace tactics {
+
+class CPUTensorConverter {
+public:
+  // where channel `c` of pixel `x` of batch `b` lives in memory
+  struct Layout {
+    // 1: planar, [batch, channel, area]
+    // 4, 8, 16: packed, [batch, UP_DIV(channel, pack), area, pack]
+    // 0: channel last, [batch, area, stride] with stride >= channel
+    int pack = 1;
+    int stride = 0;
+  };
+  // NCHW and UNKNOWN are planar, NC4HW4 is packed by channel_pack_num,
+  // NHWC and NHWC4 put the channels last, NHWC4 padded to 4
+  static Layout layout_of(const Tensor *tensor);
+
+  // copy `input` to `output` between any two DATA_FORMAT layouts of the
+  // same batch, channel and area. elements of 1, 2, 4 or 8 bytes, so int8,
+  // uint8, fp16 and float all work. padded channels of output are zeroed.
+  // float32, float16 and bfloat16 are cast to the type of output on the way,
+  // float32 is quantized to and from int8 or uint8 with a QuantAttr.
+  // large tensors are split over `threads` threads
+  static bool convert(const Tensor *input, const Tensor *output,
+                      int threads = 1);
+  static bool convert(const void *src, const Layout &srcLayout, void *dst,
+                      const Layout &dstLayout, int batch, int channel,
+                      int area, int bytes, int threads = 1);
+
+  // dst[c * dstStride + r] = src[r * srcStride + c] for `rows` x `cols`
+  // elements of `bytes`, strides in elements
+  static bool transpose(const void *src, size_t srcStride, void *dst,
+                        size_t dstStride, int rows, int cols, int bytes);
+};
+
+} // namespace tactics
+
+#endif // TACTICS_OPS_CPU_CPU_TENSOR_CONVERT_H
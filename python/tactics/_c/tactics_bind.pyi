@@ -8,3 +8,13 @@ class Tensor:
     def __init__(self, shape: List[int], data: numpy.ndarray[numpy.float32]) -> None: ...
     def dump(self) -> None: ...
     def matrix_dump(self) -> None: ...
+    def reshape(self, shape: List[int]) -> Tensor: ...
+    def expand(self, shape: List[int]) -> Tensor: ...
+    def permute(self, order: List[int]) -> Tensor: ...
+    def transpose(self, dim0: int = 1, dim1: int = 0) -> Tensor: ...
+    def slice(self, axis: int, begin: int, end: int, step: int = 1) -> Tensor: ...
+    def is_contiguous(self) -> bool: ...
+    @property
+    def shape(self) -> List[int]: ...
+    @property
+    def strides(self) -> List[int]: ...
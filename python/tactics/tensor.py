@@ -98,11 +98,21 @@ class Tensor:
     def arange(start, stop=None, step=1, **kwargs) -> Tensor:
         pass
     
+    def _view(self, tensor: Itensor) -> Tensor:
+        # shares the memory of self, no copy
+        result = Tensor.__new__(Tensor)
+        result.grad = None
+        result.requires_grad = self.requires_grad
+        result._tensor = tensor
+        return result
+
     def reshape(self, shape, *args) -> Tensor:
-        pass
+        shape = list(shape) if isinstance(shape, (tuple, list)) else [shape, *args]
+        return self._view(self._tensor.reshape(shape))
 
     def expand(self, shape, *args) -> Tensor:
-        pass
+        shape = list(shape) if isinstance(shape, (tuple, list)) else [shape, *args]
+        return self._view(self._tensor.expand(shape))
 
     def add(self, x: Union[Tensor, ConstType], reverse=False) -> Tensor:
         pass
@@ -227,11 +237,12 @@ class Tensor:
     
     def transpose(self, dim0=1, dim1=0) -> Tensor:
         order = list(range(self.ndim))
-        order[dim0], order[dim0] = order[dim1], order[dim0]
+        order[dim0], order[dim1] = order[dim1], order[dim0]
         return self.permute(order)
     
     def permute(self, order, *args) -> Tensor:
-        pass
+        order = list(order) if isinstance(order, (tuple, list)) else [order, *args]
+        return self._view(self._tensor.permute(order))
 
     def dropout(self, p=0.5) -> Tensor:
         pass
@@ -0,0 +1,226 @@
+//===------------------------tactics/core/alloc_tracer.cpp------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===-----------------------------------------------------------------------------===//
+//
+/// This file defines the allocation tracer implement
+///
+//===-----------------------------------------------------------------------------===//
+#include "tactics/core/alloc_tracer.h"
+#include "tactics/core/tensor.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace tactics {
+
+std::atomic<bool> AllocTracer::g_enabled(false);
+
+AllocTracer *AllocTracer::get() {
+  // never deleted: allocators may still report during static destruction
+  static AllocTracer *g_tracer = new AllocTracer;
+  return g_tracer;
+}
+
+uint64_t AllocTracer::now() const {
+  auto time = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::microseconds>(time).count() -
+         mStart;
+}
+
+void AllocTracer::set_enable(bool enable) {
+  std::lock_guard<std::mutex> _l(mLock);
+  if (enable) {
+    mEvents.clear();
+    mSummaries.clear();
+    mLiveChunks.clear();
+    mTensors.clear();
+    mStart = 0;
+    mStart = now();
+  }
+  g_enabled = enable;
+}
+
+void AllocTracer::on_alloc(const void *allocator, const char *name,
+                           const void *key, size_t size, size_t reserved) {
+  std::lock_guard<std::mutex> _l(mLock);
+  auto &summary = mSummaries[allocator];
+  summary.name = name;
+  summary.live += size;
+  summary.peak = std::max(summary.peak, summary.live);
+  summary.reserved = std::max(summary.reserved, reserved);
+  summary.allocCount++;
+  mLiveChunks[key] = mEvents.size();
+  mEvents.push_back(
+      {EVENT_ALLOC, now(), allocator, key, size, summary.live, 0});
+}
+
+void AllocTracer::on_free(const void *allocator, const void *key,
+                          size_t reserved) {
+  std::lock_guard<std::mutex> _l(mLock);
+  auto iter = mLiveChunks.find(key);
+  if (iter == mLiveChunks.end()) {
+    // allocated before tracing started
+    return;
+  }
+  auto allocIndex = iter->second;
+  mLiveChunks.erase(iter);
+  auto size = mEvents[allocIndex].size;
+  auto &summary = mSummaries[allocator];
+  summary.live -= size;
+  summary.reserved = std::max(summary.reserved, reserved);
+  summary.freeCount++;
+  mEvents.push_back(
+      {EVENT_FREE, now(), allocator, key, size, summary.live, allocIndex});
+}
+
+void AllocTracer::on_compute(const void *allocator, size_t arenaSize) {
+  std::lock_guard<std::mutex> _l(mLock);
+  auto &summary = mSummaries[allocator];
+  summary.reserved = std::max(summary.reserved, arenaSize);
+  mEvents.push_back(
+      {EVENT_COMPUTE, now(), allocator, nullptr, arenaSize, summary.live, 0});
+}
+
+void AllocTracer::on_attach(const void *key, const Tensor *tensor) {
+  std::lock_guard<std::mutex> _l(mLock);
+  auto iter = mLiveChunks.find(key);
+  if (iter == mLiveChunks.end()) {
+    return;
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "%p [", (const void *)tensor);
+  std::string desc = name;
+  for (int d = 0; d < tensor->dimensions(); ++d) {
+    snprintf(name, sizeof(name), "%s%d", d > 0 ? "," : "", tensor->length(d));
+    desc += name;
+  }
+  desc += "]";
+  mTensors[iter->second].emplace_back(std::move(desc));
+}
+
+std::vector<AllocTracer::Event> AllocTracer::events() const {
+  std::lock_guard<std::mutex> _l(mLock);
+  return mEvents;
+}
+
+std::map<const void *, AllocTracer::Summary> AllocTracer::summaries() const {
+  std::lock_guard<std::mutex> _l(mLock);
+  return mSummaries;
+}
+
+std::vector<AllocTracer::HistogramBin> AllocTracer::size_histogram() const {
+  std::lock_guard<std::mutex> _l(mLock);
+  std::vector<HistogramBin> bins;
+  for (auto &event : mEvents) {
+    if (EVENT_ALLOC != event.type) {
+      continue;
+    }
+    size_t index = 0;
+    while (((size_t)1 << index) < event.size) {
+      index++;
+    }
+    while (bins.size() <= index) {
+      bins.push_back({(size_t)1 << bins.size(), 0, 0});
+    }
+    bins[index].count++;
+    bins[index].bytes += event.size;
+  }
+  return bins;
+}
+
+static void write_tensor_names(FILE *file,
+                               const std::vector<std::string> &tensors) {
+  for (size_t i = 0; i < tensors.size(); ++i) {
+    fprintf(file, "%s\"%s\"", i > 0 ? ", " : "", tensors[i].c_str());
+  }
+}
+
+bool AllocTracer::export_chrome_trace(const char *path) const {
+  FILE *file = fopen(path, "w");
+  if (nullptr == file) {
+    return false;
+  }
+  std::lock_guard<std::mutex> _l(mLock);
+  std::map<const void *, int> tracks;
+  for (auto &iter : mSummaries) {
+    int tid = (int)tracks.size() + 1;
+    tracks[iter.first] = tid;
+  }
+  fprintf(file, "{\"traceEvents\":[\n");
+  bool first = true;
+  for (auto &iter : mSummaries) {
+    fprintf(file,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s %p\"}}",
+            first ? "" : ",\n", tracks[iter.first], iter.second.name,
+            iter.first);
+    first = false;
+  }
+  // chunk lifetimes, still open chunks last to the end of the trace
+  std::vector<uint64_t> freeTimes(mEvents.size(), now());
+  for (auto &event : mEvents) {
+    if (EVENT_FREE == event.type) {
+      freeTimes[event.allocIndex] = event.time;
+    }
+  }
+  for (size_t i = 0; i < mEvents.size(); ++i) {
+    auto &event = mEvents[i];
+    auto tid = tracks[event.allocator];
+    fprintf(file,
+            ",\n{\"name\":\"live bytes %d\",\"ph\":\"C\",\"pid\":1,"
+            "\"ts\":%llu,\"args\":{\"bytes\":%zu}}",
+            tid, (unsigned long long)event.time, event.live);
+    if (EVENT_COMPUTE == event.type) {
+      fprintf(file,
+              ",\n{\"name\":\"compute\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,"
+              "\"tid\":%d,\"ts\":%llu,\"args\":{\"arena\":%zu}}",
+              tid, (unsigned long long)event.time, event.size);
+      continue;
+    }
+    if (EVENT_ALLOC != event.type) {
+      continue;
+    }
+    fprintf(file,
+            ",\n{\"name\":\"%zu B\",\"cat\":\"alloc\",\"ph\":\"X\",\"pid\":1,"
+            "\"tid\":%d,\"ts\":%llu,\"dur\":%llu,\"args\":{\"size\":%zu,"
+            "\"tensors\":[",
+            event.size, tid, (unsigned long long)event.time,
+            (unsigned long long)(freeTimes[i] - event.time), event.size);
+    auto tensors = mTensors.find(i);
+    if (tensors != mTensors.end()) {
+      write_tensor_names(file, tensors->second);
+    }
+    fprintf(file, "]}}");
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+  return true;
+}
+
+bool AllocTracer::export_replay_trace(const char *path,
+                                      const void *allocator) const {
+  FILE *file = fopen(path, "w");
+  if (nullptr == file) {
+    return false;
+  }
+  std::lock_guard<std::mutex> _l(mLock);
+  for (size_t i = 0; i < mEvents.size(); ++i) {
+    auto &event = mEvents[i];
+    if (event.allocator != allocator) {
+      continue;
+    }
+    if (EVENT_ALLOC == event.type) {
+      fprintf(file, "a %zu %zu\n", i, event.size);
+    } else if (EVENT_FREE == event.type) {
+      fprintf(file, "f %zu\n", event.allocIndex);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+} // namespace tactics
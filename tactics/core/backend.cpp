@@ -9,11 +9,16 @@
 ///
 //===----------------------------------------------------------------------===//
 #include "tactics/core/backend.h"
+#include "tactics/core/memory_utils.h"
 #include "tactics/core/tensor_utils.h"
+#include "tactics/ops/cpu/cpu_tensor_convert.h"
 #include <cassert>
 #include <map>
 #include <mutex>
 #include <utility>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 namespace tactics {
 
@@ -63,7 +68,41 @@ extern void register_dataflow_runtime_creator();
 #endif
 
 static std::once_flag s_flag;
-void register_backend() {}
+void register_backend() {
+  std::call_once(s_flag, [&]() {
+    register_cpu_runtime_creator();
+#if OPENCL_ENABLED
+    register_opencl_runtime_creator();
+#endif
+#if OPENMP_ENABLED
+    register_openmp_runtime_creator();
+#endif
+#if CUDA_ENABLED
+    register_cuda_runtime_creator();
+#endif
+#if AMDGPU_ENABLED
+    register_amdgpu_runtime_creator();
+#endif
+#if MUSA_ENABLED
+    register_musa_runtime_creator();
+#endif
+#if APPLE_ENABLED
+    register_apple_runtime_creator();
+#endif
+#if HEXAGON_ENABLED
+    register_hexagon_runtime_creator();
+#endif
+#if TPU_ENABLE
+    register_tpu_runtime_creator();
+#endif
+#if HABANA_ENABLE
+    register_gaudi_runtime_creator();
+#endif
+#if DATAFLOW_ENABLE
+    register_dataflow_runtime_creator();
+#endif
+  });
+}
 
 const RuntimeCreator *get_extra_runtime_creator(ForwardType type) {
   register_backend();
@@ -107,11 +146,7 @@ bool cpu_copy_buffer(const Tensor *srcTensor, const Tensor *dstTensor) {
   if (nullptr == srcBuffer.host || nullptr == dstBuffer.host) {
     return false;
   }
-  // auto code = CPUTensorConverter::convert(srcTensor, dstTensor);
-  // if (NO_ERROR != code) {
-  //     MNN_ERROR("Error in CPUBackend::onCopyBuffer\n");
-  // }
-  return true;
+  return CPUTensorConverter::convert(srcTensor, dstTensor);
 }
 
 bool Backend::on_acquire_buffer(const Tensor *tensor, StorageType storageType) {
@@ -119,6 +154,8 @@ bool Backend::on_acquire_buffer(const Tensor *tensor, StorageType storageType) {
   if (nullptr == mem) {
     return false;
   }
+  // Tensor::map and copies go through the backend owning the memory
+  TensorUtils::get_describe_origin(tensor)->setBackend(this);
   if (mem == TensorUtils::get_describe_origin(tensor)->mem.get()) {
     return true;
   }
@@ -127,9 +164,232 @@ bool Backend::on_acquire_buffer(const Tensor *tensor, StorageType storageType) {
 }
 bool Backend::on_release_buffer(const Tensor *tensor, StorageType storageType) {
   TensorUtils::get_describe_origin(tensor)->mem = nullptr;
+  drop_staging(tensor);
   return true;
 }
 
+//------------------------------- staging
+//-----------------------------------//
+Backend::~Backend() {
+  for (auto &staging : mStaging) {
+    memory_free_align(staging.ptr);
+  }
+}
+
+// map of the tensor itself, dense planar host memory
+static bool staging_zero_copy(const Backend *backend, const Tensor *tensor) {
+  auto format = TensorUtils::get_describe(tensor)->dimension_format;
+  return backend->host_addressable() && nullptr != tensor->host<void>() &&
+         (DATA_FORMAT_NCHW == format || DATA_FORMAT_UNKNOWN == format ||
+          tensor->dimensions() < 2) &&
+         TensorUtils::is_contiguous(tensor);
+}
+
+Backend::Staging *Backend::find_staging(const Tensor *tensor, size_t size) {
+  Staging *reuse = nullptr;
+  for (auto &staging : mStaging) {
+    if (tensor == staging.tensor) {
+      if (staging.size >= size) {
+        return &staging;
+      }
+      staging.tensor = nullptr;
+      staging.version = 0;
+      continue;
+    }
+    // free buffers first, then the least recently used, not too large
+    if (staging.mapped > 0 || staging.size < size || staging.size > 2 * size) {
+      continue;
+    }
+    if (nullptr == reuse || (nullptr != reuse->tensor &&
+                             (nullptr == staging.tensor ||
+                              staging.lastUse < reuse->lastUse))) {
+      reuse = &staging;
+    }
+  }
+  if (nullptr != reuse) {
+    reuse->tensor = tensor;
+    reuse->version = 0;
+    return reuse;
+  }
+  Staging staging;
+  staging.ptr = memory_alloc_align(size, MEMORY_ALIGN_DEFAULT);
+  if (nullptr == staging.ptr) {
+    return nullptr;
+  }
+  staging.size = size;
+  staging.tensor = tensor;
+  mStaging.emplace_back(staging);
+  mStagingSize += size;
+  return &mStaging.back();
+}
+
+void Backend::evict_staging() {
+  while (mStagingSize > mStagingLimit) {
+    auto victim = mStaging.end();
+    for (auto iter = mStaging.begin(); iter != mStaging.end(); ++iter) {
+      if (iter->mapped > 0) {
+        continue;
+      }
+      if (victim == mStaging.end() || iter->lastUse < victim->lastUse) {
+        victim = iter;
+      }
+    }
+    if (victim == mStaging.end()) {
+      return;
+    }
+    memory_free_align(victim->ptr);
+    mStagingSize -= victim->size;
+    mStaging.erase(victim);
+  }
+}
+
+void *Backend::map_staging(Tensor::MapType mtype, const Tensor *tensor) {
+  if (staging_zero_copy(this, tensor)) {
+    return tensor->host<void>();
+  }
+  // planar copy of the tensor
+  Tensor host(tensor, false);
+  std::lock_guard<std::mutex> _l(mStagingLock);
+  auto staging = find_staging(tensor, host.usize());
+  if (nullptr == staging) {
+    return nullptr;
+  }
+  staging->mapped++;
+  staging->lastUse = ++mStagingClock;
+  // host kernels write the memory without bumping the version, so only
+  // backends that track their own writes may skip the copy
+  auto version = TensorUtils::get_content_version(tensor);
+  if (Tensor::MAP_TENSOR_READ == mtype &&
+      (host_addressable() || version != staging->version)) {
+    host.buffer().host = (uint8_t *)staging->ptr;
+    on_copy_buffer(tensor, &host);
+    staging->version = version;
+  }
+  void *ptr = staging->ptr;
+  evict_staging();
+  return ptr;
+}
+
+void Backend::unmap_staging(Tensor::MapType mtype, const Tensor *tensor,
+                            void *mapPtr) {
+  if (nullptr == mapPtr) {
+    return;
+  }
+  if (mapPtr == tensor->host<void>()) {
+    if (Tensor::MAP_TENSOR_WRITE == mtype) {
+      TensorUtils::set_content_changed(tensor);
+    }
+    return;
+  }
+  std::lock_guard<std::mutex> _l(mStagingLock);
+  for (auto &staging : mStaging) {
+    if (staging.ptr != mapPtr) {
+      continue;
+    }
+    if (Tensor::MAP_TENSOR_WRITE == mtype) {
+      Tensor host(tensor, false);
+      host.buffer().host = (uint8_t *)mapPtr;
+      on_copy_buffer(&host, tensor);
+      TensorUtils::set_content_changed(tensor);
+      // the buffer holds what was written
+      staging.version = TensorUtils::get_content_version(tensor);
+    }
+    staging.mapped--;
+    break;
+  }
+  evict_staging();
+}
+
+void Backend::drop_staging(const Tensor *tensor) {
+  std::lock_guard<std::mutex> _l(mStagingLock);
+  for (auto &staging : mStaging) {
+    if (tensor == staging.tensor && 0 == staging.mapped) {
+      staging.tensor = nullptr;
+      staging.version = 0;
+    }
+  }
+}
+
+void Backend::clear_staging() {
+  std::lock_guard<std::mutex> _l(mStagingLock);
+  auto limit = mStagingLimit;
+  mStagingLimit = 0;
+  evict_staging();
+  mStagingLimit = limit;
+}
+
+size_t Backend::staging_size() const {
+  std::lock_guard<std::mutex> _l(mStagingLock);
+  return mStagingSize;
+}
+
+void Backend::set_staging_limit(size_t bytes) {
+  std::lock_guard<std::mutex> _l(mStagingLock);
+  mStagingLimit = bytes;
+  evict_staging();
+}
+
+std::shared_ptr<BufferAllocator::Allocator>
+Runtime::create_arena_allocator() const {
+  if (mHint.arenaMode <= BufferAllocator::ARENA_MALLOC ||
+      mHint.arenaMode > BufferAllocator::ARENA_HUGETLB) {
+    return BufferAllocator::Allocator::create_default();
+  }
+  return BufferAllocator::Allocator::create_mmap(
+      (BufferAllocator::ArenaMode)mHint.arenaMode);
+}
+
+void Runtime::add_allocator(const std::shared_ptr<BufferAllocator> &allocator,
+                            bool nested) const {
+  std::lock_guard<std::mutex> _l(mAllocatorLock);
+  mAllocators.emplace_back(allocator, nested);
+}
+
+std::vector<std::shared_ptr<BufferAllocator>>
+Runtime::allocators(bool nested) {
+  std::vector<std::shared_ptr<BufferAllocator>> result;
+  std::lock_guard<std::mutex> _l(mAllocatorLock);
+  for (auto iter = mAllocators.begin(); iter != mAllocators.end();) {
+    auto allocator = iter->first.lock();
+    if (nullptr == allocator) {
+      iter = mAllocators.erase(iter);
+      continue;
+    }
+    if (iter->second == nested) {
+      result.emplace_back(std::move(allocator));
+    }
+    ++iter;
+  }
+  return result;
+}
+
+void Runtime::on_gabage_collect(int level) {
+  level = ALIMAX(0, ALIMIN(100, level));
+  size_t watermark = (size_t)ALIMAX(0, mHint.gcFreeWatermark) * 1024 * 1024;
+  size_t keep = watermark / 100 * (100 - level);
+  // what the nested allocators give back lands in the free list of their
+  // parents, which are trimmed after them
+  for (bool nested : {true, false}) {
+    for (auto &allocator : allocators(nested)) {
+      allocator->trim(keep);
+    }
+  }
+#if defined(__GLIBC__)
+  if (level >= 100) {
+    malloc_trim(0);
+  }
+#endif
+}
+
+float Runtime::on_get_memory_inmb() {
+  size_t bytes = 0;
+  // the memory of nested allocators is in the total of their parents
+  for (auto &allocator : allocators(false)) {
+    bytes += allocator->total_size();
+  }
+  return bytes / 1024.0f / 1024.0f;
+}
+
 bool Runtime::has_async_work() const { return mFuture.valid(); }
 void Runtime::set_async_work(std::future<int> &&future) {
   mFuture = std::move(future);
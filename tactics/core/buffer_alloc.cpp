@@ -9,8 +9,21 @@
 ///
 //===----------------------------------------------------------------------------===//
 #include "tactics/core/buffer_allocator.h"
+#include "tactics/core/alloc_tracer.h"
 #include "tactics/core/memory_utils.h"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <mutex>
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define TACTICS_USE_MMAP
+#endif
 
 namespace tactics {
 
@@ -34,11 +47,68 @@ size_t MemChunk::offset() const {
   return second;
 }
 void MemChunk::attach(Tensor *tensor) {
+  if (AllocTracer::enabled()) {
+    AllocTracer::get()->on_attach(mNode ? (const void *)mNode : ptr(), tensor);
+  }
   if (mNode) {
     mNode->tensors.push_back(tensor);
   }
 }
 
+// let the system reclaim the whole pages inside [ptr, ptr + size)
+static void discard_pages(void *ptr, size_t size) {
+#ifdef TACTICS_USE_MMAP
+  uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+  auto begin = ROUND_UP((uintptr_t)ptr, pageSize);
+  auto end = ((uintptr_t)ptr + size) / pageSize * pageSize;
+  if (end > begin) {
+    madvise((void *)begin, end - begin, MADV_DONTNEED);
+  }
+#endif
+}
+
+// `size` bytes aligned to `align`, a power of two. with mmap the range is
+// over mapped and the unaligned head and tail unmapped, so only `size`
+// rounded up to pages stays reserved
+static void *map_aligned(size_t size, size_t align) {
+#ifdef TACTICS_USE_MMAP
+  size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  align = ALIMAX(align, pageSize);
+  size_t length = ROUND_UP(size, pageSize);
+  size_t mapLength = length + align - pageSize;
+  auto origin = (uint8_t *)mmap(nullptr, mapLength, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == (void *)origin) {
+    return nullptr;
+  }
+  auto aligned = (uint8_t *)ROUND_UP((uintptr_t)origin, (uintptr_t)align);
+  if (aligned > origin) {
+    munmap(origin, aligned - origin);
+  }
+  auto tail = origin + mapLength - (aligned + length);
+  if (tail > 0) {
+    munmap(aligned + length, tail);
+  }
+  return aligned;
+#elif defined(_WIN32)
+  return _aligned_malloc(size, align);
+#else
+  void *ptr = nullptr;
+  return 0 == posix_memalign(&ptr, align, size) ? ptr : nullptr;
+#endif
+}
+
+static void unmap_aligned(void *ptr, size_t size) {
+#ifdef TACTICS_USE_MMAP
+  size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  munmap(ptr, ROUND_UP(size, pageSize));
+#elif defined(_WIN32)
+  _aligned_free(ptr);
+#else
+  ::free(ptr);
+#endif
+}
+
 class DefaultAllocator : public BufferAllocator::Allocator {
 public:
   DefaultAllocator() {
@@ -48,17 +118,448 @@ public:
     // Do nothing
   }
   virtual MemChunk on_alloc(size_t size, size_t align) {
-    return MemChunk(memory_alloc_align(size, MEMORY_ALIGN_DEFAULT), 0);
+    return MemChunk(
+        memory_alloc_align(size, ALIMAX(align, (size_t)MEMORY_ALIGN_DEFAULT)),
+        0);
   }
   virtual void on_release(MemChunk chunk) {
     assert(chunk.second == 0);
     memory_free_align(chunk.first);
   }
+  virtual void on_discard(MemChunk chunk, size_t size) {
+    discard_pages(chunk.ptr(), size);
+  }
+};
+
+// size-class slab pool. small blocks are carved from superblocks aligned to
+// their own size, so the owning superblock header can be found by masking the
+// block address. every thread keeps a private cache of free blocks per class
+// and only touches the shared pool to refill or drain a whole batch.
+static const size_t SLAB_MIN_SHIFT = 6;  // 64 B
+static const size_t SLAB_MAX_SHIFT = 16; // 64 KB
+static const size_t SLAB_CLASS_NUM = SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1;
+static const size_t SLAB_SUPER_SHIFT = 20; // 1 MB
+static const size_t SLAB_SUPER_SIZE = (size_t)1 << SLAB_SUPER_SHIFT;
+static const size_t SLAB_BATCH_BYTES = 64 * 1024;
+static const size_t SLAB_BATCH_MAX = 64;
+// large blocks are mapped in steps of 64 KB, and up to 64 MB of freed ones
+// are kept for reuse
+static const size_t SLAB_LARGE_STEP = 64 * 1024;
+static const size_t SLAB_LARGE_CACHE = 64 * 1024 * 1024;
+
+struct SlabSuperBlock {
+  // -1 means a large allocation which bypasses the size classes
+  int sizeClass;
+  // bytes mapped for a large allocation, header included
+  size_t length;
+};
+
+struct SlabFreeBlock {
+  SlabFreeBlock *next;
+};
+
+static inline SlabSuperBlock *slab_super_block(void *ptr) {
+  return (SlabSuperBlock *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SUPER_SIZE - 1));
+}
+
+static inline size_t slab_class_size(int cls) {
+  return (size_t)1 << (cls + SLAB_MIN_SHIFT);
+}
+
+static inline size_t slab_batch_num(int cls) {
+  return ALIMAX((size_t)1,
+                ALIMIN(SLAB_BATCH_MAX, SLAB_BATCH_BYTES / slab_class_size(cls)));
+}
+
+// return the size class able to hold `size` bytes aligned to `align`, or -1
+static inline int slab_size_class(size_t size, size_t align) {
+  size_t need = ALIMAX(size, align);
+  if (need > slab_class_size(SLAB_CLASS_NUM - 1)) {
+    return -1;
+  }
+  int cls = 0;
+  for (size_t rest = (need - 1) >> SLAB_MIN_SHIFT; rest > 0; rest >>= 1) {
+    cls++;
+  }
+  return cls;
+}
+
+class SlabCentralPool {
+public:
+  // move up to `num` blocks of class `cls` into `*head`, return moved number
+  size_t fetch(int cls, SlabFreeBlock **head, size_t num) {
+    auto &list = mLists[cls];
+    std::lock_guard<std::mutex> _l(list.lock);
+    if (list.count < num && !carve(cls)) {
+      if (0 == list.count) {
+        return 0;
+      }
+    }
+    size_t moved = 0;
+    while (moved < num && nullptr != list.head) {
+      auto block = list.head;
+      list.head = block->next;
+      block->next = *head;
+      *head = block;
+      moved++;
+    }
+    list.count -= moved;
+    return moved;
+  }
+  void give(int cls, SlabFreeBlock *head, SlabFreeBlock *tail, size_t num) {
+    auto &list = mLists[cls];
+    std::lock_guard<std::mutex> _l(list.lock);
+    tail->next = list.head;
+    list.head = head;
+    list.count += num;
+  }
+  // a freed large mapping of `length` bytes, or nullptr
+  void *take_large(size_t length) {
+    std::lock_guard<std::mutex> _l(mLargeLock);
+    auto iter = mLarges.find(length);
+    if (iter == mLarges.end()) {
+      return nullptr;
+    }
+    auto base = iter->second;
+    mLarges.erase(iter);
+    mLargeBytes -= length;
+    return base;
+  }
+  // false if the cache is full, the mapping is to be unmapped then
+  bool give_large(void *base, size_t length) {
+    std::lock_guard<std::mutex> _l(mLargeLock);
+    if (mLargeBytes + length > SLAB_LARGE_CACHE) {
+      return false;
+    }
+    mLarges.emplace(length, base);
+    mLargeBytes += length;
+    return true;
+  }
+
+private:
+  // split a new superblock of class `cls` into free blocks, lock held
+  bool carve(int cls) {
+    // the address mask only works on a superblock aligned to its size
+    auto base = (uint8_t *)map_aligned(SLAB_SUPER_SIZE, SLAB_SUPER_SIZE);
+    if (nullptr == base) {
+      return false;
+    }
+    ((SlabSuperBlock *)base)->sizeClass = cls;
+    ((SlabSuperBlock *)base)->length = SLAB_SUPER_SIZE;
+    auto &list = mLists[cls];
+    auto blockSize = slab_class_size(cls);
+    // the first block holds the header
+    for (size_t offset = SLAB_SUPER_SIZE - blockSize; offset >= blockSize;
+         offset -= blockSize) {
+      auto block = (SlabFreeBlock *)(base + offset);
+      block->next = list.head;
+      list.head = block;
+      list.count++;
+    }
+    return true;
+  }
+
+  struct FreeList {
+    std::mutex lock;
+    SlabFreeBlock *head = nullptr;
+    size_t count = 0;
+  };
+  FreeList mLists[SLAB_CLASS_NUM];
+  std::mutex mLargeLock;
+  std::multimap<size_t, void *> mLarges;
+  size_t mLargeBytes = 0;
+};
+
+static SlabCentralPool *get_slab_central_pool() {
+  // never deleted: thread caches drain into it during thread exit
+  static std::once_flag g_init_flag;
+  static SlabCentralPool *g_pool;
+  std::call_once(g_init_flag, [&]() { g_pool = new SlabCentralPool; });
+  return g_pool;
+}
+
+class SlabThreadCache;
+// the cache of the thread while it lives, and whether it was destroyed.
+// trivially destructible, so frees from later thread_local or static
+// destructors still read them
+static thread_local SlabThreadCache *g_slab_cache = nullptr;
+static thread_local bool g_slab_cache_gone = false;
+
+class SlabThreadCache {
+public:
+  SlabThreadCache() {
+    for (int i = 0; i < (int)SLAB_CLASS_NUM; ++i) {
+      mHeads[i] = nullptr;
+      mCounts[i] = 0;
+    }
+    g_slab_cache = this;
+  }
+  ~SlabThreadCache() {
+    g_slab_cache = nullptr;
+    g_slab_cache_gone = true;
+    for (int i = 0; i < (int)SLAB_CLASS_NUM; ++i) {
+      drain(i, mCounts[i]);
+    }
+  }
+  // nullptr once the thread is exiting, blocks go to the shared pool then
+  static SlabThreadCache *get() {
+    if (nullptr != g_slab_cache || g_slab_cache_gone) {
+      return g_slab_cache;
+    }
+    static thread_local SlabThreadCache g_cache;
+    return &g_cache;
+  }
+  void *alloc(int cls) {
+    if (nullptr == mHeads[cls]) {
+      mCounts[cls] +=
+          get_slab_central_pool()->fetch(cls, &mHeads[cls], slab_batch_num(cls));
+      if (nullptr == mHeads[cls]) {
+        return nullptr;
+      }
+    }
+    auto block = mHeads[cls];
+    mHeads[cls] = block->next;
+    mCounts[cls]--;
+    return block;
+  }
+  void release(int cls, void *ptr) {
+    auto block = (SlabFreeBlock *)ptr;
+    block->next = mHeads[cls];
+    mHeads[cls] = block;
+    mCounts[cls]++;
+    auto batch = slab_batch_num(cls);
+    if (mCounts[cls] > 2 * batch) {
+      drain(cls, batch);
+    }
+  }
+
+private:
+  void drain(int cls, size_t num) {
+    if (0 == num) {
+      return;
+    }
+    auto head = mHeads[cls];
+    auto tail = head;
+    for (size_t i = 1; i < num; ++i) {
+      tail = tail->next;
+    }
+    mHeads[cls] = tail->next;
+    mCounts[cls] -= num;
+    get_slab_central_pool()->give(cls, head, tail, num);
+  }
+
+  SlabFreeBlock *mHeads[SLAB_CLASS_NUM];
+  size_t mCounts[SLAB_CLASS_NUM];
+};
+
+static void *slab_alloc(size_t size, size_t align) {
+  if (0 == align) {
+    align = MEMORY_ALIGN_DEFAULT;
+  }
+  auto cls = slab_size_class(size, align);
+  if (cls >= 0) {
+    auto cache = SlabThreadCache::get();
+    if (nullptr != cache) {
+      return cache->alloc(cls);
+    }
+    SlabFreeBlock *block = nullptr;
+    get_slab_central_pool()->fetch(cls, &block, 1);
+    return block;
+  }
+  // large block: keep a header at the start of a superblock aligned base
+  auto headerSize = ALIMAX(align, (size_t)MEMORY_ALIGN_DEFAULT);
+  assert(headerSize < SLAB_SUPER_SIZE);
+  if (headerSize >= SLAB_SUPER_SIZE) {
+    return nullptr;
+  }
+  // mapping costs system calls and page faults, freed ones are reused
+  auto length = ROUND_UP(size + headerSize, SLAB_LARGE_STEP);
+  auto base = (uint8_t *)get_slab_central_pool()->take_large(length);
+  if (nullptr == base) {
+    base = (uint8_t *)map_aligned(length, SLAB_SUPER_SIZE);
+  }
+  if (nullptr == base) {
+    return nullptr;
+  }
+  ((SlabSuperBlock *)base)->sizeClass = -1;
+  ((SlabSuperBlock *)base)->length = length;
+  return base + headerSize;
+}
+
+static void slab_release(void *ptr) {
+  if (nullptr == ptr) {
+    return;
+  }
+  auto header = slab_super_block(ptr);
+  if (header->sizeClass < 0) {
+    if (!get_slab_central_pool()->give_large(header, header->length)) {
+      unmap_aligned(header, header->length);
+    }
+    return;
+  }
+  auto cache = SlabThreadCache::get();
+  if (nullptr != cache) {
+    cache->release(header->sizeClass, ptr);
+    return;
+  }
+  auto block = (SlabFreeBlock *)ptr;
+  get_slab_central_pool()->give(header->sizeClass, block, block, 1);
+}
+
+class SlabAllocator : public BufferAllocator::Allocator {
+public:
+  SlabAllocator() {
+    // Do nothing
+  }
+  virtual ~SlabAllocator() {
+    // Do nothing
+  }
+  virtual MemChunk on_alloc(size_t size, size_t align) override {
+    return MemChunk(slab_alloc(size, align), 0);
+  }
+  virtual void on_release(MemChunk chunk) override {
+    assert(chunk.second == 0);
+    slab_release(chunk.first);
+  }
+};
+
+// every allocation gets its own anonymous mapping, unmapped on release
+class MmapAllocator : public BufferAllocator::Allocator {
+public:
+  MmapAllocator(BufferAllocator::ArenaMode mode) : mPreferMode(mode) {}
+  virtual ~MmapAllocator() {
+    for (auto &iter : mMappings) {
+      unmap(iter.first, iter.second);
+    }
+  }
+  virtual MemChunk on_alloc(size_t size, size_t align) override {
+    Mapping mapping;
+    void *ptr = nullptr;
+    for (int mode = mPreferMode; mode > BufferAllocator::ARENA_MALLOC && !ptr;
+         --mode) {
+      mapping.mode = (BufferAllocator::ArenaMode)mode;
+      ptr = map(size, align, mapping);
+    }
+    if (nullptr == ptr) {
+      mapping.mode = BufferAllocator::ARENA_MALLOC;
+      mapping.base = nullptr;
+      mapping.length = 0;
+      ptr = memory_alloc_align(size, ALIMAX(align, (size_t)MEMORY_ALIGN_DEFAULT));
+      if (nullptr == ptr) {
+        return MemChunk();
+      }
+    }
+    mLastMode = mapping.mode;
+    std::lock_guard<std::mutex> _l(mLock);
+    mMappings[ptr] = mapping;
+    return MemChunk(ptr, 0);
+  }
+  virtual void on_release(MemChunk chunk) override {
+    assert(chunk.second == 0);
+    Mapping mapping;
+    {
+      std::lock_guard<std::mutex> _l(mLock);
+      auto iter = mMappings.find(chunk.first);
+      if (iter == mMappings.end()) {
+        assert(false);
+        return;
+      }
+      mapping = iter->second;
+      mMappings.erase(iter);
+    }
+    unmap(chunk.first, mapping);
+  }
+  virtual void on_discard(MemChunk chunk, size_t size) override {
+    discard_pages(chunk.ptr(), size);
+  }
+  virtual BufferAllocator::ArenaMode arena_mode() const override {
+    return mLastMode;
+  }
+
+private:
+  struct Mapping {
+    BufferAllocator::ArenaMode mode = BufferAllocator::ARENA_MALLOC;
+    void *base = nullptr;
+    size_t length = 0;
+  };
+  static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+  static void unmap(void *ptr, const Mapping &mapping) {
+    if (BufferAllocator::ARENA_MALLOC == mapping.mode) {
+      memory_free_align(ptr);
+      return;
+    }
+#ifdef TACTICS_USE_MMAP
+    munmap(mapping.base, mapping.length);
+#endif
+  }
+
+  // map `size` bytes aligned to `align` in `mapping.mode`, nullptr if failed
+  static void *map(size_t size, size_t align, Mapping &mapping) {
+#ifdef TACTICS_USE_MMAP
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    align = ALIMAX(align, pageSize);
+    if (align > HUGE_PAGE_SIZE) {
+      return nullptr;
+    }
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (BufferAllocator::ARENA_HUGETLB == mapping.mode) {
+#ifdef MAP_HUGETLB
+      // huge page mappings are always huge page aligned
+      flags |= MAP_HUGETLB;
+      mapping.length = ROUND_UP(size, HUGE_PAGE_SIZE);
+      mapping.base = mmap(nullptr, mapping.length, PROT_READ | PROT_WRITE,
+                          flags, -1, 0);
+      if (MAP_FAILED == mapping.base) {
+        return nullptr;
+      }
+      return mapping.base;
+#else
+      return nullptr;
+#endif
+    }
+    if (BufferAllocator::ARENA_MMAP_THP == mapping.mode) {
+#ifdef MADV_HUGEPAGE
+      // huge pages need a huge page aligned range
+      if (size >= HUGE_PAGE_SIZE) {
+        align = HUGE_PAGE_SIZE;
+      }
+#else
+      return nullptr;
+#endif
+    }
+    size_t length = ROUND_UP(size, pageSize);
+    auto aligned = (uint8_t *)map_aligned(length, align);
+    if (nullptr == aligned) {
+      return nullptr;
+    }
+#ifdef MADV_HUGEPAGE
+    if (BufferAllocator::ARENA_MMAP_THP == mapping.mode &&
+        0 != madvise(aligned, length, MADV_HUGEPAGE)) {
+      munmap(aligned, length);
+      return nullptr;
+    }
+#endif
+    mapping.base = aligned;
+    mapping.length = length;
+    return aligned;
+#else
+    return nullptr;
+#endif
+  }
+
+  const BufferAllocator::ArenaMode mPreferMode;
+  std::atomic<BufferAllocator::ArenaMode> mLastMode{
+      BufferAllocator::ARENA_MALLOC};
+  std::mutex mLock;
+  std::map<void *, Mapping> mMappings;
 };
 
 class RecurseAllocator : public BufferAllocator::Allocator {
 public:
   RecurseAllocator(BufferAllocator *parent) { mParent = parent; }
+  RecurseAllocator(std::shared_ptr<BufferAllocator> parent)
+      : mParent(parent.get()), mOwner(std::move(parent)) {}
   virtual ~RecurseAllocator() {
     // Do nothing
   }
@@ -69,6 +570,7 @@ public:
 
 private:
   BufferAllocator *mParent;
+  std::shared_ptr<BufferAllocator> mOwner;
 };
 
 bool BufferAllocator::compute() { return true; }
@@ -79,22 +581,108 @@ BufferAllocator::Allocator::create_default() {
   return _res;
 }
 std::shared_ptr<BufferAllocator::Allocator>
+BufferAllocator::Allocator::create_mmap(ArenaMode mode) {
+  std::shared_ptr<BufferAllocator::Allocator> _res;
+  _res.reset(new MmapAllocator(mode));
+  return _res;
+}
+std::shared_ptr<BufferAllocator::Allocator>
+BufferAllocator::Allocator::create_slab() {
+  std::shared_ptr<BufferAllocator::Allocator> _res;
+  _res.reset(new SlabAllocator);
+  return _res;
+}
+std::shared_ptr<BufferAllocator::Allocator>
 BufferAllocator::Allocator::create_recurse(BufferAllocator *parent) {
   std::shared_ptr<BufferAllocator::Allocator> _res;
   _res.reset(new RecurseAllocator(parent));
   return _res;
 }
 
+std::shared_ptr<BufferAllocator::Allocator>
+BufferAllocator::Allocator::create_recurse(
+    std::shared_ptr<BufferAllocator> parent) {
+  std::shared_ptr<BufferAllocator::Allocator> _res;
+  _res.reset(new RecurseAllocator(std::move(parent)));
+  return _res;
+}
+
+// alloc / free sequence recorded for one shape signature
+struct EagerBufferAllocator::Plan {
+  struct Op {
+    // index of the chunk in intervals
+    size_t index;
+    size_t size;
+    size_t align;
+    bool alloc;
+  };
+  std::vector<int> key;
+  std::vector<Op> ops;
+  // one per chunk, sizes padded for the alignment asked
+  std::vector<MemInterval> intervals;
+  std::vector<size_t> aligns;
+  // false while recording
+  bool recorded = false;
+  size_t arenaSize = 0;
+  MemChunk arena;
+  std::vector<std::pair<void *, size_t>> pointers;
+
+  // recording
+  size_t clock = 0;
+  std::map<std::pair<void *, size_t>, size_t> live;
+  // chunks freed inside a group, reusable only after barrier_end
+  std::vector<size_t> groupFrees;
+
+  // replaying
+  size_t position = 0;
+  size_t liveCount = 0;
+  bool diverged = false;
+
+  bool contains(const std::pair<void *, size_t> &pointer) const {
+    auto begin = arena.ptr();
+    auto ptr = (uint8_t *)pointer.first + pointer.second;
+    return nullptr != begin && ptr >= begin && ptr < begin + arenaSize;
+  }
+};
+
+static std::vector<int> plan_key(const std::vector<std::vector<int>> &shapes) {
+  std::vector<int> key;
+  for (auto &shape : shapes) {
+    key.emplace_back((int)shape.size());
+    key.insert(key.end(), shape.begin(), shape.end());
+  }
+  return key;
+}
+
 EagerBufferAllocator::Node::~Node() {
   if (nullptr == parent.get()) {
     outside->on_release(pointer);
   }
 }
 MemChunk EagerBufferAllocator::alloc(size_t size, bool separate, size_t align) {
-#ifdef DUMP_USAGE
-  auto memoryUsed = size / 1024.0f / 1024.0f;
-  MNN_PRINT("Alloc: %f\n", memoryUsed);
-#endif
+  if (0 == align) {
+    align = mAlign;
+  }
+  std::pair<void *, size_t> pointer(nullptr, 0);
+  if (mPlanReplay) {
+    pointer = replayAlloc(size, align);
+  }
+  if (nullptr == pointer.first) {
+    pointer = allocImpl(size, separate, align);
+    if (nullptr != pointer.first && nullptr != mPlan.get() &&
+        !mPlan->recorded) {
+      recordAlloc(pointer, size, align);
+    }
+  }
+  if (AllocTracer::enabled() && nullptr != pointer.first) {
+    AllocTracer::get()->on_alloc(this, "eager", MemChunk(pointer).ptr(), size,
+                                 mTotalSize);
+  }
+  return pointer;
+}
+
+std::pair<void *, size_t>
+EagerBufferAllocator::allocImpl(size_t size, bool separate, size_t align) {
   if (0 == align) {
     align = mAlign;
   }
@@ -105,11 +693,11 @@ MemChunk EagerBufferAllocator::alloc(size_t size, bool separate, size_t align) {
       pointer = getFromFreeList(mCurrentFreeList, size, false, align);
     }
     if (nullptr != pointer.first) {
-      return MemChunk(pointer);
+      return pointer;
     }
     pointer = getFromFreeList(&mFreeList, size, true, align);
     if (nullptr != pointer.first) {
-      return MemChunk(pointer);
+      return pointer;
     }
   }
 
@@ -118,7 +706,7 @@ MemChunk EagerBufferAllocator::alloc(size_t size, bool separate, size_t align) {
   pointer.first = chunk.first;
   pointer.second = chunk.second;
   if (nullptr == pointer.first) {
-    return chunk;
+    return pointer;
   }
   mTotalSize += size;
 
@@ -126,50 +714,133 @@ MemChunk EagerBufferAllocator::alloc(size_t size, bool separate, size_t align) {
   SharedPtr<Node> node(new Node);
   node->size = size;
   node->pointer = pointer;
-  mUsedList[pointer] = node;
   node->outside = mAllocator.get();
+  mUsedList[pointer] = std::move(node);
   assert(pointer.second % align == 0);
-#ifdef DUMP_USAGE
-  MNN_PRINT("mTotalSize: %f\n", mTotalSize / 1024.0f / 1024.0f);
-#endif
   return pointer;
 }
 
-void EagerBufferAllocator::returnMemory(FREELIST *listP, SharedPtr<Node> node,
-                                        bool permitMerge) {
-  auto &list = *listP;
-  list.insert(std::make_pair(node->size, node));
-  // update parent use count
-  if (nullptr != node->parent.get() && permitMerge) {
-    auto parent = node->parent;
-    parent->useCount -= 1;
-
-    // merge if all subnodes were freed
-    auto needMerge = parent->useCount == 0;
-    while (needMerge) {
-      // collect all subnodes
-      for (auto iter = list.begin(); iter != list.end();) {
-        if (iter->second->parent.get() == parent.get()) {
-          iter = list.erase(iter);
-          continue;
-        }
-        iter++;
-      }
-
-      // do merge downside up
-      list.insert(std::make_pair(parent->size, parent));
-      needMerge = false;
-      if (parent->parent.get() != nullptr) {
-        parent = parent->parent;
-        parent->useCount -= 1;
-        needMerge = parent->useCount == 0;
+void EagerBufferAllocator::FreeList::insert(SharedPtr<Node> node,
+                                           bool permitMerge) {
+  if (permitMerge && nullptr != node->parent.get()) {
+    auto root = node->parent;
+    auto begin = node->pointer.second;
+    auto end = begin + node->size;
+    auto sameRoot = [&](AddressIndex::iterator iter) {
+      auto other = iter->second->second.get();
+      return other->parent.get() == root.get();
+    };
+    bool merged = false;
+    size_t discarded = node->discarded;
+    auto iter = mAddressIndex.lower_bound(node->pointer);
+    if (iter != mAddressIndex.begin()) {
+      auto left = std::prev(iter);
+      auto leftNode = left->second->second.get();
+      if (sameRoot(left) && leftNode->pointer.second + leftNode->size == begin) {
+        begin = leftNode->pointer.second;
+        discarded += leftNode->discarded;
+        erase(left);
+        merged = true;
       }
     }
+    iter = mAddressIndex.lower_bound(std::make_pair(node->pointer.first, end));
+    if (iter != mAddressIndex.end() && iter->first.first == node->pointer.first &&
+        iter->first.second == end && sameRoot(iter)) {
+      end += iter->second->second->size;
+      discarded += iter->second->second->discarded;
+      erase(iter);
+      merged = true;
+    }
+    if (begin == root->pointer.second && end - begin == root->size) {
+      // all pieces are free again, give back the whole block
+      node = root;
+      node->discarded = discarded;
+    } else if (merged) {
+      node = new Node;
+      node->parent = root;
+      node->pointer = std::make_pair(root->pointer.first, begin);
+      node->size = end - begin;
+      node->discarded = discarded;
+    }
+  }
+  auto size = node->size;
+  auto pointer = node->pointer;
+  mDiscarded += node->discarded;
+  auto sizeIter = mSizeIndex.emplace(size, std::move(node));
+  mAddressIndex.emplace(pointer, sizeIter);
+  mBytes += size;
+}
+
+SharedPtr<EagerBufferAllocator::Node>
+EagerBufferAllocator::FreeList::take(size_t size) {
+  auto x = mSizeIndex.lower_bound(size);
+  if (x == mSizeIndex.end()) {
+    return nullptr;
   }
+  auto node = std::move(x->second);
+  mAddressIndex.erase(node->pointer);
+  mSizeIndex.erase(x);
+  mBytes -= node->size;
+  mDiscarded -= node->discarded;
+  return node;
+}
+
+void EagerBufferAllocator::FreeList::remove(const SharedPtr<Node> &node) {
+  auto iter = mAddressIndex.find(node->pointer);
+  if (iter != mAddressIndex.end()) {
+    erase(iter);
+  }
+}
+
+void EagerBufferAllocator::FreeList::mark_discarded(const SharedPtr<Node> &node) {
+  mDiscarded += node->size - node->discarded;
+  node->discarded = node->size;
+}
+
+void EagerBufferAllocator::FreeList::erase(AddressIndex::iterator iter) {
+  mBytes -= iter->second->first;
+  mDiscarded -= iter->second->second->discarded;
+  mSizeIndex.erase(iter->second);
+  mAddressIndex.erase(iter);
+}
+
+void EagerBufferAllocator::FreeList::clear() {
+  mAddressIndex.clear();
+  mSizeIndex.clear();
+  mBytes = 0;
+  mDiscarded = 0;
+}
+
+void EagerBufferAllocator::returnMemory(FreeList *list, SharedPtr<Node> node,
+                                        bool permitMerge) {
+  list->insert(std::move(node), permitMerge);
 }
 
 bool EagerBufferAllocator::free(MemChunk chunk) {
   std::pair<void *, size_t> pointer(chunk.first, chunk.second);
+  if (!freeImpl(pointer)) {
+    return false;
+  }
+  if (AllocTracer::enabled()) {
+    AllocTracer::get()->on_free(this, chunk.ptr(), mTotalSize);
+  }
+  return true;
+}
+
+bool EagerBufferAllocator::freeImpl(const std::pair<void *, size_t> &pointer) {
+  if (nullptr != mPlan.get() && mPlan->recorded && replayFree(pointer)) {
+    return true;
+  }
+  for (auto iter = mRetiredPlans.begin(); iter != mRetiredPlans.end(); ++iter) {
+    auto plan = iter->get();
+    if (plan->contains(pointer)) {
+      if (0 == --plan->liveCount) {
+        releaseArena(plan);
+        mRetiredPlans.erase(iter);
+      }
+      return true;
+    }
+  }
   // get node
   auto x = mUsedList.find(pointer);
   if (x == mUsedList.end()) {
@@ -177,31 +848,43 @@ bool EagerBufferAllocator::free(MemChunk chunk) {
     return false;
   }
   // mark as reusable
-  auto node = x->second;
+  auto node = std::move(x->second);
   mUsedList.erase(x);
   if (nullptr != mCurrentFreeList) {
-    returnMemory(mCurrentFreeList, node, false);
+    returnMemory(mCurrentFreeList, std::move(node), false);
   } else {
-    returnMemory(&mFreeList, node);
+    returnMemory(&mFreeList, std::move(node));
   }
-#ifdef DUMP_USAGE
-  if (node.get()) {
-    auto memoryUsed = node->size / 1024.0f / 1024.0f;
-    MNN_PRINT("Free: %f\n", memoryUsed);
+  if (nullptr != mPlan.get() && !mPlan->recorded) {
+    recordFree(pointer);
   }
-#endif
   return true;
 }
 
 void EagerBufferAllocator::release(bool allRelease) {
   assert(mGroups.empty());
+  for (auto &plan : mPlans) {
+    if (plan != mPlan) {
+      releaseArena(plan.get());
+    }
+  }
   if (allRelease) {
+    if (nullptr != mPlan.get()) {
+      releaseArena(mPlan.get());
+      mPlan.reset();
+      mPlanReplay = false;
+    }
+    mPlans.clear();
+    for (auto &plan : mRetiredPlans) {
+      releaseArena(plan.get());
+    }
+    mRetiredPlans.clear();
     mUsedList.clear();
     mFreeList.clear();
     mTotalSize = 0;
     return;
   }
-  for (auto f : mFreeList) {
+  for (auto &f : mFreeList.nodes()) {
     if (f.second->parent.get() == nullptr) {
       assert(mTotalSize >= f.first);
       mTotalSize -= f.first;
@@ -210,20 +893,92 @@ void EagerBufferAllocator::release(bool allRelease) {
   mFreeList.clear();
 }
 
+size_t EagerBufferAllocator::free_size() const {
+  size_t bytes = mFreeList.bytes();
+  for (auto &plan : mPlans) {
+    if (plan != mPlan && nullptr != plan->arena.first) {
+      bytes += plan->arenaSize;
+    }
+  }
+  return bytes;
+}
+
+size_t EagerBufferAllocator::trim(size_t keep) {
+  // freed chunks of open groups are not in mFreeList yet. discarded pieces
+  // hold no pages, they are given back only once
+  size_t cached = free_size() - mFreeList.discarded();
+  if (!mGroups.empty() || cached <= keep) {
+    return 0;
+  }
+  size_t released = 0;
+  // the plans stay, their arenas come back on the next replay
+  for (auto iter = mPlans.rbegin(); iter != mPlans.rend(); ++iter) {
+    auto plan = iter->get();
+    if (cached - released <= keep) {
+      return released;
+    }
+    if (plan != mPlan.get() && nullptr != plan->arena.first) {
+      released += plan->arenaSize;
+      releaseArena(plan);
+    }
+  }
+  std::vector<SharedPtr<Node>> blocks, pieces;
+  for (auto iter = mFreeList.nodes().rbegin(); iter != mFreeList.nodes().rend();
+       ++iter) {
+    if (nullptr == iter->second->parent.get()) {
+      blocks.push_back(iter->second);
+    } else {
+      pieces.push_back(iter->second);
+    }
+  }
+  // largest blocks first, the node destructor returns them to parent
+  for (auto &node : blocks) {
+    if (cached - released <= keep) {
+      break;
+    }
+    mFreeList.remove(node);
+    assert(mTotalSize >= node->size);
+    mTotalSize -= node->size;
+    released += node->size - node->discarded;
+  }
+  blocks.clear();
+  // the rest of their block is in use, keep the address range
+  for (auto &node : pieces) {
+    if (cached - released <= keep) {
+      break;
+    }
+    if (node->discarded == node->size) {
+      continue;
+    }
+    mAllocator->on_discard(MemChunk(node->pointer), node->size);
+    released += node->size - node->discarded;
+    mFreeList.mark_discarded(node);
+  }
+  return released;
+}
+
 void EagerBufferAllocator::barrier_begin() { assert(mGroups.empty()); }
 
 void EagerBufferAllocator::barrier_end() {
   for (auto &freeGroup : mGroups) {
-    auto freeList = *freeGroup;
-    for (auto &iter : freeList) {
+    for (auto &iter : freeGroup->nodes()) {
       returnMemory(&mFreeList, iter.second);
     }
   }
   mGroups.clear();
+  if (nullptr != mPlan.get() && !mPlan->recorded &&
+      !mPlan->groupFrees.empty()) {
+    auto plan = mPlan.get();
+    ++plan->clock;
+    for (auto index : plan->groupFrees) {
+      plan->intervals[index].end = plan->clock;
+    }
+    plan->groupFrees.clear();
+  }
 }
 
 void EagerBufferAllocator::begin_group() {
-  std::shared_ptr<FREELIST> newFreeList(new FREELIST);
+  std::shared_ptr<FreeList> newFreeList(new FreeList);
   mCurrentFreeList = newFreeList.get();
   mGroups.emplace_back(newFreeList);
 }
@@ -231,7 +986,7 @@ void EagerBufferAllocator::begin_group() {
 void EagerBufferAllocator::end_group() { mCurrentFreeList = nullptr; }
 
 std::pair<void *, size_t>
-EagerBufferAllocator::getFromFreeList(FREELIST *list, size_t size,
+EagerBufferAllocator::getFromFreeList(FreeList *list, size_t size,
                                       bool permiteSplit, size_t align) {
 #ifdef MNN_DEBUG_MEMORY
   return std::make_pair(nullptr, 0);
@@ -242,50 +997,577 @@ EagerBufferAllocator::getFromFreeList(FREELIST *list, size_t size,
     realSize = size + align - 1;
   }
   // get node larger than size
-  auto x = list->lower_bound(realSize);
-  if (x == list->end()) {
+  auto x = list->take(realSize);
+  if (nullptr == x.get()) {
     return std::make_pair(nullptr, 0);
   }
-  // update parent use count
-  auto pointer = x->second->pointer;
+  auto pointer = x->pointer;
+  // touched again once handed out, a split off rest stays discarded only if
+  // all of the node was
+  bool discarded = x->discarded == x->size;
+  x->discarded = 0;
   // Align offset
   if (needExtraSize) {
     size_t originOffset = pointer.second;
     pointer.second = UP_DIV(originOffset, align) * align;
     realSize = size + pointer.second - originOffset;
   }
-  if (permiteSplit && nullptr != x->second->parent.get()) {
-    x->second->parent->useCount += 1;
-  }
 
   // uses up all aligned space
   auto sizeAlign = UP_DIV(realSize, mAlign) * mAlign;
-  if (sizeAlign >= x->first || (!permiteSplit)) {
-    mUsedList.insert(std::make_pair(pointer, x->second));
-    list->erase(x);
+  if (sizeAlign >= x->size || (!permiteSplit)) {
+    mUsedList.emplace(pointer, std::move(x));
     assert(pointer.second % align == 0);
     return pointer;
   }
 
-  // split otherwise
+  // split otherwise, pieces always point to the outside block
+  auto root = nullptr != x->parent.get() ? x->parent : x;
   SharedPtr<Node> first(new Node);
-  first->parent = x->second;
+  first->parent = root;
   first->size = sizeAlign;
-  first->pointer = x->second->pointer;
-  mUsedList.insert(std::make_pair(pointer, first));
-  x->second->useCount += 1;
+  first->pointer = x->pointer;
+  mUsedList.emplace(pointer, std::move(first));
 
   SharedPtr<Node> second(new Node);
-  second->parent = x->second;
-  second->size = x->second->size - sizeAlign;
-  second->pointer.first = x->second->pointer.first;
-  second->pointer.second = x->second->pointer.second + sizeAlign;
-  list->erase(x);
-  list->insert(std::make_pair(second->size, second));
+  second->parent = root;
+  second->size = x->size - sizeAlign;
+  second->pointer.first = x->pointer.first;
+  second->pointer.second = x->pointer.second + sizeAlign;
+  second->discarded = discarded ? second->size : 0;
+  list->insert(std::move(second), false);
   assert(pointer.second % align == 0);
   return pointer;
 }
 
+//------------------------------- EagerBufferAllocator plan
+//-----------------------------------//
+void EagerBufferAllocator::begin_plan(
+    const std::vector<std::vector<int>> &shapes) {
+  assert(nullptr == mPlan.get());
+  auto key = plan_key(shapes);
+  for (auto iter = mPlans.begin(); iter != mPlans.end(); ++iter) {
+    if ((*iter)->key != key) {
+      continue;
+    }
+    mPlans.splice(mPlans.begin(), mPlans, iter);
+    mPlan = mPlans.front();
+    mPlan->position = 0;
+    mPlan->liveCount = 0;
+    mPlan->diverged = !prepareArena(mPlan.get());
+    mPlanReplay = !mPlan->diverged;
+    return;
+  }
+  mPlan.reset(new Plan);
+  mPlan->key = std::move(key);
+  mPlanReplay = false;
+}
+
+void EagerBufferAllocator::end_plan() {
+  auto plan = std::move(mPlan);
+  mPlanReplay = false;
+  if (nullptr == plan.get()) {
+    return;
+  }
+  if (!plan->recorded) {
+    // chunks alive after the plan would share the arena with the next replay
+    if (!plan->live.empty() || plan->intervals.empty()) {
+      return;
+    }
+    plan->arenaSize = plan_mem_intervals(plan->intervals);
+    plan->groupFrees.clear();
+    plan->recorded = true;
+    mPlans.emplace_front(std::move(plan));
+    set_plan_cache_size(mPlanCacheSize);
+    return;
+  }
+  if (!plan->diverged && 0 == plan->liveCount) {
+    return;
+  }
+  // the sequence changed for this signature, record it again next time
+  mPlans.remove(plan);
+  if (plan->liveCount > 0) {
+    mRetiredPlans.emplace_back(std::move(plan));
+  } else {
+    releaseArena(plan.get());
+  }
+}
+
+void EagerBufferAllocator::set_plan_cache_size(size_t size) {
+  mPlanCacheSize = size;
+  while (mPlans.size() > mPlanCacheSize) {
+    auto plan = std::move(mPlans.back());
+    mPlans.pop_back();
+    if (plan == mPlan) {
+      // dropped by end_plan
+      plan->diverged = true;
+      mPlanReplay = false;
+      continue;
+    }
+    releaseArena(plan.get());
+  }
+}
+
+bool EagerBufferAllocator::prepareArena(Plan *plan) {
+  if (nullptr != plan->arena.first) {
+    return true;
+  }
+  plan->arena = mAllocator->on_alloc(plan->arenaSize, mAlign);
+  if (nullptr == plan->arena.first) {
+    return false;
+  }
+  mTotalSize += plan->arenaSize;
+  plan->pointers.resize(plan->intervals.size());
+  for (size_t i = 0; i < plan->intervals.size(); ++i) {
+    auto offset = plan->intervals[i].offset;
+    auto address = (uintptr_t)plan->arena.ptr() + offset;
+    offset += ROUND_UP(address, (uintptr_t)plan->aligns[i]) - address;
+    plan->pointers[i] =
+        std::make_pair(plan->arena.first, plan->arena.second + offset);
+  }
+  return true;
+}
+
+void EagerBufferAllocator::releaseArena(Plan *plan) {
+  if (nullptr == plan->arena.first) {
+    return;
+  }
+  mAllocator->on_release(plan->arena);
+  assert(mTotalSize >= plan->arenaSize);
+  mTotalSize -= plan->arenaSize;
+  plan->arena = MemChunk();
+  plan->pointers.clear();
+}
+
+void EagerBufferAllocator::recordAlloc(const std::pair<void *, size_t> &pointer,
+                                       size_t size, size_t align) {
+  auto plan = mPlan.get();
+  auto index = plan->intervals.size();
+  MemInterval interval;
+  interval.size = UP_DIV(size, mAlign) * mAlign;
+  if (mAlign % align != 0) {
+    interval.size += align - 1;
+  }
+  interval.start = ++plan->clock;
+  plan->intervals.emplace_back(interval);
+  plan->aligns.emplace_back(align);
+  plan->ops.push_back({index, size, align, true});
+  plan->live[pointer] = index;
+}
+
+void EagerBufferAllocator::recordFree(const std::pair<void *, size_t> &pointer) {
+  auto plan = mPlan.get();
+  auto iter = plan->live.find(pointer);
+  if (iter == plan->live.end()) {
+    // allocated before the plan
+    return;
+  }
+  auto index = iter->second;
+  plan->live.erase(iter);
+  plan->ops.push_back({index, 0, 0, false});
+  if (nullptr != mCurrentFreeList) {
+    plan->groupFrees.emplace_back(index);
+  } else {
+    plan->intervals[index].end = ++plan->clock;
+  }
+}
+
+std::pair<void *, size_t> EagerBufferAllocator::replayAlloc(size_t size,
+                                                            size_t align) {
+  auto plan = mPlan.get();
+  if (plan->position < plan->ops.size()) {
+    auto &op = plan->ops[plan->position];
+    if (op.alloc && op.size == size && op.align == align) {
+      plan->position++;
+      plan->liveCount++;
+      return plan->pointers[op.index];
+    }
+  }
+  // differs from the recorded sequence, use the free lists from now on
+  plan->diverged = true;
+  mPlanReplay = false;
+  return std::make_pair(nullptr, 0);
+}
+
+bool EagerBufferAllocator::replayFree(const std::pair<void *, size_t> &pointer) {
+  auto plan = mPlan.get();
+  if (mPlanReplay && plan->position < plan->ops.size()) {
+    auto &op = plan->ops[plan->position];
+    if (!op.alloc && plan->pointers[op.index] == pointer) {
+      plan->position++;
+      plan->liveCount--;
+      return true;
+    }
+  }
+  if (!plan->contains(pointer)) {
+    return false;
+  }
+  // freed out of the recorded order
+  plan->diverged = true;
+  mPlanReplay = false;
+  plan->liveCount--;
+  return true;
+}
+
+//------------------------------- ConcurrentBufferAllocator
+//-----------------------------------//
+// four classes per power of two keep the rounding waste under 25%
+static const int CONCURRENT_CLASS_NUM = 100; // 64 B - 2 GB
+static const int CONCURRENT_SHARD_NUM = 8;
+static const size_t CONCURRENT_BATCH_BYTES = 256 * 1024;
+
+// lives right before the pointer handed out
+struct ConcurrentBlockHeader {
+  MemChunk origin;
+  size_t size;
+  // -1 if the block is never cached
+  int sizeClass;
+};
+
+static inline size_t concurrent_class_size(int cls) {
+  return (size_t)(4 + cls % 4) << (cls / 4 + 4);
+}
+
+static inline int concurrent_size_class(size_t size) {
+  int cls = 0;
+  while (cls + 4 < CONCURRENT_CLASS_NUM &&
+         concurrent_class_size(cls + 4) < size) {
+    cls += 4;
+  }
+  while (cls < CONCURRENT_CLASS_NUM && concurrent_class_size(cls) < size) {
+    cls++;
+  }
+  return cls;
+}
+
+static inline size_t concurrent_batch_num(int cls) {
+  return ALIMAX((size_t)1, ALIMIN((size_t)32,
+                                  CONCURRENT_BATCH_BYTES /
+                                      concurrent_class_size(cls)));
+}
+
+static inline ConcurrentBlockHeader *concurrent_header(void *ptr) {
+  return (ConcurrentBlockHeader *)ptr - 1;
+}
+
+struct ConcurrentBufferAllocator::Pool {
+  struct Shard {
+    std::mutex lock;
+    std::vector<void *> lists[CONCURRENT_CLASS_NUM];
+  };
+  Shard shards[CONCURRENT_SHARD_NUM];
+  std::shared_ptr<Allocator> parent;
+  size_t align;
+  size_t headerSize;
+  size_t limit;
+  std::atomic<size_t> totalSize{0};
+  // bumped by release(true), thread caches of an older generation are stale
+  std::atomic<uint32_t> generation{0};
+  // every block got from parent, to release them at any time
+  std::mutex blockLock;
+  std::set<ConcurrentBlockHeader *> blocks;
+
+  ~Pool() { releaseBlocks(true); }
+
+  void *createBlock(size_t size, size_t align, int sizeClass) {
+    auto header = ROUND_UP(sizeof(ConcurrentBlockHeader), align);
+    auto bytes = size + header;
+    if (!reserve(bytes)) {
+      return nullptr;
+    }
+    auto chunk = parent->on_alloc(bytes, align);
+    if (nullptr == chunk.ptr()) {
+      totalSize -= bytes;
+      return nullptr;
+    }
+    auto ptr = chunk.ptr() + header;
+    auto block = concurrent_header(ptr);
+    block->origin = chunk;
+    block->size = bytes;
+    block->sizeClass = sizeClass;
+    std::lock_guard<std::mutex> _l(blockLock);
+    blocks.insert(block);
+    return ptr;
+  }
+  void destroyBlock(void *ptr) {
+    auto block = concurrent_header(ptr);
+    {
+      std::lock_guard<std::mutex> _l(blockLock);
+      blocks.erase(block);
+    }
+    totalSize -= block->size;
+    parent->on_release(block->origin);
+  }
+  // account `bytes` in the budget, drop pooled blocks if needed
+  bool reserve(size_t bytes) {
+    if (totalSize.fetch_add(bytes) + bytes <= limit) {
+      return true;
+    }
+    totalSize -= bytes;
+    releaseBlocks(false);
+    if (totalSize.fetch_add(bytes) + bytes <= limit) {
+      return true;
+    }
+    totalSize -= bytes;
+    return false;
+  }
+  void releaseBlocks(bool all) {
+    if (all) {
+      generation++;
+      std::set<ConcurrentBlockHeader *> allBlocks;
+      {
+        std::lock_guard<std::mutex> _l(blockLock);
+        allBlocks.swap(blocks);
+      }
+      for (auto &shard : shards) {
+        std::lock_guard<std::mutex> _l(shard.lock);
+        for (auto &list : shard.lists) {
+          list.clear();
+        }
+      }
+      for (auto block : allBlocks) {
+        totalSize -= block->size;
+        parent->on_release(block->origin);
+      }
+      return;
+    }
+    for (auto &shard : shards) {
+      std::vector<void *> dropped;
+      {
+        std::lock_guard<std::mutex> _l(shard.lock);
+        for (auto &list : shard.lists) {
+          dropped.insert(dropped.end(), list.begin(), list.end());
+          list.clear();
+        }
+      }
+      for (auto ptr : dropped) {
+        destroyBlock(ptr);
+      }
+    }
+  }
+  // drop pooled blocks shard by shard, largest classes first, until at most
+  // `keep` of the `cached` bytes stay. returns the bytes dropped
+  size_t trimBlocks(size_t cached, size_t keep) {
+    size_t released = 0;
+    for (auto &shard : shards) {
+      if (cached - released <= keep) {
+        break;
+      }
+      std::vector<void *> dropped;
+      {
+        std::lock_guard<std::mutex> _l(shard.lock);
+        for (int i = CONCURRENT_CLASS_NUM - 1; i >= 0; --i) {
+          auto &list = shard.lists[i];
+          while (!list.empty() && cached - released > keep) {
+            released += concurrent_header(list.back())->size;
+            dropped.push_back(list.back());
+            list.pop_back();
+          }
+        }
+      }
+      for (auto ptr : dropped) {
+        destroyBlock(ptr);
+      }
+    }
+    return released;
+  }
+};
+
+// per thread cache of free blocks for one pool
+class ConcurrentThreadCache {
+public:
+  ConcurrentThreadCache(const std::shared_ptr<ConcurrentBufferAllocator::Pool> &pool)
+      : mPool(pool), mKey(pool.get()), mGeneration(pool->generation) {}
+  ~ConcurrentThreadCache() { flush(); }
+
+  const ConcurrentBufferAllocator::Pool *key() const { return mKey; }
+  bool expired() const { return mPool.expired(); }
+
+  void *alloc(ConcurrentBufferAllocator::Pool *pool, int cls) {
+    sync(pool);
+    auto &list = mLists[cls];
+    if (list.empty()) {
+      refill(pool, cls);
+      if (list.empty()) {
+        return nullptr;
+      }
+    }
+    auto ptr = list.back();
+    list.pop_back();
+    return ptr;
+  }
+  void release(ConcurrentBufferAllocator::Pool *pool, int cls, void *ptr) {
+    sync(pool);
+    auto &list = mLists[cls];
+    list.push_back(ptr);
+    auto batch = concurrent_batch_num(cls);
+    if (list.size() > 2 * batch) {
+      auto &shard = pool->shards[shard_index()];
+      std::lock_guard<std::mutex> _l(shard.lock);
+      auto &shared = shard.lists[cls];
+      shared.insert(shared.end(), list.end() - batch, list.end());
+      list.resize(list.size() - batch);
+    }
+  }
+  void flush() {
+    auto pool = mPool.lock();
+    if (nullptr == pool || pool->generation != mGeneration) {
+      return;
+    }
+    auto &shard = pool->shards[shard_index()];
+    std::lock_guard<std::mutex> _l(shard.lock);
+    for (int i = 0; i < CONCURRENT_CLASS_NUM; ++i) {
+      auto &shared = shard.lists[i];
+      shared.insert(shared.end(), mLists[i].begin(), mLists[i].end());
+      mLists[i].clear();
+    }
+  }
+
+  static int shard_index() {
+    static std::atomic<int> g_thread_count{0};
+    static thread_local int g_index =
+        g_thread_count.fetch_add(1) % CONCURRENT_SHARD_NUM;
+    return g_index;
+  }
+
+private:
+  // blocks cached before a full release are gone
+  void sync(ConcurrentBufferAllocator::Pool *pool) {
+    uint32_t generation = pool->generation;
+    if (generation != mGeneration) {
+      for (auto &list : mLists) {
+        list.clear();
+      }
+      mGeneration = generation;
+    }
+  }
+  // take a batch from the own shard first, then steal from the others
+  void refill(ConcurrentBufferAllocator::Pool *pool, int cls) {
+    auto batch = concurrent_batch_num(cls);
+    auto &list = mLists[cls];
+    auto index = shard_index();
+    for (int i = 0; i < CONCURRENT_SHARD_NUM && list.empty(); ++i) {
+      auto &shard = pool->shards[(index + i) % CONCURRENT_SHARD_NUM];
+      std::lock_guard<std::mutex> _l(shard.lock);
+      auto &shared = shard.lists[cls];
+      auto num = ALIMIN(batch, shared.size());
+      list.insert(list.end(), shared.end() - num, shared.end());
+      shared.resize(shared.size() - num);
+    }
+  }
+
+  std::weak_ptr<ConcurrentBufferAllocator::Pool> mPool;
+  const ConcurrentBufferAllocator::Pool *mKey;
+  uint32_t mGeneration;
+  std::vector<void *> mLists[CONCURRENT_CLASS_NUM];
+};
+
+static ConcurrentThreadCache *
+get_concurrent_thread_cache(const std::shared_ptr<ConcurrentBufferAllocator::Pool> &pool) {
+  static thread_local std::vector<std::unique_ptr<ConcurrentThreadCache>> g_caches;
+  for (auto iter = g_caches.begin(); iter != g_caches.end();) {
+    if ((*iter)->expired()) {
+      iter = g_caches.erase(iter);
+      continue;
+    }
+    if ((*iter)->key() == pool.get()) {
+      return iter->get();
+    }
+    iter++;
+  }
+  g_caches.emplace_back(new ConcurrentThreadCache(pool));
+  return g_caches.back().get();
+}
+
+ConcurrentBufferAllocator::ConcurrentBufferAllocator(
+    std::shared_ptr<Allocator> parent, size_t limit, size_t align) {
+  mPool.reset(new Pool);
+  mPool->parent = parent;
+  mPool->align = align;
+  mPool->limit = limit;
+}
+
+ConcurrentBufferAllocator::~ConcurrentBufferAllocator() {
+  mPool->releaseBlocks(true);
+}
+
+MemChunk ConcurrentBufferAllocator::alloc(size_t size, bool separate,
+                                          size_t align) {
+  if (0 == align) {
+    align = mPool->align;
+  }
+  auto cls = concurrent_size_class(size);
+  bool cached = !separate && align <= mPool->align && cls < CONCURRENT_CLASS_NUM;
+  auto cache = get_concurrent_thread_cache(mPool);
+  void *ptr = nullptr;
+  if (cached) {
+    ptr = cache->alloc(mPool.get(), cls);
+    if (nullptr != ptr) {
+      return MemChunk(ptr, 0);
+    }
+    size = concurrent_class_size(cls);
+    align = mPool->align;
+  } else {
+    cls = -1;
+  }
+  ptr = mPool->createBlock(size, align, cls);
+  if (nullptr == ptr) {
+    // over budget, give up the blocks this thread holds and try again
+    cache->flush();
+    ptr = mPool->createBlock(size, align, cls);
+  }
+  return MemChunk(ptr, 0);
+}
+
+bool ConcurrentBufferAllocator::free(MemChunk chunk) {
+  auto ptr = chunk.ptr();
+  if (nullptr == ptr) {
+    return false;
+  }
+  auto block = concurrent_header(ptr);
+  if (block->sizeClass < 0) {
+    mPool->destroyBlock(ptr);
+    return true;
+  }
+  get_concurrent_thread_cache(mPool)->release(mPool.get(), block->sizeClass,
+                                              ptr);
+  return true;
+}
+
+void ConcurrentBufferAllocator::release(bool allRelease) {
+  if (!allRelease) {
+    get_concurrent_thread_cache(mPool)->flush();
+  }
+  mPool->releaseBlocks(allRelease);
+}
+
+size_t ConcurrentBufferAllocator::total_size() const {
+  return mPool->totalSize;
+}
+
+size_t ConcurrentBufferAllocator::free_size() const {
+  size_t bytes = 0;
+  for (auto &shard : mPool->shards) {
+    std::lock_guard<std::mutex> _l(shard.lock);
+    for (auto &list : shard.lists) {
+      for (auto ptr : list) {
+        bytes += concurrent_header(ptr)->size;
+      }
+    }
+  }
+  return bytes;
+}
+
+size_t ConcurrentBufferAllocator::trim(size_t keep) {
+  // the blocks cached by the calling thread can be trimmed too
+  get_concurrent_thread_cache(mPool)->flush();
+  auto cached = free_size();
+  if (cached <= keep) {
+    return 0;
+  }
+  return mPool->trimBlocks(cached, keep);
+}
+
 static void _CPUMemChunkApplyToTensor(uint8_t *ptr, size_t offset, Tensor *t) {
   t->buffer().host = ptr + offset;
 }
@@ -308,12 +1590,41 @@ MemChunk DeferBufferAllocator::alloc(size_t size, bool separate, size_t align) {
     align = mAlign;
   }
   size = UP_DIV(size, align) * align;
+  mLiveSize += size;
+  mPeakLiveSize = ALIMAX(mPeakLiveSize, mLiveSize);
+  if (nullptr != mPendingAlias) {
+    // the input outlives the op, can't overwrite it
+    mPendingAlias->alias = nullptr;
+    mPendingAlias = nullptr;
+  }
+  auto chunk = allocImpl(size, separate);
+  if (AllocTracer::enabled()) {
+    AllocTracer::get()->on_alloc(this, "defer", chunk.mNode, size, 0);
+  }
+  return chunk;
+}
+MemChunk DeferBufferAllocator::alloc_inplace(MemChunk input, size_t size,
+                                             size_t align) {
+  auto chunk = alloc(size, false, align);
+  auto inputNode = input.mNode;
+  if (PLAN_INTERVAL == mPlanMode && nullptr != chunk.mNode &&
+      nullptr != inputNode && SIZE_MAX == inputNode->freeTime &&
+      !mBarrrier) {
+    chunk.mNode->alias = inputNode;
+    mPendingAlias = chunk.mNode;
+  }
+  return chunk;
+}
+MemChunk DeferBufferAllocator::allocImpl(size_t size, bool separate) {
+  if (PLAN_INTERVAL == mPlanMode) {
+    auto newChunk = createMemNode(size);
+    // a separate chunk must not reuse anything, make it live from the start
+    newChunk->allocTime = separate ? 0 : ++mClock;
+    return MemChunk(newChunk);
+  }
   if (mFreeList.empty() || separate) {
     auto newChunk = createMemNode(size);
     insert_after(newChunk);
-#ifdef DUMP_USAGE
-    MNN_PRINT("Defer alloc: %p, %d\n", newChunk, size);
-#endif
     return MemChunk(newChunk);
   }
   std::unique_ptr<MemNode> tmpChunk(new MemNode(size));
@@ -334,15 +1645,9 @@ MemChunk DeferBufferAllocator::alloc(size_t size, bool separate, size_t align) {
   }
   // equal no change; small expand
   selectChunk->size = size;
-#ifdef DUMP_USAGE
-  MNN_PRINT("Defer alloc: %p, %d\n", selectChunk, size);
-#endif
   return MemChunk(selectChunk);
 }
 bool DeferBufferAllocator::free(MemChunk chunk) {
-#ifdef DUMP_USAGE
-  MNN_PRINT("Defer free: %p\n", chunk.mNode);
-#endif
   if (mBarrrier) {
     mBarrrierFreeChunks.emplace_back(std::move(chunk));
     return true;
@@ -351,6 +1656,19 @@ bool DeferBufferAllocator::free(MemChunk chunk) {
   if (!node) {
     return false;
   }
+  if (AllocTracer::enabled()) {
+    AllocTracer::get()->on_free(this, node, 0);
+  }
+  assert(mLiveSize >= node->size);
+  mLiveSize -= node->size;
+  if (PLAN_INTERVAL == mPlanMode) {
+    node->freeTime = ++mClock;
+    if (nullptr != mPendingAlias && mPendingAlias->alias == node) {
+      // input dies at the op, the alias holds
+      mPendingAlias = nullptr;
+    }
+    return true;
+  }
   auto left = node->left;
   auto right = node->right;
   if (left && !left->usage) {
@@ -409,6 +1727,15 @@ void DeferBufferAllocator::reset() {
   mTail = nullptr;
   mBarrrier = false;
   mBarrrierFreeChunks.clear();
+  mClock = 0;
+  mLiveSize = 0;
+  mPeakLiveSize = 0;
+  mPendingAlias = nullptr;
+}
+
+void DeferBufferAllocator::set_plan_mode(PlanMode mode) {
+  assert(mChunks.empty());
+  mPlanMode = mode;
 }
 
 bool DeferBufferAllocator::compute() {
@@ -416,6 +1743,9 @@ bool DeferBufferAllocator::compute() {
     return true;
   }
   mTotalSize = 0;
+  if (PLAN_INTERVAL == mPlanMode) {
+    return computeInterval();
+  }
   if (mFreeList.empty()) {
     return true;
   }
@@ -436,6 +1766,9 @@ bool DeferBufferAllocator::compute() {
   if (mPtr.ptr() == nullptr) {
     return false;
   }
+  if (AllocTracer::enabled()) {
+    AllocTracer::get()->on_compute(this, mTotalSize);
+  }
   for (auto &chunk : mChunks) {
     chunk->base = mPtr.ptr();
     for (auto t : chunk->tensors) {
@@ -445,6 +1778,106 @@ bool DeferBufferAllocator::compute() {
   return true;
 }
 
+bool DeferBufferAllocator::computeInterval() {
+  if (mChunks.empty()) {
+    return true;
+  }
+  if (nullptr != mPendingAlias) {
+    mPendingAlias->alias = nullptr;
+    mPendingAlias = nullptr;
+  }
+  // an alias chain is planned as one interval covering all its chunks
+  std::map<MemNode *, size_t> rootSlots;
+  std::vector<size_t> slots(mChunks.size());
+  std::vector<MemInterval> intervals;
+  for (size_t i = 0; i < mChunks.size(); ++i) {
+    auto chunk = mChunks[i].get();
+    auto root = chunk;
+    while (nullptr != root->alias) {
+      root = root->alias;
+    }
+    // shorten the chain for the next members
+    if (root != chunk) {
+      chunk->alias = root;
+    }
+    auto iter = rootSlots.find(root);
+    if (iter == rootSlots.end()) {
+      iter = rootSlots.insert(std::make_pair(root, intervals.size())).first;
+      intervals.emplace_back();
+      intervals.back().size = 0;
+      intervals.back().start = SIZE_MAX;
+      intervals.back().end = 0;
+    }
+    auto &interval = intervals[iter->second];
+    interval.size = ALIMAX(interval.size, chunk->size);
+    interval.start = ALIMIN(interval.start, chunk->allocTime);
+    interval.end = ALIMAX(interval.end, chunk->freeTime);
+    slots[i] = iter->second;
+  }
+  mTotalSize = plan_mem_intervals(intervals);
+  if (0 == mTotalSize) {
+    return true;
+  }
+  mPtr = mAllocator->on_alloc(mTotalSize, mAlign);
+  if (mPtr.ptr() == nullptr) {
+    return false;
+  }
+  if (AllocTracer::enabled()) {
+    AllocTracer::get()->on_compute(this, mTotalSize);
+  }
+  for (size_t i = 0; i < mChunks.size(); ++i) {
+    auto &chunk = mChunks[i];
+    chunk->offset = intervals[slots[i]].offset;
+    chunk->base = mPtr.ptr();
+    for (auto t : chunk->tensors) {
+      mApplyFunction((uint8_t *)mPtr.base(), chunk->offset + mPtr.offset(), t);
+    }
+  }
+  return true;
+}
+
+size_t plan_mem_intervals(std::vector<MemInterval> &intervals) {
+  std::vector<size_t> order(intervals.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return intervals[a].size > intervals[b].size;
+  });
+  size_t totalSize = 0;
+  std::vector<const MemInterval *> placed, alive;
+  for (auto index : order) {
+    auto &current = intervals[index];
+    // placed intervals sharing some time with current, by offset
+    alive.clear();
+    for (auto p : placed) {
+      if (p->start < current.end && current.start < p->end) {
+        alive.emplace_back(p);
+      }
+    }
+    std::sort(alive.begin(), alive.end(),
+              [](const MemInterval *a, const MemInterval *b) {
+                return a->offset < b->offset;
+              });
+    // best fit: the smallest gap able to hold current, or the top
+    size_t gapBegin = 0, bestOffset = SIZE_MAX, bestGap = SIZE_MAX;
+    for (auto p : alive) {
+      if (p->offset > gapBegin) {
+        auto gap = p->offset - gapBegin;
+        if (gap >= current.size && gap < bestGap) {
+          bestGap = gap;
+          bestOffset = gapBegin;
+        }
+      }
+      gapBegin = ALIMAX(gapBegin, p->offset + p->size);
+    }
+    current.offset = SIZE_MAX == bestOffset ? gapBegin : bestOffset;
+    totalSize = ALIMAX(totalSize, current.offset + current.size);
+    placed.emplace_back(&current);
+  }
+  return totalSize;
+}
+
 // some utils functions of DeferBufferAllocator
 void DeferBufferAllocator::visiChildren(MemNode *chunk) {
   if (!chunk)
@@ -519,4 +1952,21 @@ void DeferBufferAllocator::eraseFree(MemNode *chunk) {
   }
 }
 
-} // namespace tactics
\ No newline at end of file
+} // namespace tactics
+
+// objects created at a high rate share the slab pool of create_slab
+extern "C" void *memory_pool_alloc(size_t size) {
+#ifdef MNN_DEBUG_MEMORY
+  return malloc(size);
+#else
+  return tactics::slab_alloc(ALIMAX(size, (size_t)1), MEMORY_ALIGN_DEFAULT);
+#endif
+}
+
+extern "C" void memory_pool_free(void *mem, size_t size) {
+#ifdef MNN_DEBUG_MEMORY
+  free(mem);
+#else
+  tactics::slab_release(mem);
+#endif
+}
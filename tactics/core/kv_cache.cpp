@@ -0,0 +1,838 @@
+//===------------------------tactics/core/kv_cache.cpp------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===-------------------------------------------------------------------------===//
+//
+/// This file implements the key / value cache of attention layers
+///
+//===-------------------------------------------------------------------------===//
+#include "tactics/core/kv_cache.h"
+#include "tactics/math/vec.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define TACTICS_KV_SPILL
+#endif
+
+namespace tactics {
+
+using Vec4 = Vec<float, 4>;
+
+//------------------------------- quantization kernels
+//-----------------------------------//
+static inline float kv_reduce_max(Vec4 v) {
+  return ALIMAX(ALIMAX(v[0], v[1]), ALIMAX(v[2], v[3]));
+}
+static inline float kv_reduce_min(Vec4 v) {
+  return ALIMIN(ALIMIN(v[0], v[1]), ALIMIN(v[2], v[3]));
+}
+
+// x = (q + 128) * scale + zero with q in [-128, 127]
+static void kv_quant_int8(int8_t *dst, float *scale, float *zero,
+                          const float *src, size_t size) {
+  size_t size4 = size / 4 * 4;
+  float minValue = size > 0 ? src[0] : 0.0f, maxValue = minValue;
+  if (size4 > 0) {
+    auto minV = Vec4::load(src), maxV = minV;
+    for (size_t i = 4; i < size4; i += 4) {
+      auto v = Vec4::load(src + i);
+      minV = Vec4::min(minV, v);
+      maxV = Vec4::max(maxV, v);
+    }
+    minValue = kv_reduce_min(minV);
+    maxValue = kv_reduce_max(maxV);
+  }
+  for (size_t i = size4; i < size; ++i) {
+    minValue = ALIMIN(minValue, src[i]);
+    maxValue = ALIMAX(maxValue, src[i]);
+  }
+  float s = (maxValue - minValue) / 255.0f;
+  if (s <= 0.0f) {
+    s = 1.0f;
+  }
+  *scale = s;
+  *zero = minValue;
+  Vec4 invScale(1.0f / s), base(minValue);
+  float buffer[4];
+  for (size_t i = 0; i < size4; i += 4) {
+    Vec4::save(buffer, (Vec4::load(src + i) - base) * invScale);
+    for (int j = 0; j < 4; ++j) {
+      dst[i + j] = (int8_t)(ALIMIN(255L, lrintf(buffer[j])) - 128);
+    }
+  }
+  for (size_t i = size4; i < size; ++i) {
+    dst[i] = (int8_t)(ALIMIN(255L, lrintf((src[i] - minValue) / s)) - 128);
+  }
+}
+
+static void kv_dequant_int8(float *dst, const int8_t *src, float scale,
+                            float zero, size_t size) {
+  size_t size4 = size / 4 * 4;
+  Vec4 scaleV(scale), zeroV(zero + 128.0f * scale);
+  float buffer[4];
+  for (size_t i = 0; i < size4; i += 4) {
+    for (int j = 0; j < 4; ++j) {
+      buffer[j] = src[i + j];
+    }
+    Vec4::save(dst + i, Vec4::fma(zeroV, Vec4::load(buffer), scaleV));
+  }
+  for (size_t i = size4; i < size; ++i) {
+    dst[i] = (src[i] + 128) * scale + zero;
+  }
+}
+
+static const float FP8_E4M3_MAX = 448.0f;
+
+// round to the nearest e4m3 value, |x| must not be above FP8_E4M3_MAX
+static inline uint8_t kv_fp8_from_float(float x) {
+  uint8_t sign = std::signbit(x) ? 0x80 : 0;
+  float a = ALIMIN(std::fabs(x), FP8_E4M3_MAX);
+  if (a < 0.015625f) {
+    // zero or subnormal, step 2^-9. rounding up to 8 gives the smallest
+    // normal
+    return sign | (uint8_t)lrintf(a * 512.0f);
+  }
+  int e;
+  float m = std::frexp(a, &e);
+  int exponent = e - 1 + 7;
+  int mantissa = (int)lrintf((m * 2.0f - 1.0f) * 8.0f);
+  if (8 == mantissa) {
+    mantissa = 0;
+    exponent++;
+  }
+  if (exponent > 15 || (15 == exponent && 7 == mantissa)) {
+    return sign | 0x7e;
+  }
+  return sign | (uint8_t)(exponent << 3 | mantissa);
+}
+
+static const float *kv_fp8_table() {
+  static float table[256];
+  static std::once_flag flag;
+  std::call_once(flag, []() {
+    for (int code = 0; code < 256; ++code) {
+      int exponent = (code >> 3) & 15, mantissa = code & 7;
+      float value;
+      if (15 == exponent && 7 == mantissa) {
+        value = NAN;
+      } else if (0 == exponent) {
+        value = std::ldexp((float)mantissa, -9);
+      } else {
+        value = std::ldexp(1.0f + mantissa / 8.0f, exponent - 7);
+      }
+      table[code] = (code & 0x80) ? -value : value;
+    }
+  });
+  return table;
+}
+
+// x = fp8(q) * scale
+static void kv_quant_fp8(uint8_t *dst, float *scale, const float *src,
+                         size_t size) {
+  size_t size4 = size / 4 * 4;
+  float absMax = 0.0f;
+  if (size4 > 0) {
+    Vec4 maxV(0.0f);
+    for (size_t i = 0; i < size4; i += 4) {
+      auto v = Vec4::load(src + i);
+      maxV = Vec4::max(maxV, Vec4::max(v, -v));
+    }
+    absMax = kv_reduce_max(maxV);
+  }
+  for (size_t i = size4; i < size; ++i) {
+    absMax = ALIMAX(absMax, std::fabs(src[i]));
+  }
+  float s = absMax > 0.0f ? absMax / FP8_E4M3_MAX : 1.0f;
+  *scale = s;
+  Vec4 invScale(1.0f / s);
+  float buffer[4];
+  for (size_t i = 0; i < size4; i += 4) {
+    Vec4::save(buffer, Vec4::load(src + i) * invScale);
+    for (int j = 0; j < 4; ++j) {
+      dst[i + j] = kv_fp8_from_float(buffer[j]);
+    }
+  }
+  for (size_t i = size4; i < size; ++i) {
+    dst[i] = kv_fp8_from_float(src[i] / s);
+  }
+}
+
+static void kv_dequant_fp8(float *dst, const uint8_t *src, float scale,
+                           size_t size) {
+  auto table = kv_fp8_table();
+  size_t size4 = size / 4 * 4;
+  Vec4 scaleV(scale);
+  float buffer[4];
+  for (size_t i = 0; i < size4; i += 4) {
+    for (int j = 0; j < 4; ++j) {
+      buffer[j] = table[src[i + j]];
+    }
+    Vec4::save(dst + i, Vec4::load(buffer) * scaleV);
+  }
+  for (size_t i = size4; i < size; ++i) {
+    dst[i] = table[src[i]] * scale;
+  }
+}
+
+// file the spilled blocks of one layer are written to, slot i holds block i.
+// the file is mapped in segments so the mapping of a slot never moves, and
+// unlinked right after creation so it goes away with the cache.
+class KVSpillFile {
+public:
+  static KVSpillFile *create(const std::string &dir, size_t slotBytes) {
+#ifdef TACTICS_KV_SPILL
+    std::string path = dir + "/tactics_kv_XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    int fd = mkstemp(name.data());
+    if (fd < 0) {
+      return nullptr;
+    }
+    unlink(name.data());
+    return new KVSpillFile(fd, slotBytes);
+#else
+    return nullptr;
+#endif
+  }
+  ~KVSpillFile() {
+#ifdef TACTICS_KV_SPILL
+    for (auto segment : mSegments) {
+      munmap(segment, mSegmentBytes);
+    }
+    close(mFd);
+#endif
+  }
+  // write `data` to slot `index`, return the mapping of the slot
+  uint8_t *write(size_t index, const uint8_t *data) {
+#ifdef TACTICS_KV_SPILL
+    auto segment = index / mSegmentSlots;
+    while (segment >= mSegments.size()) {
+      if (!grow()) {
+        return nullptr;
+      }
+    }
+    auto offset = (off_t)(segment * mSegmentBytes +
+                          index % mSegmentSlots * mSlotBytes);
+    size_t written = 0;
+    while (written < mSlotBytes) {
+      auto n = pwrite(mFd, data + written, mSlotBytes - written,
+                      offset + written);
+      if (n <= 0) {
+        return nullptr;
+      }
+      written += n;
+    }
+    return mSegments[segment] + index % mSegmentSlots * mSlotBytes;
+#else
+    return nullptr;
+#endif
+  }
+  // start reading the first `slots` slots
+  void prefetch(size_t slots) const {
+#ifdef TACTICS_KV_SPILL
+    for (size_t i = 0; i < mSegments.size() && slots > 0; ++i) {
+      auto count = ALIMIN(slots, mSegmentSlots);
+      madvise(mSegments[i], ROUND_UP(count * mSlotBytes, mPageSize),
+              MADV_WILLNEED);
+      slots -= count;
+    }
+#endif
+  }
+
+private:
+  KVSpillFile(int fd, size_t slotBytes) : mFd(fd), mSlotBytes(slotBytes) {
+#ifdef TACTICS_KV_SPILL
+    mPageSize = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+    mSegmentSlots = ALIMAX((size_t)1, (4 * 1024 * 1024) / slotBytes);
+    mSegmentBytes = ROUND_UP(mSegmentSlots * mSlotBytes, mPageSize);
+  }
+  bool grow() {
+#ifdef TACTICS_KV_SPILL
+    auto size = (off_t)((mSegments.size() + 1) * mSegmentBytes);
+    if (0 != ftruncate(mFd, size)) {
+      return false;
+    }
+    auto segment = mmap(nullptr, mSegmentBytes, PROT_READ, MAP_SHARED, mFd,
+                        (off_t)(mSegments.size() * mSegmentBytes));
+    if (MAP_FAILED == segment) {
+      return false;
+    }
+    mSegments.emplace_back((uint8_t *)segment);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  int mFd;
+  size_t mSlotBytes;
+  size_t mPageSize = 4096;
+  size_t mSegmentSlots;
+  size_t mSegmentBytes;
+  std::vector<uint8_t *> mSegments;
+};
+
+KVCache::Config KVCache::config_from_hint(const RuntimeHint &hint, int kvHeads,
+                                          int headDim) {
+  Config config;
+  config.kvHeads = kvHeads;
+  config.headDim = headDim;
+  if (hint.kvcacheSizeLimit >= 0) {
+    config.sizeLimit = (size_t)hint.kvcacheSizeLimit * 1024 * 1024;
+  }
+  config.dirPath = hint.kvcacheDirPath;
+  config.quantOption = hint.kvcacheQuantOption;
+  return config;
+}
+
+KVBlockPool::KVBlockPool(size_t blockBytes, int arenaBlocks, int maxBlocks,
+                         std::shared_ptr<BufferAllocator::Allocator> allocator)
+    : mBlockBytes(blockBytes), mStride(ROUND_UP(blockBytes, MEMORY_ALIGN_DEFAULT)),
+      mArenaBlocks(ALIMAX(1, arenaBlocks)), mMaxBlocks(maxBlocks),
+      mAllocator(allocator) {
+  if (nullptr == mAllocator) {
+    mAllocator = BufferAllocator::Allocator::create_default();
+  }
+}
+
+KVBlockPool::~KVBlockPool() {
+  for (auto &arena : mArenas) {
+    mAllocator->on_release(arena);
+  }
+}
+
+int KVBlockPool::alloc() {
+  if (mFree.empty()) {
+    int first = (int)mArenas.size() * mArenaBlocks;
+    if (first >= mMaxBlocks) {
+      return -1;
+    }
+    auto arena = mAllocator->on_alloc(mStride * mArenaBlocks,
+                                      MEMORY_ALIGN_DEFAULT);
+    if (nullptr == arena.ptr()) {
+      return -1;
+    }
+    mArenas.emplace_back(arena);
+    int count = ALIMIN(mArenaBlocks, mMaxBlocks - first);
+    for (int i = count - 1; i >= 0; --i) {
+      mFree.push_back(first + i);
+    }
+  }
+  int block = mFree.back();
+  mFree.pop_back();
+  mUsed++;
+  return block;
+}
+
+void KVBlockPool::free(int block) {
+  assert(block >= 0 && block < (int)mArenas.size() * mArenaBlocks);
+  mFree.push_back(block);
+  mUsed--;
+}
+
+int KVBlockPool::available() const {
+  int capacity = ALIMIN((size_t)mMaxBlocks, mArenas.size() * mArenaBlocks);
+  return free_count() + (mMaxBlocks - capacity);
+}
+
+size_t KVBlockPool::total_size() const {
+  return mArenas.size() * mArenaBlocks * mStride;
+}
+
+// 64 bits FNV-1a over the token ids, chained from block to block
+static const uint64_t KV_HASH_SEED = 0xcbf29ce484222325ULL;
+static inline uint64_t kv_hash(uint64_t hash, int id) {
+  auto bytes = (uint32_t)id;
+  for (int i = 0; i < 4; ++i) {
+    hash = (hash ^ ((bytes >> (8 * i)) & 0xff)) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+KVCache::Layout KVCache::make_layout(const Config &config) {
+  bool quantKey = 0 != (config.quantOption & QUANT_KEY);
+  bool quantValue = 0 != (config.quantOption & QUANT_VALUE);
+  size_t elements = (size_t)config.blockTokens * config.kvHeads *
+                    config.headDim;
+  size_t heads = (size_t)config.blockTokens * config.kvHeads;
+  Layout layout;
+  size_t offset = 0;
+  layout.key = offset;
+  offset += ROUND_UP(elements * (quantKey ? 1 : sizeof(float)), 16);
+  layout.value = offset;
+  offset += ROUND_UP(elements * (quantValue ? 1 : sizeof(float)), 16);
+  layout.keyParam = offset;
+  offset += quantKey ? heads * 2 * sizeof(float) : 0;
+  layout.valueParam = offset;
+  offset += quantValue ? heads * sizeof(float) : 0;
+  layout.blockBytes = offset;
+  return layout;
+}
+
+size_t KVCache::block_bytes(const Config &config) {
+  return make_layout(config).blockBytes;
+}
+
+KVCache::KVCache(const Config &config,
+                 std::shared_ptr<BufferAllocator::Allocator> allocator)
+    : mConfig(config), mHash(KV_HASH_SEED) {
+  assert(mConfig.kvHeads > 0 && mConfig.headDim > 0 && mConfig.blockTokens > 0);
+  mLayout = make_layout(mConfig);
+  mPool.reset(new KVBlockPool(mLayout.blockBytes, 16, INT_MAX, allocator));
+}
+
+KVCache::KVCache(const Config &config, std::shared_ptr<KVBlockPool> pool)
+    : mConfig(config), mPool(pool), mHash(KV_HASH_SEED) {
+  assert(mConfig.kvHeads > 0 && mConfig.headDim > 0 && mConfig.blockTokens > 0);
+  mLayout = make_layout(mConfig);
+  assert(mPool->block_bytes() == mLayout.blockBytes);
+}
+
+KVCache::~KVCache() { clear(); }
+
+void KVCache::writeToken(uint8_t *data, int index, const float *key,
+                         const float *value) {
+  const size_t headDim = mConfig.headDim;
+  for (int h = 0; h < mConfig.kvHeads; ++h) {
+    size_t head = (size_t)index * mConfig.kvHeads + h;
+    auto k = key + h * headDim;
+    auto v = value + h * headDim;
+    if (quantKey()) {
+      auto param = (float *)(data + mLayout.keyParam) + 2 * head;
+      kv_quant_int8((int8_t *)(data + mLayout.key) + head * headDim, param,
+                    param + 1, k, headDim);
+    } else {
+      ::memcpy((float *)(data + mLayout.key) + head * headDim, k,
+               headDim * sizeof(float));
+    }
+    if (quantValue()) {
+      auto param = (float *)(data + mLayout.valueParam) + head;
+      kv_quant_fp8(data + mLayout.value + head * headDim, param, v, headDim);
+    } else {
+      ::memcpy((float *)(data + mLayout.value) + head * headDim, v,
+               headDim * sizeof(float));
+    }
+  }
+}
+
+bool KVCache::pushBlock(bool copyLast) {
+  int id = mPool->alloc();
+  if (id < 0) {
+    return false;
+  }
+  Block block;
+  block.shared = new KVBlock(mPool.get(), id);
+  block.data = block.shared->data();
+  if (copyLast) {
+    auto &last = mBlocks.back();
+    ::memcpy(block.data, last.data, block_bytes());
+    block.shared->tokens = last.shared->tokens;
+    last = std::move(block);
+  } else {
+    mBlocks.emplace_back(std::move(block));
+  }
+  return true;
+}
+
+bool KVCache::append(const float *key, const float *value, int tokens,
+                     const int *ids) {
+  const size_t tokenFloats = mConfig.kvHeads * mConfig.headDim;
+  if (nullptr == ids && tokens > 0) {
+    mHashed = false;
+  }
+  for (int t = 0; t < tokens; ++t) {
+    auto offset = mTokens % mConfig.blockTokens;
+    if (0 == offset) {
+      if (!pushBlock(false)) {
+        return false;
+      }
+    } else if (mBlocks.back().shared->count() > 1) {
+      // shared with a fork
+      if (!pushBlock(true)) {
+        return false;
+      }
+    }
+    auto &block = mBlocks.back();
+    writeToken(block.data, offset, key + t * tokenFloats,
+               value + t * tokenFloats);
+    if (mHashed) {
+      mHash = kv_hash(mHash, ids[t]);
+      block.shared->tokens.push_back(ids[t]);
+      if (offset + 1 == mConfig.blockTokens) {
+        block.shared->hash = mHash;
+        block.shared->hashed = true;
+      }
+    }
+    mTokens++;
+  }
+  // the last block may be partly filled, older ones are full
+  while (resident_size() > mConfig.sizeLimit &&
+         mFirstResident + 1 < block_count()) {
+    if (!spill(mFirstResident)) {
+      break;
+    }
+    mFirstResident++;
+  }
+  return true;
+}
+
+KVCache *KVCache::fork() const {
+  assert(0 == mFirstResident);
+  auto cache = new KVCache(mConfig, mPool);
+  cache->mBlocks = mBlocks;
+  cache->mTokens = mTokens;
+  cache->mHashed = mHashed;
+  cache->mHash = mHash;
+  return cache;
+}
+
+void KVCache::attach(const SharedPtr<KVBlock> &block) {
+  assert(0 == mTokens % mConfig.blockTokens && block->hashed);
+  Block entry;
+  entry.shared = block;
+  entry.data = block->data();
+  mBlocks.emplace_back(std::move(entry));
+  mTokens += mConfig.blockTokens;
+  mHash = block->hash;
+}
+
+bool KVCache::spill(int index) {
+  if (nullptr == mSpillFile) {
+    mSpillFile.reset(KVSpillFile::create(mConfig.dirPath, block_bytes()));
+    if (nullptr == mSpillFile) {
+      // keep everything in memory
+      mConfig.sizeLimit = SIZE_MAX;
+      return false;
+    }
+  }
+  auto &block = mBlocks[index];
+  auto mapped = mSpillFile->write(index, block.data);
+  if (nullptr == mapped) {
+    return false;
+  }
+  block.shared = nullptr;
+  block.data = mapped;
+  block.spilled = true;
+  return true;
+}
+
+void KVCache::clear() {
+  mBlocks.clear();
+  mTokens = 0;
+  mFirstResident = 0;
+  mHashed = true;
+  mHash = KV_HASH_SEED;
+}
+
+int KVCache::block_tokens(int block) const {
+  if (block + 1 < block_count()) {
+    return mConfig.blockTokens;
+  }
+  return mTokens - block * mConfig.blockTokens;
+}
+
+const float *KVCache::key_block(int block) const {
+  assert(!quantKey());
+  return (const float *)(mBlocks[block].data + mLayout.key);
+}
+
+const float *KVCache::value_block(int block) const {
+  assert(!quantValue());
+  return (const float *)(mBlocks[block].data + mLayout.value);
+}
+
+void KVCache::read_block(int block, float *key, float *value) const {
+  auto data = mBlocks[block].data;
+  const size_t headDim = mConfig.headDim;
+  size_t heads = (size_t)block_tokens(block) * mConfig.kvHeads;
+  if (nullptr != key) {
+    if (quantKey()) {
+      auto param = (const float *)(data + mLayout.keyParam);
+      auto src = (const int8_t *)(data + mLayout.key);
+      for (size_t h = 0; h < heads; ++h) {
+        kv_dequant_int8(key + h * headDim, src + h * headDim, param[2 * h],
+                        param[2 * h + 1], headDim);
+      }
+    } else {
+      ::memcpy(key, data + mLayout.key, heads * headDim * sizeof(float));
+    }
+  }
+  if (nullptr != value) {
+    if (quantValue()) {
+      auto param = (const float *)(data + mLayout.valueParam);
+      auto src = data + mLayout.value;
+      for (size_t h = 0; h < heads; ++h) {
+        kv_dequant_fp8(value + h * headDim, src + h * headDim, param[h],
+                       headDim);
+      }
+    } else {
+      ::memcpy(value, data + mLayout.value, heads * headDim * sizeof(float));
+    }
+  }
+}
+
+static inline float kv_dot(const float *a, const float *b, size_t size) {
+  size_t size4 = size / 4 * 4;
+  float sum = 0.0f;
+  if (size4 > 0) {
+    Vec4 sumV(0.0f);
+    for (size_t i = 0; i < size4; i += 4) {
+      sumV = Vec4::fma(sumV, Vec4::load(a + i), Vec4::load(b + i));
+    }
+    sum = sumV[0] + sumV[1] + sumV[2] + sumV[3];
+  }
+  for (size_t i = size4; i < size; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+// dst = dst * scale + p * src
+static inline void kv_scale_add(float *dst, float scale, float p,
+                                const float *src, size_t size) {
+  size_t size4 = size / 4 * 4;
+  Vec4 scaleV(scale), pV(p);
+  for (size_t i = 0; i < size4; i += 4) {
+    Vec4::save(dst + i, Vec4::fma(Vec4::load(dst + i) * scaleV,
+                                  Vec4::load(src + i), pV));
+  }
+  for (size_t i = size4; i < size; ++i) {
+    dst[i] = dst[i] * scale + p * src[i];
+  }
+}
+
+void KVCache::attention(const float *query, int heads, float *output) const {
+  const int kvHeads = mConfig.kvHeads;
+  const size_t headDim = mConfig.headDim;
+  assert(heads % kvHeads == 0);
+  const int group = heads / kvHeads;
+  const float scale = 1.0f / std::sqrt((float)headDim);
+  ::memset(output, 0, heads * headDim * sizeof(float));
+  // running max and sum of exp of every query head, softmax is rescaled
+  // block by block
+  std::vector<float> maxScore(heads, -INFINITY), sum(heads, 0.0f);
+  std::vector<float> scores(mConfig.blockTokens);
+  std::vector<float> keys, values;
+  if (quantKey()) {
+    keys.resize((size_t)mConfig.blockTokens * kvHeads * headDim);
+  }
+  if (quantValue()) {
+    values.resize((size_t)mConfig.blockTokens * kvHeads * headDim);
+  }
+  for (int b = 0; b < block_count(); ++b) {
+    const int count = block_tokens(b);
+    read_block(b, quantKey() ? keys.data() : nullptr,
+               quantValue() ? values.data() : nullptr);
+    auto key = quantKey() ? keys.data() : key_block(b);
+    auto value = quantValue() ? values.data() : value_block(b);
+    for (int h = 0; h < heads; ++h) {
+      const size_t kvHead = h / group;
+      auto q = query + h * headDim;
+      float blockMax = -INFINITY;
+      for (int t = 0; t < count; ++t) {
+        scores[t] = kv_dot(q, key + (t * kvHeads + kvHead) * headDim,
+                           headDim) *
+                    scale;
+        blockMax = ALIMAX(blockMax, scores[t]);
+      }
+      float newMax = ALIMAX(maxScore[h], blockMax);
+      float rescale = std::exp(maxScore[h] - newMax);
+      auto out = output + h * headDim;
+      sum[h] *= rescale;
+      for (int t = 0; t < count; ++t) {
+        float p = std::exp(scores[t] - newMax);
+        sum[h] += p;
+        kv_scale_add(out, 0 == t ? rescale : 1.0f, p,
+                     value + (t * kvHeads + kvHead) * headDim, headDim);
+      }
+      maxScore[h] = newMax;
+    }
+  }
+  for (int h = 0; h < heads; ++h) {
+    if (sum[h] > 0.0f) {
+      auto out = output + h * headDim;
+      kv_scale_add(out, 1.0f / sum[h], 0.0f, out, headDim);
+    }
+  }
+}
+
+bool KVCache::spilled(int block) const { return mBlocks[block].spilled; }
+
+void KVCache::prefetch() const {
+  if (nullptr != mSpillFile && mFirstResident > 0) {
+    mSpillFile->prefetch(mFirstResident);
+  }
+}
+
+size_t KVCache::resident_size() const {
+  return (block_count() - mFirstResident) * block_bytes();
+}
+
+size_t KVCache::spilled_size() const {
+  return mFirstResident * block_bytes();
+}
+
+PagedKVCache::PagedKVCache(
+    const KVCache::Config &config, int maxBlocks,
+    std::shared_ptr<BufferAllocator::Allocator> allocator)
+    : mConfig(config), mSizeLimit(config.sizeLimit) {
+  // the limit bounds the pool, sequences do not spill
+  mConfig.sizeLimit = SIZE_MAX;
+  // arenas of about 1 MB
+  size_t blockBytes = KVCache::block_bytes(mConfig);
+  int arenaBlocks = (int)ALIMAX((size_t)1, (1 << 20) / blockBytes);
+  mPool.reset(new KVBlockPool(blockBytes, arenaBlocks, maxBlocks, allocator));
+}
+
+void PagedKVCache::touch(LRUList::iterator iter) {
+  mLRU.splice(mLRU.begin(), mLRU, iter);
+}
+
+void PagedKVCache::reserve(int blocks) {
+  auto full = [&]() {
+    return mPool->available() < blocks ||
+           (size_t)(mPool->used_count() + blocks) * mPool->block_bytes() >
+               mSizeLimit;
+  };
+  for (auto iter = mLRU.end(); iter != mLRU.begin() && full();) {
+    --iter;
+    // referenced by the cache only
+    if (1 == (*iter)->count()) {
+      mCached.erase((*iter)->hash);
+      iter = mLRU.erase(iter);
+    }
+  }
+}
+
+void PagedKVCache::publish(Sequence &sequence) {
+  auto cache = sequence.cache.get();
+  int full = cache->tokens() / mConfig.blockTokens;
+  for (; sequence.published < full; ++sequence.published) {
+    auto &block = cache->shared_block(sequence.published);
+    if (nullptr == block.get() || !block->hashed) {
+      continue;
+    }
+    auto iter = mCached.find(block->hash);
+    if (iter != mCached.end()) {
+      touch(iter->second);
+      continue;
+    }
+    mLRU.push_front(block);
+    mCached[block->hash] = mLRU.begin();
+  }
+}
+
+int PagedKVCache::add_sequence(const int *ids, int count) {
+  int id = mNextId++;
+  auto &sequence = mSequences[id];
+  sequence.cache.reset(new KVCache(mConfig, mPool));
+  const int blockTokens = mConfig.blockTokens;
+  uint64_t hash = KV_HASH_SEED;
+  for (int begin = 0; begin + blockTokens < count; begin += blockTokens) {
+    for (int t = begin; t < begin + blockTokens; ++t) {
+      hash = kv_hash(hash, ids[t]);
+    }
+    auto iter = mCached.find(hash);
+    if (iter == mCached.end()) {
+      break;
+    }
+    auto &block = *iter->second;
+    if (!std::equal(ids + begin, ids + begin + blockTokens,
+                    block->tokens.begin())) {
+      break;
+    }
+    sequence.cache->attach(block);
+    touch(iter->second);
+  }
+  sequence.published = sequence.cache->block_count();
+  return id;
+}
+
+int PagedKVCache::fork_sequence(int id) {
+  auto cache = sequence(id);
+  if (nullptr == cache) {
+    return -1;
+  }
+  int forkId = mNextId++;
+  auto &forked = mSequences[forkId];
+  forked.cache.reset(cache->fork());
+  forked.published = mSequences[id].published;
+  return forkId;
+}
+
+bool PagedKVCache::append(int id, const int *ids, const float *key,
+                          const float *value, int tokens) {
+  auto iter = mSequences.find(id);
+  if (iter == mSequences.end()) {
+    return false;
+  }
+  auto cache = iter->second.cache.get();
+  // new blocks, plus one if the last block is copied
+  int offset = cache->tokens() % mConfig.blockTokens;
+  reserve(UP_DIV(offset + tokens, mConfig.blockTokens));
+  bool success = cache->append(key, value, tokens, ids);
+  publish(iter->second);
+  return success;
+}
+
+void PagedKVCache::end_sequence(int id) { mSequences.erase(id); }
+
+KVCache *PagedKVCache::sequence(int id) {
+  auto iter = mSequences.find(id);
+  if (iter == mSequences.end()) {
+    return nullptr;
+  }
+  return iter->second.cache.get();
+}
+
+KVCacheStore::KVCacheStore(const RuntimeHint &hint, int layers, int kvHeads,
+                           int headDim) {
+  auto config = KVCache::config_from_hint(hint, kvHeads, headDim);
+  auto allocator = BufferAllocator::Allocator::create_default();
+  for (int i = 0; i < layers; ++i) {
+    mLayers.emplace_back(new KVCache(config, allocator));
+  }
+}
+
+void KVCacheStore::begin_layer(int index) {
+  if (mLayers.empty()) {
+    return;
+  }
+  // the next layer, or the first one of the next step
+  mLayers[(index + 1) % mLayers.size()]->prefetch();
+}
+
+void KVCacheStore::clear() {
+  for (auto &layer : mLayers) {
+    layer->clear();
+  }
+}
+
+size_t KVCacheStore::resident_size() const {
+  size_t size = 0;
+  for (auto &layer : mLayers) {
+    size += layer->resident_size();
+  }
+  return size;
+}
+
+size_t KVCacheStore::spilled_size() const {
+  size_t size = 0;
+  for (auto &layer : mLayers) {
+    size += layer->spilled_size();
+  }
+  return size;
+}
+
+} // namespace tactics
@@ -12,6 +12,7 @@
 #include "HalideRuntime.h"
 #include "tactics/core/memory_utils.h"
 #include "tactics/core/tensor_utils.h"
+#include "tactics/ops/cpu/cpu_cast.h"
 #include <cassert>
 #include <complex>
 #include <cstdint>
@@ -20,10 +21,51 @@
 
 namespace tactics {
 
+// host memory of MEMORY_HOST tensors, shared with their views
+class HostMemObj : public Backend::MemObj {
+public:
+    HostMemObj(void* host) : mHost(host) {}
+    virtual ~HostMemObj() { memory_free_align(mHost); }
+
+private:
+    void* mHost;
+};
+
+static void alloc_host_memory(Tensor* tensor) {
+    auto memory_size = tensor->size();
+    if (memory_size <= 0) {
+        return;
+    }
+    auto des = TensorUtils::get_describe_origin(tensor);
+    des->m_content->memoryType = Tensor::InsideDescribe::MEMORY_HOST;
+    tensor->buffer().host = (uint8_t*)memory_alloc_align(memory_size, MEMORY_ALIGN_DEFAULT);
+    if (nullptr != tensor->buffer().host) {
+        des->mem = new HostMemObj(tensor->buffer().host);
+    }
+}
+
+void* Tensor::operator new(size_t size) {
+    return memory_pool_alloc(size);
+}
+
+void Tensor::operator delete(void* ptr, size_t size) {
+    memory_pool_free(ptr, size);
+}
+
+void* Tensor::InsideDescribe::operator new(size_t size) {
+    return memory_pool_alloc(size);
+}
+
+void Tensor::InsideDescribe::operator delete(void* ptr, size_t size) {
+    memory_pool_free(ptr, size);
+}
+
 Tensor::Tensor(int dim_size) {
   assert(dim_size <= MAX_TENSOR_DIM);
   m_describe = new InsideDescribe();
-  m_describe->m_content.reset(new InsideDescribe::NativeInsideDescribe());
+  // describe and its control block in one pooled block
+  m_describe->m_content = std::allocate_shared<InsideDescribe::NativeInsideDescribe>(
+      PoolAllocator<InsideDescribe::NativeInsideDescribe>());
   auto native_desribe = m_describe->m_content.get();
   m_buffer.dimensions = dim_size;
   m_buffer.type = halide_type_of<float>();
@@ -40,7 +82,8 @@ Tensor::Tensor(const Tensor* tensor, bool alloc_memory) {
 
   auto buffer = tensor->buffer();
   m_describe = new InsideDescribe();
-  m_describe->m_content.reset(new InsideDescribe::NativeInsideDescribe());
+  m_describe->m_content = std::allocate_shared<InsideDescribe::NativeInsideDescribe>(
+      PoolAllocator<InsideDescribe::NativeInsideDescribe>());
   auto native_desribe = m_describe->m_content.get();
   m_buffer.dimensions = buffer.dimensions;
   m_buffer.type = buffer.type;
@@ -64,11 +107,7 @@ Tensor::Tensor(const Tensor* tensor, bool alloc_memory) {
   }
 
   if (alloc_memory) {
-    auto memory_size = size();
-    if (memory_size > 0) {
-      native_desribe->memoryType = Tensor::InsideDescribe::MEMORY_HOST;
-      m_buffer.host = (uint8_t*)memory_alloc_align(size(), MEMORY_ALIGN_DEFAULT);
-    }
+    alloc_host_memory(this);
   }
 }
 
@@ -86,12 +125,7 @@ Tensor::Tensor(bool deepCopy, const Tensor* tensor) {
 }
 
 Tensor::~Tensor() {
-    auto native_desribe = m_describe->m_content.get();
-    if (native_desribe->memoryType == InsideDescribe::MEMORY_HOST) {
-        if (nullptr != m_buffer.host) {
-            memory_free_align(m_buffer.host);
-        }
-    }
+    // host memory goes with the last of mem, clones and views included
     delete m_describe;
 }
 
@@ -106,16 +140,15 @@ Tensor* Tensor::create_device(const std::vector<int>& dims, halide_type_t type)
 }
 
 Tensor* Tensor::create(const std::vector<int>& dims, halide_type_t type, void* userData) {
-    Tensor shapeTensor((int)dims.size());
-    for (int i = 0; i < dims.size(); ++i) {
-        shapeTensor.setLength(i, dims[i]);
+    // same as Tensor(&shapeTensor, ownData) without building the shape tensor
+    auto result = create_device(dims, type);
+    for (int i = result->m_buffer.dimensions; i < 4; i++) {
+        result->m_buffer.dim[i].extent = 1;
     }
-    shapeTensor.buffer().type = type;
-
-    bool ownData = userData == nullptr;
-    auto result  = new Tensor(&shapeTensor, ownData);
     if (nullptr != userData) {
         result->buffer().host = (uint8_t*)userData;
+    } else {
+        alloc_host_memory(result);
     }
     return result;
 }
@@ -124,6 +157,156 @@ Tensor* Tensor::clone(const Tensor* src, bool deepCopy) {
     return new Tensor(deepCopy, src);
 }
 
+Tensor* Tensor::create_view(const Tensor* tensor, const std::vector<int>& shape,
+                            const std::vector<int64_t>& strides, int64_t offset) {
+    auto des = TensorUtils::get_describe(tensor);
+    if (nullptr == tensor->host<uint8_t>() || shape.size() != strides.size() ||
+        shape.size() > MAX_TENSOR_DIM ||
+        DATA_FORMAT_NC4HW4 == des->dimension_format ||
+        DATA_FORMAT_NHWC4 == des->dimension_format) {
+        return nullptr;
+    }
+    auto view = new Tensor((int)shape.size());
+    auto viewDes = TensorUtils::get_describe(view);
+    viewDes->dimension_format = des->dimension_format;
+    viewDes->quantAttr = des->quantAttr;
+    viewDes->type = des->type;
+    // not owned, kept alive by mem
+    viewDes->memoryType = InsideDescribe::MEMORY_OUTSIDE;
+    for (int i = 0; i < (int)shape.size(); ++i) {
+        view->setLength(i, shape[i]);
+        view->setStride(i, strides[i]);
+    }
+    view->m_buffer.type = tensor->getType();
+    view->m_buffer.host = tensor->m_buffer.host + offset * tensor->getType().bytes();
+    view->m_describe->mem = tensor->m_describe->mem;
+    view->m_describe->setBackend(tensor->m_describe->getBackend());
+    return view;
+}
+
+Tensor* Tensor::slice(const Tensor* tensor, int axis, int begin, int end, int step) {
+    int dims = tensor->dimensions();
+    if (axis < 0) {
+        axis += dims;
+    }
+    if (axis < 0 || axis >= dims || step < 1) {
+        return nullptr;
+    }
+    int extent = tensor->length(axis);
+    begin = ALIMAX(0, begin < 0 ? begin + extent : begin);
+    end = ALIMIN(extent, end < 0 ? end + extent : end);
+    auto shape = tensor->shape();
+    std::vector<int64_t> strides(dims);
+    for (int i = 0; i < dims; ++i) {
+        strides[i] = tensor->stride(i);
+    }
+    shape[axis] = end > begin ? UP_DIV(end - begin, step) : 0;
+    strides[axis] *= step;
+    return create_view(tensor, shape, strides, end > begin ? begin * tensor->stride(axis) : 0);
+}
+
+Tensor* Tensor::permute(const Tensor* tensor, const std::vector<int>& order) {
+    int dims = tensor->dimensions();
+    if ((int)order.size() != dims) {
+        return nullptr;
+    }
+    std::vector<int> shape(dims);
+    std::vector<int64_t> strides(dims);
+    std::vector<bool> used(dims, false);
+    for (int i = 0; i < dims; ++i) {
+        int axis = order[i] < 0 ? order[i] + dims : order[i];
+        if (axis < 0 || axis >= dims || used[axis]) {
+            return nullptr;
+        }
+        used[axis] = true;
+        shape[i] = tensor->length(axis);
+        strides[i] = tensor->stride(axis);
+    }
+    return create_view(tensor, shape, strides);
+}
+
+Tensor* Tensor::expand(const Tensor* tensor, const std::vector<int>& shape) {
+    int dims = tensor->dimensions();
+    int lead = (int)shape.size() - dims;
+    if (lead < 0) {
+        return nullptr;
+    }
+    std::vector<int64_t> strides(shape.size(), 0);
+    for (int i = 0; i < dims; ++i) {
+        int extent = tensor->length(i);
+        if (extent == shape[lead + i]) {
+            strides[lead + i] = tensor->stride(i);
+        } else if (1 != extent) {
+            return nullptr;
+        }
+    }
+    return create_view(tensor, shape, strides);
+}
+
+Tensor* Tensor::reshape(const Tensor* tensor, const std::vector<int>& shape) {
+    int dims = tensor->dimensions();
+    int64_t count = 1, known = 1;
+    for (int i = 0; i < dims; ++i) {
+        count *= tensor->length(i);
+    }
+    auto newShape = shape;
+    int infer = -1;
+    for (int i = 0; i < (int)newShape.size(); ++i) {
+        if (-1 == newShape[i] && infer < 0) {
+            infer = i;
+        } else if (newShape[i] < 0) {
+            return nullptr;
+        } else {
+            known *= newShape[i];
+        }
+    }
+    if (infer >= 0) {
+        // extents stay 32 bit
+        if (0 == known || 0 != count % known || count / known > INT32_MAX) {
+            return nullptr;
+        }
+        newShape[infer] = (int)(count / known);
+        known *= newShape[infer];
+    }
+    if (known != count) {
+        return nullptr;
+    }
+    int newDims = (int)newShape.size();
+    std::vector<int64_t> strides(newDims, 1);
+    if (0 == count || 0 == dims) {
+        for (int i = newDims - 2; i >= 0; --i) {
+            strides[i] = strides[i + 1] * ALIMAX(1, newShape[i + 1]);
+        }
+        return create_view(tensor, newShape, strides);
+    }
+    // old dims are taken in chunks contiguous among themselves, each chunk
+    // is split into new dims of the same count
+    int view = newDims - 1;
+    int64_t base = tensor->stride(dims - 1), chunk = 1, viewCount = 1;
+    for (int i = dims - 1; i >= 0; --i) {
+        chunk *= tensor->length(i);
+        if (0 == i || (1 != tensor->length(i - 1) && tensor->stride(i - 1) != chunk * base)) {
+            while (view >= 0 && (viewCount < chunk || 1 == newShape[view])) {
+                strides[view] = viewCount * base;
+                viewCount *= newShape[view];
+                view--;
+            }
+            if (viewCount != chunk) {
+                return nullptr;
+            }
+            if (i > 0) {
+                base = tensor->stride(i - 1);
+                chunk = 1;
+                viewCount = 1;
+            }
+        }
+    }
+    if (-1 != view) {
+        return nullptr;
+    }
+    return create_view(tensor, newShape, strides);
+}
+
 
 bool Tensor::copy_from_host_tensor(const Tensor* hostTensor) {
     auto bn = m_describe->getBackend();
@@ -131,6 +314,7 @@ bool Tensor::copy_from_host_tensor(const Tensor* hostTensor) {
         return false;
     }
     bn->on_copy_buffer(hostTensor, this);
+    TensorUtils::set_content_changed(this);
     return true;
 }
 
@@ -165,6 +349,9 @@ void Tensor::setType(int type) {
         case DataType_DT_FLOAT:
             m_buffer.type = halide_type_of<float>();
             break;
+        case DataType_DT_HALF:
+            m_buffer.type = halide_type_t(halide_type_float, 16);
+            break;
         case DataType_DT_BFLOAT16:
             m_buffer.type = halide_type_t(halide_type_bfloat, 16);
             break;
@@ -209,7 +396,7 @@ void printData(const Tensor* tensor, const void* data, const char* fmt) {
     const T* buffer = (const T*)data;
     if (tensor->dimensions() != 4) {
         auto size = tensor->elementSize();
-        for (int i = 0; i < size; i++) {
+        for (int64_t i = 0; i < size; i++) {
             printf(fmt, buffer[i]);
         }
         printf("\n");
@@ -236,7 +423,7 @@ void printData(const Tensor* tensor, const void* data, const char* fmt) {
             for (int c = 0; c < channel; c++) {
                 for (int h = 0; h < height; h++) {
                     for (int w = 0; w < width; w++) {
-                        printf(fmt, bytes[c * width * height + h * width + w]);
+                        printf(fmt, bytes[((size_t)c * height + h) * width + w]);
                     }
                     printf("\n");
                 }
@@ -281,9 +468,17 @@ void Tensor::print() const {
     } else if (printee->getType().code == halide_type_float) {
         if (printee->getType().bits == 32) { // float32
             printData<float>(printee, buffer, "%f, ");
+        } else if (printee->getType().bits == 16) { // float16
+            std::vector<float> data(printee->usize() / 2);
+            CPUCast::half_to_float((const uint16_t*)buffer, data.data(), data.size());
+            printData<float>(printee, data.data(), "%f, ");
         } else {
             printf("\nunsupported data type\n");
         }
+    } else if (printee->getType().code == halide_type_bfloat) {
+        std::vector<float> data(printee->usize() / 2);
+        CPUCast::bf16_to_float((const uint16_t*)buffer, data.data(), data.size());
+        printData<float>(printee, data.data(), "%f, ");
     } else {
         printf("\nunsupported data type");
     }
@@ -310,9 +505,15 @@ size_t Tensor::usize() const {
     size_t dataSize = m_buffer.type.bytes();
     assert(dataSize >= 1);
     auto nativeDescribe = m_describe->m_content.get();
-    for (int i = 0; i < this->buffer().dimensions; i++) {
+    auto dims = this->buffer().dimensions;
+    for (int i = 0; i < dims; i++) {
         int currentDimSize = m_buffer.dim[i].extent;
         if (nativeDescribe->dimension_format == DATA_FORMAT_NC4HW4 && 1 == i) {
+            currentDimSize = ROUND_UP(currentDimSize,
+                                      TensorUtils::get_tensor_channel_pack(this));
+        }
+        if (nativeDescribe->dimension_format == DATA_FORMAT_NHWC4 && dims > 1 &&
+            dims - 1 == i) {
             currentDimSize = ALIGN_UP4(currentDimSize);
         }
         dataSize *= currentDimSize;
@@ -320,8 +521,8 @@ size_t Tensor::usize() const {
     return dataSize;
 }
 
-int Tensor::size() const {
-    return static_cast<int>(usize());
+int64_t Tensor::size() const {
+    return static_cast<int64_t>(usize());
 }
 
 void* Tensor::map(MapType mtype) {
@@ -337,46 +538,31 @@ void* Tensor::map(MapType mtype) {
         return mapPtr;
     }
 
-    /* Common backend */
-    auto needSize = this->size();
-    void* hostPtr = malloc(needSize);
-
-    if(mtype == Tensor::MAP_TENSOR_READ) {
-        //tmpTensor alloc
-        Tensor tmp_tensor(this, false);
-        tmp_tensor.buffer().host = (uint8_t *)hostPtr;
-
-        //use onCopyBuffer
-        bn->on_copy_buffer(this, &tmp_tensor);
-    }
-    return hostPtr;
+    /* Common backend, cached host copy */
+    return bn->map_staging(mtype, this);
 }
 
 void Tensor::unmap(MapType mtype, void *mapPtr) {
     auto nativeDescribe = m_describe;
     auto bn = nativeDescribe->getBackend();
     if (nullptr == bn) {
+        if (mtype == Tensor::MAP_TENSOR_WRITE) {
+            TensorUtils::set_content_changed(this);
+        }
         return;
     }
 
     bool ret = bn->on_unmap_tensor(mtype, this, mapPtr);
     if(true == ret) {
         //do unmap already, just return
+        if (mtype == Tensor::MAP_TENSOR_WRITE) {
+            TensorUtils::set_content_changed(this);
+        }
         return;
     }
 
-    if(mtype == Tensor::MAP_TENSOR_WRITE) {
-        //srcTensor alloc
-        Tensor src_tensor(this, false);
-        src_tensor.buffer().host = (uint8_t *)mapPtr;
-
-        //use onCopyBuffer
-        bn->on_copy_buffer(&src_tensor, this);
-    }
-    if(mapPtr != nullptr) {
-        free(mapPtr);
-        mapPtr = nullptr;
-    }
+    // copied back for write, kept for the next map
+    bn->unmap_staging(mtype, this, mapPtr);
 }
 int Tensor::wait(MapType mtype, bool finish) {
     auto nativeDescribe = m_describe;
@@ -10,7 +10,10 @@
 //===----------------------------------------------------------------------------===//
 #include "tactics/core/tensor_utils.h"
 #include "tactics/core/backend.h"
+#include "tactics/ops/cpu/cpu_cast.h"
+#include "tactics/ops/cpu/cpu_parallel.h"
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <cstring>
@@ -132,7 +135,7 @@ void TensorUtils::copy_shape(const Tensor *source, Tensor *dest,
 void TensorUtils::set_shape(Tensor *dest, const std::vector<int> &alldims) {
   auto &ob = dest->buffer();
   ob.dimensions = alldims.size();
-  int stride = 1;
+  int64_t stride = 1;
   for (int i = alldims.size() - 1; i >= 0; --i) {
     ob.dim[i].stride = stride;
     ob.dim[i].extent = alldims[i];
@@ -143,13 +146,16 @@ void TensorUtils::set_shape(Tensor *dest, const std::vector<int> &alldims) {
 
 void TensorUtils::set_linear_layout(Tensor *tensor) {
   auto &buffer = tensor->buffer();
-  int size = 1;
+  auto format = tensor->m_describe->m_content->dimension_format;
+  int64_t size = 1;
   for (int i = 0; i < buffer.dimensions; ++i) {
     auto index = buffer.dimensions - i - 1;
     auto extent = buffer.dim[index].extent;
-    if (1 == index &&
-        tensor->m_describe->m_content->dimension_format == DATA_FORMAT_NC4HW4) {
-      extent = ROUND_UP(extent, 4);
+    if (1 == index && format == DATA_FORMAT_NC4HW4) {
+      extent = ROUND_UP(extent, get_tensor_channel_pack(tensor));
+    }
+    if (0 == i && buffer.dimensions > 1 && format == DATA_FORMAT_NHWC4) {
+      extent = ALIGN_UP4(extent);
     }
     buffer.dim[index].stride = size;
     size *= extent;
@@ -169,7 +175,13 @@ static const Tensor *createHostPlanar(const Tensor *source) {
 
   // no convert needed
   if (!device && !chunky) {
-    return source;
+    if (nullptr == source->host<void>() || TensorUtils::is_contiguous(source)) {
+      return source;
+    }
+    // views are read through a dense copy
+    auto dense = Tensor::create(source->shape(), source->getType());
+    TensorUtils::copy_strided(source, dense);
+    return dense;
   }
 
   // convert
@@ -205,148 +217,332 @@ static const Tensor *createHostPlanar(const Tensor *source) {
   }
 }
 
+//------------------------------- compare
+//-----------------------------------//
+// elements per block. the stats loop has no branches, the indices are only
+// searched in blocks with a mismatch
+static const int64_t COMPARE_BLOCK = 4096;
+static const int COMPARE_LANES = 4;
+
+struct CompareParam {
+  double tolerance;
+  double epsilon;
+  bool overall;
+  // max |expect| when overall
+  double overallMax;
+  int maxIndices;
+};
+
+// rank of a float among all floats, neighbours differ by 1
+static inline uint64_t ulp_order(float v) {
+  uint32_t bits;
+  ::memcpy(&bits, &v, sizeof(bits));
+  return (bits & 0x80000000u) ? (uint64_t)(~bits) : (uint64_t)bits | 0x80000000u;
+}
+
+static inline uint64_t ulp_order(double v) {
+  uint64_t bits;
+  ::memcpy(&bits, &v, sizeof(bits));
+  const uint64_t sign = 1ull << 63;
+  return (bits & sign) ? ~bits : bits | sign;
+}
+
+// float16 and bfloat16 elements, compared as floats
+struct HalfElement {
+  uint16_t bits;
+  explicit operator double() const { return CPUCast::half_to_float(bits); }
+};
+struct BF16Element {
+  uint16_t bits;
+  explicit operator double() const { return CPUCast::bf16_to_float(bits); }
+};
+
+static inline uint64_t ulp_order(uint16_t bits) {
+  return (bits & 0x8000u) ? (uint64_t)(uint16_t)~bits : (uint64_t)bits | 0x8000u;
+}
+
+template <typename T> static inline uint64_t ulp_distance(T a, T b) {
+  return a > b ? (uint64_t)a - (uint64_t)b : (uint64_t)b - (uint64_t)a;
+}
+
+static inline uint64_t ulp_distance(float a, float b) {
+  auto oa = ulp_order(a), ob = ulp_order(b);
+  return oa > ob ? oa - ob : ob - oa;
+}
+
+static inline uint64_t ulp_distance(double a, double b) {
+  auto oa = ulp_order(a), ob = ulp_order(b);
+  return oa > ob ? oa - ob : ob - oa;
+}
+
+// ulps of the 16 bit type
+static inline uint64_t ulp_distance(HalfElement a, HalfElement b) {
+  auto oa = ulp_order(a.bits), ob = ulp_order(b.bits);
+  return oa > ob ? oa - ob : ob - oa;
+}
+
+static inline uint64_t ulp_distance(BF16Element a, BF16Element b) {
+  auto oa = ulp_order(a.bits), ob = ulp_order(b.bits);
+  return oa > ob ? oa - ob : ob - oa;
+}
+
+// two nans are equal, as are two values both under epsilon
+static inline bool compare_exact(double va, double vb, const CompareParam &p) {
+  return va == vb || (std::isnan(va) && std::isnan(vb)) ||
+         (std::fabs(va) < p.epsilon && std::fabs(vb) < p.epsilon);
+}
+
+// |va - vb| / div <= tolerance without the division. nan and infinite
+// differences are never within
+static inline bool compare_within(double va, double vb,
+                                  const CompareParam &p) {
+  double diff = std::fabs(va - vb);
+  double div = p.overall ? p.overallMax : std::fabs(vb);
+  return diff < HUGE_VAL && diff <= p.tolerance * div;
+}
+
+// the max relative error is kept as relNum / relDen, compared by cross
+// products so no element needs a division. a zero relDen is infinite
 template <typename T>
-static void copyTensorToFloat(const Tensor *source, double *dest) {
-  auto srcData = source->host<T>();
-  auto size = source->elementSize();
-  for (int i = 0; i < size; ++i) {
-    dest[i] = srcData[i];
-  }
+static inline void compare_element(T a, T b, const CompareParam &p,
+                                   double &maxAbs, double &relNum,
+                                   double &relDen, uint64_t &maxUlp,
+                                   int64_t &bad) {
+  double va = (double)a, vb = (double)b;
+  bool exact = compare_exact(va, vb, p);
+  bad += !(exact || compare_within(va, vb, p));
+  double diff = exact ? 0.0 : std::fabs(va - vb);
+  double div = p.overall ? p.overallMax : std::fabs(vb);
+  uint64_t ulp = exact ? 0 : ulp_distance(a, b);
+  bool larger = diff * relDen > relNum * div;
+  relNum = larger ? diff : relNum;
+  relDen = larger ? div : relDen;
+  maxAbs = diff > maxAbs ? diff : maxAbs;
+  maxUlp = ulp > maxUlp ? ulp : maxUlp;
 }
 
-static bool equals(const double *pa, const double *pb, size_t size,
-                   double tolerance, double epsilon, bool overall,
-                   bool prints) {
-  // get max if using overall torelance
-  double max = fabs(pb[0]);
-  if (overall) {
-    for (int i = 1; i < size; i++) {
-      max = std::max(max, fabs(pb[i]));
+template <typename T>
+static void compare_range(const T *a, const T *b, int64_t begin, int64_t end,
+                          const CompareParam &p,
+                          TensorUtils::CompareStats &stats) {
+  for (int64_t x0 = begin; x0 < end; x0 += COMPARE_BLOCK) {
+    int64_t x1 = ALIMIN(end, x0 + COMPARE_BLOCK);
+    // COMPARE_LANES independent scalar chains, so the maxima don't wait on
+    // each other
+    double maxAbs[COMPARE_LANES], relNum[COMPARE_LANES], relDen[COMPARE_LANES];
+    uint64_t maxUlp[COMPARE_LANES];
+    for (int l = 0; l < COMPARE_LANES; ++l) {
+      maxAbs[l] = 0.0, relNum[l] = 0.0, relDen[l] = 1.0, maxUlp[l] = 0;
     }
-  }
-
-  // compare
-  for (int i = 0; i < size; i++) {
-    float va = pa[i], vb = pb[i];
-    if (std::isinf(va) && std::isinf(vb)) {
-      continue;
+    int64_t bad = 0;
+    int64_t i = x0;
+    for (; i + COMPARE_LANES <= x1; i += COMPARE_LANES) {
+      for (int l = 0; l < COMPARE_LANES; ++l) {
+        compare_element(a[i + l], b[i + l], p, maxAbs[l], relNum[l],
+                        relDen[l], maxUlp[l], bad);
+      }
     }
-    if (fabs(va) < epsilon && fabs(vb) < epsilon) {
-      continue;
+    for (; i < x1; ++i) {
+      compare_element(a[i], b[i], p, maxAbs[0], relNum[0], relDen[0],
+                      maxUlp[0], bad);
+    }
+    for (int l = 0; l < COMPARE_LANES; ++l) {
+      double rel = relNum[l] > 0.0 ? relNum[l] / relDen[l] : 0.0;
+      stats.maxAbsError = ALIMAX(stats.maxAbsError, maxAbs[l]);
+      stats.maxRelError = ALIMAX(stats.maxRelError, rel);
+      stats.maxUlp = ALIMAX(stats.maxUlp, maxUlp[l]);
     }
-    float div = overall ? max : fabsf(vb);
-    if (fabsf(va - vb) / div > tolerance) {
-      if (prints) {
-        printf("%d: %f != %f\n", i, va, vb);
+    stats.mismatches += bad;
+    auto &indices = stats.mismatchIndices;
+    for (int64_t i = x0; bad > 0 && i < x1 &&
+                         (int64_t)indices.size() < p.maxIndices;
+         ++i) {
+      double va = (double)a[i], vb = (double)b[i];
+      if (!compare_exact(va, vb, p) && !compare_within(va, vb, p)) {
+        indices.push_back(i);
       }
-      return false;
     }
   }
-  return true;
+  stats.count += end - begin;
 }
 
-bool TensorUtils::compare_tensors(const Tensor *compare, const Tensor *expect,
-                                  float tolerance, bool overall,
-                                  bool printsErrors, bool printsTensors) {
-  // type
-  if (compare->getType().code != expect->getType().code ||
-      compare->getType().bits != expect->getType().bits) {
-    if (printsErrors) {
-      printf("NOT equal in type: %d/%d - %d/%d.\n", compare->getType().code,
-             compare->getType().bits, expect->getType().code,
-             expect->getType().bits);
+template <typename T>
+static void compare_typed(const Tensor *compare, const Tensor *expect,
+                          int64_t count, CompareParam p,
+                          TensorUtils::CompareStats &stats, int threads) {
+  auto a = compare->host<T>();
+  auto b = expect->host<T>();
+  if (count * sizeof(T) < CPU_PARALLEL_BYTES) {
+    threads = 1;
+  }
+  threads = (int)ALIMAX(1, ALIMIN((int64_t)threads, count));
+  int64_t part = UP_DIV(count, (int64_t)threads);
+  if (p.overall) {
+    std::vector<double> maxs(threads, 0.0);
+    cpu_parallel_for(threads, threads, [&](int t) {
+      int64_t end = ALIMIN(count, part * (t + 1));
+      double m = 0.0;
+      for (int64_t i = part * t; i < end; ++i) {
+        double v = std::fabs((double)b[i]);
+        m = v > m ? v : m;
+      }
+      maxs[t] = m;
+    });
+    p.overallMax = *std::max_element(maxs.begin(), maxs.end());
+  }
+  std::vector<TensorUtils::CompareStats> parts(threads);
+  cpu_parallel_for(threads, threads, [&](int t) {
+    int64_t begin = ALIMIN(count, part * t);
+    int64_t end = ALIMIN(count, begin + part);
+    compare_range(a, b, begin, end, p, parts[t]);
+  });
+  // in order, the first indices come from the first parts
+  for (auto &s : parts) {
+    stats.count += s.count;
+    stats.mismatches += s.mismatches;
+    stats.maxAbsError = ALIMAX(stats.maxAbsError, s.maxAbsError);
+    stats.maxRelError = ALIMAX(stats.maxRelError, s.maxRelError);
+    stats.maxUlp = ALIMAX(stats.maxUlp, s.maxUlp);
+    for (auto i : s.mismatchIndices) {
+      if ((int64_t)stats.mismatchIndices.size() < p.maxIndices) {
+        stats.mismatchIndices.push_back(i);
+      }
     }
-    return false;
   }
+}
 
-  // dimensions
-  if (compare->dimensions() != expect->dimensions()) {
-    if (printsErrors) {
-      printf("NOT equal in dimensions: %d - %d.\n", compare->dimensions(),
-             expect->dimensions());
+static double element_at(const Tensor *tensor, int64_t i) {
+  auto type = tensor->getType();
+  auto host = tensor->host<uint8_t>();
+  switch (type.code) {
+  case halide_type_float:
+    if (16 == type.bits) {
+      return CPUCast::half_to_float(((const uint16_t *)host)[i]);
     }
+    return 64 == type.bits ? ((const double *)host)[i]
+                           : ((const float *)host)[i];
+  case halide_type_bfloat:
+    return CPUCast::bf16_to_float(((const uint16_t *)host)[i]);
+  case halide_type_int:
+    switch (type.bits) {
+    case 8:
+      return ((const int8_t *)host)[i];
+    case 16:
+      return ((const int16_t *)host)[i];
+    case 32:
+      return ((const int32_t *)host)[i];
+    default:
+      return (double)((const int64_t *)host)[i];
+    }
+  default:
+    switch (type.bits) {
+    case 8:
+      return ((const uint8_t *)host)[i];
+    case 16:
+      return ((const uint16_t *)host)[i];
+    case 32:
+      return ((const uint32_t *)host)[i];
+    default:
+      return (double)((const uint64_t *)host)[i];
+    }
+  }
+}
+
+static bool compare_host(const Tensor *compare, const Tensor *expect,
+                         TensorUtils::CompareStats &stats, float tolerance,
+                         bool overall, int maxIndices, int threads,
+                         bool printsErrors) {
+  stats = TensorUtils::CompareStats();
+  auto type = expect->getType();
+  if (compare->getType() != type || compare->shape() != expect->shape()) {
     return false;
   }
-  for (int i = 0; i < compare->dimensions(); i++) {
-    if (compare->length(i) == expect->length(i)) {
-      continue;
-    }
+  bool supported = false;
+  switch (type.code) {
+  case halide_type_float:
+    supported = 16 == type.bits || 32 == type.bits || 64 == type.bits;
+    break;
+  case halide_type_bfloat:
+    supported = 16 == type.bits;
+    break;
+  case halide_type_int:
+  case halide_type_uint:
+    supported = 8 == type.bits || 16 == type.bits || 32 == type.bits ||
+                64 == type.bits;
+    break;
+  default:
+    break;
+  }
+  if (!supported) {
     if (printsErrors) {
-      printf("NOT equal in dimensions[%d]: %d - %d.\n", i, compare->length(i),
-             expect->length(i));
+      printf("unsupported data type.");
     }
     return false;
   }
 
   // convert to host if needed
   auto a = createHostPlanar(compare), b = createHostPlanar(expect);
-
-  // get value as double
-  auto size = expect->elementSize();
-  std::vector<double> expectValue(expect->elementSize(), 0.0f);
-  std::vector<double> compareValue(compare->elementSize(), 0.0f);
-
-  auto result = false;
-  if (b->buffer().type.code == halide_type_uint) {
-    switch (b->buffer().type.bits) {
+  int64_t count = 1;
+  for (int i = 0; i < expect->dimensions(); ++i) {
+    count *= expect->length(i);
+  }
+  CompareParam p;
+  p.tolerance = tolerance;
+  p.epsilon = FLT_EPSILON;
+  p.overall = overall;
+  p.overallMax = 0.0;
+  p.maxIndices = ALIMAX(0, maxIndices);
+  threads = ALIMAX(1, threads);
+  if (halide_type_float == type.code) {
+    if (16 == type.bits) {
+      compare_typed<HalfElement>(a, b, count, p, stats, threads);
+    } else if (32 == type.bits) {
+      compare_typed<float>(a, b, count, p, stats, threads);
+    } else {
+      compare_typed<double>(a, b, count, p, stats, threads);
+    }
+  } else if (halide_type_bfloat == type.code) {
+    compare_typed<BF16Element>(a, b, count, p, stats, threads);
+  } else if (halide_type_int == type.code) {
+    switch (type.bits) {
     case 8:
-      copyTensorToFloat<uint8_t>(a, compareValue.data());
-      copyTensorToFloat<uint8_t>(b, expectValue.data());
+      compare_typed<int8_t>(a, b, count, p, stats, threads);
       break;
     case 16:
-      copyTensorToFloat<uint16_t>(a, compareValue.data());
-      copyTensorToFloat<uint16_t>(b, expectValue.data());
+      compare_typed<int16_t>(a, b, count, p, stats, threads);
       break;
     case 32:
-      copyTensorToFloat<uint32_t>(a, compareValue.data());
-      copyTensorToFloat<uint32_t>(b, expectValue.data());
-      break;
-    case 64:
-      copyTensorToFloat<uint64_t>(a, compareValue.data());
-      copyTensorToFloat<uint64_t>(b, expectValue.data());
+      compare_typed<int32_t>(a, b, count, p, stats, threads);
       break;
     default:
+      compare_typed<int64_t>(a, b, count, p, stats, threads);
       break;
     }
-  } else if (b->buffer().type.code == halide_type_int) {
-    switch (b->buffer().type.bits) {
+  } else {
+    switch (type.bits) {
     case 8:
-      copyTensorToFloat<int8_t>(a, compareValue.data());
-      copyTensorToFloat<int8_t>(b, expectValue.data());
+      compare_typed<uint8_t>(a, b, count, p, stats, threads);
       break;
     case 16:
-      copyTensorToFloat<int16_t>(a, compareValue.data());
-      copyTensorToFloat<int16_t>(b, expectValue.data());
-      break;
-    case 32:
-      copyTensorToFloat<int32_t>(a, compareValue.data());
-      copyTensorToFloat<int32_t>(b, expectValue.data());
-      break;
-    case 64:
-      copyTensorToFloat<int64_t>(a, compareValue.data());
-      copyTensorToFloat<int64_t>(b, expectValue.data());
-      break;
-    default:
+      compare_typed<uint16_t>(a, b, count, p, stats, threads);
       break;
-    }
-  } else if (b->buffer().type.code == halide_type_float) {
-    switch (b->buffer().type.bits) {
     case 32:
-      copyTensorToFloat<float>(a, compareValue.data());
-      copyTensorToFloat<float>(b, expectValue.data());
+      compare_typed<uint32_t>(a, b, count, p, stats, threads);
       break;
     default:
+      compare_typed<uint64_t>(a, b, count, p, stats, threads);
       break;
     }
-  } else {
-    if (printsErrors) {
-      printf("unsupported data type.");
-    }
   }
-  auto epsilon = FLT_EPSILON;
-  if ((NULL != compareValue.data()) && (NULL != expectValue.data())) {
-    result = equals(compareValue.data(), expectValue.data(), size, tolerance,
-                    epsilon, overall, printsErrors);
+  if (printsErrors && stats.mismatches > 0) {
+    printf("%lld of %lld not equal, max abs %g, max rel %g, max ulp %llu\n",
+           (long long)stats.mismatches, (long long)stats.count,
+           stats.maxAbsError, stats.maxRelError,
+           (unsigned long long)stats.maxUlp);
+    for (auto i : stats.mismatchIndices) {
+      printf("%lld: %f != %f\n", (long long)i, element_at(a, i),
+             element_at(b, i));
+    }
   }
 
   // clean up
@@ -356,7 +552,53 @@ bool TensorUtils::compare_tensors(const Tensor *compare, const Tensor *expect,
   if (b != expect) {
     delete b;
   }
-  return result;
+  return 0 == stats.mismatches;
+}
+
+bool TensorUtils::compare_tensors(const Tensor *compare, const Tensor *expect,
+                                  float tolerance, bool overall,
+                                  bool printsErrors, bool printsTensors) {
+  // type
+  if (compare->getType().code != expect->getType().code ||
+      compare->getType().bits != expect->getType().bits) {
+    if (printsErrors) {
+      printf("NOT equal in type: %d/%d - %d/%d.\n", compare->getType().code,
+             compare->getType().bits, expect->getType().code,
+             expect->getType().bits);
+    }
+    return false;
+  }
+
+  // dimensions
+  if (compare->dimensions() != expect->dimensions()) {
+    if (printsErrors) {
+      printf("NOT equal in dimensions: %d - %d.\n", compare->dimensions(),
+             expect->dimensions());
+    }
+    return false;
+  }
+  for (int i = 0; i < compare->dimensions(); i++) {
+    if (compare->length(i) == expect->length(i)) {
+      continue;
+    }
+    if (printsErrors) {
+      printf("NOT equal in dimensions[%d]: %d - %d.\n", i, compare->length(i),
+             expect->length(i));
+    }
+    return false;
+  }
+
+  CompareStats stats;
+  int threads = (int)ALIMAX(1u, std::thread::hardware_concurrency());
+  return compare_host(compare, expect, stats, tolerance, overall,
+                      printsErrors ? 1 : 0, threads, printsErrors);
+}
+
+bool TensorUtils::compare_tensors(const Tensor *compare, const Tensor *expect,
+                                  CompareStats &stats, float tolerance,
+                                  bool overall, int maxIndices, int threads) {
+  return compare_host(compare, expect, stats, tolerance, overall, maxIndices,
+                      threads, false);
 }
 
 // is copy only region
@@ -405,7 +647,7 @@ bool TensorUtils::is_depth_to_space_regions(const Tensor *output) {
     return false;
   }
   auto input = regions[0].origin;
-  for (const auto region : regions) {
+  for (const auto &region : regions) {
     if (region.origin != input) {
       return false;
     }
@@ -434,8 +676,9 @@ bool TensorUtils::is_depth_to_space_regions(const Tensor *output) {
 }
 
 // compute offset through region
-static inline int offsetCompute(const Tensor::InsideDescribe::Region &reg,
-                                int srcOffset, int dstOffset, bool backward) {
+static inline int64_t offsetCompute(const Tensor::InsideDescribe::Region &reg,
+                                    int64_t srcOffset, int64_t dstOffset,
+                                    bool backward) {
   const Tensor::InsideDescribe::View *src;
   const Tensor::InsideDescribe::View *dst;
   if (backward) {
@@ -445,7 +688,7 @@ static inline int offsetCompute(const Tensor::InsideDescribe::Region &reg,
     src = &reg.src;
     dst = &reg.dst;
   }
-  int res = 0;
+  int64_t res = 0;
   for (int i = 0; i < 3; i++) {
     if (reg.size[i] > 1) {
       res += (srcOffset / src->stride[i] - dstOffset / src->stride[i]) *
@@ -476,8 +719,8 @@ static inline bool expandSrc(std::vector<int> &src, std::vector<int> &dst,
   return false;
 }
 // expand stride and size with expand value
-static inline bool expandStrideSize(int *src, int *dst, int *size, int &num,
-                                    int expandValue) {
+static inline bool expandStrideSize(int64_t *src, int64_t *dst, int *size,
+                                    int &num, int64_t expandValue) {
 #define MNN_3_INT_INSERT(x, i, y)                                              \
   if (i == 2) {                                                                \
     x[2] = y;                                                                  \
@@ -492,12 +735,12 @@ static inline bool expandStrideSize(int *src, int *dst, int *size, int &num,
     return false;                                                              \
   }
   for (int i = num - 1; i >= 0; i--) {
-    int splitSize = expandValue / src[i];
+    int64_t splitSize = expandValue / src[i];
     if (!(expandValue % src[i] || size[i] % splitSize)) {
       MNN_3_INT_INSERT(src, i, expandValue)
       MNN_3_INT_INSERT(dst, i, (splitSize * dst[i]))
-      size[i] /= splitSize;
-      MNN_3_INT_INSERT(size, (i + 1), splitSize)
+      size[i] /= (int)splitSize;
+      MNN_3_INT_INSERT(size, (i + 1), (int)splitSize)
       if (++num > 3)
         return false;
       return true;
@@ -524,9 +767,9 @@ bool TensorUtils::ref_tensor_content(Tensor *dst, const Tensor *src) {
   return needMalloc;
 }
 
-static bool _ClipDst(int *stride, int srcOffset, int dstOffset,
+static bool _ClipDst(int64_t *stride, int64_t srcOffset, int64_t dstOffset,
                      const int *srcSize, const int *dstSize, const int sizeNum,
-                     int *dstMax, int *dstMin) {
+                     int64_t *dstMax, int64_t *dstMin) {
   /* Compute The range of dx, dy, dz:
    s0 * (dx-sx) + s1 * (dy-sy) + s2 * (dz-sz) + (doff-soff) = 0
    Assume the region won't be overlapped, then extract doff -> s0*xd+
@@ -538,12 +781,12 @@ static bool _ClipDst(int *stride, int srcOffset, int dstOffset,
    dy,dz compute the same
    **/
 
-  int offsetBias = dstOffset - srcOffset;
+  int64_t offsetBias = dstOffset - srcOffset;
   if (sizeNum == 0) {
     // All stride is zero, then size will be all one
     return offsetBias == 0;
   }
-  int o[3] = {0, 0, 0};
+  int64_t o[3] = {0, 0, 0};
   int validIndex[3] = {0, 1, 2};
   if (sizeNum == 2) {
     if (stride[0] < stride[1]) {
@@ -551,13 +794,13 @@ static bool _ClipDst(int *stride, int srcOffset, int dstOffset,
       validIndex[1] = 0;
     }
   } else if (sizeNum > 2) {
-    int maxs = stride[0];
-    int mins = stride[0];
+    int64_t maxs = stride[0];
+    int64_t mins = stride[0];
     int maxi = 0;
     int mini = 0;
     // Sort index by stride
     for (int i = 1; i < sizeNum; ++i) {
-      int s = stride[i];
+      int64_t s = stride[i];
       if (s > maxs) {
         maxs = s;
         maxi = i;
@@ -578,9 +821,9 @@ static bool _ClipDst(int *stride, int srcOffset, int dstOffset,
   }
   // Compute offset
   for (int i = 0; i < sizeNum; ++i) {
-    int s = stride[validIndex[i]];
-    int xs = srcOffset / s;
-    int xd = dstOffset / s;
+    int64_t s = stride[validIndex[i]];
+    int64_t xs = srcOffset / s;
+    int64_t xd = dstOffset / s;
     o[validIndex[i]] = xd - xs;
     srcOffset = srcOffset % s;
     dstOffset = dstOffset % s;
@@ -588,11 +831,11 @@ static bool _ClipDst(int *stride, int srcOffset, int dstOffset,
   if (0 != srcOffset || 0 != dstOffset) {
     return false;
   }
-  int srcMax = 0;
+  int64_t srcMax = 0;
   for (int i = 0; i < sizeNum; ++i) {
     srcMax += srcSize[i] * stride[i];
     dstMin[i] = ALIMAX(0, -o[i]);
-    dstMax[i] = ALIMIN(srcSize[i] - o[i], dstSize[i]);
+    dstMax[i] = ALIMIN(srcSize[i] - o[i], (int64_t)dstSize[i]);
   }
   // Check If dstMax is inside src, it means one region can't describe dst - src
   // TODO: Support slice region to support fuse
@@ -600,7 +843,7 @@ static bool _ClipDst(int *stride, int srcOffset, int dstOffset,
     if (dstMax[i] == dstSize[i]) {
       continue;
     }
-    int bias = offsetBias + dstMax[i] * stride[i];
+    int64_t bias = offsetBias + dstMax[i] * stride[i];
     if (bias < srcMax) {
       // for [dstMax, dstSize], exist value match formula
       return false;
@@ -608,23 +851,6 @@ static bool _ClipDst(int *stride, int srcOffset, int dstOffset,
   }
   return true;
 }
-static bool _RegionValid(int *stride, int offset, int *size, int sizeNum,
-                         size_t limitSize) {
-  int maxOffset = offset;
-  int minOffset = offset;
-  // Check start and end
-  for (int i = 0; i < sizeNum; ++i) {
-    if (stride[i] > 0) {
-      maxOffset += (stride[i] * (size[i] - 1));
-    } else {
-      minOffset += (stride[i] * (size[i] - 1));
-    }
-  }
-  if (minOffset < 0 || maxOffset >= limitSize) {
-    return false;
-  }
-  return true;
-}
 class TensorUtils::FuseRegionStatus {
 public:
   enum Status { FUSE_SRC_COPY, FUSE_DST_COPY, FUSE_REGION_COMPUTE };
@@ -664,7 +890,7 @@ public:
             if (dstSize[i] == 1) {
               expandIdx = i;
             }
-            dstReg.size[i + offset] = dstMax[i] - dstMin[i];
+            dstReg.size[i + offset] = (int)(dstMax[i] - dstMin[i]);
             valid[i] = dstSize[i] > 1;
           } else {
             dstReg.size[i + offset] = 1;
@@ -673,7 +899,7 @@ public:
         }
       } else {
         for (int i = 0; i < dstNum; ++i) {
-          dstReg.size[i + offset] = dstMax[i] - dstMin[i];
+          dstReg.size[i + offset] = (int)(dstMax[i] - dstMin[i]);
           valid[i] = dstSize[i] > 1 ? 1 : 0;
         }
       }
@@ -712,11 +938,11 @@ public:
         srcReg.dst.stride[2] > srcReg.size[1] * srcReg.size[2]) {
       copyValid = false;
     }
-    int dstTotalSize = 1, srcTotalSize = 1;
-    int dstSrcMin = dstReg.src.offset;
-    int dstSrcMax = dstSrcMin;
-    int srcDstMin = srcReg.dst.offset;
-    int srcDstMax = srcDstMin;
+    int64_t dstTotalSize = 1, srcTotalSize = 1;
+    int64_t dstSrcMin = dstReg.src.offset;
+    int64_t dstSrcMax = dstSrcMin;
+    int64_t srcDstMin = srcReg.dst.offset;
+    int64_t srcDstMax = srcDstMin;
     for (int i = 0; i < 3; i++) {
       srcDstMax += srcReg.dst.stride[i] * (srcReg.size[i] - 1);
       dstSrcMax += dstReg.src.stride[i] * (dstReg.size[i] - 1);
@@ -790,7 +1016,7 @@ public:
       r = x[i];                                                                \
     }                                                                          \
   }
-    int srcExtra = -1, dstExtra = -1;
+    int64_t srcExtra = -1, dstExtra = -1;
     MNN_3_INT_DIFF(srcExtra, srcStride, dstStride, 0)
     MNN_3_INT_DIFF(srcExtra, srcStride, dstStride, 1)
     MNN_3_INT_DIFF(srcExtra, srcStride, dstStride, 2)
@@ -852,16 +1078,17 @@ public:
 
 private:
   int mStatus;
-  int mSrcOff;
-  int mDstOff;
-  // general fuse
-  int srcDst[3], srcSrc[3], dstSrc[3], dstDst[3], srcSize[3], dstSize[3],
-      newSrc[3], dstStride[3], srcStride[3];
-  int dstMin[3], dstMax[3];
+  int64_t mSrcOff;
+  int64_t mDstOff;
+  // general fuse, strides and offsets in elements
+  int64_t srcDst[3], srcSrc[3], dstSrc[3], dstDst[3], newSrc[3], dstStride[3],
+      srcStride[3];
+  int srcSize[3], dstSize[3];
+  int64_t dstMin[3], dstMax[3];
   int newSrcSize[3];
   int srcNum, dstNum, sizeNum;
-  int newSrcOffset;
-  int newDstOffset;
+  int64_t newSrcOffset;
+  int64_t newDstOffset;
   int expandIdx;
 };
 
@@ -877,6 +1104,45 @@ void TensorUtils::FuseWrap::apply(const Tensor::InsideDescribe::Region &srcReg,
   mStatus->apply(srcReg, dstReg);
 }
 
+int TensorUtils::fuse_virtual_regions(Tensor *output) {
+  auto &regions = get_describe(output)->regions;
+  int fused = 0;
+  FuseWrap fuse;
+  for (auto &region : regions) {
+    while (nullptr != region.origin && output != region.origin) {
+      auto des = get_describe(region.origin);
+      if (Tensor::InsideDescribe::MEMORY_VIRTUAL != des->memoryType ||
+          1 != des->regions.size()) {
+        break;
+      }
+      auto &srcReg = des->regions[0];
+      if (nullptr == srcReg.origin || region.origin == srcReg.origin ||
+          !fuse.match(srcReg, region)) {
+        break;
+      }
+      fuse.apply(srcReg, region);
+      fused++;
+    }
+  }
+  // regions clipped to nothing read no origin
+  regions.erase(std::remove_if(regions.begin(), regions.end(),
+                               [](const Tensor::InsideDescribe::Region &r) {
+                                 return nullptr == r.origin;
+                               }),
+                regions.end());
+  return fused;
+}
+
+int TensorUtils::fuse_virtual_regions(const std::vector<Tensor *> &outputs) {
+  // in execution order a virtual tensor is fused before its readers, so they
+  // walk the shortened chain
+  int fused = 0;
+  for (auto output : outputs) {
+    fused += fuse_virtual_regions(output);
+  }
+  return fused;
+}
+
 void TensorUtils::adjust_tensor_for_compability(Tensor *newTensor) {
   if (newTensor->dimensions() < 4) {
     for (int n = newTensor->dimensions(); n < 4; ++n) {
@@ -922,6 +1188,107 @@ size_t TensorUtils::get_raw_size(const Tensor *t) {
 //     }
 // }
 
+static std::atomic<uint64_t> s_content_version(0);
+
+void TensorUtils::set_content_changed(const Tensor *tensor) {
+  get_describe(tensor)->contentVersion = ++s_content_version;
+}
+
+uint64_t TensorUtils::get_content_version(const Tensor *tensor) {
+  auto des = get_describe(tensor);
+  if (0 == des->contentVersion) {
+    des->contentVersion = ++s_content_version;
+  }
+  return des->contentVersion;
+}
+
+bool TensorUtils::is_contiguous(const Tensor *tensor) {
+  int64_t expect = 1;
+  for (int i = tensor->dimensions() - 1; i >= 0; --i) {
+    if (1 == tensor->length(i)) {
+      continue;
+    }
+    if (tensor->stride(i) != expect) {
+      return false;
+    }
+    expect *= tensor->length(i);
+  }
+  return true;
+}
+
+template <typename T>
+static void copy_strided_row(T *dst, int64_t dstStride, const T *src,
+                             int64_t srcStride, int count) {
+  for (int x = 0; x < count; ++x) {
+    dst[x * dstStride] = src[x * srcStride];
+  }
+}
+
+bool TensorUtils::copy_strided(const Tensor *src, Tensor *dst) {
+  auto s = src->host<uint8_t>();
+  auto d = dst->host<uint8_t>();
+  int bytes = src->getType().bytes();
+  if (nullptr == s || nullptr == d || src->shape() != dst->shape() ||
+      bytes != dst->getType().bytes()) {
+    return false;
+  }
+  int dims = src->dimensions();
+  if (0 == dims) {
+    ::memcpy(d, s, bytes);
+    return true;
+  }
+  // rows along the last dim, the outer dims walked by counters
+  int inner = src->length(dims - 1);
+  int64_t srcInner = src->stride(dims - 1), dstInner = dst->stride(dims - 1);
+  int64_t rows = 1;
+  for (int i = 0; i < dims - 1; ++i) {
+    rows *= src->length(i);
+  }
+  if (0 == rows || 0 == inner) {
+    return true;
+  }
+  int counters[MAX_TENSOR_DIM] = {0};
+  int64_t srcOffset = 0, dstOffset = 0;
+  for (int64_t r = 0; r < rows; ++r) {
+    auto sr = s + srcOffset * bytes;
+    auto dr = d + dstOffset * bytes;
+    if (1 == srcInner && 1 == dstInner) {
+      ::memcpy(dr, sr, (size_t)inner * bytes);
+    } else {
+      switch (bytes) {
+      case 1:
+        copy_strided_row(dr, dstInner, sr, srcInner, inner);
+        break;
+      case 2:
+        copy_strided_row((uint16_t *)dr, dstInner, (const uint16_t *)sr,
+                         srcInner, inner);
+        break;
+      case 4:
+        copy_strided_row((uint32_t *)dr, dstInner, (const uint32_t *)sr,
+                         srcInner, inner);
+        break;
+      default:
+        for (int x = 0; x < inner; ++x) {
+          ::memcpy(dr + (int64_t)x * dstInner * bytes,
+                   sr + (int64_t)x * srcInner * bytes, bytes);
+        }
+        break;
+      }
+    }
+    for (int i = dims - 2; i >= 0; --i) {
+      srcOffset += src->stride(i);
+      dstOffset += dst->stride(i);
+      if (++counters[i] < src->length(i)) {
+        break;
+      }
+      srcOffset -= (int64_t)src->stride(i) * src->length(i);
+      dstOffset -= (int64_t)dst->stride(i) * dst->length(i);
+      counters[i] = 0;
+    }
+  }
+  return true;
+}
+
 int TensorUtils::get_tensor_channel_pack(const Tensor *tensor) {
   auto srcDes = TensorUtils::get_describe(tensor);
   return srcDes->support_pack16 ? srcDes->channel_pack_num : 4;
@@ -1,5 +1,6 @@
 #include "tactics/math/common.h"
 #include "tactics/math/vec.h"
+#include "tactics/ops/cpu/cpu_cast.h"
 #include <algorithm>
 #include <string>
 
@@ -76,7 +77,7 @@ void matrix_sub_common(float *C, const float *A, const float *B, size_t width, s
       auto b = B + b_stride * y;
       auto c = C + c_stride * y;
       for (int x = 0; x < width; ++x) {
-        c[x] = a[x] + b[x];
+        c[x] = a[x] - b[x];
       }
     }
   }
@@ -101,4 +102,57 @@ void matrix_prod_common(float *C, const float *A, const float *B, size_t width,
       }
     }
   }
-}
\ No newline at end of file
+}
+
+// elements converted at once, the float rows stay on the stack
+static const size_t HALF_BLOCK = 256;
+
+typedef void (*MatrixProc)(float *C, const float *A, const float *B, size_t width, size_t c_stride,
+                           size_t a_stride, size_t b_stride, size_t height);
+typedef void (*LoadProc)(const uint16_t *src, float *dst, size_t count);
+typedef void (*StoreProc)(const float *src, uint16_t *dst, size_t count);
+
+static void matrix_half_common(uint16_t *C, const uint16_t *A, const uint16_t *B, size_t width, size_t c_stride,
+                               size_t a_stride, size_t b_stride, size_t height, MatrixProc proc, LoadProc load,
+                               StoreProc store) {
+  float a[HALF_BLOCK], b[HALF_BLOCK], c[HALF_BLOCK];
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x0 = 0; x0 < width; x0 += HALF_BLOCK) {
+      size_t count = std::min(width - x0, HALF_BLOCK);
+      load(A + a_stride * y + x0, a, count);
+      load(B + b_stride * y + x0, b, count);
+      proc(c, a, b, count, 0, 0, 0, 1);
+      store(c, C + c_stride * y + x0, count);
+    }
+  }
+}
+
+void matrix_add_common_fp16(uint16_t *C, const uint16_t *A, const uint16_t *B, size_t width, size_t c_stride, size_t a_stride, size_t b_stride, size_t height) {
+  matrix_half_common(C, A, B, width, c_stride, a_stride, b_stride, height, matrix_add_common,
+                     tactics::CPUCast::half_to_float, tactics::CPUCast::float_to_half);
+}
+
+void matrix_sub_common_fp16(uint16_t *C, const uint16_t *A, const uint16_t *B, size_t width, size_t c_stride, size_t a_stride, size_t b_stride, size_t height) {
+  matrix_half_common(C, A, B, width, c_stride, a_stride, b_stride, height, matrix_sub_common,
+                     tactics::CPUCast::half_to_float, tactics::CPUCast::float_to_half);
+}
+
+void matrix_prod_common_fp16(uint16_t *C, const uint16_t *A, const uint16_t *B, size_t width, size_t c_stride, size_t a_stride, size_t b_stride, size_t height) {
+  matrix_half_common(C, A, B, width, c_stride, a_stride, b_stride, height, matrix_prod_common,
+                     tactics::CPUCast::half_to_float, tactics::CPUCast::float_to_half);
+}
+
+void matrix_add_common_bf16(uint16_t *C, const uint16_t *A, const uint16_t *B, size_t width, size_t c_stride, size_t a_stride, size_t b_stride, size_t height) {
+  matrix_half_common(C, A, B, width, c_stride, a_stride, b_stride, height, matrix_add_common,
+                     tactics::CPUCast::bf16_to_float, tactics::CPUCast::float_to_bf16);
+}
+
+void matrix_sub_common_bf16(uint16_t *C, const uint16_t *A, const uint16_t *B, size_t width, size_t c_stride, size_t a_stride, size_t b_stride, size_t height) {
+  matrix_half_common(C, A, B, width, c_stride, a_stride, b_stride, height, matrix_sub_common,
+                     tactics::CPUCast::bf16_to_float, tactics::CPUCast::float_to_bf16);
+}
+
+void matrix_prod_common_bf16(uint16_t *C, const uint16_t *A, const uint16_t *B, size_t width, size_t c_stride, size_t a_stride, size_t b_stride, size_t height) {
+  matrix_half_common(C, A, B, width, c_stride, a_stride, b_stride, height, matrix_prod_common,
+                     tactics::CPUCast::bf16_to_float, tactics::CPUCast::float_to_bf16);
+}
@@ -29,6 +29,55 @@ Tensor* Matrix::create(int w, int h) {
   return result;
 }
 
+// the row kernels want columns next to each other, views from permute or
+// expand along the columns are copied to a dense tensor first
+static const Tensor *matrix_dense(const Tensor *tensor,
+                                  std::unique_ptr<Tensor> &holder) {
+  int dims = tensor->dimensions();
+  if (0 == dims || 1 == tensor->stride(dims - 1) ||
+      1 == tensor->length(dims - 1)) {
+    return tensor;
+  }
+  holder.reset(Tensor::create(tensor->shape(), tensor->getType()));
+  TensorUtils::copy_strided(tensor, holder.get());
+  return holder.get();
+}
+
+// results go to the holder of a dense copy, written back by matrix_store
+static Tensor *matrix_output(Tensor *tensor, std::unique_ptr<Tensor> &holder) {
+  int dims = tensor->dimensions();
+  if (0 == dims || 1 == tensor->stride(dims - 1) ||
+      1 == tensor->length(dims - 1)) {
+    return tensor;
+  }
+  holder.reset(Tensor::create(tensor->shape(), tensor->getType()));
+  return holder.get();
+}
+
+static void matrix_store(Tensor *tensor, const std::unique_ptr<Tensor> &holder) {
+  if (nullptr != holder) {
+    TensorUtils::copy_strided(holder.get(), tensor);
+  }
+}
+
+typedef decltype(&matrix_add_common) MatrixProc;
+typedef decltype(&matrix_add_common_fp16) MatrixHalfProc;
+
+// float32 goes to `fp32`, float16 and bfloat16 stay at half width
+static void matrix_common(Tensor *C, const Tensor *A, const Tensor *B, size_t width, int64_t c_stride,
+                          int64_t a_stride, int64_t b_stride, size_t height, MatrixProc fp32, MatrixHalfProc fp16,
+                          MatrixHalfProc bf16) {
+  auto type = C->getType();
+  assert(A->getType() == type && B->getType() == type);
+  if (halide_type_bfloat == type.code) {
+    bf16(C->host<uint16_t>(), A->host<uint16_t>(), B->host<uint16_t>(), width, c_stride, a_stride, b_stride, height);
+  } else if (16 == type.bits) {
+    fp16(C->host<uint16_t>(), A->host<uint16_t>(), B->host<uint16_t>(), width, c_stride, a_stride, b_stride, height);
+  } else {
+    fp32(C->host<float>(), A->host<float>(), B->host<float>(), width, c_stride, a_stride, b_stride, height);
+  }
+}
+
 void Matrix::multi(Tensor *C, const Tensor *A, const Tensor *B) {
   assert(C != nullptr);
   assert(B != nullptr);
@@ -46,9 +95,13 @@ void Matrix::multi(Tensor *C, const Tensor *A, const Tensor *B) {
   const int k = A->length(1);
   const int w = B->length(1);
 
-  const int aw = A->stride(0);
-  const int bw = B->stride(0);
-  const int cw = C->stride(0);
+  const int64_t aw = A->stride(0);
+  const int64_t bw = B->stride(0);
+  const int64_t cw = C->stride(0);
+  // 1 unless a view
+  const int64_t as = A->stride(1);
+  const int64_t bs = B->stride(1);
+  const int64_t cs = C->stride(1);
 
   assert(k == B->length(0));
 
@@ -59,12 +112,12 @@ void Matrix::multi(Tensor *C, const Tensor *A, const Tensor *B) {
     auto c_line = c + y * cw;
 
     for (; x < w; ++x) {
-      auto b_column = b + x;
+      auto b_column = b + x * bs;
       float sum = 0.0f;
       for (int i = 0; i < k; ++i) {
-        sum += a_line[i] * b_column[i * bw];
+        sum += a_line[i * as] * b_column[i * bw];
       }
-      c_line[x] = sum;
+      c_line[x * cs] = sum;
     }
   }
 }
@@ -73,11 +126,16 @@ void Matrix::add(Tensor *C, const Tensor *A, const Tensor *B) {
   assert(C != nullptr);
   assert(B != nullptr);
   assert(A != nullptr);
+  std::unique_ptr<Tensor> a_dense, b_dense, c_dense;
+  A = matrix_dense(A, a_dense);
+  B = matrix_dense(B, b_dense);
+  auto output = C;
+  C = matrix_output(C, c_dense);
 
   assert(A->size() == C->size());
   auto height = A->length(0);
   auto width = A->length(1);
-  int b_offset = 0;
+  int64_t b_offset = 0;
   if (B->dimensions() == A->dimensions()) {
     b_offset = B->stride(0);
     assert(B->length(1) == A->length(1));
@@ -86,7 +144,9 @@ void Matrix::add(Tensor *C, const Tensor *A, const Tensor *B) {
     b_offset = 0;
     assert(B->length(0) == A->length(1));
   }
-  matrix_add_common(C->host<float>(), A->host<float>(), B->host<float>(), width, C->stride(0), A->stride(0), b_offset, height);
+  matrix_common(C, A, B, width, C->stride(0), A->stride(0), b_offset, height, matrix_add_common,
+                matrix_add_common_fp16, matrix_add_common_bf16);
+  matrix_store(output, c_dense);
   return;
 }
 
@@ -94,11 +154,16 @@ void Matrix::sub(Tensor *C, const Tensor *A, const Tensor *B) {
   assert(C != nullptr);
   assert(B != nullptr);
   assert(A != nullptr);
+  std::unique_ptr<Tensor> a_dense, b_dense, c_dense;
+  A = matrix_dense(A, a_dense);
+  B = matrix_dense(B, b_dense);
+  auto output = C;
+  C = matrix_output(C, c_dense);
 
   assert(A->size() == C->size());
   auto height = A->length(0);
   auto width = A->length(1);
-  int b_offset = 0;
+  int64_t b_offset = 0;
   if (B->dimensions() == A->dimensions()) {
     b_offset = B->stride(0);
     assert(B->length(1) == A->length(1));
@@ -107,7 +172,9 @@ void Matrix::sub(Tensor *C, const Tensor *A, const Tensor *B) {
     b_offset = 0;
     assert(B->length(0) == A->length(1));
   }
-  matrix_sub_common(C->host<float>(), A->host<float>(), B->host<float>(), width, C->stride(0), A->stride(0), b_offset, height);
+  matrix_common(C, A, B, width, C->stride(0), A->stride(0), b_offset, height, matrix_sub_common,
+                matrix_sub_common_fp16, matrix_sub_common_bf16);
+  matrix_store(output, c_dense);
 }
 
 void Matrix::dot(Tensor *C, const Tensor *A, const Tensor *B) {
@@ -118,14 +185,22 @@ void Matrix::dot(Tensor *C, const Tensor *A, const Tensor *B) {
   assert(B->dimensions() == 2);
   assert(A->dimensions() == 2);
   assert(A->shape() == B->shape());
-  assert(A->shape() == C->shape());
+  assert(A->size() == C->size());
   const int height = A->length(0);
   const int width = A->length(1);
 
-  const int aw = A->stride(0);
-  const int bw = B->stride(0);
-  const int cw = C->stride(0);
-  matrix_prod_common(C->host<float>(), A->host<float>(), B->host<float>(), width, cw, aw, bw, height);
+  std::unique_ptr<Tensor> a_dense, b_dense, c_dense;
+  A = matrix_dense(A, a_dense);
+  B = matrix_dense(B, b_dense);
+  auto output = C;
+  C = matrix_output(C, c_dense);
+
+  const int64_t aw = A->stride(0);
+  const int64_t bw = B->stride(0);
+  const int64_t cw = C->stride(0);
+  matrix_common(C, A, B, width, cw, aw, bw, height, matrix_prod_common, matrix_prod_common_fp16,
+                matrix_prod_common_bf16);
+  matrix_store(output, c_dense);
 }
 
 void Matrix::invert(Tensor *dst, const Tensor *src) {
@@ -191,15 +266,17 @@ void Matrix::invert(Tensor *dst, const Tensor *src) {
 void Matrix::transpose(Tensor* dst, const Tensor *src) {
   auto a = src->host<float>();
   auto b = dst->host<float>();
-  int as = src->buffer().dim[0].stride;
-  int bs = dst->buffer().dim[0].stride;
+  int64_t as = src->buffer().dim[0].stride;
+  int64_t bs = dst->buffer().dim[0].stride;
+  int64_t ac = src->buffer().dim[1].stride;
+  int64_t bc = dst->buffer().dim[1].stride;
 
   int w = dst->buffer().dim[1].extent;
   int h = dst->buffer().dim[0].extent;
 
   for (int y = 0; y < h; ++y) {
     for (int x = 0; x < w; ++x) {
-      b[bs * y + x] = a[as * x + y];
+      b[bs * y + bc * x] = a[as * x + ac * y];
     }
   }
 }
@@ -212,12 +289,14 @@ void Matrix::print(const Tensor *C, const char* head) {
   }
   auto h = C->buffer().dim[0].extent;
   auto stride = C->buffer().dim[0].stride;
+  // merged columns are dense, unless a single one of a view
+  auto column = 2 == C->dimensions() ? C->buffer().dim[1].stride : 1;
 
   printf("%s\n", head);
 
   for (int y = 0; y < h; ++y) {
     for (int x = 0; x < w; ++x) {
-      printf("%.7f\t", c[x + y * stride]);
+      printf("%.7f\t", c[x * column + y * stride]);
     }
     printf("\n");
   }
@@ -232,8 +311,10 @@ void Matrix::mul(Tensor *dst, const Tensor *src, const float scale) {
   const int height = src->length(0);
   const int width = src->length(1);
 
-  const int sw = src->stride(0);
-  const int dw = dst->stride(0);
+  const int64_t sw = src->stride(0);
+  const int64_t dw = dst->stride(0);
+  const int64_t ss = src->stride(1);
+  const int64_t ds = dst->stride(1);
 
   for (int y = 0; y < height; y++) {
     auto s = src->host<float>() + y * sw;
@@ -241,7 +322,7 @@ void Matrix::mul(Tensor *dst, const Tensor *src, const float scale) {
     int i = 0;
 
     for (; i < width; ++i) {
-      d[i] = s[i] * scale;
+      d[i * ds] = s[i * ss] * scale;
     }
   }
 }
@@ -0,0 +1,186 @@
+//===------------------------tactics/ops/cpu/cpu_backend.cpp------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===-------------------------------------------------------------------------------===//
+//
+/// This file implements the cpu runtime and backend
+///
+//===-------------------------------------------------------------------------------===//
+#include "tactics/ops/cpu/cpu_backend.h"
+#include "tactics/core/tensor_utils.h"
+#include "tactics/ops/cpu/cpu_tensor_convert.h"
+
+namespace tactics {
+
+//------------------------------- CPURuntime
+//-----------------------------------//
+CPURuntime::CPURuntime(const Backend::Info &info)
+    : mThreadNumber(ALIMAX(1, info.numThread)) {
+  if (nullptr != info.user) {
+    mPrecision = info.user->precision;
+    mMemory = info.user->memory;
+  }
+  // not an arena allocator: every weight would get a mapping of its own
+  mStaticAllocator.reset(
+      new EagerBufferAllocator(BufferAllocator::Allocator::create_default()));
+  add_allocator(mStaticAllocator);
+}
+
+Backend *CPURuntime::on_create(const BackendConfig *config) const {
+  auto precision = mPrecision;
+  auto memory = mMemory;
+  if (nullptr != config) {
+    precision = config->precision;
+    memory = config->memory;
+  }
+  return new CPUBackend(this, precision, memory);
+}
+
+void CPURuntime::on_reset(int numberThread, const BackendConfig *config,
+                          bool full) {
+  mThreadNumber = ALIMAX(1, numberThread);
+  if (nullptr != config) {
+    mPrecision = config->precision;
+    mMemory = config->memory;
+  }
+}
+
+//------------------------------- CPUBackend
+//-----------------------------------//
+class CPUBackend::CPUMemObj : public Backend::MemObj {
+public:
+  // `generation` is nullptr for STATIC memory, which outlives every clear.
+  // the allocator is held, tensors may outlive the backend and the runtime
+  CPUMemObj(std::shared_ptr<const int> generation,
+            std::shared_ptr<BufferAllocator> allocator, MemChunk chunk)
+      : mGeneration(std::move(generation)), mAllocator(std::move(allocator)),
+        mChunk(chunk), mCreated(nullptr != mGeneration ? *mGeneration : 0) {}
+  virtual ~CPUMemObj() {
+    if (nullptr != mGeneration && *mGeneration != mCreated) {
+      return;
+    }
+    mAllocator->free(mChunk);
+  }
+  MemChunk chunk() override { return mChunk; }
+
+private:
+  std::shared_ptr<const int> mGeneration;
+  std::shared_ptr<BufferAllocator> mAllocator;
+  MemChunk mChunk;
+  int mCreated;
+};
+
+CPUBackend::CPUBackend(const CPURuntime *runtime,
+                       BackendConfig::PrecisionMode precision,
+                       BackendConfig::MemoryMode memory)
+    : Backend(FORWARD_CPU), mRuntime(runtime), mPrecision(precision),
+      mMemory(memory) {
+  mAllocatorType = (Runtime::AllocatorType)runtime->hint().memoryAllocatorType;
+  if (Runtime::Allocator_Eager == mAllocatorType) {
+    // dynamic memory is carved from the static allocator, so what one
+    // resize frees can hold the weights of the next
+    mDynamicAllocator.reset(new EagerBufferAllocator(
+        BufferAllocator::Allocator::create_recurse(
+            runtime->static_allocator())));
+  } else {
+    mAllocatorType = Runtime::Allocator_Defer;
+    mDynamicAllocator.reset(
+        new DeferBufferAllocator(runtime->create_arena_allocator()));
+  }
+  runtime->add_allocator(mDynamicAllocator,
+                         Runtime::Allocator_Eager == mAllocatorType);
+}
+
+CPUBackend::~CPUBackend() {
+  // nothing to do
+}
+
+size_t CPUBackend::get_bytes(const Tensor *tensor) {
+  return tensor->usize();
+}
+
+Backend::MemObj *CPUBackend::on_acquire(const Tensor *tensor,
+                                        StorageType storageType) {
+  auto size = get_bytes(tensor);
+  if (0 == size) {
+    return nullptr;
+  }
+  MemChunk chunk;
+  std::shared_ptr<BufferAllocator> allocator;
+  switch (storageType) {
+  case STATIC:
+    allocator = mRuntime->static_allocator();
+    chunk = allocator->alloc(size, false);
+    break;
+  case DYNAMIC:
+    allocator = mDynamicAllocator;
+    chunk = allocator->alloc(size, false);
+    break;
+  case DYNAMIC_SEPERATE:
+    allocator = mDynamicAllocator;
+    chunk = allocator->alloc(size, true);
+    break;
+  default:
+    break;
+  }
+  if (chunk.invalid()) {
+    return nullptr;
+  }
+  auto dest = const_cast<Tensor *>(tensor);
+  chunk.attach(dest);
+  // nullptr with Defer until on_resize_end
+  dest->buffer().host = chunk.ptr();
+  auto des = TensorUtils::get_describe(tensor);
+  des->extra.offset = 0;
+  des->memoryType = Tensor::InsideDescribe::MEMORY_BACKEND;
+  if (DYNAMIC_SEPERATE == storageType) {
+    // kept until on_clear_buffer
+    return new MemObj;
+  }
+  return new CPUMemObj(STATIC == storageType ? nullptr : mGeneration,
+                       allocator, chunk);
+}
+
+bool CPUBackend::on_clear_buffer() {
+  mDynamicAllocator->release(true);
+  (*mGeneration)++;
+  return true;
+}
+
+void CPUBackend::on_copy_buffer(const Tensor *srcTensor,
+                                const Tensor *dstTensor) const {
+  if (nullptr == srcTensor->buffer().host ||
+      nullptr == dstTensor->buffer().host) {
+    return;
+  }
+  if (CPUTensorConverter::convert(srcTensor, dstTensor,
+                                  mRuntime->thread_number())) {
+    TensorUtils::set_content_changed(dstTensor);
+  }
+}
+
+void CPUBackend::on_resize_begin() {
+  if (Runtime::Allocator_Defer == mAllocatorType) {
+    mDynamicAllocator->reset();
+    (*mGeneration)++;
+  }
+}
+
+bool CPUBackend::on_resize_end() { return mDynamicAllocator->compute(); }
+
+class CPURuntimeCreator : public RuntimeCreator {
+public:
+  Runtime *on_create(const Backend::Info &info) const override {
+    return new CPURuntime(info);
+  }
+};
+
+void register_cpu_runtime_creator() {
+  static CPURuntimeCreator creator;
+  insert_extra_runtime_creator(FORWARD_CPU, &creator);
+}
+
+} // namespace tactics
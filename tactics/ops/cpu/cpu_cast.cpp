@@ -0,0 +1,241 @@
+//===------------------------tactics/ops/cpu/cpu_cast.cpp------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===----------------------------------------------------------------------------===//
+//
+/// This file implements the float32, float16 and bfloat16 casts of host tensors
+///
+//===----------------------------------------------------------------------------===//
+#include "tactics/ops/cpu/cpu_cast.h"
+#include "tactics/core/tensor_utils.h"
+#include "tactics/math/vec.h"
+#include "tactics/ops/cpu/cpu_parallel.h"
+
+// F16C is built with a target attribute and picked at runtime, so the rest
+// of the library keeps its flags
+#if defined(USE_SSE) && (defined(__GNUC__) || defined(__clang__))
+#define TACTICS_CAST_F16C
+#endif
+
+namespace tactics {
+
+// elements of half and bfloat16 cast through a float block on the stack
+static const size_t CAST_BLOCK = 64;
+
+//------------------------------- kernels
+//-----------------------------------//
+#ifdef TACTICS_CAST_F16C
+__attribute__((target("avx,f16c"))) static void
+half_to_float_f16c(const uint16_t *src, float *dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    auto h = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+  }
+  for (; i < count; ++i) {
+    dst[i] = CPUCast::half_to_float(src[i]);
+  }
+}
+
+__attribute__((target("avx,f16c"))) static void
+float_to_half_f16c(const float *src, uint16_t *dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    auto h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                             _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    _mm_storeu_si128((__m128i *)(dst + i), h);
+  }
+  for (; i < count; ++i) {
+    dst[i] = CPUCast::float_to_half(src[i]);
+  }
+}
+
+static bool has_f16c() {
+#ifdef __F16C__
+  return true;
+#else
+  static const bool supported = __builtin_cpu_supports("f16c");
+  return supported;
+#endif
+}
+#endif
+
+void CPUCast::half_to_float(const uint16_t *src, float *dst, size_t count) {
+#ifdef TACTICS_CAST_F16C
+  if (has_f16c()) {
+    half_to_float_f16c(src, dst, count);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = half_to_float(src[i]);
+  }
+}
+
+void CPUCast::float_to_half(const float *src, uint16_t *dst, size_t count) {
+#ifdef TACTICS_CAST_F16C
+  if (has_f16c()) {
+    float_to_half_f16c(src, dst, count);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = float_to_half(src[i]);
+  }
+}
+
+void CPUCast::bf16_to_float(const uint16_t *src, float *dst, size_t count) {
+  size_t i = 0;
+#ifdef USE_SSE
+  // the bfloat16 bits go to the high half of each float
+  auto zero = _mm_setzero_si128();
+  for (; i + 8 <= count; i += 8) {
+    auto h = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi16(zero, h));
+    _mm_storeu_si128((__m128i *)(dst + i + 4), _mm_unpackhi_epi16(zero, h));
+  }
+#endif
+  for (; i < count; ++i) {
+    dst[i] = bf16_to_float(src[i]);
+  }
+}
+
+#ifdef USE_SSE
+// 4 floats rounded to nearest even, in the low 16 bits sign extended
+static inline __m128i float_to_bf16_sse(__m128 v) {
+  auto x = _mm_castps_si128(v);
+  auto lsb = _mm_and_si128(_mm_srli_epi32(x, 16), _mm_set1_epi32(1));
+  auto rounded = _mm_add_epi32(_mm_add_epi32(x, _mm_set1_epi32(0x7fff)), lsb);
+  auto nan = _mm_cmpgt_epi32(_mm_and_si128(x, _mm_set1_epi32(0x7fffffff)),
+                             _mm_set1_epi32(0x7f800000));
+  auto quiet = _mm_or_si128(x, _mm_set1_epi32(0x400000));
+  auto r = _mm_or_si128(_mm_and_si128(nan, quiet),
+                        _mm_andnot_si128(nan, rounded));
+  return _mm_srai_epi32(r, 16);
+}
+#endif
+
+void CPUCast::float_to_bf16(const float *src, uint16_t *dst, size_t count) {
+  size_t i = 0;
+#ifdef USE_SSE
+  for (; i + 8 <= count; i += 8) {
+    auto lo = float_to_bf16_sse(_mm_loadu_ps(src + i));
+    auto hi = float_to_bf16_sse(_mm_loadu_ps(src + i + 4));
+    // sign extended, so the saturating pack keeps the bits
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(lo, hi));
+  }
+#endif
+  for (; i < count; ++i) {
+    dst[i] = float_to_bf16(src[i]);
+  }
+}
+
+//------------------------------- CPUCast
+//-----------------------------------//
+enum CastType { CAST_NONE, CAST_FLOAT, CAST_HALF, CAST_BF16 };
+
+static CastType cast_type(halide_type_t type) {
+  if (halide_type_float == type.code && 32 == type.bits) {
+    return CAST_FLOAT;
+  }
+  if (halide_type_float == type.code && 16 == type.bits) {
+    return CAST_HALF;
+  }
+  if (halide_type_bfloat == type.code && 16 == type.bits) {
+    return CAST_BF16;
+  }
+  return CAST_NONE;
+}
+
+bool CPUCast::can_cast(halide_type_t from, halide_type_t to) {
+  return CAST_NONE != cast_type(from) && CAST_NONE != cast_type(to);
+}
+
+// elements [begin, end)
+static void cast_range(const void *src, CastType from, void *dst, CastType to,
+                       size_t begin, size_t end) {
+  size_t count = end - begin;
+  if (from == to) {
+    size_t bytes = CAST_FLOAT == from ? 4 : 2;
+    ::memcpy((uint8_t *)dst + begin * bytes,
+             (const uint8_t *)src + begin * bytes, count * bytes);
+    return;
+  }
+  if (CAST_FLOAT == from) {
+    auto s = (const float *)src + begin;
+    auto d = (uint16_t *)dst + begin;
+    if (CAST_HALF == to) {
+      CPUCast::float_to_half(s, d, count);
+    } else {
+      CPUCast::float_to_bf16(s, d, count);
+    }
+    return;
+  }
+  if (CAST_FLOAT == to) {
+    auto s = (const uint16_t *)src + begin;
+    auto d = (float *)dst + begin;
+    if (CAST_HALF == from) {
+      CPUCast::half_to_float(s, d, count);
+    } else {
+      CPUCast::bf16_to_float(s, d, count);
+    }
+    return;
+  }
+  // half and bfloat16 through a float block on the stack
+  float block[CAST_BLOCK];
+  auto s = (const uint16_t *)src;
+  auto d = (uint16_t *)dst;
+  for (size_t x0 = begin; x0 < end; x0 += CAST_BLOCK) {
+    size_t n = ALIMIN(end - x0, CAST_BLOCK);
+    if (CAST_HALF == from) {
+      CPUCast::half_to_float(s + x0, block, n);
+      CPUCast::float_to_bf16(block, d + x0, n);
+    } else {
+      CPUCast::bf16_to_float(s + x0, block, n);
+      CPUCast::float_to_half(block, d + x0, n);
+    }
+  }
+}
+
+bool CPUCast::cast(const void *src, halide_type_t from, void *dst,
+                   halide_type_t to, size_t count, int threads) {
+  auto fromType = cast_type(from), toType = cast_type(to);
+  if (CAST_NONE == fromType || CAST_NONE == toType) {
+    return false;
+  }
+  if (0 == count) {
+    return true;
+  }
+  if (count * 4 < CPU_PARALLEL_BYTES) {
+    threads = 1;
+  }
+  size_t part = ROUND_UP(UP_DIV(count, (size_t)ALIMAX(1, threads)),
+                         CPU_PARALLEL_ALIGN);
+  int units = (int)UP_DIV(count, part);
+  cpu_parallel_for(units, threads, [&](int u) {
+    size_t begin = part * u;
+    cast_range(src, fromType, dst, toType, begin, ALIMIN(count, begin + part));
+  });
+  return true;
+}
+
+bool CPUCast::cast(const Tensor *input, const Tensor *output, int threads) {
+  auto src = input->buffer().host;
+  auto dst = output->buffer().host;
+  if (nullptr == src || nullptr == dst || input->shape() != output->shape() ||
+      TensorUtils::get_describe(input)->dimension_format !=
+          TensorUtils::get_describe(output)->dimension_format) {
+    return false;
+  }
+  auto inType = input->getType(), outType = output->getType();
+  size_t count = input->usize() / inType.bytes();
+  if (count != output->usize() / outType.bytes()) {
+    return false;
+  }
+  return cast(src, inType, dst, outType, count, threads);
+}
+
+} // namespace tactics
@@ -0,0 +1,514 @@
+//===------------------------tactics/ops/cpu/cpu_quantize.cpp------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===--------------------------------------------------------------------------------===//
+//
+/// This file implements the int8 quantization and calibration of host tensors
+///
+//===--------------------------------------------------------------------------------===//
+#include "tactics/ops/cpu/cpu_quantize.h"
+#include "tactics/math/vec.h"
+#include "tactics/ops/cpu/cpu_parallel.h"
+#include <algorithm>
+#include <cmath>
+
+namespace tactics {
+
+using Vec4 = Vec<float, 4>;
+
+// bins of the calibration histogram, a power of 2 so they merge in pairs
+static const int QUANT_BINS = 2048;
+
+//------------------------------- kernels
+//-----------------------------------//
+// the same steps as the vector path, maxps and minps send nan to lo
+template <typename T>
+static inline T quant_scalar(float x, float inv, float zero, float lo,
+                             float hi) {
+  float v = x * inv + zero;
+  v = v > lo ? v : lo;
+  v = v < hi ? v : hi;
+  return (T)lrintf(v);
+}
+
+#ifdef USE_SSE
+static inline __m128i quant_sse(const float *src, __m128 inv, __m128 zero,
+                                __m128 lo, __m128 hi) {
+  auto v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src), inv), zero);
+  return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, lo), hi));
+}
+
+// 16 clamped int32 to bytes, the saturating packs keep them exact
+static inline __m128i quant_pack(const __m128i *v, int8_t *) {
+  return _mm_packs_epi16(_mm_packs_epi32(v[0], v[1]),
+                         _mm_packs_epi32(v[2], v[3]));
+}
+static inline __m128i quant_pack(const __m128i *v, uint8_t *) {
+  return _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]),
+                          _mm_packs_epi32(v[2], v[3]));
+}
+
+// 16 bytes to 4 x 4 int32
+static inline void dequant_widen(__m128i q, __m128i *v, const int8_t *) {
+  auto lo = _mm_srai_epi16(_mm_unpacklo_epi8(q, q), 8);
+  auto hi = _mm_srai_epi16(_mm_unpackhi_epi8(q, q), 8);
+  v[0] = _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16);
+  v[1] = _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16);
+  v[2] = _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16);
+  v[3] = _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16);
+}
+static inline void dequant_widen(__m128i q, __m128i *v, const uint8_t *) {
+  auto z = _mm_setzero_si128();
+  auto lo = _mm_unpacklo_epi8(q, z), hi = _mm_unpackhi_epi8(q, z);
+  v[0] = _mm_unpacklo_epi16(lo, z);
+  v[1] = _mm_unpackhi_epi16(lo, z);
+  v[2] = _mm_unpacklo_epi16(hi, z);
+  v[3] = _mm_unpackhi_epi16(hi, z);
+}
+#endif
+
+// one inverse scale and zero for all, or one per element when PerElement
+template <typename T, bool PerElement>
+static void quant_run(const float *src, T *dst, size_t count, const float *inv,
+                      const float *zero, float lo, float hi) {
+  size_t i = 0;
+#ifdef USE_SSE
+  auto loV = _mm_set1_ps(lo), hiV = _mm_set1_ps(hi);
+  auto invV = _mm_set1_ps(inv[0]), zeroV = _mm_set1_ps(zero[0]);
+  for (; i + 16 <= count; i += 16) {
+    __m128i v[4];
+    for (int k = 0; k < 4; ++k) {
+      if (PerElement) {
+        invV = _mm_loadu_ps(inv + i + 4 * k);
+        zeroV = _mm_loadu_ps(zero + i + 4 * k);
+      }
+      v[k] = quant_sse(src + i + 4 * k, invV, zeroV, loV, hiV);
+    }
+    _mm_storeu_si128((__m128i *)(dst + i), quant_pack(v, dst));
+  }
+#endif
+  for (; i < count; ++i) {
+    size_t p = PerElement ? i : 0;
+    dst[i] = quant_scalar<T>(src[i], inv[p], zero[p], lo, hi);
+  }
+}
+
+template <typename T, bool PerElement>
+static void dequant_run(const T *src, float *dst, size_t count,
+                        const float *scale, const float *zero) {
+  size_t i = 0;
+#ifdef USE_SSE
+  auto scaleV = _mm_set1_ps(scale[0]), zeroV = _mm_set1_ps(zero[0]);
+  for (; i + 16 <= count; i += 16) {
+    __m128i v[4];
+    dequant_widen(_mm_loadu_si128((const __m128i *)(src + i)), v, src);
+    for (int k = 0; k < 4; ++k) {
+      if (PerElement) {
+        scaleV = _mm_loadu_ps(scale + i + 4 * k);
+        zeroV = _mm_loadu_ps(zero + i + 4 * k);
+      }
+      auto x = _mm_sub_ps(_mm_cvtepi32_ps(v[k]), zeroV);
+      _mm_storeu_ps(dst + i + 4 * k, _mm_mul_ps(x, scaleV));
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    size_t p = PerElement ? i : 0;
+    dst[i] = ((float)src[i] - zero[p]) * scale[p];
+  }
+}
+
+void CPUQuantize::quantize(const float *src, int8_t *dst, size_t count,
+                           float scale, float zero, float min, float max) {
+  float inv = 1.0f / scale;
+  quant_run<int8_t, false>(src, dst, count, &inv, &zero, ALIMAX(min, -128.0f),
+                           ALIMIN(max, 127.0f));
+}
+
+void CPUQuantize::quantize(const float *src, uint8_t *dst, size_t count,
+                           float scale, float zero, float min, float max) {
+  float inv = 1.0f / scale;
+  quant_run<uint8_t, false>(src, dst, count, &inv, &zero, ALIMAX(min, 0.0f),
+                            ALIMIN(max, 255.0f));
+}
+
+void CPUQuantize::dequantize(const int8_t *src, float *dst, size_t count,
+                             float scale, float zero) {
+  dequant_run<int8_t, false>(src, dst, count, &scale, &zero);
+}
+
+void CPUQuantize::dequantize(const uint8_t *src, float *dst, size_t count,
+                             float scale, float zero) {
+  dequant_run<uint8_t, false>(src, dst, count, &scale, &zero);
+}
+
+//------------------------------- CPUQuantize
+//-----------------------------------//
+static bool quant_type(halide_type_t type) {
+  return 8 == type.bits &&
+         (halide_type_int == type.code || halide_type_uint == type.code);
+}
+
+// per channel scales and zeros, or a single one. zeros may be left empty
+static bool quant_params(const QuantAttr &attr, size_t channel,
+                         std::vector<float> &scales,
+                         std::vector<float> &zeros) {
+  if (attr.scales.empty()) {
+    if (1 != channel) {
+      return false;
+    }
+    scales.assign(1, attr.scale);
+    zeros.assign(1, attr.zero);
+  } else {
+    if (attr.scales.size() != channel ||
+        (!attr.zeros.empty() && attr.zeros.size() != channel)) {
+      return false;
+    }
+    scales = attr.scales;
+    zeros = attr.zeros;
+    zeros.resize(channel, 0.0f);
+  }
+  for (auto s : scales) {
+    if (!(s > 0.0f)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// [outer, channel, inner] in units of a thread. rows of a parameter per
+// element when the channel is last, runs of one parameter otherwise
+template <typename Run, typename Row>
+static void quant_parallel(size_t outer, size_t channel, size_t inner,
+                           int threads, const Run &run, const Row &row) {
+  size_t count = outer * channel * inner;
+  if (0 == count) {
+    return;
+  }
+  if (count * sizeof(float) < CPU_PARALLEL_BYTES) {
+    threads = 1;
+  }
+  threads = ALIMAX(1, threads);
+  if (1 == inner && channel > 1) {
+    size_t part = UP_DIV(outer, (size_t)threads);
+    int units = (int)UP_DIV(outer, part);
+    cpu_parallel_for(units, threads, [&](int u) {
+      size_t end = ALIMIN(outer, part * (u + 1));
+      for (size_t o = part * u; o < end; ++o) {
+        row(o * channel, channel);
+      }
+    });
+    return;
+  }
+  size_t part = ROUND_UP(UP_DIV(count, (size_t)threads), CPU_PARALLEL_ALIGN);
+  int units = (int)UP_DIV(count, part);
+  cpu_parallel_for(units, threads, [&](int u) {
+    size_t i = part * u, end = ALIMIN(count, i + part);
+    while (i < end) {
+      size_t index = i / inner;
+      size_t n = ALIMIN(end, (index + 1) * inner) - i;
+      run(i, n, index % channel);
+      i += n;
+    }
+  });
+}
+
+template <typename T>
+static void quantize_typed(const float *src, T *dst,
+                           const std::vector<float> &scales,
+                           const std::vector<float> &zeros, float lo, float hi,
+                           size_t outer, size_t channel, size_t inner,
+                           int threads) {
+  std::vector<float> inv(scales.size());
+  for (size_t c = 0; c < scales.size(); ++c) {
+    inv[c] = 1.0f / scales[c];
+  }
+  quant_parallel(
+      outer, channel, inner, threads,
+      [&](size_t i, size_t n, size_t c) {
+        quant_run<T, false>(src + i, dst + i, n, &inv[c], &zeros[c], lo, hi);
+      },
+      [&](size_t i, size_t n) {
+        quant_run<T, true>(src + i, dst + i, n, inv.data(), zeros.data(), lo,
+                           hi);
+      });
+}
+
+template <typename T>
+static void dequantize_typed(const T *src, float *dst,
+                             const std::vector<float> &scales,
+                             const std::vector<float> &zeros, size_t outer,
+                             size_t channel, size_t inner, int threads) {
+  quant_parallel(
+      outer, channel, inner, threads,
+      [&](size_t i, size_t n, size_t c) {
+        dequant_run<T, false>(src + i, dst + i, n, &scales[c], &zeros[c]);
+      },
+      [&](size_t i, size_t n) {
+        dequant_run<T, true>(src + i, dst + i, n, scales.data(), zeros.data());
+      });
+}
+
+bool CPUQuantize::is_quantized(const Tensor *tensor) {
+  return quant_type(tensor->getType()) &&
+         nullptr != TensorUtils::get_describe(tensor)->quantAttr;
+}
+
+bool CPUQuantize::split(const Tensor *tensor, const QuantAttr &attr,
+                        size_t &outer, size_t &channel, size_t &inner) {
+  outer = 1, channel = 1;
+  inner = tensor->usize() / tensor->getType().bytes();
+  if (attr.scales.empty()) {
+    return true;
+  }
+  int dims = tensor->dimensions();
+  auto format = TensorUtils::get_describe(tensor)->dimension_format;
+  if (attr.axis < 0 || attr.axis >= dims ||
+      (dims > 1 &&
+       (DATA_FORMAT_NC4HW4 == format || DATA_FORMAT_NHWC4 == format))) {
+    return false;
+  }
+  inner = 1;
+  for (int i = 0; i < dims; ++i) {
+    size_t length = tensor->length(i);
+    if (i < attr.axis) {
+      outer *= length;
+    } else if (i > attr.axis) {
+      inner *= length;
+    }
+  }
+  channel = tensor->length(attr.axis);
+  return attr.scales.size() == channel;
+}
+
+bool CPUQuantize::quantize(const float *src, void *dst, halide_type_t type,
+                           const QuantAttr &attr, size_t outer, size_t channel,
+                           size_t inner, int threads) {
+  std::vector<float> scales, zeros;
+  if (!quant_type(type) || !quant_params(attr, channel, scales, zeros)) {
+    return false;
+  }
+  if (halide_type_int == type.code) {
+    quantize_typed(src, (int8_t *)dst, scales, zeros,
+                   ALIMAX(attr.min, -128.0f), ALIMIN(attr.max, 127.0f), outer,
+                   channel, inner, threads);
+  } else {
+    quantize_typed(src, (uint8_t *)dst, scales, zeros,
+                   ALIMAX(attr.min, 0.0f), ALIMIN(attr.max, 255.0f), outer,
+                   channel, inner, threads);
+  }
+  return true;
+}
+
+bool CPUQuantize::dequantize(const void *src, halide_type_t type, float *dst,
+                             const QuantAttr &attr, size_t outer,
+                             size_t channel, size_t inner, int threads) {
+  std::vector<float> scales, zeros;
+  if (!quant_type(type) || !quant_params(attr, channel, scales, zeros)) {
+    return false;
+  }
+  if (halide_type_int == type.code) {
+    dequantize_typed((const int8_t *)src, dst, scales, zeros, outer, channel,
+                     inner, threads);
+  } else {
+    dequantize_typed((const uint8_t *)src, dst, scales, zeros, outer, channel,
+                     inner, threads);
+  }
+  return true;
+}
+
+// `quantized` carries the QuantAttr, `floats` is float32 in the same layout
+static bool quant_pair(const Tensor *floats, const Tensor *quantized,
+                       size_t &outer, size_t &channel, size_t &inner) {
+  if (nullptr == floats->host<void>() || nullptr == quantized->host<void>() ||
+      halide_type_of<float>() != floats->getType() ||
+      !CPUQuantize::is_quantized(quantized) ||
+      floats->shape() != quantized->shape() ||
+      TensorUtils::get_describe(floats)->dimension_format !=
+          TensorUtils::get_describe(quantized)->dimension_format) {
+    return false;
+  }
+  auto &attr = *TensorUtils::get_describe(quantized)->quantAttr;
+  return CPUQuantize::split(quantized, attr, outer, channel, inner);
+}
+
+bool CPUQuantize::quantize(const Tensor *input, const Tensor *output,
+                           int threads) {
+  size_t outer, channel, inner;
+  if (!quant_pair(input, output, outer, channel, inner)) {
+    return false;
+  }
+  return quantize(input->host<float>(), output->host<void>(),
+                  output->getType(), *TensorUtils::get_describe(output)->quantAttr,
+                  outer, channel, inner, threads);
+}
+
+bool CPUQuantize::dequantize(const Tensor *input, const Tensor *output,
+                             int threads) {
+  size_t outer, channel, inner;
+  if (!quant_pair(output, input, outer, channel, inner)) {
+    return false;
+  }
+  return dequantize(input->host<void>(), input->getType(),
+                    output->host<float>(),
+                    *TensorUtils::get_describe(input)->quantAttr, outer,
+                    channel, inner, threads);
+}
+
+//------------------------------- QuantCalibrator
+//-----------------------------------//
+QuantCalibrator::QuantCalibrator(Method method, int axis, float percentile)
+    : mMethod(method), mAxis(axis), mPercentile(percentile) {}
+
+// widens [lo, hi] to the values of `src`
+static void quant_min_max(const float *src, size_t count, float &lo,
+                          float &hi) {
+  size_t count4 = count / 4 * 4;
+  if (count4 > 0) {
+    Vec4 minV(lo), maxV(hi);
+    for (size_t i = 0; i < count4; i += 4) {
+      auto v = Vec4::load(src + i);
+      minV = Vec4::min(minV, v);
+      maxV = Vec4::max(maxV, v);
+    }
+    for (int j = 0; j < 4; ++j) {
+      lo = ALIMIN(lo, minV[j]);
+      hi = ALIMAX(hi, maxV[j]);
+    }
+  }
+  for (size_t i = count4; i < count; ++i) {
+    lo = ALIMIN(lo, src[i]);
+    hi = ALIMAX(hi, src[i]);
+  }
+}
+
+bool QuantCalibrator::observe(const Tensor *tensor) {
+  auto src = tensor->host<float>();
+  if (nullptr == src || halide_type_of<float>() != tensor->getType()) {
+    return false;
+  }
+  size_t outer = 1, channel = 1, inner = tensor->usize() / sizeof(float);
+  if (mAxis >= 0) {
+    if (mAxis >= tensor->dimensions()) {
+      return false;
+    }
+    QuantAttr attr;
+    attr.axis = mAxis;
+    attr.scales.resize(tensor->length(mAxis));
+    if (!CPUQuantize::split(tensor, attr, outer, channel, inner)) {
+      return false;
+    }
+  }
+  if (mMin.empty()) {
+    mMin.assign(channel, INFINITY);
+    mMax.assign(channel, -INFINITY);
+  } else if (mMin.size() != channel) {
+    return false;
+  }
+  for (size_t o = 0; o < outer; ++o) {
+    for (size_t c = 0; c < channel; ++c) {
+      quant_min_max(src + (o * channel + c) * inner, inner, mMin[c], mMax[c]);
+    }
+  }
+  size_t count = outer * channel * inner;
+  if (PERCENTILE == mMethod) {
+    add_histogram(src, count);
+  }
+  mCount += count;
+  return true;
+}
+
+void QuantCalibrator::add_histogram(const float *src, size_t count) {
+  float maxAbs = 0.0f;
+  for (size_t i = 0; i < count; ++i) {
+    float a = std::fabs(src[i]);
+    maxAbs = a > maxAbs && a < INFINITY ? a : maxAbs;
+  }
+  if (mHistogram.empty()) {
+    mHistogram.assign(QUANT_BINS, 0);
+    mHistogramRange = maxAbs > 0.0f ? maxAbs : 1.0f;
+  }
+  // the range only doubles, pairs of bins merge and earlier counts stay
+  // in the right bin
+  while (maxAbs > mHistogramRange) {
+    for (int i = 0; i < QUANT_BINS / 2; ++i) {
+      mHistogram[i] = mHistogram[2 * i] + mHistogram[2 * i + 1];
+    }
+    std::fill(mHistogram.begin() + QUANT_BINS / 2, mHistogram.end(), 0);
+    mHistogramRange *= 2.0f;
+  }
+  float unit = QUANT_BINS / mHistogramRange;
+  for (size_t i = 0; i < count; ++i) {
+    float a = std::fabs(src[i]);
+    if (a <= mHistogramRange) {
+      mHistogram[ALIMIN(QUANT_BINS - 1, (int)(a * unit))]++;
+    }
+  }
+}
+
+// upper edge of the bin where `mPercentile` of |x| is reached
+float QuantCalibrator::clip_range() const {
+  uint64_t total = 0;
+  for (auto n : mHistogram) {
+    total += n;
+  }
+  double target = (double)mPercentile * total;
+  uint64_t sum = 0;
+  for (int i = 0; i < QUANT_BINS; ++i) {
+    sum += mHistogram[i];
+    if ((double)sum >= target) {
+      return (i + 1) * mHistogramRange / QUANT_BINS;
+    }
+  }
+  return mHistogramRange;
+}
+
+QuantAttr QuantCalibrator::compute(halide_type_t type, bool symmetric) const {
+  QuantAttr attr;
+  bool int8 = halide_type_int == type.code;
+  symmetric = symmetric && int8;
+  float qmin = int8 ? (symmetric ? -127.0f : -128.0f) : 0.0f;
+  float qmax = int8 ? 127.0f : 255.0f;
+  attr.min = qmin;
+  attr.max = qmax;
+  attr.scale = 1.0f;
+  attr.zero = symmetric ? 0.0f : qmin;
+  if (mMin.empty()) {
+    return attr;
+  }
+  float clip = PERCENTILE == mMethod && !mHistogram.empty() ? clip_range()
+                                                             : INFINITY;
+  std::vector<float> scales(mMin.size()), zeros(mMin.size());
+  for (size_t c = 0; c < mMin.size(); ++c) {
+    // 0 stays exact
+    float lo = ALIMAX(ALIMIN(mMin[c], 0.0f), -clip);
+    float hi = ALIMIN(ALIMAX(mMax[c], 0.0f), clip);
+    float scale, zero = 0.0f;
+    if (symmetric) {
+      scale = ALIMAX(-lo, hi) / qmax;
+    } else {
+      scale = (hi - lo) / (qmax - qmin);
+    }
+    if (!(scale > 0.0f) || !(scale < INFINITY)) {
+      scale = 1.0f;
+    }
+    if (!symmetric) {
+      zero = ALIMIN(qmax, ALIMAX(qmin, rintf(qmin - lo / scale)));
+    }
+    scales[c] = scale;
+    zeros[c] = zero;
+  }
+  attr.scale = scales[0];
+  attr.zero = zeros[0];
+  if (mAxis >= 0) {
+    attr.axis = mAxis;
+    attr.scales = std::move(scales);
+    attr.zeros = std::move(zeros);
+  }
+  return attr;
+}
+
+} // namespace tactics
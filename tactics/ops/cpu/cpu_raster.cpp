@@ -0,0 +1,260 @@
+//===------------------------tactics/ops/cpu/cpu_raster.cpp------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===------------------------------------------------------------------------------===//
+//
+/// This file implements the raster of tensors described by regions
+///
+//===------------------------------------------------------------------------------===//
+#include "tactics/ops/cpu/cpu_raster.h"
+#include "tactics/ops/cpu/cpu_parallel.h"
+#include "tactics/ops/cpu/cpu_tensor_convert.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace tactics {
+
+typedef CPURaster::Region Region;
+typedef Tensor::InsideDescribe::View View;
+
+static inline int64_t raster_offset(const View &view, int z, int y) {
+  return (int64_t)z * view.stride[0] + (int64_t)y * view.stride[1];
+}
+
+static inline size_t raster_count(const Region &region) {
+  if (region.size[0] <= 0 || region.size[1] <= 0 || region.size[2] <= 0) {
+    return 0;
+  }
+  return (size_t)region.size[0] * region.size[1] * region.size[2];
+}
+
+//------------------------------- kernels
+//-----------------------------------//
+// `src` and `dst` already at the offsets of the region
+
+// rows of size[2] elements, contiguous on both sides
+static void raster_rows(const Region &region, const uint8_t *src,
+                        uint8_t *dst, int bytes) {
+  size_t row = (size_t)region.size[2] * bytes;
+  for (int z = 0; z < region.size[0]; ++z) {
+    for (int y = 0; y < region.size[1]; ++y) {
+      ::memcpy(dst + raster_offset(region.dst, z, y) * bytes,
+               src + raster_offset(region.src, z, y) * bytes, row);
+    }
+  }
+}
+
+// the dim contiguous in src differs from the one contiguous in dst
+static bool raster_transpose(const Region &region, const uint8_t *src,
+                             uint8_t *dst, int bytes) {
+  int srcOne = 0, dstOne = 0;
+  for (int i = 0; i < 3; ++i) {
+    if (1 == region.src.stride[i] && region.size[i] > 1) {
+      srcOne = i;
+    }
+    if (1 == region.dst.stride[i] && region.size[i] > 1) {
+      dstOne = i;
+    }
+  }
+  int other = 3 - srcOne - dstOne;
+  int64_t srcStride = region.src.stride[dstOne];
+  int64_t dstStride = region.dst.stride[srcOne];
+  if (srcStride <= 0 || dstStride <= 0) {
+    // reversed, left to the strided loop
+    return false;
+  }
+  for (int k = 0; k < region.size[other]; ++k) {
+    CPUTensorConverter::transpose(
+        src + k * region.src.stride[other] * bytes, srcStride,
+        dst + k * region.dst.stride[other] * bytes, dstStride,
+        region.size[dstOne], region.size[srcOne], bytes);
+  }
+  return true;
+}
+
+// one src element stored over each row
+template <typename T>
+static void raster_broadcast(const Region &region, const T *src, T *dst) {
+  const int count = region.size[2];
+  const int64_t stride = region.dst.stride[2];
+  for (int z = 0; z < region.size[0]; ++z) {
+    for (int y = 0; y < region.size[1]; ++y) {
+      auto value = src[raster_offset(region.src, z, y)];
+      auto d = dst + raster_offset(region.dst, z, y);
+      if (1 == stride) {
+        std::fill(d, d + count, value);
+        continue;
+      }
+      for (int x = 0; x < count; ++x) {
+        d[x * stride] = value;
+      }
+    }
+  }
+}
+
+template <typename T>
+static void raster_strided(const Region &region, const T *src, T *dst) {
+  const int64_t srcStride = region.src.stride[2];
+  const int64_t dstStride = region.dst.stride[2];
+  for (int z = 0; z < region.size[0]; ++z) {
+    for (int y = 0; y < region.size[1]; ++y) {
+      auto s = src + raster_offset(region.src, z, y);
+      auto d = dst + raster_offset(region.dst, z, y);
+      for (int x = 0; x < region.size[2]; ++x) {
+        d[x * dstStride] = s[x * srcStride];
+      }
+    }
+  }
+}
+
+template <typename T>
+static void raster_typed(const Region &region, const uint8_t *src,
+                         uint8_t *dst) {
+  if (0 == region.src.stride[2] && TensorUtils::is_tile_region(region)) {
+    raster_broadcast(region, (const T *)src, (T *)dst);
+    return;
+  }
+  raster_strided(region, (const T *)src, (T *)dst);
+}
+
+//------------------------------- CPURaster
+//-----------------------------------//
+Region CPURaster::compact(const Region &region) {
+  int size[3], dims = 0;
+  int64_t srcStride[3], dstStride[3];
+  for (int i = 0; i < 3; ++i) {
+    int extent = region.size[i];
+    if (extent <= 1) {
+      continue;
+    }
+    int64_t s = region.src.stride[i], d = region.dst.stride[i];
+    // sizes stay 32 bit, dims too long together are left apart
+    if (dims > 0 && s * extent == srcStride[dims - 1] &&
+        d * extent == dstStride[dims - 1] &&
+        (int64_t)size[dims - 1] * extent <= INT32_MAX) {
+      // the outer dim steps over exactly one run of this one
+      size[dims - 1] *= extent;
+      srcStride[dims - 1] = s;
+      dstStride[dims - 1] = d;
+      continue;
+    }
+    size[dims] = extent;
+    srcStride[dims] = s;
+    dstStride[dims] = d;
+    dims++;
+  }
+  Region result = region;
+  for (int i = 0; i < 3; ++i) {
+    // right aligned, the innermost dim stays at 2
+    int j = i - (3 - dims);
+    result.size[i] = j >= 0 ? size[j] : 1;
+    result.src.stride[i] = j >= 0 ? srcStride[j] : 1;
+    result.dst.stride[i] = j >= 0 ? dstStride[j] : 1;
+  }
+  return result;
+}
+
+bool CPURaster::execute(const Region &region, const void *src, void *dst,
+                        int bytes) {
+  if (1 != bytes && 2 != bytes && 4 != bytes && 8 != bytes) {
+    return false;
+  }
+  if (0 == raster_count(region)) {
+    return true;
+  }
+  auto r = compact(region);
+  auto s = (const uint8_t *)src + r.src.offset * bytes;
+  auto d = (uint8_t *)dst + r.dst.offset * bytes;
+  if (TensorUtils::is_copy_region(r) && 1 == r.src.stride[2]) {
+    // one memcpy once compacted, unless a slice of a larger tensor
+    raster_rows(r, s, d, bytes);
+    return true;
+  }
+  if (TensorUtils::is_transpose_region(r) &&
+      raster_transpose(r, s, d, bytes)) {
+    return true;
+  }
+  if (1 == r.src.stride[2] && 1 == r.dst.stride[2]) {
+    // concat, slice, tile over outer dims
+    raster_rows(r, s, d, bytes);
+    return true;
+  }
+  switch (bytes) {
+  case 1:
+    raster_typed<uint8_t>(r, s, d);
+    break;
+  case 2:
+    raster_typed<uint16_t>(r, s, d);
+    break;
+  case 4:
+    raster_typed<uint32_t>(r, s, d);
+    break;
+  default:
+    raster_typed<uint64_t>(r, s, d);
+    break;
+  }
+  return true;
+}
+
+bool CPURaster::execute(const Tensor *output, int threads) {
+  auto dst = output->host<uint8_t>();
+  int bytes = output->getType().bytes();
+  if (nullptr == dst) {
+    return false;
+  }
+  struct Unit {
+    Region region;
+    const uint8_t *src;
+  };
+  std::vector<Unit> units;
+  size_t covered = 0;
+  for (auto &region : TensorUtils::get_describe(output)->regions) {
+    auto origin = region.origin;
+    if (nullptr == origin || nullptr == origin->host<uint8_t>() ||
+        origin->getType().bytes() != bytes) {
+      return false;
+    }
+    auto count = raster_count(region);
+    if (0 == count) {
+      continue;
+    }
+    covered += count;
+    units.push_back({compact(region), origin->host<uint8_t>()});
+  }
+  if (covered * bytes < output->usize()) {
+    ::memset(dst, 0, output->usize());
+  }
+  if (threads > 1 && covered * bytes >= CPU_PARALLEL_BYTES) {
+    // split the outermost dim of each region by its share of the threads
+    std::vector<Unit> parts;
+    for (auto &unit : units) {
+      auto &r = unit.region;
+      int d = 0;
+      while (d < 2 && r.size[d] <= 1) {
+        d++;
+      }
+      int share = (int)UP_DIV(raster_count(r) * threads, covered);
+      int step = UP_DIV(r.size[d], ALIMAX(1, ALIMIN(r.size[d], share)));
+      for (int begin = 0; begin < r.size[d]; begin += step) {
+        Unit part = unit;
+        part.region.size[d] = ALIMIN(step, r.size[d] - begin);
+        part.region.src.offset += begin * r.src.stride[d];
+        part.region.dst.offset += begin * r.dst.stride[d];
+        parts.push_back(part);
+      }
+    }
+    units.swap(parts);
+  } else {
+    threads = 1;
+  }
+  cpu_parallel_for((int)units.size(), threads, [&](int u) {
+    execute(units[u].region, units[u].src, dst, bytes);
+  });
+  return true;
+}
+
+} // namespace tactics
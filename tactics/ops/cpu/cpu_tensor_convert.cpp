@@ -0,0 +1,491 @@
+//===------------------------tactics/ops/cpu/cpu_tensor_convert.cpp------------------------===//
+//
+// Copyright (c) RISC-X Organizations, see https://risc-x.org
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+//===--------------------------------------------------------------------------------------===//
+//
+/// This file implements the layout conversion of host tensors
+///
+//===--------------------------------------------------------------------------------------===//
+#include "tactics/ops/cpu/cpu_tensor_convert.h"
+#include "tactics/math/vec.h"
+#include "tactics/ops/cpu/cpu_cast.h"
+#include "tactics/ops/cpu/cpu_parallel.h"
+#include "tactics/ops/cpu/cpu_quantize.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace tactics {
+
+using Vec4 = Vec<float, 4>;
+
+// pixels handled at once, so the rows written stay in cache
+static const int CONVERT_TILE = 64;
+
+//------------------------------- kernels
+//-----------------------------------//
+// dst[x * dstStride + k] = src[k * srcStride + x]
+template <typename T>
+static void convert_interleave_scalar(T *dst, size_t dstStride, const T *src,
+                                      size_t srcStride, int count, int area) {
+  for (int x0 = 0; x0 < area; x0 += CONVERT_TILE) {
+    int x1 = ALIMIN(area, x0 + CONVERT_TILE);
+    for (int k = 0; k < count; ++k) {
+      auto s = src + k * srcStride;
+      for (int x = x0; x < x1; ++x) {
+        dst[x * dstStride + k] = s[x];
+      }
+    }
+  }
+}
+
+// dst[k * dstStride + x] = src[x * srcStride + k]
+template <typename T>
+static void convert_deinterleave_scalar(T *dst, size_t dstStride,
+                                        const T *src, size_t srcStride,
+                                        int count, int area) {
+  for (int x0 = 0; x0 < area; x0 += CONVERT_TILE) {
+    int x1 = ALIMIN(area, x0 + CONVERT_TILE);
+    for (int k = 0; k < count; ++k) {
+      auto d = dst + k * dstStride;
+      for (int x = x0; x < x1; ++x) {
+        d[x] = src[x * srcStride + k];
+      }
+    }
+  }
+}
+
+// 4 channels x 4 pixels per transpose4
+static void convert_interleave_float(float *dst, size_t dstStride,
+                                     const float *src, size_t srcStride,
+                                     int count, int area) {
+  int count4 = count / 4 * 4, area4 = area / 4 * 4;
+  for (int x0 = 0; x0 < area4; x0 += CONVERT_TILE) {
+    int x1 = ALIMIN(area4, x0 + CONVERT_TILE);
+    for (int k = 0; k < count4; k += 4) {
+      auto s = src + k * srcStride;
+      auto d = dst + k;
+      for (int x = x0; x < x1; x += 4) {
+        auto v0 = Vec4::load(s + x);
+        auto v1 = Vec4::load(s + srcStride + x);
+        auto v2 = Vec4::load(s + 2 * srcStride + x);
+        auto v3 = Vec4::load(s + 3 * srcStride + x);
+        Vec4::transpose4(v0, v1, v2, v3);
+        Vec4::save(d + x * dstStride, v0);
+        Vec4::save(d + (x + 1) * dstStride, v1);
+        Vec4::save(d + (x + 2) * dstStride, v2);
+        Vec4::save(d + (x + 3) * dstStride, v3);
+      }
+    }
+  }
+  convert_interleave_scalar(dst + count4, dstStride, src + count4 * srcStride,
+                            srcStride, count - count4, area);
+  convert_interleave_scalar(dst + area4 * dstStride, dstStride, src + area4,
+                            srcStride, count4, area - area4);
+}
+
+static void convert_deinterleave_float(float *dst, size_t dstStride,
+                                       const float *src, size_t srcStride,
+                                       int count, int area) {
+  int count4 = count / 4 * 4, area4 = area / 4 * 4;
+  for (int x0 = 0; x0 < area4; x0 += CONVERT_TILE) {
+    int x1 = ALIMIN(area4, x0 + CONVERT_TILE);
+    for (int k = 0; k < count4; k += 4) {
+      auto s = src + k;
+      auto d = dst + k * dstStride;
+      for (int x = x0; x < x1; x += 4) {
+        auto v0 = Vec4::load(s + x * srcStride);
+        auto v1 = Vec4::load(s + (x + 1) * srcStride);
+        auto v2 = Vec4::load(s + (x + 2) * srcStride);
+        auto v3 = Vec4::load(s + (x + 3) * srcStride);
+        Vec4::transpose4(v0, v1, v2, v3);
+        Vec4::save(d + x, v0);
+        Vec4::save(d + dstStride + x, v1);
+        Vec4::save(d + 2 * dstStride + x, v2);
+        Vec4::save(d + 3 * dstStride + x, v3);
+      }
+    }
+  }
+  convert_deinterleave_scalar(dst + count4 * dstStride, dstStride,
+                              src + count4, srcStride, count - count4, area);
+  convert_deinterleave_scalar(dst + area4, dstStride, src + area4 * srcStride,
+                              srcStride, count4, area - area4);
+}
+
+template <typename T>
+static void convert_interleave(T *dst, size_t dstStride, const T *src,
+                               size_t srcStride, int count, int area) {
+  if (4 == sizeof(T)) {
+    convert_interleave_float((float *)dst, dstStride, (const float *)src,
+                             srcStride, count, area);
+    return;
+  }
+  convert_interleave_scalar(dst, dstStride, src, srcStride, count, area);
+}
+
+template <typename T>
+static void convert_deinterleave(T *dst, size_t dstStride, const T *src,
+                                 size_t srcStride, int count, int area) {
+  if (4 == sizeof(T)) {
+    convert_deinterleave_float((float *)dst, dstStride, (const float *)src,
+                               srcStride, count, area);
+    return;
+  }
+  convert_deinterleave_scalar(dst, dstStride, src, srcStride, count, area);
+}
+
+// `count` channels next to each other on both sides
+template <typename T>
+static void convert_runs(T *dst, size_t dstStride, const T *src,
+                         size_t srcStride, int count, int area) {
+  if (dstStride == (size_t)count && srcStride == (size_t)count) {
+    ::memcpy(dst, src, (size_t)count * area * sizeof(T));
+    return;
+  }
+  for (int x = 0; x < area; ++x) {
+    auto d = dst + x * dstStride;
+    auto s = src + x * srcStride;
+    for (int k = 0; k < count; ++k) {
+      d[k] = s[k];
+    }
+  }
+}
+
+//------------------------------- layouts
+//-----------------------------------//
+typedef CPUTensorConverter::Layout Layout;
+
+static inline size_t layout_offset(const Layout &layout, int channel,
+                                   int area, int b, int c, int x) {
+  if (0 == layout.pack) {
+    return ((size_t)b * area + x) * layout.stride + c;
+  }
+  return (((size_t)b * UP_DIV(channel, layout.pack) + c / layout.pack) * area +
+          x) *
+             layout.pack +
+         c % layout.pack;
+}
+
+// from one pixel to the next in a channel
+static inline size_t layout_pixel_stride(const Layout &layout) {
+  return 0 == layout.pack ? layout.stride : layout.pack;
+}
+
+static inline size_t layout_size(const Layout &layout, int batch, int channel,
+                                 int area) {
+  if (0 == layout.pack) {
+    return (size_t)batch * area * layout.stride;
+  }
+  return (size_t)batch * ROUND_UP(channel, layout.pack) * area;
+}
+
+// zero the padded channels of pixels [x0, x1) of batch `b`
+template <typename T>
+static void convert_zero_padding(T *dst, const Layout &layout, int channel,
+                                 int area, int b, int x0, int x1) {
+  int begin, end;
+  if (0 == layout.pack) {
+    begin = channel;
+    end = layout.stride;
+  } else {
+    begin = channel % layout.pack;
+    end = 0 == begin ? 0 : layout.pack;
+  }
+  if (begin >= end) {
+    return;
+  }
+  int c = 0 == layout.pack ? 0 : channel - begin;
+  for (int x = x0; x < x1; ++x) {
+    auto d = dst + layout_offset(layout, channel, area, b, c, x);
+    for (int k = begin; k < end; ++k) {
+      d[k] = 0;
+    }
+  }
+}
+
+enum ConvertMode {
+  // planar to interleaved channels
+  CONVERT_INTERLEAVE,
+  // interleaved channels to planar
+  CONVERT_DEINTERLEAVE,
+  // interleaved to interleaved, runs of channels
+  CONVERT_RUNS,
+};
+
+template <typename T>
+static void convert_layout(const T *src, const Layout &srcLayout, T *dst,
+                           const Layout &dstLayout, int batch, int channel,
+                           int area, int threads) {
+  bool srcPlanar = 1 == srcLayout.pack, dstPlanar = 1 == dstLayout.pack;
+  size_t bytes = layout_size(dstLayout, batch, channel, area) * sizeof(T);
+  if (bytes < CPU_PARALLEL_BYTES) {
+    threads = 1;
+  }
+  bool padded = 0 == srcLayout.pack ? srcLayout.stride != channel
+                                     : 0 != channel % srcLayout.pack;
+  if (!padded && srcLayout.pack == dstLayout.pack &&
+      srcLayout.stride == dstLayout.stride) {
+    // same layout, split the bytes
+    threads = ALIMAX(1, threads);
+    size_t part = UP_DIV(bytes, (size_t)threads);
+    cpu_parallel_for(threads, threads, [&](int t) {
+      size_t begin = part * t, end = ALIMIN(bytes, begin + part);
+      if (begin < end) {
+        ::memcpy((uint8_t *)dst + begin, (const uint8_t *)src + begin,
+                 end - begin);
+      }
+    });
+    for (int b = 0; b < batch; ++b) {
+      convert_zero_padding(dst, dstLayout, channel, area, b, 0, area);
+    }
+    return;
+  }
+  ConvertMode mode;
+  // channels handled together, next to each other on the interleaved sides
+  int step = channel;
+  if (srcPlanar || dstPlanar) {
+    mode = srcPlanar ? CONVERT_INTERLEAVE : CONVERT_DEINTERLEAVE;
+    auto &other = srcPlanar ? dstLayout : srcLayout;
+    if (other.pack > 1) {
+      step = other.pack;
+    }
+  } else {
+    mode = CONVERT_RUNS;
+    if (srcLayout.pack > 1) {
+      step = ALIMIN(step, srcLayout.pack);
+    }
+    if (dstLayout.pack > 1) {
+      step = ALIMIN(step, dstLayout.pack);
+    }
+  }
+  step = ALIMAX(1, step);
+  const int blocks = UP_DIV(channel, step);
+  // too few channel blocks for the threads, split the pixels too
+  const int splits = batch * blocks < threads ? threads : 1;
+  const int pixels = UP_DIV(area, splits);
+  const size_t srcPixel = layout_pixel_stride(srcLayout);
+  const size_t dstPixel = layout_pixel_stride(dstLayout);
+  cpu_parallel_for(batch * blocks * splits, threads, [&](int unit) {
+    int x0 = unit % splits * pixels;
+    int x1 = ALIMIN(area, x0 + pixels);
+    int z = unit / splits % blocks;
+    int b = unit / splits / blocks;
+    if (x0 >= x1) {
+      return;
+    }
+    int c = z * step;
+    int count = ALIMIN(step, channel - c);
+    auto s = src + layout_offset(srcLayout, channel, area, b, c, x0);
+    auto d = dst + layout_offset(dstLayout, channel, area, b, c, x0);
+    switch (mode) {
+    case CONVERT_INTERLEAVE:
+      convert_interleave(d, dstPixel, s, area, count, x1 - x0);
+      break;
+    case CONVERT_DEINTERLEAVE:
+      convert_deinterleave(d, area, s, srcPixel, count, x1 - x0);
+      break;
+    default:
+      convert_runs(d, dstPixel, s, srcPixel, count, x1 - x0);
+      break;
+    }
+    if (z == blocks - 1) {
+      convert_zero_padding(dst, dstLayout, channel, area, b, x0, x1);
+    }
+  });
+}
+
+//------------------------------- CPUTensorConverter
+//-----------------------------------//
+CPUTensorConverter::Layout CPUTensorConverter::layout_of(const Tensor *tensor) {
+  Layout layout;
+  int dims = tensor->dimensions();
+  if (dims < 2) {
+    // no channel, any layout is the same
+    return layout;
+  }
+  switch (TensorUtils::get_describe(tensor)->dimension_format) {
+  case DATA_FORMAT_NC4HW4:
+    layout.pack = TensorUtils::get_tensor_channel_pack(tensor);
+    break;
+  case DATA_FORMAT_NHWC:
+    layout.pack = 0;
+    layout.stride = tensor->length(dims - 1);
+    break;
+  case DATA_FORMAT_NHWC4:
+    layout.pack = 0;
+    layout.stride = ALIGN_UP4(tensor->length(dims - 1));
+    break;
+  default:
+    break;
+  }
+  return layout;
+}
+
+// batch, channel and area of `tensor` stored as `layout`. false when the
+// area does not fit 32 bits, the kernels count pixels in int
+static bool convert_shape(const Tensor *tensor, const Layout &layout,
+                          int &batch, int &channel, int &area) {
+  int dims = tensor->dimensions();
+  batch = 1, channel = 1, area = 1;
+  if (dims < 2) {
+    area = dims > 0 ? tensor->length(0) : 1;
+    return true;
+  }
+  batch = tensor->length(0);
+  int first = 2, last = dims;
+  if (0 == layout.pack) {
+    channel = tensor->length(dims - 1);
+    first = 1, last = dims - 1;
+  } else {
+    channel = tensor->length(1);
+  }
+  int64_t pixels = 1;
+  for (int i = first; i < last; ++i) {
+    pixels *= tensor->length(i);
+  }
+  area = (int)pixels;
+  return pixels <= INT32_MAX;
+}
+
+bool CPUTensorConverter::convert(const Tensor *input, const Tensor *output,
+                                 int threads) {
+  auto src = input->buffer().host;
+  auto dst = output->buffer().host;
+  auto srcType = input->getType(), dstType = output->getType();
+  bool cast = srcType != dstType && CPUCast::can_cast(srcType, dstType);
+  // float32 to and from int8 tensors with a QuantAttr
+  bool quantize = halide_type_of<float>() == srcType &&
+                  CPUQuantize::is_quantized(output);
+  bool dequantize = halide_type_of<float>() == dstType &&
+                    CPUQuantize::is_quantized(input);
+  bool copy = !cast && !quantize && !dequantize;
+  if (nullptr == src || nullptr == dst ||
+      (copy && srcType.bytes() != dstType.bytes())) {
+    return false;
+  }
+  auto srcLayout = layout_of(input), dstLayout = layout_of(output);
+  int batch, channel, area, dstBatch, dstChannel, dstArea;
+  if (!convert_shape(input, srcLayout, batch, channel, area) ||
+      !convert_shape(output, dstLayout, dstBatch, dstChannel, dstArea) ||
+      batch != dstBatch || channel != dstChannel || area != dstArea) {
+    return false;
+  }
+  if (copy) {
+    return convert(src, srcLayout, dst, dstLayout, batch, channel, area,
+                   srcType.bytes(), threads);
+  }
+  // the type changes in place when no padding needs zeroing
+  bool padded = 0 == srcLayout.pack ? srcLayout.stride != channel
+                                     : 0 != channel % srcLayout.pack;
+  bool direct = !padded && srcLayout.pack == dstLayout.pack &&
+                srcLayout.stride == dstLayout.stride;
+  if (quantize) {
+    // moved in float, quantized in the layout of output. padding becomes
+    // the zero point
+    auto &attr = *TensorUtils::get_describe(output)->quantAttr;
+    size_t outer, quantChannel, inner;
+    if (!CPUQuantize::split(output, attr, outer, quantChannel, inner)) {
+      return false;
+    }
+    auto floats = (const float *)src;
+    std::vector<float> moved;
+    if (!direct) {
+      moved.resize(outer * quantChannel * inner);
+      if (!convert(src, srcLayout, moved.data(), dstLayout, batch, channel,
+                   area, sizeof(float), threads)) {
+        return false;
+      }
+      floats = moved.data();
+    }
+    return CPUQuantize::quantize(floats, dst, dstType, attr, outer,
+                                 quantChannel, inner, threads);
+  }
+  if (dequantize) {
+    // dequantized in the layout of input, then moved in float
+    auto &attr = *TensorUtils::get_describe(input)->quantAttr;
+    size_t outer, quantChannel, inner;
+    if (!CPUQuantize::split(input, attr, outer, quantChannel, inner)) {
+      return false;
+    }
+    if (direct) {
+      return CPUQuantize::dequantize(src, srcType, (float *)dst, attr, outer,
+                                     quantChannel, inner, threads);
+    }
+    std::vector<float> floats(outer * quantChannel * inner);
+    if (!CPUQuantize::dequantize(src, srcType, floats.data(), attr, outer,
+                                 quantChannel, inner, threads)) {
+      return false;
+    }
+    return convert(floats.data(), srcLayout, dst, dstLayout, batch, channel,
+                   area, sizeof(float), threads);
+  }
+  // cast in the layout of input, then move to the layout of output
+  size_t count = 0 == srcLayout.pack
+                     ? (size_t)batch * area * srcLayout.stride
+                     : (size_t)batch * ROUND_UP(channel, srcLayout.pack) * area;
+  if (direct) {
+    return CPUCast::cast(src, srcType, dst, dstType, count, threads);
+  }
+  std::vector<uint8_t> casted(count * dstType.bytes());
+  if (!CPUCast::cast(src, srcType, casted.data(), dstType, count, threads)) {
+    return false;
+  }
+  return convert(casted.data(), srcLayout, dst, dstLayout, batch, channel,
+                 area, dstType.bytes(), threads);
+}
+
+bool CPUTensorConverter::convert(const void *src, const Layout &srcLayout,
+                                 void *dst, const Layout &dstLayout, int batch,
+                                 int channel, int area, int bytes,
+                                 int threads) {
+  switch (bytes) {
+  case 1:
+    convert_layout((const uint8_t *)src, srcLayout, (uint8_t *)dst, dstLayout,
+                   batch, channel, area, threads);
+    return true;
+  case 2:
+    convert_layout((const uint16_t *)src, srcLayout, (uint16_t *)dst,
+                   dstLayout, batch, channel, area, threads);
+    return true;
+  case 4:
+    convert_layout((const uint32_t *)src, srcLayout, (uint32_t *)dst,
+                   dstLayout, batch, channel, area, threads);
+    return true;
+  case 8:
+    convert_layout((const uint64_t *)src, srcLayout, (uint64_t *)dst,
+                   dstLayout, batch, channel, area, threads);
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool CPUTensorConverter::transpose(const void *src, size_t srcStride, void *dst,
+                                   size_t dstStride, int rows, int cols,
+                                   int bytes) {
+  switch (bytes) {
+  case 1:
+    convert_interleave((uint8_t *)dst, dstStride, (const uint8_t *)src,
+                       srcStride, rows, cols);
+    return true;
+  case 2:
+    convert_interleave((uint16_t *)dst, dstStride, (const uint16_t *)src,
+                       srcStride, rows, cols);
+    return true;
+  case 4:
+    convert_interleave((uint32_t *)dst, dstStride, (const uint32_t *)src,
+                       srcStride, rows, cols);
+    return true;
+  case 8:
+    convert_interleave((uint64_t *)dst, dstStride, (const uint64_t *)src,
+                       srcStride, rows, cols);
+    return true;
+  default:
+    return false;
+  }
+}
+
+} // namespace tactics
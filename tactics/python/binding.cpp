@@ -22,10 +22,13 @@
 #include <fmt/ranges.h>
 #include <sstream>
 #include <stdexcept>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 #include "HalideRuntime.h"
 #include "tactics/core/tensor.h"
+#include "tactics/core/tensor_utils.h"
 #include "tactics/math/matrix.h"
 
 namespace py = pybind11;
@@ -55,7 +58,7 @@ std::string tensor_to_string(const Tensor &tensor) {
   std::ostringstream oss;
   auto data = tensor.host<float>();
   auto shape = tensor.shape();
-  int total_elements = 1;
+  int64_t total_elements = 1;
   for (int dim : shape) {
     total_elements *= dim;
   }
@@ -69,16 +72,20 @@ std::string tensor_to_string(const Tensor &tensor) {
     }
   }
 
-  for (int i = 0; i < total_elements; ++i) {
+  // views are strided
+  int64_t offset = 0;
+  for (int64_t i = 0; i < total_elements; ++i) {
 
     // print element
-    oss << data[i];
+    oss << data[offset];
 
     // update index counter
     for (int j = shape.size() - 1; j >= 0; --j) {
       counters[j]++;
+      offset += tensor.stride(j);
       if (counters[j] < shape[j])
         break;
+      offset -= tensor.stride(j) * shape[j];
       counters[j] = 0;
       oss << "]";
       if (j > 0) {
@@ -98,19 +105,16 @@ std::string tensor_to_string(const Tensor &tensor) {
   return oss.str();
 }
 
-void print_tensor_recursive(const Tensor &tensor, int depth = 0, int offset = 0) {
+void print_tensor_recursive(const Tensor &tensor, int depth = 0, int64_t offset = 0) {
   if (depth == tensor.shape().size() - 1) {
     // print inner data
     for (int i = 0; i < tensor.shape()[depth]; ++i) {
-      std::cout << tensor.host<float>()[offset + i] << " ";
+      std::cout << tensor.host<float>()[offset + i * tensor.stride(depth)] << " ";
     }
     std::cout << std::endl;
   } else {
     // recursive print high dimension element
-    int stride = 1;
-    for (int i = depth + 1; i < tensor.shape().size(); ++i) {
-      stride *= tensor.shape()[i];
-    }
+    int64_t stride = tensor.stride(depth);
     for (int i = 0; i < tensor.shape()[depth]; ++i) {
       print_tensor_recursive(tensor, depth + 1, offset + i * stride);
     }
@@ -147,6 +151,25 @@ void print_tensor(const Tensor &tensor) {
   std::cout << std::endl;
 }
 
+// views share the memory of `self`, which the returned tensor keeps alive
+Tensor* checked_view(Tensor *view, const char *name) {
+  if (nullptr == view) {
+    throw std::runtime_error(format("{}: invalid arguments for a view", name));
+  }
+  return view;
+}
+
+Tensor* reshape_tensor(const Tensor &self, const std::vector<int> &shape) {
+  auto view = Tensor::reshape(&self, shape);
+  if (nullptr != view) {
+    return view;
+  }
+  // the dims merged are not contiguous, reshape a dense copy
+  std::unique_ptr<Tensor> dense(Tensor::create(self.shape(), self.getType()));
+  TensorUtils::copy_strided(&self, dense.get());
+  return checked_view(Tensor::reshape(dense.get(), shape), "reshape");
+}
+
 PYBIND11_MODULE(tactics_bind, m) {
   py::class_<Tensor>(m, "Tensor")
     .def(py::init(&create_tensor<int>), py::arg("shape"), py::arg("data"))
@@ -157,5 +180,41 @@ PYBIND11_MODULE(tactics_bind, m) {
     .def("dump", [&](const Tensor& self) {
       print_tensor_recursive(self);
     })
+    .def("reshape", &reshape_tensor, py::arg("shape"), py::keep_alive<0, 1>())
+    .def("expand", [](const Tensor& self, const std::vector<int>& shape) {
+      return checked_view(Tensor::expand(&self, shape), "expand");
+    }, py::arg("shape"), py::keep_alive<0, 1>())
+    .def("permute", [](const Tensor& self, const std::vector<int>& order) {
+      return checked_view(Tensor::permute(&self, order), "permute");
+    }, py::arg("order"), py::keep_alive<0, 1>())
+    .def("transpose", [](const Tensor& self, int dim0, int dim1) {
+      std::vector<int> order(self.dimensions());
+      for (int i = 0; i < order.size(); ++i) {
+        order[i] = i;
+      }
+      int dims = self.dimensions();
+      dim0 = dim0 < 0 ? dim0 + dims : dim0;
+      dim1 = dim1 < 0 ? dim1 + dims : dim1;
+      if (dim0 < 0 || dim0 >= dims || dim1 < 0 || dim1 >= dims) {
+        throw std::runtime_error("transpose: dim out of range");
+      }
+      std::swap(order[dim0], order[dim1]);
+      return checked_view(Tensor::permute(&self, order), "transpose");
+    }, py::arg("dim0") = 1, py::arg("dim1") = 0, py::keep_alive<0, 1>())
+    .def("slice", [](const Tensor& self, int axis, int begin, int end, int step) {
+      return checked_view(Tensor::slice(&self, axis, begin, end, step), "slice");
+    }, py::arg("axis"), py::arg("begin"), py::arg("end"), py::arg("step") = 1,
+       py::keep_alive<0, 1>())
+    .def("is_contiguous", [](const Tensor& self) {
+      return TensorUtils::is_contiguous(&self);
+    })
+    .def_property_readonly("shape", &Tensor::shape)
+    .def_property_readonly("strides", [](const Tensor& self) {
+      std::vector<int64_t> strides(self.dimensions());
+      for (int i = 0; i < strides.size(); ++i) {
+        strides[i] = self.stride(i);
+      }
+      return strides;
+    })
     .def("__str__", &tensor_to_string);
 }
\ No newline at end of file
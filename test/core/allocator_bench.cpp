@@ -0,0 +1,261 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tactics/core/buffer_allocator.h>
+#include <vector>
+
+using namespace tactics;
+
+// one allocator event, `size` is 0 for a free
+struct TraceOp {
+  int id;
+  size_t size;
+};
+
+// load a trace with lines `a <id> <size>` and `f <id>`
+static bool load_trace(const char *path, std::vector<TraceOp> &trace) {
+  FILE *file = fopen(path, "r");
+  if (nullptr == file) {
+    printf("can't open %s\n", path);
+    return false;
+  }
+  char type;
+  int id;
+  size_t size;
+  while (fscanf(file, " %c %d", &type, &id) == 2) {
+    if ('a' == type) {
+      if (fscanf(file, " %zu", &size) != 1) {
+        break;
+      }
+      trace.push_back({id, size});
+    } else {
+      trace.push_back({id, 0});
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+// residual network style graph: per block `y = x + conv(conv(x))` plus a few
+// small shape tensors, spatial size halves and channels double every stage.
+static std::vector<TraceOp> make_residual_trace(int blocks) {
+  std::vector<TraceOp> trace;
+  int id = 0;
+  size_t channel = 64, area = 112 * 112;
+  auto x = id++;
+  trace.push_back({x, channel * area * 4});
+  for (int b = 0; b < blocks; ++b) {
+    if (b > 0 && b % (blocks / 4 + 1) == 0 && area > 49) {
+      channel *= 2;
+      area /= 4;
+    }
+    auto bytes = channel * area * 4;
+    auto shape = id++;
+    trace.push_back({shape, (size_t)(64 + (b % 4) * 32)});
+    auto t1 = id++;
+    trace.push_back({t1, bytes});
+    auto t2 = id++;
+    trace.push_back({t2, bytes});
+    trace.push_back({t1, 0});
+    trace.push_back({shape, 0});
+    auto y = id++;
+    trace.push_back({y, bytes});
+    trace.push_back({t2, 0});
+    trace.push_back({x, 0});
+    x = y;
+  }
+  trace.push_back({x, 0});
+  return trace;
+}
+
+// wide graph: many branches keep thousands of tensors alive, outputs of
+// different sizes are carved from blocks freed by earlier layers
+static std::vector<TraceOp> make_wide_trace(int width, int layers) {
+  std::vector<TraceOp> trace;
+  std::vector<int> live;
+  int id = 0;
+  unsigned seed = 1;
+  auto next = [&]() {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xffff;
+  };
+  for (int i = 0; i < width; ++i) {
+    live.push_back(id);
+    trace.push_back({id++, 4096 + (size_t)(next() % 16) * 1024});
+  }
+  for (int l = 0; l < layers; ++l) {
+    for (int i = 0; i < width; ++i) {
+      auto index = next() % live.size();
+      trace.push_back({live[index], 0});
+      live[index] = id;
+      trace.push_back({id++, 256 + (size_t)(next() % 64) * 64});
+    }
+  }
+  for (auto t : live) {
+    trace.push_back({t, 0});
+  }
+  return trace;
+}
+
+// with `plan` every loop runs as a plan of the same signature, recorded by
+// an extra loop before timing, so the timed loops replay the offsets
+static double replay_eager(const std::vector<TraceOp> &trace, int loop,
+                           bool plan = false) {
+  EagerBufferAllocator allocator(BufferAllocator::Allocator::create_default());
+  std::map<int, MemChunk> live;
+  auto begin = std::chrono::steady_clock::now();
+  for (int l = plan ? -1 : 0; l < loop; ++l) {
+    if (0 == l) {
+      begin = std::chrono::steady_clock::now();
+    }
+    if (plan) {
+      allocator.begin_plan({{(int)trace.size()}});
+    }
+    for (auto &op : trace) {
+      if (op.size > 0) {
+        live[op.id] = allocator.alloc(op.size);
+      } else {
+        auto iter = live.find(op.id);
+        allocator.free(iter->second);
+        live.erase(iter);
+      }
+    }
+    if (plan) {
+      allocator.end_plan();
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  auto ns = std::chrono::duration<double, std::nano>(end - begin).count();
+  return ns / (trace.size() * loop);
+}
+
+// every thread runs a small request loop against one shared allocator,
+// return million alloc/free pairs per second
+template <typename Alloc, typename Free>
+static double run_contention(int threadNum, Alloc alloc, Free free) {
+  const int loop = 200000;
+  std::vector<std::thread> threads;
+  auto begin = std::chrono::steady_clock::now();
+  for (int t = 0; t < threadNum; ++t) {
+    threads.emplace_back([&, t]() {
+      MemChunk live[8];
+      for (int i = 0; i < loop; ++i) {
+        auto &slot = live[i % 8];
+        if (nullptr != slot.ptr()) {
+          free(slot);
+        }
+        slot = alloc(256 + ((i * 97 + t * 31) % 64) * 256);
+      }
+      for (auto &slot : live) {
+        free(slot);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+  auto seconds = std::chrono::duration<double>(end - begin).count();
+  return threadNum * (double)loop / seconds / 1e6;
+}
+
+static void bench_contention() {
+  int threadNums[] = {1, 2, 4, 8};
+  for (auto num : threadNums) {
+    ConcurrentBufferAllocator concurrent(
+        BufferAllocator::Allocator::create_default());
+    auto concurrentRate = run_contention(
+        num, [&](size_t size) { return concurrent.alloc(size); },
+        [&](MemChunk chunk) { concurrent.free(chunk); });
+
+    EagerBufferAllocator eager(BufferAllocator::Allocator::create_default());
+    std::mutex lock;
+    auto eagerRate = run_contention(
+        num,
+        [&](size_t size) {
+          std::lock_guard<std::mutex> _l(lock);
+          return eager.alloc(size);
+        },
+        [&](MemChunk chunk) {
+          std::lock_guard<std::mutex> _l(lock);
+          eager.free(chunk);
+        });
+    printf("%d threads: concurrent %.2f M/s, eager with mutex %.2f M/s\n", num,
+           concurrentRate, eagerRate);
+  }
+}
+
+// the Eager alloc/free hot path on a warm free list, where every call moves
+// SharedPtr<Node> between the free and used lists. `split` serves the
+// chunks from one block, so the pieces also hold their parent node
+static void bench_free_list_path(bool split) {
+  EagerBufferAllocator allocator(BufferAllocator::Allocator::create_default());
+  const size_t nodeNum = 64;
+  std::vector<MemChunk> chunks;
+  if (split) {
+    chunks.push_back(allocator.alloc(nodeNum * (nodeNum + 1) / 2 * 64));
+  } else {
+    for (size_t i = 0; i < nodeNum; ++i) {
+      chunks.push_back(allocator.alloc((i + 1) * 64));
+    }
+  }
+  for (auto &chunk : chunks) {
+    allocator.free(chunk);
+  }
+  const int loop = 200000;
+  MemChunk live[4];
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < loop; ++i) {
+    auto &slot = live[i % 4];
+    if (nullptr != slot.ptr()) {
+      allocator.free(slot);
+    }
+    slot = allocator.alloc((i % nodeNum + 1) * 64);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  for (auto &slot : live) {
+    allocator.free(slot);
+  }
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  printf("eager free list %s: %.1f ns per alloc and free, %zu bytes total\n",
+         split ? "split" : "reuse", ns / loop, allocator.total_size());
+}
+
+static void bench_free_list() {
+  bench_free_list_path(false);
+  bench_free_list_path(true);
+}
+
+int main(int argc, const char *argv[]) {
+  if (argc > 1) {
+    std::vector<TraceOp> trace;
+    if (!load_trace(argv[1], trace)) {
+      return 1;
+    }
+    printf("trace %s: %zu ops, eager %.1f ns/op, plan %.1f ns/op\n", argv[1],
+           trace.size(), replay_eager(trace, 10), replay_eager(trace, 10, true));
+    return 0;
+  }
+  int blocks[] = {256, 1024, 4096};
+  for (auto num : blocks) {
+    auto trace = make_residual_trace(num);
+    printf("residual %d blocks: %zu ops, eager %.1f ns/op, plan %.1f ns/op\n",
+           num, trace.size(), replay_eager(trace, 10),
+           replay_eager(trace, 10, true));
+  }
+  int widths[] = {1000, 4000};
+  for (auto width : widths) {
+    auto trace = make_wide_trace(width, 8);
+    printf("wide %d tensors: %zu ops, eager %.1f ns/op, plan %.1f ns/op\n",
+           width, trace.size(), replay_eager(trace, 10),
+           replay_eager(trace, 10, true));
+  }
+  bench_contention();
+  bench_free_list();
+  return 0;
+}
@@ -0,0 +1,600 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <tactics/core/alloc_tracer.h>
+#include <tactics/core/backend.h>
+#include <tactics/core/buffer_allocator.h>
+#include <tactics/core/memory_utils.h>
+#include <tactics/core/tensor.h>
+
+using namespace tactics;
+
+static bool aligned(const void *ptr, size_t align) {
+  return ((uintptr_t)ptr) % align == 0;
+}
+
+static void test_slab_allocator() {
+  auto slab = BufferAllocator::Allocator::create_slab();
+  size_t sizes[] = {1, 63, 64, 100, 4096, 65536, 65537, 3 * 1024 * 1024};
+  size_t aligns[] = {16, 64, 256, 4096};
+  for (auto size : sizes) {
+    for (auto align : aligns) {
+      auto chunk = slab->on_alloc(size, align);
+      assert(chunk.first != nullptr);
+      assert(aligned(chunk.ptr(), align));
+      ::memset(chunk.ptr(), 0x5a, size);
+      slab->on_release(chunk);
+    }
+  }
+
+  // freed block is served again from the thread cache
+  auto first = slab->on_alloc(200, 64);
+  slab->on_release(first);
+  auto second = slab->on_alloc(256, 64);
+  assert(first.first == second.first);
+  slab->on_release(second);
+  // so is a large mapping
+  first = slab->on_alloc(200 * 1024, 64);
+  slab->on_release(first);
+  second = slab->on_alloc(200 * 1024 + 100, 64);
+  assert(first.first == second.first);
+  slab->on_release(second);
+
+  // distinct live blocks never overlap
+  std::vector<MemChunk> chunks;
+  for (int i = 0; i < 1000; ++i) {
+    auto chunk = slab->on_alloc(128, 64);
+    ::memset(chunk.ptr(), i & 0xff, 128);
+    chunks.push_back(chunk);
+  }
+  for (int i = 0; i < 1000; ++i) {
+    assert(chunks[i].ptr()[0] == (uint8_t)(i & 0xff));
+    assert(chunks[i].ptr()[127] == (uint8_t)(i & 0xff));
+    slab->on_release(chunks[i]);
+  }
+}
+
+// built before the pool cache of its thread, so destroyed after it
+struct TensorHolder {
+  std::unique_ptr<Tensor> tensor;
+};
+
+static void test_pool_thread_exit() {
+  std::thread worker([]() {
+    static thread_local TensorHolder holder;
+    holder.tensor.reset(Tensor::create<float>({4, 4}));
+    void *block = memory_pool_alloc(100);
+    assert(nullptr != block);
+    memory_pool_free(block, 100);
+  });
+  worker.join();
+  // the blocks freed during the thread exit are served again
+  std::unique_ptr<Tensor> tensor(Tensor::create<float>({4, 4}));
+  assert(nullptr != tensor->host<float>());
+}
+
+static void test_eager_on_slab() {
+  EagerBufferAllocator allocator(BufferAllocator::Allocator::create_slab());
+  auto a = allocator.alloc(1000);
+  auto b = allocator.alloc(3000, false, 128);
+  assert(aligned(b.ptr(), 128));
+  allocator.free(a);
+  auto c = allocator.alloc(500);
+  assert(c.ptr() == a.ptr());
+  allocator.free(b);
+  allocator.free(c);
+  allocator.release(false);
+  assert(allocator.total_size() == 0);
+}
+
+static void test_eager_coalesce() {
+  EagerBufferAllocator allocator(BufferAllocator::Allocator::create_default());
+  auto block = allocator.alloc(64 * 1024);
+  allocator.free(block);
+
+  // split the block, free pieces out of order and expect them fused back
+  auto a = allocator.alloc(8 * 1024);
+  auto b = allocator.alloc(8 * 1024);
+  auto c = allocator.alloc(8 * 1024);
+  assert(a.ptr() == block.ptr());
+  assert(b.ptr() == a.ptr() + 8 * 1024);
+  allocator.free(b);
+  allocator.free(a);
+  auto d = allocator.alloc(16 * 1024);
+  assert(d.ptr() == a.ptr());
+  allocator.free(d);
+  allocator.free(c);
+  auto whole = allocator.alloc(64 * 1024);
+  assert(whole.ptr() == block.ptr());
+  assert(allocator.total_size() == 64 * 1024);
+  allocator.free(whole);
+
+  // a fully fused block is released back to the outside allocator
+  allocator.release(false);
+  assert(allocator.total_size() == 0);
+
+  // pieces freed inside a group fuse only after the barrier
+  block = allocator.alloc(32 * 1024);
+  allocator.free(block);
+  a = allocator.alloc(4 * 1024);
+  b = allocator.alloc(4 * 1024);
+  allocator.barrier_begin();
+  allocator.begin_group();
+  allocator.free(a);
+  allocator.free(b);
+  allocator.end_group();
+  allocator.barrier_end();
+  allocator.release(false);
+  assert(allocator.total_size() == 0);
+}
+
+static void test_mmap_allocator() {
+  BufferAllocator::ArenaMode modes[] = {
+      BufferAllocator::ARENA_MMAP, BufferAllocator::ARENA_MMAP_THP,
+      BufferAllocator::ARENA_HUGETLB};
+  for (auto mode : modes) {
+    auto allocator = BufferAllocator::Allocator::create_mmap(mode);
+    size_t aligns[] = {64, 4096, 2 * 1024 * 1024};
+    for (auto align : aligns) {
+      auto chunk = allocator->on_alloc(3 * 1024 * 1024 + 100, align);
+      assert(chunk.first != nullptr);
+      assert(aligned(chunk.ptr(), align));
+      assert(allocator->arena_mode() <= mode);
+      ::memset(chunk.ptr(), 1, 3 * 1024 * 1024 + 100);
+      allocator->on_release(chunk);
+    }
+  }
+
+  DeferBufferAllocator defer(BufferAllocator::Allocator::create_mmap());
+  auto a = defer.alloc(1024 * 1024);
+  auto b = defer.alloc(1024 * 1024);
+  defer.free(a);
+  defer.free(b);
+  bool ok = defer.compute();
+  assert(ok);
+  ::memset(b.ptr(), 1, 1024 * 1024);
+}
+
+static void test_concurrent_allocator() {
+  ConcurrentBufferAllocator allocator(BufferAllocator::Allocator::create_default(),
+                                      64 * 1024 * 1024);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&allocator, t]() {
+      std::vector<MemChunk> live;
+      for (int i = 0; i < 10000; ++i) {
+        size_t size = 64 + ((i * 131 + t * 17) % 4096);
+        auto chunk = allocator.alloc(size);
+        assert(chunk.ptr() != nullptr);
+        assert(aligned(chunk.ptr(), MEMORY_ALIGN_DEFAULT));
+        ::memset(chunk.ptr(), t, size);
+        live.push_back(chunk);
+        if (live.size() > 16) {
+          assert(live.front().ptr()[0] == (uint8_t)t);
+          allocator.free(live.front());
+          live.erase(live.begin());
+        }
+      }
+      for (auto &chunk : live) {
+        allocator.free(chunk);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  assert(allocator.total_size() <= 64 * 1024 * 1024);
+
+  // freed blocks of one thread are reused by another one
+  allocator.release(false);
+  auto chunk = allocator.alloc(1000);
+  std::thread([&]() { allocator.free(chunk); }).join();
+  allocator.release(false);
+  assert(allocator.total_size() == 0);
+
+  // trim drops pooled blocks only down to `keep`
+  std::vector<MemChunk> blocks;
+  for (int i = 0; i < 8; ++i) {
+    blocks.push_back(allocator.alloc(4000));
+  }
+  for (auto &block : blocks) {
+    allocator.free(block);
+  }
+  auto cached = allocator.total_size();
+  auto released = allocator.trim(cached / 2);
+  assert(released > 0 && released < cached);
+  assert(allocator.free_size() <= cached / 2);
+  assert(allocator.free_size() + released == cached);
+  auto again = allocator.trim(cached / 2);
+  assert(0 == again);
+  again = allocator.trim(0);
+  assert(again + released == cached);
+  assert(allocator.total_size() == 0);
+
+  // the budget is shared
+  ConcurrentBufferAllocator small(BufferAllocator::Allocator::create_default(),
+                                  1024 * 1024);
+  auto a = small.alloc(600 * 1024);
+  assert(a.ptr() != nullptr);
+  auto b = small.alloc(600 * 1024, false, 4096);
+  assert(b.ptr() == nullptr);
+  small.free(a);
+  b = small.alloc(600 * 1024, false, 4096);
+  assert(b.ptr() != nullptr);
+  assert(aligned(b.ptr(), 4096));
+  small.free(b);
+}
+
+static const size_t g_chain_sizes[] = {4096, 1024, 8192, 512,  2048,
+                                       16384, 1024, 4096, 256, 8192};
+
+// replay a chain where each op reads the two previous outputs
+static size_t run_defer_chain(DeferBufferAllocator &allocator,
+                              std::vector<MemChunk> &chunks) {
+  std::vector<MemChunk> live;
+  for (auto size : g_chain_sizes) {
+    auto chunk = allocator.alloc(size);
+    chunks.push_back(chunk);
+    live.push_back(chunk);
+    if (live.size() > 2) {
+      allocator.free(live.front());
+      live.erase(live.begin());
+    }
+  }
+  for (auto &chunk : live) {
+    allocator.free(chunk);
+  }
+  bool ok = allocator.compute();
+  assert(ok);
+  return allocator.total_size();
+}
+
+static void test_defer_interval_plan() {
+  auto root = BufferAllocator::Allocator::create_default();
+  DeferBufferAllocator firstFit(root);
+  std::vector<MemChunk> firstFitChunks;
+  auto firstFitSize = run_defer_chain(firstFit, firstFitChunks);
+
+  DeferBufferAllocator interval(root);
+  interval.set_plan_mode(DeferBufferAllocator::PLAN_INTERVAL);
+  std::vector<MemChunk> chunks;
+  auto intervalSize = run_defer_chain(interval, chunks);
+  assert(interval.peak_live_size() == firstFit.peak_live_size());
+  assert(intervalSize >= interval.peak_live_size());
+  assert(intervalSize <= firstFitSize);
+
+  // chunks alive together must not overlap: i overlaps i+1 and i+2
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    for (size_t j = i + 1; j < chunks.size() && j <= i + 2; ++j) {
+      auto a = chunks[i].ptr(), b = chunks[j].ptr();
+      size_t sa = g_chain_sizes[i], sb = g_chain_sizes[j];
+      assert(a + sa <= b || b + sb <= a);
+    }
+  }
+
+  // separate chunks never reuse memory freed before them
+  DeferBufferAllocator separate(root);
+  separate.set_plan_mode(DeferBufferAllocator::PLAN_INTERVAL);
+  auto a = separate.alloc(1024);
+  separate.free(a);
+  auto b = separate.alloc(1024, true);
+  separate.free(b);
+  bool ok = separate.compute();
+  assert(ok);
+  assert(a.ptr() != b.ptr());
+}
+
+static void test_alloc_tracer() {
+  auto tracer = AllocTracer::get();
+  tracer->set_enable(true);
+  auto parent = BufferAllocator::Allocator::create_default();
+  EagerBufferAllocator eager(parent);
+  auto a = eager.alloc(1000);
+  auto b = eager.alloc(3000);
+  eager.free(a);
+  auto c = eager.alloc(200);
+  eager.free(b);
+  eager.free(c);
+
+  DeferBufferAllocator defer(parent);
+  auto d = defer.alloc(4096);
+  std::unique_ptr<Tensor> tensor(new Tensor(4));
+  d.attach(tensor.get());
+  auto e = defer.alloc(4096);
+  defer.free(d);
+  defer.free(e);
+  defer.compute();
+  tracer->set_enable(false);
+
+  auto summaries = tracer->summaries();
+  assert(summaries.size() == 2);
+  auto &eagerSummary = summaries[&eager];
+  assert(eagerSummary.allocCount == 3 && eagerSummary.freeCount == 3);
+  assert(eagerSummary.live == 0 && eagerSummary.peak == 4000);
+  assert(eagerSummary.reserved >= eagerSummary.peak);
+  auto &deferSummary = summaries[&defer];
+  assert(deferSummary.peak == 8192 && deferSummary.reserved >= 8192);
+  assert(deferSummary.fragmentation() >= 0.0f);
+
+  size_t count = 0;
+  for (auto &bin : tracer->size_histogram()) {
+    count += bin.count;
+  }
+  assert(count == 5);
+
+  // the tensor is named in the trace after it is gone
+  char name[32];
+  snprintf(name, sizeof(name), "\"%p [", (const void *)tensor.get());
+  tensor.reset();
+  const char *path = "alloc_tracer_test.json";
+  bool ok = tracer->export_chrome_trace(path);
+  assert(ok);
+  FILE *f = fopen(path, "r");
+  assert(f);
+  std::string content;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    content.append(buffer, n);
+  }
+  fclose(f);
+  remove(path);
+  assert(0 == content.compare(0, 14, "{\"traceEvents\""));
+  assert(std::string::npos != content.find(name));
+
+  // disabled tracer records nothing
+  auto events = tracer->events().size();
+  eager.free(eager.alloc(64));
+  assert(tracer->events().size() == events);
+}
+
+// resident set size in bytes, 0 if unknown
+static size_t resident_size() {
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (nullptr == f) {
+    return 0;
+  }
+  unsigned long pages = 0, resident = 0;
+  int n = fscanf(f, "%lu %lu", &pages, &resident);
+  fclose(f);
+  return 2 == n ? resident * 4096 : 0;
+}
+
+static void test_runtime_gc() {
+  const size_t MB = 1024 * 1024;
+  Runtime runtime;
+  RuntimeHint hint;
+  hint.gcFreeWatermark = 32;
+  runtime.set_rumtime_hint(hint);
+  auto arena = BufferAllocator::Allocator::create_mmap(BufferAllocator::ARENA_MMAP);
+  std::shared_ptr<BufferAllocator> eager(new EagerBufferAllocator(arena));
+  runtime.add_allocator(eager);
+  {
+    // gone allocators are dropped from the registry
+    std::shared_ptr<BufferAllocator> other(new EagerBufferAllocator(arena));
+    runtime.add_allocator(other);
+  }
+
+  std::vector<MemChunk> chunks;
+  for (int i = 0; i < 4; ++i) {
+    chunks.push_back(eager->alloc(16 * MB, true));
+    ::memset(chunks.back().ptr(), 1, 16 * MB);
+  }
+  // a piece split from a block in use
+  auto block = eager->alloc(16 * MB, true);
+  ::memset(block.ptr(), 1, 16 * MB);
+  eager->free(block);
+  auto piece = eager->alloc(MB);
+  assert(piece.first == block.first);
+  for (auto &chunk : chunks) {
+    eager->free(chunk);
+  }
+  assert(runtime.on_get_memory_inmb() >= 80.0f);
+  assert(eager->free_size() == 79 * MB);
+  auto rss = resident_size();
+
+  // keep half of the watermark: whole blocks go back first, largest first
+  runtime.on_gabage_collect(50);
+  assert(eager->free_size() == 15 * MB);
+  assert(eager->total_size() == 16 * MB);
+  assert(runtime.on_get_memory_inmb() < 17.0f);
+  if (rss > 0) {
+    assert(resident_size() + 60 * MB < rss);
+  }
+
+  // only the free piece behind `piece` is left, its pages are discarded
+  rss = resident_size();
+  runtime.on_gabage_collect(100);
+  assert(eager->free_size() == 15 * MB);
+  assert(eager->total_size() == 16 * MB);
+  if (rss > 0) {
+    assert(resident_size() + 12 * MB < rss);
+  }
+  // discarded pieces are given back once
+  auto again = eager->trim(0);
+  assert(0 == again);
+  // the piece still in use keeps its content, the discarded rest is usable
+  assert(((uint8_t *)piece.ptr())[MB - 1] == 1);
+  auto reuse = eager->alloc(15 * MB);
+  assert(reuse.first == block.first);
+  ::memset(reuse.ptr(), 2, 15 * MB);
+  eager->free(reuse);
+  eager->free(piece);
+  again = eager->trim(0);
+  assert(again == 16 * MB);
+  assert(eager->total_size() == 0);
+}
+
+// chunks of one inference step, b is freed inside a group so c can't use it
+static std::vector<MemChunk> run_plan_step(EagerBufferAllocator &eager,
+                                           int n) {
+  eager.begin_plan({{1, 3, n, n}});
+  std::vector<MemChunk> chunks;
+  auto a = eager.alloc(1000 * n);
+  auto b = eager.alloc(2000);
+  eager.barrier_begin();
+  eager.begin_group();
+  eager.free(b);
+  eager.end_group();
+  auto c = eager.alloc(1500);
+  eager.barrier_end();
+  auto d = eager.alloc(2000, false, 256);
+  ::memset(a.ptr(), 1, 1000 * n);
+  ::memset(c.ptr(), 2, 1500);
+  ::memset(d.ptr(), 3, 2000);
+  assert(((uint8_t *)a.ptr())[0] == 1 && ((uint8_t *)c.ptr())[0] == 2);
+  eager.free(a);
+  eager.free(c);
+  eager.free(d);
+  eager.end_plan();
+  return {a, b, c, d};
+}
+
+static bool overlap(MemChunk x, size_t xSize, MemChunk y, size_t ySize) {
+  return x.ptr() < y.ptr() + ySize && y.ptr() < x.ptr() + xSize;
+}
+
+static void test_eager_plan() {
+  EagerBufferAllocator eager(BufferAllocator::Allocator::create_default());
+  // first run of a signature records, the next ones replay
+  run_plan_step(eager, 4);
+  assert(eager.plan_count() == 1);
+  auto before = eager.total_size();
+  auto first = run_plan_step(eager, 4);
+  auto arena = eager.total_size() - before;
+  assert(arena > 0 && arena < 4000 + 2000 + 1500 + 2000 + 256);
+  auto second = run_plan_step(eager, 4);
+  assert(eager.total_size() == before + arena);
+  for (size_t i = 0; i < first.size(); ++i) {
+    assert(first[i].ptr() == second[i].ptr());
+  }
+  assert(!overlap(first[0], 4000, first[1], 2000));
+  assert(!overlap(first[1], 2000, first[2], 1500));
+  assert(!overlap(first[0], 4000, first[2], 1500));
+  assert(aligned(first[3].ptr(), 256));
+
+  // a diverging run falls back to the free lists and drops the plan
+  eager.begin_plan({{1, 3, 4, 4}});
+  assert(eager.replaying());
+  auto a = eager.alloc(4000);
+  assert(a.ptr() == first[0].ptr());
+  auto b = eager.alloc(3000);
+  assert(!eager.replaying());
+  eager.free(b);
+  eager.end_plan();
+  assert(eager.plan_count() == 0);
+  // the replayed chunk outlives its plan
+  ::memset(a.ptr(), 1, 4000);
+  eager.free(a);
+  assert(eager.total_size() == before);
+
+  // least recently used plans are dropped
+  eager.set_plan_cache_size(2);
+  for (int n = 1; n <= 3; ++n) {
+    run_plan_step(eager, n);
+  }
+  assert(eager.plan_count() == 2);
+  run_plan_step(eager, 3);
+  eager.begin_plan({{1, 3, 1, 1}});
+  assert(!eager.replaying());
+  eager.end_plan();
+
+  // trim keeps the plans and drops their idle arenas
+  eager.trim(0);
+  assert(eager.plan_count() == 2);
+  run_plan_step(eager, 3);
+  eager.release();
+  assert(eager.plan_count() == 0 && eager.total_size() == 0);
+}
+
+// elementwise chain x0 -> x1 -> ... -> xn, each op frees its input
+static size_t run_inplace_chain(DeferBufferAllocator &defer, int length,
+                                bool inplace, std::vector<MemChunk> &chunks) {
+  defer.reset();
+  defer.set_plan_mode(DeferBufferAllocator::PLAN_INTERVAL);
+  chunks.clear();
+  chunks.push_back(defer.alloc(4096));
+  for (int i = 0; i < length; ++i) {
+    auto input = chunks.back();
+    chunks.push_back(inplace ? defer.alloc_inplace(input, 4096)
+                             : defer.alloc(4096));
+    defer.free(input);
+  }
+  defer.free(chunks.back());
+  bool ok = defer.compute();
+  assert(ok);
+  return defer.total_size();
+}
+
+static void test_defer_inplace() {
+  DeferBufferAllocator defer(BufferAllocator::Allocator::create_default());
+  std::vector<MemChunk> chunks;
+  auto size = run_inplace_chain(defer, 8, false, chunks);
+  assert(size == 2 * 4096);
+  size = run_inplace_chain(defer, 8, true, chunks);
+  assert(size == 4096);
+  for (auto &chunk : chunks) {
+    assert(chunk.ptr() == chunks[0].ptr());
+  }
+
+  // the input is still read by a later op, no alias
+  defer.reset();
+  defer.set_plan_mode(DeferBufferAllocator::PLAN_INTERVAL);
+  auto x = defer.alloc(4096);
+  auto y = defer.alloc_inplace(x, 4096);
+  auto z = defer.alloc(4096);
+  defer.free(x);
+  defer.free(y);
+  defer.free(z);
+  bool ok = defer.compute();
+  assert(ok);
+  assert(x.ptr() != y.ptr());
+  assert(defer.total_size() == 3 * 4096);
+
+  // a smaller output on a larger input, then a larger one again
+  defer.reset();
+  defer.set_plan_mode(DeferBufferAllocator::PLAN_INTERVAL);
+  auto a = defer.alloc(8192);
+  auto b = defer.alloc_inplace(a, 1024);
+  defer.free(a);
+  auto c = defer.alloc_inplace(b, 16384);
+  defer.free(b);
+  auto d = defer.alloc(4096);
+  defer.free(c);
+  defer.free(d);
+  ok = defer.compute();
+  assert(ok);
+  assert(a.ptr() == b.ptr() && b.ptr() == c.ptr());
+  assert(defer.total_size() == 16384 + 4096);
+
+  // first fit ignores the hint
+  defer.reset();
+  defer.set_plan_mode(DeferBufferAllocator::PLAN_FIRST_FIT);
+  auto e = defer.alloc(4096);
+  auto f = defer.alloc_inplace(e, 4096);
+  defer.free(e);
+  defer.free(f);
+  ok = defer.compute();
+  assert(ok);
+  assert(e.ptr() != f.ptr());
+}
+
+int main() {
+  test_slab_allocator();
+  test_pool_thread_exit();
+  test_eager_on_slab();
+  test_eager_coalesce();
+  test_mmap_allocator();
+  test_concurrent_allocator();
+  test_defer_interval_plan();
+  test_alloc_tracer();
+  test_runtime_gc();
+  test_eager_plan();
+  test_defer_inplace();
+  return 0;
+}
@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <tactics/core/tensor.h>
+#include <tactics/core/tensor_utils.h>
+
+using namespace tactics;
+
+// best ms of `rounds` compares of two equal [64, 1024, 1024] float
+// tensors, the size of the outputs checked by the accuracy gates
+template <typename Compare> static double bench(Compare compare, int rounds = 5) {
+  double best = 0.0;
+  for (int r = 0; r < rounds; ++r) {
+    auto begin = std::chrono::steady_clock::now();
+    compare();
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - begin).count();
+    best = 0 == r ? ms : std::min(best, ms);
+  }
+  return best;
+}
+
+int main() {
+  std::unique_ptr<Tensor> a(Tensor::create<float>({64, 1024, 1024}));
+  std::unique_ptr<Tensor> b(Tensor::create<float>({64, 1024, 1024}));
+  for (int64_t i = 0; i < a->elementSize(); ++i) {
+    a->host<float>()[i] = (float)(i % 1000) * 0.001f;
+    b->host<float>()[i] = a->host<float>()[i];
+  }
+  // the floor, one pass over both
+  float floor = 0.0f;
+  printf("max |a - b| loop: %.1f ms\n", bench([&]() {
+           auto pa = a->host<float>(), pb = b->host<float>();
+           int64_t count = a->elementSize();
+           for (int64_t i = 0; i < count; ++i) {
+             floor = std::max(floor, std::fabs(pa[i] - pb[i]));
+           }
+         }));
+  printf("compare_tensors: %.1f ms\n", bench([&]() {
+           TensorUtils::compare_tensors(a.get(), b.get(), 0.001f);
+         }));
+  TensorUtils::CompareStats stats;
+  for (int threads : {1, 4}) {
+    printf("compare_tensors with stats, %d threads: %.1f ms\n", threads,
+           bench([&]() {
+             TensorUtils::compare_tensors(a.get(), b.get(), stats, 0.001f,
+                                          false, 16, threads);
+           }));
+  }
+  return floor > 0.0f;
+}
@@ -0,0 +1,249 @@
+#include <cassert>
+#include <memory>
+#include <tactics/core/tensor_utils.h>
+#include <tactics/ops/cpu/cpu_backend.h>
+
+using namespace tactics;
+
+static Runtime *create_runtime(int allocatorType) {
+  auto creator = get_extra_runtime_creator(FORWARD_CPU);
+  assert(nullptr != creator);
+  Backend::Info info;
+  auto runtime = creator->on_create(info);
+  RuntimeHint hint;
+  hint.memoryAllocatorType = allocatorType;
+  runtime->set_rumtime_hint(hint);
+  return runtime;
+}
+
+static void test_eager() {
+  std::unique_ptr<Runtime> runtime(create_runtime(Runtime::Allocator_Eager));
+  std::unique_ptr<Backend> backend(runtime->on_create());
+  std::unique_ptr<Tensor> a(Tensor::create_device<float>({1, 3, 8, 8}));
+  std::unique_ptr<Tensor> b(Tensor::create_device<float>({1, 3, 8, 8}));
+  std::unique_ptr<Tensor> weight(Tensor::create_device<float>({16, 3}));
+  bool ok = backend->on_acquire_buffer(weight.get(), Backend::STATIC) &&
+            backend->on_acquire_buffer(a.get(), Backend::DYNAMIC);
+  assert(ok);
+  assert(nullptr != a->host<float>() && nullptr != weight->host<float>());
+  auto host = a->host<float>();
+  host[3 * 64 - 1] = 1.0f;
+  // a released chunk is handed to the next tensor of the same size
+  backend->on_release_buffer(a.get(), Backend::DYNAMIC);
+  ok = backend->on_acquire_buffer(b.get(), Backend::DYNAMIC);
+  assert(ok);
+  assert(b->host<float>() == host);
+  assert(runtime->on_get_memory_inmb() > 0.0f);
+
+  // kept over release until the buffers are cleared
+  std::unique_ptr<Tensor> c(Tensor::create_device<float>({1, 3, 8, 8}));
+  ok = backend->on_acquire_buffer(c.get(), Backend::DYNAMIC_SEPERATE);
+  assert(ok);
+  auto separate = c->host<float>();
+  backend->on_release_buffer(c.get(), Backend::DYNAMIC_SEPERATE);
+  ok = backend->on_acquire_buffer(a.get(), Backend::DYNAMIC);
+  assert(ok);
+  assert(a->host<float>() != separate);
+  ok = backend->on_clear_buffer();
+  assert(ok);
+  // mem objects of cleared buffers free nothing
+  backend->on_release_buffer(a.get(), Backend::DYNAMIC);
+  backend->on_release_buffer(b.get(), Backend::DYNAMIC);
+  backend->on_release_buffer(weight.get(), Backend::STATIC);
+}
+
+static void test_defer() {
+  std::unique_ptr<Runtime> runtime(create_runtime(Runtime::Allocator_Defer));
+  std::unique_ptr<Backend> backend(runtime->on_create());
+  std::unique_ptr<Tensor> a(Tensor::create_device<float>({1, 4, 16, 16}));
+  std::unique_ptr<Tensor> b(Tensor::create_device<float>({1, 4, 16, 16}));
+  std::unique_ptr<Tensor> c(Tensor::create_device<float>({1, 4, 16, 16}));
+  backend->on_resize_begin();
+  bool ok = backend->on_acquire_buffer(a.get(), Backend::DYNAMIC) &&
+            backend->on_acquire_buffer(b.get(), Backend::DYNAMIC);
+  assert(ok);
+  backend->on_release_buffer(a.get(), Backend::DYNAMIC);
+  ok = backend->on_acquire_buffer(c.get(), Backend::DYNAMIC);
+  assert(ok);
+  // offsets are known once the resize ends, the memory of the tensors
+  // released during the resize stays valid until the next one
+  assert(nullptr == b->host<float>() && nullptr == c->host<float>());
+  backend->on_release_buffer(b.get(), Backend::DYNAMIC);
+  backend->on_release_buffer(c.get(), Backend::DYNAMIC);
+  ok = backend->on_resize_end();
+  assert(ok);
+  assert(nullptr != b->host<float>() && nullptr != c->host<float>());
+  assert(b->host<float>() != c->host<float>());
+  auto cpu = static_cast<CPUBackend *>(backend.get());
+  assert(cpu->dynamic_allocator()->total_size() == 2 * b->usize());
+
+  // a new resize drops the old plan
+  backend->on_resize_begin();
+  ok = backend->on_acquire_buffer(a.get(), Backend::DYNAMIC);
+  assert(ok);
+  backend->on_release_buffer(a.get(), Backend::DYNAMIC);
+  ok = backend->on_resize_end();
+  assert(ok);
+  assert(cpu->dynamic_allocator()->total_size() == a->usize());
+}
+
+static Tensor *create_format(const std::vector<int> &dims, DATA_FORMAT format) {
+  auto tensor = Tensor::create_device<float>(dims);
+  TensorUtils::get_describe(tensor)->dimension_format = format;
+  TensorUtils::set_linear_layout(tensor);
+  return tensor;
+}
+
+static void test_copy() {
+  std::unique_ptr<Runtime> runtime(create_runtime(Runtime::Allocator_Eager));
+  std::unique_ptr<Backend> backend(runtime->on_create());
+  const int batch = 2, channel = 5, area = 6;
+  std::unique_ptr<Tensor> nchw(
+      create_format({batch, channel, 2, 3}, DATA_FORMAT_NCHW));
+  std::unique_ptr<Tensor> nc4hw4(
+      create_format({batch, channel, 2, 3}, DATA_FORMAT_NC4HW4));
+  std::unique_ptr<Tensor> nhwc(
+      create_format({batch, 2, 3, channel}, DATA_FORMAT_NHWC));
+  std::unique_ptr<Tensor> back(
+      create_format({batch, channel, 2, 3}, DATA_FORMAT_NCHW));
+  for (auto t : {nchw.get(), nc4hw4.get(), nhwc.get(), back.get()}) {
+    bool ok = backend->on_acquire_buffer(t, Backend::STATIC);
+    assert(ok);
+  }
+  assert(nc4hw4->usize() == batch * 8 * area * sizeof(float));
+  for (int i = 0; i < batch * channel * area; ++i) {
+    nchw->host<float>()[i] = (float)i;
+  }
+  backend->on_copy_buffer(nchw.get(), nc4hw4.get());
+  auto packed = nc4hw4->host<float>();
+  // batch 1, channel 4 at position 4 is the first of the second pack
+  assert(packed[((1 * 2 + 1) * area + 4) * 4] == (1 * channel + 4) * area + 4);
+  // channels padded to 8 are zero
+  assert(packed[(1 * area + 0) * 4 + 2] == 0.0f);
+  backend->on_copy_buffer(nc4hw4.get(), nhwc.get());
+  assert(nhwc->host<float>()[(1 * area + 4) * channel + 2] ==
+         (1 * channel + 2) * area + 4);
+  backend->on_copy_buffer(nhwc.get(), back.get());
+  for (int i = 0; i < batch * channel * area; ++i) {
+    assert(back->host<float>()[i] == (float)i);
+  }
+  // packed tensors are compared through a planar copy
+  assert(TensorUtils::compare_tensors(nc4hw4.get(), nchw.get()));
+  for (auto t : {nchw.get(), nc4hw4.get(), nhwc.get(), back.get()}) {
+    backend->on_release_buffer(t, Backend::STATIC);
+  }
+}
+
+static void test_map() {
+  std::unique_ptr<Runtime> runtime(create_runtime(Runtime::Allocator_Eager));
+  std::unique_ptr<Backend> backend(runtime->on_create());
+  const int channel = 5, area = 6;
+  std::unique_ptr<Tensor> nchw(
+      create_format({1, channel, 2, 3}, DATA_FORMAT_NCHW));
+  std::unique_ptr<Tensor> packed(
+      create_format({1, channel, 2, 3}, DATA_FORMAT_NC4HW4));
+  for (auto t : {nchw.get(), packed.get()}) {
+    bool ok = backend->on_acquire_buffer(t, Backend::STATIC);
+    assert(ok);
+  }
+  // dense planar host memory is mapped as it is
+  auto plain = nchw->map(Tensor::MAP_TENSOR_READ);
+  assert(plain == nchw->host<void>());
+  nchw->unmap(Tensor::MAP_TENSOR_READ, plain);
+  assert(0 == backend->staging_size());
+
+  // written planar, stored packed
+  auto write = (float *)packed->map(Tensor::MAP_TENSOR_WRITE);
+  assert(nullptr != write && write != packed->host<float>());
+  for (int i = 0; i < channel * area; ++i) {
+    write[i] = (float)i;
+  }
+  packed->unmap(Tensor::MAP_TENSOR_WRITE, write);
+  auto device = packed->host<float>();
+  assert(device[(1 * area + 2) * 4 + 0] == 4 * area + 2);
+  // host memory written behind the backend's back is read fresh
+  device[0] = -1.0f;
+  auto read = (float *)packed->map(Tensor::MAP_TENSOR_READ);
+  assert(read == write && -1.0f == read[0]);
+  packed->unmap(Tensor::MAP_TENSOR_READ, read);
+  device[0] = -2.0f;
+  read = (float *)packed->map(Tensor::MAP_TENSOR_READ);
+  assert(read == write && -2.0f == read[0]);
+  assert(read[4 * area + 2] == 4 * area + 2);
+  packed->unmap(Tensor::MAP_TENSOR_READ, read);
+
+  // a copy into the tensor changes its content
+  for (int i = 0; i < channel * area; ++i) {
+    nchw->host<float>()[i] = 2.0f * i;
+  }
+  backend->on_copy_buffer(nchw.get(), packed.get());
+  read = (float *)packed->map(Tensor::MAP_TENSOR_READ);
+  assert(read == write && 2.0f * (4 * area + 2) == read[4 * area + 2]);
+
+  // mapped buffers stay, the others go above the limit
+  size_t size = backend->staging_size();
+  assert(size >= channel * area * sizeof(float));
+  backend->set_staging_limit(0);
+  assert(size == backend->staging_size());
+  packed->unmap(Tensor::MAP_TENSOR_READ, read);
+  assert(0 == backend->staging_size());
+  for (auto t : {nchw.get(), packed.get()}) {
+    backend->on_release_buffer(t, Backend::STATIC);
+  }
+}
+
+// tensors held past their backend and runtime still free their memory
+static void test_outlive() {
+  for (int type : {Runtime::Allocator_Eager, Runtime::Allocator_Defer}) {
+    std::unique_ptr<Runtime> runtime(create_runtime(type));
+    std::unique_ptr<Backend> backend(runtime->on_create());
+    std::unique_ptr<Tensor> weight(Tensor::create_device<float>({16, 3}));
+    std::unique_ptr<Tensor> a(Tensor::create_device<float>({1, 3, 8, 8}));
+    std::unique_ptr<Tensor> b(Tensor::create_device<float>({1, 3, 8, 8}));
+    backend->on_resize_begin();
+    bool ok = backend->on_acquire_buffer(weight.get(), Backend::STATIC) &&
+              backend->on_acquire_buffer(a.get(), Backend::DYNAMIC) &&
+              backend->on_acquire_buffer(b.get(), Backend::DYNAMIC);
+    assert(ok);
+    ok = backend->on_resize_end();
+    assert(ok);
+    // a is from a cleared generation, b and weight are live
+    backend->on_clear_buffer();
+    ok = backend->on_acquire_buffer(b.get(), Backend::DYNAMIC);
+    assert(ok);
+    backend.reset();
+    runtime.reset();
+  }
+}
+
+// garbage collection gives the free memory of a backend back to the system
+static void test_gc() {
+  std::unique_ptr<Runtime> runtime(create_runtime(Runtime::Allocator_Eager));
+  RuntimeHint hint = runtime->hint();
+  hint.gcFreeWatermark = 0;
+  runtime->set_rumtime_hint(hint);
+  std::unique_ptr<Backend> backend(runtime->on_create());
+  std::unique_ptr<Tensor> a(Tensor::create_device<float>({1, 4, 1024, 1024}));
+  std::unique_ptr<Tensor> b(Tensor::create_device<float>({1, 4, 1024, 1024}));
+  bool ok = backend->on_acquire_buffer(a.get(), Backend::DYNAMIC) &&
+            backend->on_acquire_buffer(b.get(), Backend::DYNAMIC);
+  assert(ok);
+  // dynamic memory is carved from the static allocator, counted once
+  float used = runtime->on_get_memory_inmb();
+  assert(used >= 32.0f && used < 33.0f);
+  backend->on_release_buffer(a.get(), Backend::DYNAMIC);
+  backend->on_release_buffer(b.get(), Backend::DYNAMIC);
+  assert(runtime->on_get_memory_inmb() == used);
+  runtime->on_gabage_collect(100);
+  assert(runtime->on_get_memory_inmb() < 1.0f);
+}
+
+int main() {
+  test_eager();
+  test_defer();
+  test_copy();
+  test_map();
+  test_outlive();
+  test_gc();
+  return 0;
+}
@@ -0,0 +1,172 @@
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <tactics/ops/cpu/cpu_cast.h>
+#include <tactics/ops/cpu/cpu_tensor_convert.h>
+
+using namespace tactics;
+
+static uint32_t bits_of(float f) {
+  uint32_t bits;
+  ::memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+static float float_of(uint32_t bits) {
+  float f;
+  ::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// the nearest half by search, ties to the even one
+static uint16_t reference_half(float f) {
+  if (std::isnan(f)) {
+    return 0x7e00;
+  }
+  uint16_t sign = std::signbit(f) ? 0x8000 : 0;
+  double v = std::fabs((double)f);
+  uint16_t best = 0x7c00;
+  double bestDiff = HUGE_VAL;
+  for (uint32_t h = 0; h < 0x7c00; ++h) {
+    double diff = std::fabs((double)CPUCast::half_to_float((uint16_t)h) - v);
+    if (diff < bestDiff || (diff == bestDiff && 0 == (h & 1))) {
+      best = (uint16_t)h, bestDiff = diff;
+    }
+  }
+  // past the largest half plus half an ulp
+  if (v >= 65520.0) {
+    best = 0x7c00;
+  }
+  return sign | best;
+}
+
+static void test_scalar() {
+  // every half goes to float and back unchanged, nan stays nan
+  for (uint32_t h = 0; h < 0x10000; ++h) {
+    float f = CPUCast::half_to_float((uint16_t)h);
+    if (0x7c00 == (h & 0x7c00) && 0 != (h & 0x3ff)) {
+      assert(std::isnan(f));
+      continue;
+    }
+    assert(CPUCast::float_to_half(f) == h);
+  }
+  assert(1.0f == CPUCast::half_to_float(0x3c00));
+  assert(65504.0f == CPUCast::half_to_float(0x7bff));
+  assert(std::ldexp(1.0f, -24) == CPUCast::half_to_float(0x0001));
+  // ties to even, overflow, underflow
+  assert(0x3c00 == CPUCast::float_to_half(1.0f + std::ldexp(1.0f, -11)));
+  assert(0x3c02 == CPUCast::float_to_half(1.0f + 3 * std::ldexp(1.0f, -11)));
+  assert(0x7bff == CPUCast::float_to_half(65519.0f));
+  assert(0x7c00 == CPUCast::float_to_half(65520.0f));
+  assert(0xfc00 == CPUCast::float_to_half(-INFINITY));
+  assert(0x0000 == CPUCast::float_to_half(std::ldexp(1.0f, -26)));
+  assert(0x0001 == CPUCast::float_to_half(std::ldexp(1.5f, -25)));
+  for (float f : {0.1f, -3.14159f, 1e-5f, 6.1e-5f, 3e-7f, 1000.7f, -65510.0f}) {
+    assert(CPUCast::float_to_half(f) == reference_half(f));
+  }
+
+  // bfloat16 is the top half of a float, rounded to even
+  assert(0x3f80 == CPUCast::float_to_bf16(1.0f));
+  assert(0x3f80 == CPUCast::float_to_bf16(float_of(0x3f808000)));
+  assert(0x3f82 == CPUCast::float_to_bf16(float_of(0x3f818000)));
+  assert(0x3f81 == CPUCast::float_to_bf16(float_of(0x3f808001)));
+  assert(0x7f80 == CPUCast::float_to_bf16(INFINITY));
+  assert(0x7fc0 == CPUCast::float_to_bf16(float_of(0x7f800001)));
+  assert(float_of(0xc0490000) == CPUCast::bf16_to_float(0xc049));
+}
+
+// the vector kernels agree with the scalar ones, tails included
+static void test_bulk() {
+  std::vector<float> src;
+  for (uint32_t i = 0; i < 70001; ++i) {
+    src.push_back(float_of(i * 61417u));
+  }
+  src.push_back(NAN);
+  src.push_back(-0.0f);
+  std::vector<uint16_t> half(src.size()), bf16(src.size());
+  std::vector<float> back(src.size());
+  for (size_t count : {src.size(), (size_t)7, (size_t)8, (size_t)13}) {
+    CPUCast::float_to_half(src.data(), half.data(), count);
+    CPUCast::float_to_bf16(src.data(), bf16.data(), count);
+    for (size_t i = 0; i < count; ++i) {
+      assert(half[i] == CPUCast::float_to_half(src[i]));
+      assert(bf16[i] == CPUCast::float_to_bf16(src[i]));
+    }
+    CPUCast::half_to_float(half.data(), back.data(), count);
+    for (size_t i = 0; i < count; ++i) {
+      assert(bits_of(back[i]) == bits_of(CPUCast::half_to_float(half[i])));
+    }
+    CPUCast::bf16_to_float(bf16.data(), back.data(), count);
+    for (size_t i = 0; i < count; ++i) {
+      assert(bits_of(back[i]) == bits_of(CPUCast::bf16_to_float(bf16[i])));
+    }
+  }
+}
+
+static void test_tensor() {
+  auto half = halide_type_t(halide_type_float, 16);
+  auto bf16 = halide_type_t(halide_type_bfloat, 16);
+  // large enough to be split over threads
+  std::vector<int> shape = {3, 5, 301, 257};
+  auto input = Tensor::create(shape, halide_type_of<float>());
+  auto count = input->elementSize();
+  for (int64_t i = 0; i < count; ++i) {
+    input->host<float>()[i] = (float)(i % 2000) * 0.25f - 100.0f;
+  }
+  auto h = Tensor::create(shape, half);
+  auto b = Tensor::create(shape, bf16);
+  auto output = Tensor::create(shape, halide_type_of<float>());
+  assert(h->size() == count * 2);
+  bool ok = CPUCast::cast(input, h, 4);
+  assert(ok);
+  ok = CPUCast::cast(h, b, 4);
+  assert(ok);
+  ok = CPUCast::cast(b, output, 4);
+  assert(ok);
+  // float to half is exact here, half to bfloat16 rounds once
+  for (int64_t i = 0; i < count; ++i) {
+    float v = input->host<float>()[i];
+    assert(output->host<float>()[i] ==
+           CPUCast::bf16_to_float(CPUCast::float_to_bf16(v)));
+  }
+  TensorUtils::CompareStats stats;
+  ok = TensorUtils::compare_tensors(output, input, stats, 0.01f);
+  assert(ok);
+  assert(stats.maxUlp > 0);
+  // not a float type
+  auto ints = Tensor::create(shape, halide_type_of<int32_t>());
+  ok = CPUCast::cast(input, ints);
+  assert(!ok);
+
+  // NCHW float to NC4HW4 half through the converter, cast and packed
+  auto packed = Tensor::create_device(shape, half);
+  TensorUtils::get_describe(packed)->dimension_format = DATA_FORMAT_NC4HW4;
+  TensorUtils::set_linear_layout(packed);
+  std::vector<uint16_t> packedData(packed->usize() / 2, 0xffff);
+  packed->buffer().host = (uint8_t *)packedData.data();
+  ok = CPUTensorConverter::convert(input, packed);
+  assert(ok);
+  // batch 1, channel 4, pixel 7
+  int area = 301 * 257;
+  assert(packedData[((1 * 2 + 1) * area + 7) * 4 + 0] ==
+         CPUCast::float_to_half(input->host<float>()[(1 * 5 + 4) * area + 7]));
+  // padded channels are zeroed
+  assert(0 == packedData[((1 * 2 + 1) * area + 7) * 4 + 1]);
+  ok = CPUTensorConverter::convert(packed, output);
+  assert(ok);
+  ok = TensorUtils::compare_tensors(output, input, stats, 0.001f);
+  assert(ok);
+  packed->buffer().host = nullptr;
+  for (auto t : {input, h, b, output, ints, packed}) {
+    delete t;
+  }
+}
+
+int main() {
+  test_scalar();
+  test_bulk();
+  test_tensor();
+  return 0;
+}
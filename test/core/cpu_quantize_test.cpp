@@ -0,0 +1,244 @@
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include <tactics/ops/cpu/cpu_quantize.h>
+#include <tactics/ops/cpu/cpu_tensor_convert.h>
+
+using namespace tactics;
+
+static float reference_dequant(int q, float scale, float zero) {
+  return ((float)q - zero) * scale;
+}
+
+static int reference_quant(float x, float scale, float zero, float lo,
+                           float hi) {
+  float v = x * (1.0f / scale) + zero;
+  if (std::isnan(v)) {
+    return (int)lo;
+  }
+  return (int)lrintf(std::min(std::max(v, lo), hi));
+}
+
+static void set_quant(Tensor *tensor, const QuantAttr &attr) {
+  TensorUtils::get_describe(tensor)->quantAttr.reset(new QuantAttr(attr));
+}
+
+// the vector kernels agree with the scalar reference, tails included
+static void test_kernels() {
+  std::vector<float> src;
+  for (int i = 0; i < 1000; ++i) {
+    src.push_back((float)(i % 301) * 0.173f - 26.0f);
+  }
+  // ties, clamping and nan
+  src[3] = 0.125f;
+  src[4] = 0.375f;
+  src[5] = 1e9f;
+  src[6] = -1e9f;
+  src[7] = NAN;
+  std::vector<int8_t> q8(src.size());
+  std::vector<uint8_t> u8(src.size());
+  std::vector<float> back(src.size());
+  for (size_t count : {src.size(), (size_t)15, (size_t)16, (size_t)17}) {
+    CPUQuantize::quantize(src.data(), q8.data(), count, 0.25f, 0.0f, -127.0f,
+                          127.0f);
+    CPUQuantize::quantize(src.data(), u8.data(), count, 0.21f, 124.0f, 0.0f,
+                          255.0f);
+    for (size_t i = 0; i < count; ++i) {
+      assert(q8[i] == reference_quant(src[i], 0.25f, 0.0f, -127.0f, 127.0f));
+      assert(u8[i] == reference_quant(src[i], 0.21f, 124.0f, 0.0f, 255.0f));
+    }
+    CPUQuantize::dequantize(q8.data(), back.data(), count, 0.25f, 0.0f);
+    for (size_t i = 0; i < count; ++i) {
+      assert(back[i] == reference_dequant(q8[i], 0.25f, 0.0f));
+    }
+    CPUQuantize::dequantize(u8.data(), back.data(), count, 0.21f, 124.0f);
+    for (size_t i = 0; i < count; ++i) {
+      assert(back[i] == reference_dequant(u8[i], 0.21f, 124.0f));
+    }
+  }
+  assert(127 == q8[5] && -127 == q8[6] && -127 == q8[7]);
+  // 0.5 and 1.5 round to even
+  assert(0 == q8[3] && 2 == q8[4]);
+  // the range of the type wins over a wider QuantAttr
+  CPUQuantize::quantize(src.data() + 5, q8.data(), 2, 1.0f, 0.0f, -1000.0f,
+                        1000.0f);
+  assert(127 == q8[0] && -128 == q8[1]);
+}
+
+// [outer, channel, inner] reference with a scale per channel
+static void check_per_channel(const std::vector<int> &shape, int axis,
+                              int threads) {
+  auto input = Tensor::create(shape, halide_type_of<float>());
+  std::unique_ptr<Tensor> holder(input);
+  int64_t count = input->elementSize();
+  for (int64_t i = 0; i < count; ++i) {
+    input->host<float>()[i] = (float)((i * 37) % 1001) * 0.01f - 5.0f;
+  }
+  QuantAttr attr;
+  attr.axis = axis;
+  attr.min = -128.0f;
+  attr.max = 127.0f;
+  for (int c = 0; c < shape[axis]; ++c) {
+    attr.scales.push_back(0.01f + c * 0.003f);
+    attr.zeros.push_back((float)(c % 5) - 2.0f);
+  }
+  std::unique_ptr<Tensor> quant(Tensor::create(shape, halide_type_of<int8_t>()));
+  std::unique_ptr<Tensor> output(Tensor::create(shape, halide_type_of<float>()));
+  set_quant(quant.get(), attr);
+  bool ok = CPUQuantize::quantize(input, quant.get(), threads);
+  assert(ok);
+  ok = CPUQuantize::dequantize(quant.get(), output.get(), threads);
+  assert(ok);
+  size_t outer, channel, inner;
+  ok = CPUQuantize::split(input, attr, outer, channel, inner);
+  assert(ok && channel == (size_t)shape[axis]);
+  for (size_t o = 0; o < outer; ++o) {
+    for (size_t c = 0; c < channel; ++c) {
+      for (size_t x = 0; x < inner; ++x) {
+        size_t i = (o * channel + c) * inner + x;
+        int q = reference_quant(input->host<float>()[i], attr.scales[c],
+                                attr.zeros[c], -128.0f, 127.0f);
+        assert(quant->host<int8_t>()[i] == q);
+        assert(output->host<float>()[i] ==
+               reference_dequant(q, attr.scales[c], attr.zeros[c]));
+      }
+    }
+  }
+}
+
+static void test_tensor() {
+  check_per_channel({2, 3, 5, 7}, 1, 1);
+  // channel last, a parameter per element
+  check_per_channel({4, 5, 19}, 2, 1);
+  check_per_channel({7}, 0, 1);
+  // large enough to be split over threads
+  check_per_channel({3, 17, 129, 65}, 1, 4);
+  check_per_channel({3, 129, 65, 17}, 3, 4);
+
+  // scales must match the axis, and packed tensors are per tensor only
+  std::unique_ptr<Tensor> input(Tensor::create({2, 3, 4}, halide_type_of<float>()));
+  std::unique_ptr<Tensor> quant(Tensor::create({2, 3, 4}, halide_type_of<int8_t>()));
+  QuantAttr attr;
+  attr.axis = 1;
+  attr.scales = {0.1f, 0.2f};
+  set_quant(quant.get(), attr);
+  bool ok = CPUQuantize::quantize(input.get(), quant.get());
+  assert(!ok);
+  attr.scales.push_back(0.3f);
+  set_quant(quant.get(), attr);
+  TensorUtils::get_describe(quant.get())->dimension_format = DATA_FORMAT_NC4HW4;
+  TensorUtils::get_describe(input.get())->dimension_format = DATA_FORMAT_NC4HW4;
+  size_t outer, channel, inner;
+  ok = CPUQuantize::split(quant.get(), attr, outer, channel, inner);
+  assert(!ok);
+  // no QuantAttr
+  std::unique_ptr<Tensor> plain(Tensor::create({2, 3, 4}, halide_type_of<int8_t>()));
+  ok = CPUQuantize::quantize(input.get(), plain.get());
+  assert(!ok);
+}
+
+static void test_convert() {
+  // NCHW float to NC4HW4 int8 and back through the converter
+  std::vector<int> shape = {2, 7, 3, 5};
+  std::unique_ptr<Tensor> input(Tensor::create(shape, halide_type_of<float>()));
+  for (int i = 0; i < 2 * 7 * 3 * 5; ++i) {
+    input->host<float>()[i] = (float)(i % 23) * 0.5f - 5.0f;
+  }
+  QuantAttr attr;
+  attr.scale = 0.05f;
+  attr.zero = 3.0f;
+  std::unique_ptr<Tensor> packed(Tensor::create_device(shape, halide_type_of<int8_t>()));
+  TensorUtils::get_describe(packed.get())->dimension_format = DATA_FORMAT_NC4HW4;
+  TensorUtils::set_linear_layout(packed.get());
+  set_quant(packed.get(), attr);
+  std::vector<int8_t> packedData(packed->usize(), 0x55);
+  packed->buffer().host = (uint8_t *)packedData.data();
+  bool ok = CPUTensorConverter::convert(input.get(), packed.get());
+  assert(ok);
+  // batch 1, channel 6, pixel 4
+  assert(packedData[((1 * 2 + 1) * 15 + 4) * 4 + 2] ==
+         reference_quant(input->host<float>()[(1 * 7 + 6) * 15 + 4], 0.05f,
+                         3.0f, -127.0f, 127.0f));
+  // padding is the zero point
+  assert(3 == packedData[((1 * 2 + 1) * 15 + 4) * 4 + 3]);
+
+  std::unique_ptr<Tensor> output(Tensor::create(shape, halide_type_of<float>()));
+  ok = CPUTensorConverter::convert(packed.get(), output.get());
+  assert(ok);
+  TensorUtils::CompareStats stats;
+  TensorUtils::compare_tensors(output.get(), input.get(), stats);
+  // half a step of 0.05 at most
+  assert(stats.maxAbsError <= 0.025f + 1e-6f);
+  packed->buffer().host = nullptr;
+}
+
+static void test_calibrate() {
+  std::unique_ptr<Tensor> a(Tensor::create({4, 1000}, halide_type_of<float>()));
+  std::unique_ptr<Tensor> b(Tensor::create({4, 1000}, halide_type_of<float>()));
+  for (int i = 0; i < 4000; ++i) {
+    a->host<float>()[i] = (float)(i % 1000) * 0.002f - 1.0f;
+    b->host<float>()[i] = (float)(i % 1000) * 0.003f - 0.5f;
+  }
+  // a single outlier
+  b->host<float>()[1234] = 40.0f;
+
+  QuantCalibrator minMax;
+  bool ok = minMax.observe(a.get()) && minMax.observe(b.get());
+  assert(ok);
+  auto attr = minMax.compute(halide_type_of<int8_t>());
+  assert(std::fabs(attr.scale - 40.0f / 127.0f) < 1e-6f && 0.0f == attr.zero);
+  assert(-127.0f == attr.min && 127.0f == attr.max);
+  // asymmetric uint8 over [-1, 40], 0 stays exact
+  attr = minMax.compute(halide_type_of<uint8_t>());
+  assert(std::fabs(attr.scale - 41.0f / 255.0f) < 1e-6f);
+  assert(attr.zero == rintf(1.0f / attr.scale));
+  assert(0.0f == attr.min && 255.0f == attr.max);
+
+  // the outlier is clipped, about 2.5 covers the rest
+  QuantCalibrator percentile(QuantCalibrator::PERCENTILE, -1, 0.999f);
+  ok = percentile.observe(a.get()) && percentile.observe(b.get());
+  assert(ok);
+  attr = percentile.compute(halide_type_of<int8_t>());
+  assert(attr.scale * 127.0f > 2.4f && attr.scale * 127.0f < 2.6f);
+
+  // per channel along axis 0 of a, row r spans [-1, 0.998] shifted by r
+  for (int i = 0; i < 4000; ++i) {
+    a->host<float>()[i] += (float)(i / 1000);
+  }
+  QuantCalibrator perChannel(QuantCalibrator::MIN_MAX, 0);
+  ok = perChannel.observe(a.get());
+  assert(ok);
+  attr = perChannel.compute(halide_type_of<int8_t>(), false);
+  assert(4 == attr.scales.size() && 4 == attr.zeros.size());
+  for (int c = 0; c < 4; ++c) {
+    float lo = ALIMIN(-1.0f + c, 0.0f), hi = 0.998f + c;
+    assert(std::fabs(attr.scales[c] - (hi - lo) / 255.0f) < 1e-6f);
+    assert(attr.zeros[c] == rintf(-128.0f - lo / attr.scales[c]));
+  }
+  // quantized with the derived parameters, within a step of the input
+  std::unique_ptr<Tensor> quant(Tensor::create({4, 1000}, halide_type_of<int8_t>()));
+  std::unique_ptr<Tensor> output(Tensor::create({4, 1000}, halide_type_of<float>()));
+  set_quant(quant.get(), attr);
+  ok = CPUQuantize::quantize(a.get(), quant.get());
+  assert(ok);
+  ok = CPUQuantize::dequantize(quant.get(), output.get());
+  assert(ok);
+  for (int i = 0; i < 4000; ++i) {
+    float step = attr.scales[i / 1000];
+    assert(std::fabs(output->host<float>()[i] - a->host<float>()[i]) <= step);
+  }
+  // another batch must have the same channels
+  std::unique_ptr<Tensor> other(Tensor::create({3, 1000}, halide_type_of<float>()));
+  ok = perChannel.observe(other.get());
+  assert(!ok);
+}
+
+int main() {
+  test_kernels();
+  test_tensor();
+  test_convert();
+  test_calibrate();
+  return 0;
+}
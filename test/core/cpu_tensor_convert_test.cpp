@@ -0,0 +1,162 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <tactics/ops/cpu/cpu_tensor_convert.h>
+
+using namespace tactics;
+
+typedef CPUTensorConverter::Layout Layout;
+
+struct Format {
+  const char *name;
+  Layout layout;
+};
+
+static Layout make_layout(int pack, int stride) {
+  Layout layout;
+  layout.pack = pack;
+  layout.stride = stride;
+  return layout;
+}
+
+static std::vector<Format> all_formats(int channel) {
+  return {
+      {"NCHW", make_layout(1, 0)},
+      {"NC4HW4", make_layout(4, 0)},
+      {"NC8HW8", make_layout(8, 0)},
+      {"NC16HW16", make_layout(16, 0)},
+      {"NHWC", make_layout(0, channel)},
+      {"NHWC4", make_layout(0, ROUND_UP(channel, 4))},
+  };
+}
+
+// element index of (b, c, x)
+static size_t index_of(const Layout &layout, int channel, int area, int b,
+                       int c, int x) {
+  if (0 == layout.pack) {
+    return ((size_t)b * area + x) * layout.stride + c;
+  }
+  int blocks = UP_DIV(channel, layout.pack);
+  return ((size_t)(b * blocks + c / layout.pack) * area + x) * layout.pack +
+         c % layout.pack;
+}
+
+static size_t size_of(const Layout &layout, int batch, int channel, int area) {
+  if (0 == layout.pack) {
+    return (size_t)batch * area * layout.stride;
+  }
+  return (size_t)batch * ROUND_UP(channel, layout.pack) * area;
+}
+
+template <typename T>
+static void check_pair(const Format &from, const Format &to, int batch,
+                       int channel, int area, int threads) {
+  std::vector<T> src(size_of(from.layout, batch, channel, area), (T)0x5a);
+  std::vector<T> dst(size_of(to.layout, batch, channel, area), (T)0x7f);
+  for (int b = 0; b < batch; ++b) {
+    for (int c = 0; c < channel; ++c) {
+      for (int x = 0; x < area; ++x) {
+        src[index_of(from.layout, channel, area, b, c, x)] =
+            (T)((b * channel + c) * area + x + 1);
+      }
+    }
+  }
+  bool ok = CPUTensorConverter::convert(src.data(), from.layout, dst.data(),
+                                        to.layout, batch, channel, area,
+                                        sizeof(T), threads);
+  assert(ok);
+  std::vector<bool> written(dst.size(), false);
+  for (int b = 0; b < batch; ++b) {
+    for (int c = 0; c < channel; ++c) {
+      for (int x = 0; x < area; ++x) {
+        auto index = index_of(to.layout, channel, area, b, c, x);
+        if (dst[index] != (T)((b * channel + c) * area + x + 1)) {
+          printf("%s -> %s, %d bytes: wrong at %d %d %d\n", from.name,
+                 to.name, (int)sizeof(T), b, c, x);
+          assert(false);
+          return;
+        }
+        written[index] = true;
+      }
+    }
+  }
+  // padding is zeroed
+  for (size_t i = 0; i < dst.size(); ++i) {
+    assert(written[i] || 0 == dst[i]);
+  }
+}
+
+template <typename T> static void check_all(int batch, int channel, int area) {
+  auto formats = all_formats(channel);
+  for (auto &from : formats) {
+    for (auto &to : formats) {
+      check_pair<T>(from, to, batch, channel, area, 1);
+    }
+  }
+}
+
+static void test_tensor() {
+  // float NCHW to NC4HW4 and NHWC4 through tensors
+  std::vector<int> shape = {2, 7, 3, 5};
+  std::vector<float> data(2 * 7 * 3 * 5);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (float)i;
+  }
+  auto nchw = Tensor::create<float>(shape, data.data());
+  TensorUtils::get_describe(nchw)->dimension_format = DATA_FORMAT_NCHW;
+
+  auto packed = Tensor::create_device<float>(shape);
+  TensorUtils::get_describe(packed)->dimension_format = DATA_FORMAT_NC4HW4;
+  TensorUtils::set_tensor_channel_pack(packed, 8);
+  TensorUtils::set_linear_layout(packed);
+  assert(packed->usize() == 2 * 8 * 3 * 5 * sizeof(float));
+  std::vector<float> packedData(packed->usize() / sizeof(float));
+  packed->buffer().host = (uint8_t *)packedData.data();
+  bool ok = CPUTensorConverter::convert(nchw, packed);
+  assert(ok);
+  // batch 1, channel 6, pixel 4
+  assert(packedData[((1 * 1 + 0) * 15 + 4) * 8 + 6] ==
+         data[(1 * 7 + 6) * 15 + 4]);
+
+  auto nhwc4 = Tensor::create_device<float>({2, 3, 5, 7});
+  TensorUtils::get_describe(nhwc4)->dimension_format = DATA_FORMAT_NHWC4;
+  TensorUtils::set_linear_layout(nhwc4);
+  assert(nhwc4->usize() == 2 * 3 * 5 * 8 * sizeof(float));
+  std::vector<float> nhwc4Data(nhwc4->usize() / sizeof(float));
+  nhwc4->buffer().host = (uint8_t *)nhwc4Data.data();
+  ok = CPUTensorConverter::convert(packed, nhwc4);
+  assert(ok);
+  assert(nhwc4Data[(1 * 15 + 4) * 8 + 6] == data[(1 * 7 + 6) * 15 + 4]);
+  assert(0.0f == nhwc4Data[(1 * 15 + 4) * 8 + 7]);
+
+  // shapes must match
+  auto other = Tensor::create_device<float>({2, 6, 3, 5});
+  other->buffer().host = (uint8_t *)nhwc4Data.data();
+  ok = CPUTensorConverter::convert(nchw, other);
+  assert(!ok);
+  for (auto t : {packed, nhwc4, other}) {
+    t->buffer().host = nullptr;
+    delete t;
+  }
+  delete nchw;
+}
+
+int main() {
+  for (int channel : {1, 3, 4, 5, 8, 13, 16, 21}) {
+    for (int area : {1, 3, 4, 9, 70}) {
+      check_all<uint8_t>(2, channel, area);
+      check_all<uint16_t>(2, channel, area);
+      check_all<uint32_t>(2, channel, area);
+    }
+  }
+  // large enough to be split over threads, by channel blocks and by pixels
+  auto formats = all_formats(37);
+  for (auto &from : formats) {
+    for (auto &to : formats) {
+      check_pair<uint32_t>(from, to, 1, 37, 120 * 77, 4);
+    }
+  }
+  test_tensor();
+  return 0;
+}
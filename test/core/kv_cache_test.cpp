@@ -0,0 +1,400 @@
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <tactics/core/kv_cache.h>
+
+using namespace tactics;
+
+// value of element `i` of token `t`, distinct for keys and values
+static float kv_value(int t, int i, bool key) {
+  return (key ? 1.0f : -1.0f) * (t * 100 + i);
+}
+
+static void append_tokens(KVCache &cache, int begin, int count) {
+  int tokenFloats = cache.config().kvHeads * cache.config().headDim;
+  std::vector<float> key(count * tokenFloats), value(count * tokenFloats);
+  for (int t = 0; t < count; ++t) {
+    for (int i = 0; i < tokenFloats; ++i) {
+      key[t * tokenFloats + i] = kv_value(begin + t, i, true);
+      value[t * tokenFloats + i] = kv_value(begin + t, i, false);
+    }
+  }
+  bool ok = cache.append(key.data(), value.data(), count);
+  assert(ok);
+}
+
+static void check_tokens(const KVCache &cache) {
+  int tokenFloats = cache.config().kvHeads * cache.config().headDim;
+  int t = 0;
+  for (int b = 0; b < cache.block_count(); ++b) {
+    auto key = cache.key_block(b);
+    auto value = cache.value_block(b);
+    for (int j = 0; j < cache.block_tokens(b); ++j, ++t) {
+      for (int i = 0; i < tokenFloats; ++i) {
+        assert(key[j * tokenFloats + i] == kv_value(t, i, true));
+        assert(value[j * tokenFloats + i] == kv_value(t, i, false));
+      }
+    }
+  }
+  assert(t == cache.tokens());
+}
+
+static void test_spill() {
+  KVCache::Config config;
+  config.kvHeads = 2;
+  config.headDim = 8;
+  config.blockTokens = 4;
+  size_t blockBytes = 2 * sizeof(float) * 4 * 2 * 8;
+  config.sizeLimit = 3 * blockBytes;
+  KVCache cache(config);
+  int tokens = 0;
+  for (int count : {1, 3, 5, 2, 11, 7, 4}) {
+    append_tokens(cache, tokens, count);
+    tokens += count;
+    assert(cache.resident_size() <= config.sizeLimit);
+    check_tokens(cache);
+  }
+  assert(cache.tokens() == 33 && cache.block_count() == 9);
+  // oldest blocks spilled, the newest stay in memory
+  assert(cache.spilled(0) && !cache.spilled(8));
+  assert(cache.spilled_size() == 6 * blockBytes);
+  cache.prefetch();
+  check_tokens(cache);
+
+  cache.clear();
+  assert(0 == cache.tokens() && 0 == cache.spilled_size());
+  append_tokens(cache, 0, 20);
+  check_tokens(cache);
+}
+
+static void test_store() {
+  RuntimeHint hint;
+  KVCacheStore unlimited(hint, 2, 1, 64);
+  hint.kvcacheSizeLimit = 1;
+  hint.kvcacheDirPath = "/tmp";
+  KVCacheStore store(hint, 2, 1, 64);
+  // 512 bytes per token, 2 MB per layer
+  for (int l = 0; l < store.layers(); ++l) {
+    assert(store.layer(l)->config().sizeLimit == 1024 * 1024);
+    append_tokens(*store.layer(l), 0, 4096);
+    append_tokens(*unlimited.layer(l), 0, 4096);
+  }
+  for (int l = 0; l < store.layers(); ++l) {
+    store.begin_layer(l);
+    check_tokens(*store.layer(l));
+  }
+  assert(store.resident_size() <= 2 * 1024 * 1024);
+  assert(store.spilled_size() >= 2 * 1024 * 1024);
+  assert(0 == unlimited.spilled_size());
+  store.clear();
+  assert(0 == store.resident_size());
+}
+
+static void test_quant() {
+  const int heads = 2, headDim = 30, tokens = 21;
+  const int tokenFloats = heads * headDim;
+  std::vector<float> key(tokens * tokenFloats), value(tokens * tokenFloats);
+  srand(7);
+  for (size_t i = 0; i < key.size(); ++i) {
+    key[i] = (rand() % 20001 - 10000) / 1000.0f + 3.0f;
+    value[i] = (rand() % 20001 - 10000) / 5000.0f;
+  }
+  // tiny and zero heads must survive too
+  for (int i = 0; i < headDim; ++i) {
+    value[i] = 1e-4f * i;
+    key[headDim + i] = 0.0f;
+  }
+  KVCache::Config config;
+  config.kvHeads = heads;
+  config.headDim = headDim;
+  config.blockTokens = 8;
+  KVCache plain(config);
+  bool ok = plain.append(key.data(), value.data(), tokens);
+  assert(ok);
+  for (int option = KVCache::QUANT_KEY; option <= KVCache::QUANT_BOTH;
+       ++option) {
+    config.quantOption = option;
+    KVCache cache(config);
+    ok = cache.append(key.data(), value.data(), 5) &&
+         cache.append(key.data() + 5 * tokenFloats,
+                      value.data() + 5 * tokenFloats, tokens - 5);
+    assert(ok);
+    assert(cache.block_bytes() < plain.block_bytes());
+    std::vector<float> k(config.blockTokens * tokenFloats),
+        v(config.blockTokens * tokenFloats);
+    int t = 0;
+    for (int b = 0; b < cache.block_count(); ++b) {
+      cache.read_block(b, k.data(), v.data());
+      for (int j = 0; j < cache.block_tokens(b) * tokenFloats; ++j) {
+        auto index = t * tokenFloats + j;
+        if (option & KVCache::QUANT_KEY) {
+          // half a step of (max - min) / 255 with max - min < 20
+          assert(std::fabs(k[j] - key[index]) <= 20.0f / 255.0f);
+        } else {
+          assert(k[j] == key[index]);
+        }
+        if (option & KVCache::QUANT_VALUE) {
+          // 3 mantissa bits: relative error 1/16, plus the subnormal step
+          assert(std::fabs(v[j] - value[index]) <=
+                 std::fabs(value[index]) / 16.0f + 2.0f / 448.0f / 512.0f);
+        } else {
+          assert(v[j] == value[index]);
+        }
+      }
+      t += cache.block_tokens(b);
+    }
+    assert(t == tokens);
+  }
+  // 64 dims: int8 keys and fp8 values take 3.6x less than floats
+  config.headDim = 64;
+  config.quantOption = KVCache::QUANT_NONE;
+  KVCache floats(config);
+  config.quantOption = KVCache::QUANT_BOTH;
+  KVCache quant(config);
+  assert(floats.block_bytes() > 3 * quant.block_bytes());
+
+  RuntimeHint hint;
+  hint.kvcacheQuantOption = 3;
+  assert(KVCache::config_from_hint(hint, 1, 64).quantOption ==
+         KVCache::QUANT_BOTH);
+}
+
+// softmax(q * k / sqrt(d)) * v of `heads` query heads over `tokens` tokens
+static void reference_attention(const float *query, const float *key,
+                                const float *value, int tokens, int heads,
+                                int kvHeads, int headDim, float *output) {
+  int group = heads / kvHeads;
+  std::vector<float> scores(tokens);
+  for (int h = 0; h < heads; ++h) {
+    int kh = h / group;
+    float maxScore = -INFINITY, sum = 0.0f;
+    for (int t = 0; t < tokens; ++t) {
+      float s = 0.0f;
+      for (int i = 0; i < headDim; ++i) {
+        s += query[h * headDim + i] * key[(t * kvHeads + kh) * headDim + i];
+      }
+      scores[t] = s / std::sqrt((float)headDim);
+      maxScore = std::fmax(maxScore, scores[t]);
+    }
+    for (int i = 0; i < headDim; ++i) {
+      output[h * headDim + i] = 0.0f;
+    }
+    for (int t = 0; t < tokens; ++t) {
+      float p = std::exp(scores[t] - maxScore);
+      sum += p;
+      for (int i = 0; i < headDim; ++i) {
+        output[h * headDim + i] += p * value[(t * kvHeads + kh) * headDim + i];
+      }
+    }
+    for (int i = 0; i < headDim; ++i) {
+      output[h * headDim + i] /= sum;
+    }
+  }
+}
+
+static void test_paged() {
+  const int kvHeads = 2, heads = 4, headDim = 20;
+  const int tokenFloats = kvHeads * headDim;
+  KVCache::Config config;
+  config.kvHeads = kvHeads;
+  config.headDim = headDim;
+  config.blockTokens = 8;
+  PagedKVCache paged(config, 40);
+  assert(paged.pool().block_bytes() == KVCache::block_bytes(config));
+
+  // wildly different lengths, appended interleaved
+  const int lengths[] = {1, 150, 37, 9};
+  std::vector<std::vector<float>> keys, values;
+  std::vector<int> ids;
+  srand(13);
+  for (int length : lengths) {
+    std::vector<float> key(length * tokenFloats), value(length * tokenFloats);
+    for (size_t i = 0; i < key.size(); ++i) {
+      key[i] = (rand() % 2001 - 1000) / 1000.0f;
+      value[i] = (rand() % 2001 - 1000) / 100.0f;
+    }
+    keys.emplace_back(key);
+    values.emplace_back(value);
+    ids.emplace_back(paged.add_sequence());
+  }
+  for (int t = 0; t < 150; t += 5) {
+    for (int s = 0; s < 4; ++s) {
+      int count = ALIMIN(5, lengths[s] - t);
+      if (count > 0) {
+        auto cache = paged.sequence(ids[s]);
+        bool ok = cache->append(keys[s].data() + t * tokenFloats,
+                                values[s].data() + t * tokenFloats, count);
+        assert(ok);
+      }
+    }
+  }
+  // no padding: only the last block of a sequence is partly filled
+  int blocks = 1 + 19 + 5 + 2;
+  assert(paged.pool().used_count() == blocks);
+  std::vector<float> query(heads * headDim), out(heads * headDim),
+      expect(heads * headDim);
+  for (auto &q : query) {
+    q = (rand() % 2001 - 1000) / 500.0f;
+  }
+  for (int s = 0; s < 4; ++s) {
+    auto cache = paged.sequence(ids[s]);
+    assert(cache->tokens() == lengths[s]);
+    cache->attention(query.data(), heads, out.data());
+    reference_attention(query.data(), keys[s].data(), values[s].data(),
+                        lengths[s], heads, kvHeads, headDim, expect.data());
+    for (size_t i = 0; i < out.size(); ++i) {
+      assert(std::fabs(out[i] - expect[i]) <= 1e-3f);
+    }
+  }
+
+  // the pool is full, a sequence ending gives its blocks back at once
+  assert(paged.pool().free_count() == 40 - blocks);
+  int extra = paged.add_sequence();
+  std::vector<float> token(tokenFloats, 1.0f);
+  bool ok = true;
+  for (int t = 0; t < (40 - blocks) * 8; ++t) {
+    ok = ok && paged.sequence(extra)->append(token.data(), token.data(), 1);
+  }
+  assert(ok);
+  ok = paged.sequence(extra)->append(token.data(), token.data(), 1);
+  assert(!ok);
+  paged.end_sequence(ids[1]);
+  assert(nullptr == paged.sequence(ids[1]));
+  assert(paged.pool().free_count() == 19);
+  size_t total = paged.pool().total_size();
+  ok = paged.sequence(extra)->append(token.data(), token.data(), 1);
+  assert(ok);
+  assert(paged.pool().total_size() == total);
+
+  // quantized blocks are read through the same table
+  config.quantOption = KVCache::QUANT_BOTH;
+  PagedKVCache quant(config);
+  int id = quant.add_sequence();
+  ok = quant.sequence(id)->append(keys[2].data(), values[2].data(), 37);
+  assert(ok);
+  quant.sequence(id)->attention(query.data(), heads, out.data());
+  reference_attention(query.data(), keys[2].data(), values[2].data(), 37,
+                      heads, kvHeads, headDim, expect.data());
+  for (size_t i = 0; i < out.size(); ++i) {
+    assert(std::fabs(out[i] - expect[i]) <= 0.5f);
+  }
+}
+
+// key / value of token `id` at `position`, as a model would compute them
+static void prefill(std::vector<float> &key, std::vector<float> &value,
+                    const std::vector<int> &ids, int begin, int tokenFloats) {
+  key.resize((ids.size() - begin) * tokenFloats);
+  value.resize(key.size());
+  for (size_t t = begin; t < ids.size(); ++t) {
+    for (int i = 0; i < tokenFloats; ++i) {
+      auto index = (t - begin) * tokenFloats + i;
+      key[index] = std::sin(ids[t] * 0.37f + t * 0.11f + i);
+      value[index] = std::cos(ids[t] * 0.53f + t * 0.07f + i);
+    }
+  }
+}
+
+// add a sequence of `ids` and prefill the tokens not cached
+static int add_prompt(PagedKVCache &paged, const std::vector<int> &ids,
+                      int tokenFloats) {
+  int id = paged.add_sequence(ids.data(), (int)ids.size());
+  int cached = paged.sequence(id)->tokens();
+  std::vector<float> key, value;
+  prefill(key, value, ids, cached, tokenFloats);
+  bool ok = paged.append(id, ids.data() + cached, key.data(), value.data(),
+                         (int)ids.size() - cached);
+  assert(ok);
+  return id;
+}
+
+static void test_prefix() {
+  const int kvHeads = 1, headDim = 8, tokenFloats = kvHeads * headDim;
+  KVCache::Config config;
+  config.kvHeads = kvHeads;
+  config.headDim = headDim;
+  config.blockTokens = 4;
+  const size_t blockBytes = KVCache::block_bytes(config);
+  config.sizeLimit = 10 * blockBytes;
+  PagedKVCache paged(config);
+
+  // a system prompt of 4 blocks and different questions
+  std::vector<int> system = {1, 2, 3, 4, 5, 6, 7, 8,
+                             9, 10, 11, 12, 13, 14, 15, 16};
+  auto first = system, second = system;
+  first.insert(first.end(), {100, 101, 102});
+  second.insert(second.end(), {200, 201, 202, 203, 204, 205});
+  int a = add_prompt(paged, first, tokenFloats);
+  assert(paged.cached_count() == 4);
+  assert(paged.pool().used_count() == 5);
+  // the system prompt is not prefilled again
+  int b = paged.add_sequence(second.data(), (int)second.size());
+  assert(paged.sequence(b)->tokens() == 16);
+  for (int i = 0; i < 4; ++i) {
+    assert(paged.sequence(b)->block_id(i) == paged.sequence(a)->block_id(i));
+  }
+  std::vector<float> key, value;
+  prefill(key, value, second, 16, tokenFloats);
+  bool ok = paged.append(b, second.data() + 16, key.data(), value.data(), 6);
+  assert(ok);
+  assert(paged.pool().used_count() == 7);
+  assert(paged.cached_count() == 5);
+  std::vector<float> query(headDim, 0.5f), out(headDim), expect(headDim);
+  prefill(key, value, second, 0, tokenFloats);
+  paged.sequence(b)->attention(query.data(), 1, out.data());
+  reference_attention(query.data(), key.data(), value.data(), 22, 1, kvHeads,
+                      headDim, expect.data());
+  for (int i = 0; i < headDim; ++i) {
+    assert(std::fabs(out[i] - expect[i]) <= 1e-4f);
+  }
+
+  // a fork shares the partly filled block until it writes to it
+  int c = paged.fork_sequence(a);
+  assert(paged.sequence(c)->block_id(4) == paged.sequence(a)->block_id(4));
+  std::vector<int> next = {300};
+  std::vector<float> token(tokenFloats, 9.0f);
+  ok = paged.append(c, next.data(), token.data(), token.data(), 1);
+  assert(ok);
+  assert(paged.sequence(c)->block_id(4) != paged.sequence(a)->block_id(4));
+  assert(paged.sequence(a)->tokens() == 19 && paged.sequence(c)->tokens() == 20);
+  std::vector<float> k(4 * tokenFloats), v(4 * tokenFloats);
+  paged.sequence(a)->read_block(4, k.data(), v.data());
+  prefill(key, value, first, 16, tokenFloats);
+  for (int i = 0; i < 3 * tokenFloats; ++i) {
+    assert(k[i] == key[i] && v[i] == value[i]);
+  }
+  paged.sequence(c)->read_block(4, k.data(), v.data());
+  assert(v[3 * tokenFloats] == 9.0f);
+
+  // ended sequences leave their full blocks cached
+  paged.end_sequence(a);
+  paged.end_sequence(b);
+  paged.end_sequence(c);
+  assert(paged.pool().used_count() == 6 && paged.cached_count() == 6);
+  int d = paged.add_sequence(first.data(), (int)first.size());
+  assert(paged.sequence(d)->tokens() == 16);
+  paged.end_sequence(d);
+
+  // 10 blocks at most: an unrelated prompt pushes out the least recently
+  // used cached blocks, the system prompt used last stays
+  std::vector<int> other;
+  for (int i = 0; i < 24; ++i) {
+    other.push_back(1000 + i);
+  }
+  int e = add_prompt(paged, other, tokenFloats);
+  assert(paged.pool().used_count() == 10);
+  assert(paged.sequence(e)->tokens() == 24);
+  int f = paged.add_sequence(second.data(), (int)second.size());
+  assert(paged.sequence(f)->tokens() == 16);
+  int g = paged.add_sequence(first.data(), (int)first.size());
+  assert(paged.sequence(g)->tokens() == 16);
+}
+
+int main() {
+  test_spill();
+  test_store();
+  test_quant();
+  test_paged();
+  test_prefix();
+  return 0;
+}
@@ -0,0 +1,64 @@
+#include <chrono>
+#include <memory>
+#include <cstdio>
+#include <thread>
+#include <tactics/core/tensor.h>
+#include <tactics/core/tensor_utils.h>
+#include <vector>
+
+using namespace tactics;
+
+// ns per create and destroy of `batch` live tensors at a time, the churn of
+// scalars and small shapes from the python layer
+template <typename Create>
+static double bench(Create create, int rounds = 2000, int batch = 64) {
+  std::vector<Tensor *> live(batch);
+  auto begin = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; ++r) {
+    for (int i = 0; i < batch; ++i) {
+      live[i] = create(i);
+    }
+    for (int i = 0; i < batch; ++i) {
+      delete live[i];
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - begin).count() /
+         ((double)rounds * batch);
+}
+
+// the same from several threads at once
+template <typename Create>
+static double bench_threads(Create create, int threads) {
+  std::vector<std::thread> workers;
+  std::vector<double> cost(threads);
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t]() { cost[t] = bench(create); });
+  }
+  double total = 0.0;
+  for (int t = 0; t < threads; ++t) {
+    workers[t].join();
+    total += cost[t];
+  }
+  return total / threads;
+}
+
+int main() {
+  float scalar = 1.0f;
+  std::unique_ptr<Tensor> base(Tensor::create<float>({16, 16}));
+  auto shape = [](int) { return Tensor::create_device<float>({2, 3}); };
+  auto wrap = [&](int) { return Tensor::create<float>({1}, &scalar); };
+  auto owned = [](int) { return Tensor::create<float>({4}); };
+  auto view = [&](int i) { return Tensor::slice(base.get(), 0, i % 16, 16); };
+  auto clone = [&](int) { return Tensor::clone(base.get()); };
+  printf("create_device [2, 3]: %.1f ns\n", bench(shape));
+  printf("create scalar over user data: %.1f ns\n", bench(wrap));
+  printf("create [4] owning memory: %.1f ns\n", bench(owned));
+  printf("slice view: %.1f ns\n", bench(view));
+  printf("clone: %.1f ns\n", bench(clone));
+  printf("create_device [2, 3], 4 threads: %.1f ns\n", bench_threads(shape, 4));
+  printf("sizeof Tensor %zu, InsideDescribe %zu, NativeInsideDescribe %zu\n",
+         sizeof(Tensor), sizeof(Tensor::InsideDescribe),
+         sizeof(Tensor::InsideDescribe::NativeInsideDescribe));
+  return 0;
+}
@@ -1,8 +1,180 @@
 #include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
 #include <tactics/core/tensor.h>
+#include <tactics/core/tensor_utils.h>
+#include "../test_utils.h"
 
 using namespace tactics;
 
+static void test_views() {
+  // [2, 3, 4] of 0..23, freed with its last view
+  Tensor *base = Tensor::create<float>({2, 3, 4});
+  for (int i = 0; i < 24; ++i) {
+    base->host<float>()[i] = (float)i;
+  }
+  Tensor *slice = Tensor::slice(base, 2, 1, 4, 2);
+  assert(slice->shape() == std::vector<int>({2, 3, 2}));
+  assert(slice->stride(2) == 2 && slice->host<float>() == base->host<float>() + 1);
+  Tensor *permute = Tensor::permute(base, {2, 0, 1});
+  assert(permute->shape() == std::vector<int>({4, 2, 3}));
+  assert(!TensorUtils::is_contiguous(permute));
+  Tensor *expand = Tensor::slice(base, 1, 1, 2);
+  Tensor *broadcast = Tensor::expand(expand, {5, 2, 3, 4});
+  assert(broadcast->stride(0) == 0 && broadcast->stride(2) == 0);
+  assert(nullptr == Tensor::expand(base, {2, 5, 4}));
+  delete expand;
+  delete base;
+
+  // the views still read the memory of base
+  Tensor *dense = Tensor::create<float>({4, 2, 3});
+  bool ok = TensorUtils::copy_strided(permute, dense);
+  assert(ok);
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 6; ++j) {
+      assert(dense->host<float>()[i * 6 + j] == (float)(j * 4 + i));
+    }
+  }
+  Tensor *sliceDense = Tensor::create<float>({2, 3, 2});
+  ok = TensorUtils::copy_strided(slice, sliceDense);
+  assert(ok);
+  assert(sliceDense->host<float>()[5] == 11.0f);
+  Tensor *broadcastDense = Tensor::create<float>({5, 2, 3, 4});
+  ok = TensorUtils::copy_strided(broadcast, broadcastDense);
+  assert(ok);
+  assert(broadcastDense->host<float>()[3 * 24 + 1 * 12 + 2 * 4 + 3] == 19.0f);
+
+  // reshape of a view merges only the dims contiguous among themselves
+  Tensor *merged = Tensor::reshape(slice, {6, -1});
+  assert(merged->shape() == std::vector<int>({6, 2}));
+  assert(merged->stride(0) == 4 && merged->stride(1) == 2);
+  assert(nullptr == Tensor::reshape(permute, {8, 3}));
+  Tensor *rows = Tensor::reshape(dense, {-1, 3});
+  assert(rows->shape() == std::vector<int>({8, 3}));
+  assert(TensorUtils::is_contiguous(rows));
+  Tensor *outer = Tensor::reshape(permute, {2, 2, 2, 3});
+  assert(outer->stride(0) == 2 && outer->stride(1) == 1);
+  assert(outer->stride(2) == 12 && outer->stride(3) == 4);
+  assert(nullptr == Tensor::reshape(dense, {5, 5}));
+
+  for (auto t : {slice, permute, broadcast, dense, sliceDense, broadcastDense,
+                 merged, rows, outer}) {
+    delete t;
+  }
+}
+
+static void test_compare() {
+  // [1000, 1000] floats, over the threshold to split
+  std::unique_ptr<Tensor> expect(Tensor::create<float>({1000, 1000}));
+  std::unique_ptr<Tensor> compare(Tensor::create<float>({1000, 1000}));
+  auto e = expect->host<float>(), c = compare->host<float>();
+  for (int i = 0; i < 1000000; ++i) {
+    e[i] = c[i] = (float)(i % 100) + 1.0f;
+  }
+  TensorUtils::CompareStats stats;
+  bool ok = TensorUtils::compare_tensors(compare.get(), expect.get(), stats);
+  assert(ok && 1000000 == stats.count && 0 == stats.mismatches);
+
+  // one ulp off is within 1e-6, not within 0
+  c[10] = std::nextafter(e[10], 1000.0f);
+  ok = TensorUtils::compare_tensors(compare.get(), expect.get(), stats, 1e-6f);
+  assert(ok && 1 == stats.maxUlp && 0 == stats.mismatches);
+  ok = TensorUtils::compare_tensors(compare.get(), expect.get(), stats);
+  assert(!ok && 1 == stats.mismatches && 10 == stats.mismatchIndices[0]);
+
+  // nan, an absolute error of 1 over 0 and of 0.5 over 100
+  c[500000] = NAN;
+  e[123] = 0.0f;
+  c[123] = 1.0f;
+  e[999999] = 100.0f;
+  c[999999] = 100.5f;
+  for (int threads : {1, 4}) {
+    ok = TensorUtils::compare_tensors(compare.get(), expect.get(), stats,
+                                      1e-3f, false, 2, threads);
+    assert(!ok && 3 == stats.mismatches && 1000000 == stats.count);
+    assert(2 == stats.mismatchIndices.size());
+    assert(123 == stats.mismatchIndices[0] &&
+           500000 == stats.mismatchIndices[1]);
+    assert(1.0 == stats.maxAbsError && std::isinf(stats.maxRelError));
+  }
+  // against the largest expected value, 1 / 100 is off by more than 0.6%
+  // and 0.5 / 100 is not
+  c[500000] = e[500000];
+  ok = TensorUtils::compare_tensors(compare.get(), expect.get(), stats, 0.006f,
+                                    true, 16, 4);
+  assert(!ok && 1 == stats.mismatches && 123 == stats.mismatchIndices[0]);
+  assert(std::fabs(stats.maxRelError - 0.01) < 1e-6);
+  ok = TensorUtils::compare_tensors(compare.get(), expect.get(), stats, 0.02f,
+                                    true);
+  assert(ok);
+
+  // two nans are equal
+  e[500000] = c[500000] = NAN;
+  ok = TensorUtils::compare_tensors(compare.get(), expect.get(), stats, 0.02f,
+                                    true);
+  assert(ok);
+
+  // integers differ by their distance, views are compared in order
+  std::unique_ptr<Tensor> ints(Tensor::create<int32_t>({3, 4}));
+  std::unique_ptr<Tensor> intsT(Tensor::create<int32_t>({4, 3}));
+  for (int y = 0; y < 3; ++y) {
+    for (int x = 0; x < 4; ++x) {
+      ints->host<int32_t>()[y * 4 + x] = intsT->host<int32_t>()[x * 3 + y] =
+          -y * x;
+    }
+  }
+  std::unique_ptr<Tensor> view(Tensor::permute(ints.get(), {1, 0}));
+  ok = TensorUtils::compare_tensors(view.get(), intsT.get(), stats);
+  assert(ok && 12 == stats.count);
+  intsT->host<int32_t>()[11] += 7;
+  ok = TensorUtils::compare_tensors(view.get(), intsT.get(), stats);
+  assert(!ok && 7 == stats.maxUlp && 11 == stats.mismatchIndices[0]);
+  // types must match
+  ok = TensorUtils::compare_tensors(ints.get(), expect.get(), stats);
+  assert(!ok && 0 == stats.count);
+}
+
+static void test_large() {
+  // [3, 2, 1 << 30] bytes, 6 GB and a stride past 2^31
+  const int64_t inner = 1 << 30;
+  std::unique_ptr<Tensor> shape(Tensor::create_device<uint8_t>({3, 2, 1 << 30}));
+  assert(shape->size() == 6 * inner && shape->elementSize() == 6 * inner);
+  assert(shape->stride(0) == 2 * inner && shape->stride(1) == inner);
+  size_t bytes = (size_t)shape->usize();
+  uint8_t *data = map_sparse(bytes);
+  if (nullptr == data) {
+    printf("no sparse file for %zu bytes, large tensors not tested\n", bytes);
+    return;
+  }
+  std::unique_ptr<Tensor> tensor(
+      Tensor::create<uint8_t>({3, 2, 1 << 30}, data));
+  // element [2, 1, 7] and [2, 1, 2^30 - 1], past 4 GB
+  int64_t at = 2 * 2 * inner + inner + 7;
+  data[at] = 11;
+  data[bytes - 1] = 13;
+
+  std::unique_ptr<Tensor> slice(Tensor::slice(tensor.get(), 0, 2, 3));
+  assert(slice->host<uint8_t>() == data + 4 * inner);
+  assert(slice->host<uint8_t>()[slice->stride(1) + 7] == 11);
+  std::unique_ptr<Tensor> permute(Tensor::permute(tensor.get(), {2, 1, 0}));
+  assert(permute->stride(2) == 2 * inner);
+  assert(permute->host<uint8_t>()[7 + permute->stride(1) + 2 * permute->stride(2)] == 11);
+  std::unique_ptr<Tensor> rows(Tensor::reshape(tensor.get(), {6, -1}));
+  assert(rows->length(1) == inner && rows->stride(0) == inner);
+  // one extent of 6G does not fit
+  assert(nullptr == Tensor::reshape(tensor.get(), {-1}));
+
+  // the last column of each row, strided by 2^30
+  std::unique_ptr<Tensor> column(Tensor::slice(rows.get(), 1, -1, 1 << 30));
+  std::unique_ptr<Tensor> dense(Tensor::create<uint8_t>({6, 1}));
+  bool ok = TensorUtils::copy_strided(column.get(), dense.get());
+  assert(ok);
+  assert(13 == dense->host<uint8_t>()[5] && 0 == dense->host<uint8_t>()[4]);
+  unmap_sparse(data, bytes);
+}
+
 int main() {
   Tensor base(3);
   assert(base.dimensions() == 3 && "dimension error");
@@ -35,6 +207,18 @@ int main() {
   delete tensor;
   }
 
+  {
+  // half width floats
+  Tensor *tensor = Tensor::create_device<float>({2, 3});
+  tensor->setType(DataType_DT_HALF);
+  assert(tensor->getType() == halide_type_t(halide_type_float, 16));
+  assert(tensor->usize() == 2 * 3 * 2);
+  tensor->setType(DataType_DT_BFLOAT16);
+  assert(tensor->getType() == halide_type_t(halide_type_bfloat, 16));
+  assert(tensor->usize() == 2 * 3 * 2);
+  delete tensor;
+  }
+
   uint8_t data[] = {
     0x01, 0x02, 0x01, 0x02, 0x01, 0x02, 0x01, 0x02, 0x01, 0x02, 0x01, 0x02,
     0x01, 0x02, 0x01, 0x02, 0x01, 0x02, 0x01, 0x02, 0x01, 0x02, 0x01, 0x02,
@@ -54,4 +238,8 @@ int main() {
       assert(tensor->host<uint8_t>()[i] == data[i]);
   }
   delete tensor;
-}
\ No newline at end of file
+
+  test_views();
+  test_compare();
+  test_large();
+}
@@ -1,8 +1,151 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
 #include <tactics/math/matrix.h>
 #include <tactics/core/tensor.h>
+#include <tactics/ops/cpu/cpu_cast.h>
+#include "../test_utils.h"
 
 using namespace tactics;
 
+static void test_views() {
+  // a is [3, 4], b = a^T is [4, 3] as a view
+  std::unique_ptr<Tensor> a(Matrix::create(4, 3));
+  for (int i = 0; i < 12; ++i) {
+    a->host<float>()[i] = (float)i;
+  }
+  std::unique_ptr<Tensor> b(Tensor::permute(a.get(), {1, 0}));
+  std::unique_ptr<Tensor> dense(Matrix::create(3, 4));
+  Matrix::transpose(dense.get(), a.get());
+
+  // b + dense, both a^T
+  std::unique_ptr<Tensor> sum(Matrix::create(3, 4));
+  Matrix::add(sum.get(), b.get(), dense.get());
+  // a * b into a transposed view of c
+  std::unique_ptr<Tensor> c(Matrix::create(3, 3));
+  std::unique_ptr<Tensor> cT(Tensor::permute(c.get(), {1, 0}));
+  Matrix::multi(cT.get(), a.get(), b.get());
+  // a row broadcast with stride 0
+  std::unique_ptr<Tensor> row(Tensor::slice(a.get(), 0, 1, 2));
+  std::unique_ptr<Tensor> rows(Tensor::expand(row.get(), {3, 4}));
+  std::unique_ptr<Tensor> diff(Matrix::create(4, 3));
+  Matrix::sub(diff.get(), a.get(), rows.get());
+  for (int y = 0; y < 4; ++y) {
+    for (int x = 0; x < 3; ++x) {
+      assert(sum->host<float>()[y * 3 + x] == 2.0f * (x * 4 + y));
+    }
+  }
+  for (int y = 0; y < 3; ++y) {
+    for (int x = 0; x < 3; ++x) {
+      float expect = 0.0f;
+      for (int k = 0; k < 4; ++k) {
+        expect += (float)(y * 4 + k) * (x * 4 + k);
+      }
+      assert(c->host<float>()[x * 3 + y] == expect);
+    }
+    for (int x = 0; x < 4; ++x) {
+      assert(diff->host<float>()[y * 4 + x] == (float)(y - 1) * 4);
+    }
+  }
+}
+
+static void test_half() {
+  // [3, 301] so a row spans more than one conversion block, b broadcast
+  // as a single row for add
+  const int h = 3, w = 301;
+  for (auto type : {halide_type_t(halide_type_float, 16),
+                    halide_type_t(halide_type_bfloat, 16)}) {
+    bool bf16 = halide_type_bfloat == type.code;
+    auto load = [bf16](uint16_t v) {
+      return bf16 ? CPUCast::bf16_to_float(v) : CPUCast::half_to_float(v);
+    };
+    auto store = [bf16](float v) {
+      return bf16 ? CPUCast::float_to_bf16(v) : CPUCast::float_to_half(v);
+    };
+    std::unique_ptr<Tensor> a(Tensor::create({h, w}, type));
+    std::unique_ptr<Tensor> b(Tensor::create({h, w}, type));
+    std::unique_ptr<Tensor> row(Tensor::create({w}, type));
+    for (int i = 0; i < h * w; ++i) {
+      a->host<uint16_t>()[i] = store((float)(i % 97) * 0.37f - 11.0f);
+      b->host<uint16_t>()[i] = store((float)(i % 89) * 0.11f + 0.5f);
+    }
+    for (int x = 0; x < w; ++x) {
+      row->host<uint16_t>()[x] = store((float)x * 0.01f);
+    }
+    std::unique_ptr<Tensor> sum(Tensor::create({h, w}, type));
+    std::unique_ptr<Tensor> diff(Tensor::create({h, w}, type));
+    std::unique_ptr<Tensor> prod(Tensor::create({h, w}, type));
+    Matrix::add(sum.get(), a.get(), row.get());
+    Matrix::sub(diff.get(), a.get(), b.get());
+    Matrix::dot(prod.get(), a.get(), b.get());
+    // computed in float, rounded once
+    for (int y = 0; y < h; ++y) {
+      for (int x = 0; x < w; ++x) {
+        int i = y * w + x;
+        float av = load(a->host<uint16_t>()[i]);
+        float bv = load(b->host<uint16_t>()[i]);
+        float rv = load(row->host<uint16_t>()[x]);
+        assert(sum->host<uint16_t>()[i] == store(av + rv));
+        assert(diff->host<uint16_t>()[i] == store(av - bv));
+        assert(prod->host<uint16_t>()[i] == store(av * bv));
+      }
+    }
+  }
+}
+
+static void test_large() {
+  // [2, 2^30] floats, 8 GB. a is the last 4 columns, b the first 4, rows
+  // 4 GB apart
+  const int64_t inner = 1 << 30;
+  size_t bytes = 2 * inner * sizeof(float);
+  auto data = (float *)map_sparse(bytes);
+  if (nullptr == data) {
+    printf("no sparse file for %zu bytes, large matrices not tested\n", bytes);
+    return;
+  }
+  std::unique_ptr<Tensor> big(Tensor::create<float>({2, 1 << 30}, data));
+  std::unique_ptr<Tensor> a(Tensor::slice(big.get(), 1, -4, 1 << 30));
+  std::unique_ptr<Tensor> b(Tensor::slice(big.get(), 1, 0, 4));
+  assert(a->stride(0) == inner && b->stride(0) == inner);
+  for (int y = 0; y < 2; ++y) {
+    for (int x = 0; x < 4; ++x) {
+      data[y * inner + inner - 4 + x] = (float)(y * 4 + x);
+      data[y * inner + x] = (float)(x - y);
+    }
+  }
+  std::unique_ptr<Tensor> sum(Matrix::create(4, 2));
+  Matrix::add(sum.get(), a.get(), b.get());
+  std::unique_ptr<Tensor> scaled(Matrix::create(4, 2));
+  Matrix::mul(scaled.get(), a.get(), 2.0f);
+  std::unique_ptr<Tensor> aT(Matrix::create(2, 4));
+  Matrix::transpose(aT.get(), a.get());
+  // a * b^T, b^T a view with columns 4 GB apart
+  std::unique_ptr<Tensor> bT(Tensor::permute(b.get(), {1, 0}));
+  std::unique_ptr<Tensor> prod(Matrix::create(2, 2));
+  Matrix::multi(prod.get(), a.get(), bT.get());
+  for (int y = 0; y < 2; ++y) {
+    for (int x = 0; x < 4; ++x) {
+      assert(sum->host<float>()[y * 4 + x] == (float)(y * 4 + x + x - y));
+      assert(scaled->host<float>()[y * 4 + x] == (float)(y * 4 + x) * 2);
+      assert(aT->host<float>()[x * 2 + y] == (float)(y * 4 + x));
+    }
+    for (int x = 0; x < 2; ++x) {
+      float expect = 0.0f;
+      for (int k = 0; k < 4; ++k) {
+        expect += (float)(y * 4 + k) * (k - x);
+      }
+      assert(prod->host<float>()[y * 2 + x] == expect);
+    }
+  }
+  // views first, big owns no memory
+  a.reset();
+  b.reset();
+  bT.reset();
+  big.reset();
+  unmap_sparse(data, bytes);
+}
+
 int main() {
   uint8_t data1[] = {
     0x01, 0x02, 0x01, 0x02, 0x01, 0x02, 0x01, 0x02, 0x01, 0x02, 0x01, 0x02,
@@ -15,6 +158,11 @@ int main() {
     0x01, 0x02, 0x01, 0x02, 0x01, 0x02, 0x01, 0x02, 0x01, 0x02, 0x01, 0x02,
   };
   Tensor *tensor2 = Tensor::create<uint8_t>({1, 2, 3, 4}, data2);
+  delete tensor1;
+  delete tensor2;
 
-  
-}
\ No newline at end of file
+  test_views();
+  test_half();
+  test_large();
+  return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef TACTICS_TEST_TEST_UTILS_H
+#define TACTICS_TEST_TEST_UTILS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// `bytes` of a sparse file, only the pages touched take space
+static inline uint8_t *map_sparse(size_t bytes) {
+  char path[] = "/tmp/tactics_large_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    return nullptr;
+  }
+  unlink(path);
+  void *ptr = MAP_FAILED;
+  if (0 == ftruncate(fd, (off_t)bytes)) {
+    ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  return MAP_FAILED == ptr ? nullptr : (uint8_t *)ptr;
+}
+
+static inline void unmap_sparse(void *ptr, size_t bytes) { munmap(ptr, bytes); }
+
+#endif // TACTICS_TEST_TEST_UTILS_H